@@ -0,0 +1,19 @@
+#ifndef PG_CHECK_CLI_H
+#define PG_CHECK_CLI_H
+
+#include "postgres.h"
+
+/*
+ * Offline checks of a data directory. The checks from src/ are built with
+ * PG_CHECK_OFFLINE, i.e. without the cross-check, and called without a
+ * relation (so attributes of tuples are not checked, as there are no tuple
+ * descriptors without the catalogs).
+ */
+
+/* path of the file checked by the thread (prefix of the messages) */
+extern __thread const char *cli_context;
+
+/* minimum level of the messages printed (WARNING by default) */
+extern int	cli_min_elevel;
+
+#endif							/* PG_CHECK_CLI_H */
@@ -0,0 +1,120 @@
+/*-------------------------------------------------------------------------
+ *
+ * elog.c
+ *	  Minimal error reporting for the offline checks.
+ *
+ * The checks report issues using ereport, so this implements the functions
+ * the macro expands to, to allow linking the backend code into a frontend
+ * program. The messages are written to stderr, prefixed with the file
+ * checked by the current thread. The state is per thread, so the checks
+ * may run in multiple threads at the same time.
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cli.h"
+
+typedef struct report_state
+{
+	int			elevel;
+	char		message[1024];
+}			report_state;
+
+static __thread report_state state;
+
+__thread const char *cli_context = NULL;
+
+int			cli_min_elevel = WARNING;
+
+static const char *
+level_name(int elevel)
+{
+	if (elevel >= ERROR)
+		return "ERROR";
+	else if (elevel >= WARNING)
+		return "WARNING";
+	else if (elevel >= NOTICE)
+		return "NOTICE";
+	else if (elevel >= INFO)
+		return "INFO";
+	else if (elevel >= LOG)
+		return "LOG";
+
+	return "DEBUG";
+}
+
+#if (PG_VERSION_NUM >= 130000)
+bool
+errstart(int elevel, const char *domain)
+#else
+bool
+errstart(int elevel, const char *filename, int lineno,
+		 const char *funcname, const char *domain)
+#endif
+{
+	if ((elevel < cli_min_elevel) && (elevel < ERROR))
+		return false;
+
+	state.elevel = elevel;
+	state.message[0] = '\0';
+
+	return true;
+}
+
+#if (PG_VERSION_NUM >= 140000)
+bool
+errstart_cold(int elevel, const char *domain)
+{
+	return errstart(elevel, domain);
+}
+#endif
+
+int
+errmsg(const char *fmt,...)
+{
+	va_list		args;
+
+	va_start(args, fmt);
+	vsnprintf(state.message, sizeof(state.message), fmt, args);
+	va_end(args);
+
+	return 0;
+}
+
+#if (PG_VERSION_NUM >= 130000)
+void
+errfinish(const char *filename, int lineno, const char *funcname)
+#else
+void
+errfinish(int dummy,...)
+#endif
+{
+	/* a single call, so that lines from different threads don't mix */
+	fprintf(stderr, "%s: %s:  %s\n",
+			(cli_context) ? cli_context : "pg_check",
+			level_name(state.elevel), state.message);
+
+	if (state.elevel >= ERROR)
+		exit(2);
+}
+
+#ifdef USE_ASSERT_CHECKING
+#if (PG_VERSION_NUM >= 160000)
+void
+ExceptionalCondition(const char *conditionName,
+					 const char *fileName, int lineNumber)
+#else
+void
+ExceptionalCondition(const char *conditionName, const char *errorType,
+					 const char *fileName, int lineNumber)
+#endif
+{
+	fprintf(stderr, "TRAP: failed Assert(\"%s\"), File: \"%s\", Line: %d\n",
+			conditionName, fileName, lineNumber);
+	abort();
+}
+#endif
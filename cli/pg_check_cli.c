@@ -0,0 +1,619 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_check_cli.c
+ *	  Offline checks of relation files in a data directory.
+ *
+ * Checks all relations (main forks) in a data directory of a stopped
+ * cluster (or a restored backup), using the same page checks as the
+ * extension. The segment files are split into chunks of blocks, and the
+ * chunks are checked by a pool of threads - each thread gets a range of
+ * chunks, and when it runs out of work, it steals half of the remaining
+ * chunks from the thread with the most work left.
+ *
+ * The kind of each relation is determined from the first page (heap pages
+ * have no special space, b-tree indexes have a metapage), other relations
+ * only get the generic page header checks.
+ *
+ * FIXME Without the catalogs we don't know the tuple descriptors, so the
+ * attributes of heap/index tuples are not checked.
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/nbtree.h"
+
+/* the backend implementation of pg_checksum_page (exactly one file) */
+#if (PG_VERSION_NUM >= 90300)
+#include "storage/checksum_impl.h"
+#endif
+
+#if (PG_VERSION_NUM >= 90600)
+#include "catalog/pg_am.h"
+#endif
+
+#include "cli.h"
+#include "common.h"
+#include "heap.h"
+#include "index.h"
+
+/* default number of blocks in a chunk (8MB with 8kB pages) */
+#define DEFAULT_CHUNK_BLOCKS	1024
+
+typedef enum
+{
+	RELATION_HEAP,
+	RELATION_BTREE,
+	RELATION_OTHER
+}			RelationKind;
+
+/* segment file of a relation */
+typedef struct segment_file
+{
+	char	   *path;
+	BlockNumber segno;
+	BlockNumber nblocks;
+	RelationKind kind;
+}			segment_file;
+
+/* range of blocks in a segment, the unit of work */
+typedef struct chunk
+{
+	int			segment;
+	BlockNumber blockFrom;		/* first block (within the segment) */
+	BlockNumber nblocks;
+}			chunk;
+
+/* chunks [next, end) assigned to a thread */
+typedef struct worker
+{
+	pthread_t	thread;
+	pthread_mutex_t mutex;
+	int			next;
+	int			end;
+	uint64		nerrs;
+	uint64		nblocks;
+}			worker;
+
+static segment_file *segments = NULL;
+static int	nsegments = 0;
+static int	maxsegments = 0;
+
+static chunk *chunks = NULL;
+static int	nchunks = 0;
+
+static worker *workers = NULL;
+static int	nworkers = 0;
+
+static check_page_cb btree_check = NULL;
+
+static void *xmalloc(size_t size);
+static void scan_directory(const char *path);
+static void scan_tablespaces(const char *datadir);
+static void add_relation(const char *dir, const char *name);
+static RelationKind relation_kind(const char *path);
+static void build_chunks(BlockNumber chunkBlocks);
+static void *worker_main(void *arg);
+static bool worker_take(worker * w, int *idx);
+static bool worker_steal(worker * w);
+static uint32 check_chunk(chunk * c, attribute_plan * plan);
+
+static void
+usage(const char *progname)
+{
+	printf("%s checks relation files of a stopped PostgreSQL cluster.\n\n", progname);
+	printf("Usage:\n  %s [OPTION]... DATADIR\n\n", progname);
+	printf("Options:\n");
+	printf("  -j, --jobs=NUM     number of threads (default: number of CPUs)\n");
+	printf("  -c, --chunk=NUM    number of blocks in a chunk (default: %d)\n",
+		   DEFAULT_CHUNK_BLOCKS);
+	printf("  -k, --checksums    verify data checksums (9.3+)\n");
+	printf("  -l, --level=LEVEL  depth of the checks (header, line_pointers, tuples,\n"
+		   "                     attributes; default: attributes)\n");
+	printf("  -v, --verbose      print notices and the checked files\n");
+	printf("  -h, --help         show this help, then exit\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"jobs", required_argument, NULL, 'j'},
+		{"chunk", required_argument, NULL, 'c'},
+		{"checksums", no_argument, NULL, 'k'},
+		{"level", required_argument, NULL, 'l'},
+		{"verbose", no_argument, NULL, 'v'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	const char *datadir;
+	long		chunkBlocks = DEFAULT_CHUNK_BLOCKS;
+	uint64		nerrs = 0;
+	uint64		nblocks = 0;
+	int			c;
+	int			i;
+	char		path[MAXPGPATH];
+
+	nworkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt_long(argc, argv, "j:c:kl:vh", long_options, NULL)) != -1)
+	{
+		switch (c)
+		{
+			case 'j':
+				nworkers = atoi(optarg);
+				break;
+			case 'c':
+				chunkBlocks = atol(optarg);
+				break;
+			case 'k':
+#if (PG_VERSION_NUM >= 90300)
+				check_checksums = true;
+#else
+				fprintf(stderr, "checksums are not supported before 9.3\n");
+				exit(2);
+#endif
+				break;
+			case 'l':
+				if (strcmp(optarg, "header") == 0)
+					check_level = CHECK_LEVEL_HEADER;
+				else if (strcmp(optarg, "line_pointers") == 0)
+					check_level = CHECK_LEVEL_LINE_POINTERS;
+				else if (strcmp(optarg, "tuples") == 0)
+					check_level = CHECK_LEVEL_TUPLES;
+				else if (strcmp(optarg, "attributes") == 0)
+					check_level = CHECK_LEVEL_ATTRIBUTES;
+				else
+				{
+					fprintf(stderr, "invalid check level \"%s\"\n", optarg);
+					exit(2);
+				}
+				break;
+			case 'v':
+				cli_min_elevel = NOTICE;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+			default:
+				usage(argv[0]);
+				exit(2);
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		exit(2);
+	}
+
+	if ((nworkers < 1) || (chunkBlocks < 1) || (chunkBlocks > RELSEG_SIZE))
+	{
+		fprintf(stderr, "invalid number of threads or chunk size\n");
+		exit(2);
+	}
+
+	datadir = argv[optind];
+
+	btree_check = lookup_check_method(BTREE_AM_OID, NULL);
+
+	/* shared catalogs, databases and tablespaces */
+	snprintf(path, sizeof(path), "%s/global", datadir);
+	scan_directory(path);
+
+	snprintf(path, sizeof(path), "%s/base", datadir);
+	scan_tablespaces(path);
+
+	snprintf(path, sizeof(path), "%s/pg_tblspc", datadir);
+	scan_tablespaces(path);
+
+	build_chunks((BlockNumber) chunkBlocks);
+
+	/* distribute the chunks between the threads evenly, then start them */
+	nworkers = Max(1, Min(nworkers, nchunks));
+	workers = (worker *) xmalloc(nworkers * sizeof(worker));
+
+	for (i = 0; i < nworkers; i++)
+	{
+		memset(&workers[i], 0, sizeof(worker));
+		pthread_mutex_init(&workers[i].mutex, NULL);
+		workers[i].next = (int) ((int64) nchunks * i / nworkers);
+		workers[i].end = (int) ((int64) nchunks * (i + 1) / nworkers);
+	}
+
+	for (i = 0; i < nworkers; i++)
+	{
+		if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+		{
+			fprintf(stderr, "could not create thread\n");
+			exit(2);
+		}
+	}
+
+	for (i = 0; i < nworkers; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		nerrs += workers[i].nerrs;
+		nblocks += workers[i].nblocks;
+	}
+
+	printf("checked %d files, " UINT64_FORMAT " blocks, found " UINT64_FORMAT " issues\n",
+		   nsegments, nblocks, nerrs);
+
+	return (nerrs > 0) ? 1 : 0;
+}
+
+static void *
+xmalloc(size_t size)
+{
+	void	   *ptr = malloc(size);
+
+	if (ptr == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(2);
+	}
+
+	return ptr;
+}
+
+/* scan directories of databases (in base/ or a tablespace) */
+static void
+scan_tablespaces(const char *path)
+{
+	DIR		   *dir;
+	struct dirent *de;
+	char		subpath[MAXPGPATH];
+
+	if ((dir = opendir(path)) == NULL)
+		return;
+
+	while ((de = readdir(dir)) != NULL)
+	{
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(subpath, sizeof(subpath), "%s/%s", path, de->d_name);
+
+		/* tablespaces have a version directory (PG_x.y_catversion) */
+		if (strncmp(de->d_name, "PG_", 3) == 0)
+			scan_tablespaces(subpath);
+		else if (strspn(de->d_name, "0123456789") == strlen(de->d_name))
+		{
+			if (strcmp(path + strlen(path) - strlen("pg_tblspc"), "pg_tblspc") == 0)
+				scan_tablespaces(subpath);
+			else
+				scan_directory(subpath);
+		}
+	}
+
+	closedir(dir);
+}
+
+/* add all relations (main forks, i.e. files named by relfilenode) */
+static void
+scan_directory(const char *path)
+{
+	DIR		   *dir;
+	struct dirent *de;
+
+	if ((dir = opendir(path)) == NULL)
+		return;
+
+	while ((de = readdir(dir)) != NULL)
+	{
+		if ((de->d_name[0] != '\0') &&
+			(strspn(de->d_name, "0123456789") == strlen(de->d_name)))
+			add_relation(path, de->d_name);
+	}
+
+	closedir(dir);
+}
+
+/* add all segments of a relation */
+static void
+add_relation(const char *dir, const char *name)
+{
+	char		path[MAXPGPATH];
+	BlockNumber segno;
+	RelationKind kind;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	kind = relation_kind(path);
+
+	for (segno = 0;; segno++)
+	{
+		struct stat st;
+		segment_file *seg;
+
+		if (segno > 0)
+			snprintf(path, sizeof(path), "%s/%s.%u", dir, name, segno);
+
+		if (stat(path, &st) != 0)
+			break;
+
+		if (nsegments == maxsegments)
+		{
+			segment_file *tmp;
+
+			maxsegments = Max(1024, maxsegments * 2);
+			tmp = (segment_file *) xmalloc(maxsegments * sizeof(segment_file));
+
+			if (segments != NULL)
+			{
+				memcpy(tmp, segments, nsegments * sizeof(segment_file));
+				free(segments);
+			}
+
+			segments = tmp;
+		}
+
+		seg = &segments[nsegments++];
+
+		seg->path = strdup(path);
+		seg->segno = segno;
+		seg->nblocks = (BlockNumber) (st.st_size / BLCKSZ);
+		seg->kind = kind;
+
+		if (st.st_size % BLCKSZ != 0)
+			fprintf(stderr, "%s: WARNING:  file size %ld is not a multiple of %d\n",
+					path, (long) st.st_size, BLCKSZ);
+	}
+}
+
+/* determine kind of the relation from the first page */
+static RelationKind
+relation_kind(const char *path)
+{
+	char		page[BLCKSZ];
+	PageHeader	header = (PageHeader) page;
+	int			fd;
+	ssize_t		nread;
+
+	if ((fd = open(path, O_RDONLY | PG_BINARY, 0)) < 0)
+		return RELATION_OTHER;
+
+	nread = read(fd, page, BLCKSZ);
+	close(fd);
+
+	if (nread != BLCKSZ)
+		return RELATION_OTHER;
+
+	if (PageIsNew(header) || (header->pd_special == BLCKSZ))
+		return RELATION_HEAP;
+
+	if ((PageGetSpecialSize(header) == MAXALIGN(sizeof(BTPageOpaqueData))) &&
+		(((BTPageOpaque) PageGetSpecialPointer(header))->btpo_flags & BTP_META) &&
+		(BTPageGetMeta(page)->btm_magic == BTREE_MAGIC))
+		return RELATION_BTREE;
+
+	return RELATION_OTHER;
+}
+
+static void
+build_chunks(BlockNumber chunkBlocks)
+{
+	int			i;
+	int			maxchunks = 0;
+
+	for (i = 0; i < nsegments; i++)
+		maxchunks += (segments[i].nblocks + chunkBlocks - 1) / chunkBlocks;
+
+	chunks = (chunk *) xmalloc(Max(1, maxchunks) * sizeof(chunk));
+
+	for (i = 0; i < nsegments; i++)
+	{
+		BlockNumber blkno;
+
+		for (blkno = 0; blkno < segments[i].nblocks; blkno += chunkBlocks)
+		{
+			chunks[nchunks].segment = i;
+			chunks[nchunks].blockFrom = blkno;
+			chunks[nchunks].nblocks = Min(chunkBlocks,
+										  segments[i].nblocks - blkno);
+			nchunks++;
+		}
+	}
+}
+
+static void *
+worker_main(void *arg)
+{
+	worker	   *w = (worker *) arg;
+	int			idx;
+	attribute_plan *plan;
+
+	/* no tuple descriptors, but the page checks need the buffers */
+	plan = attribute_plan_build(NULL);
+
+	for (;;)
+	{
+		if (worker_take(w, &idx))
+		{
+			w->nerrs += check_chunk(&chunks[idx], plan);
+			w->nblocks += chunks[idx].nblocks;
+			continue;
+		}
+
+		/* our range is empty, so steal some work (or we're done) */
+		if (!worker_steal(w))
+			break;
+	}
+
+	attribute_plan_free(plan);
+
+	return NULL;
+}
+
+/* take the next chunk from the thread's own range */
+static bool
+worker_take(worker * w, int *idx)
+{
+	bool		found = false;
+
+	pthread_mutex_lock(&w->mutex);
+
+	if (w->next < w->end)
+	{
+		*idx = w->next++;
+		found = true;
+	}
+
+	pthread_mutex_unlock(&w->mutex);
+
+	return found;
+}
+
+/* steal upper half of the chunks from the thread with most work left */
+static bool
+worker_steal(worker * w)
+{
+	int			i;
+	int			victim = -1;
+	int			remaining = 0;
+	int			from,
+				to;
+
+	for (i = 0; i < nworkers; i++)
+	{
+		int			n;
+
+		if (&workers[i] == w)
+			continue;
+
+		pthread_mutex_lock(&workers[i].mutex);
+		n = workers[i].end - workers[i].next;
+		pthread_mutex_unlock(&workers[i].mutex);
+
+		if (n > remaining)
+		{
+			remaining = n;
+			victim = i;
+		}
+	}
+
+	if (victim == -1)
+		return false;
+
+	pthread_mutex_lock(&workers[victim].mutex);
+
+	/* it might have changed since we looked */
+	remaining = workers[victim].end - workers[victim].next;
+
+	if (remaining <= 0)
+	{
+		pthread_mutex_unlock(&workers[victim].mutex);
+		return true;			/* try again */
+	}
+
+	to = workers[victim].end;
+	from = to - (remaining + 1) / 2;
+	workers[victim].end = from;
+
+	pthread_mutex_unlock(&workers[victim].mutex);
+
+	pthread_mutex_lock(&w->mutex);
+	w->next = from;
+	w->end = to;
+	pthread_mutex_unlock(&w->mutex);
+
+	return true;
+}
+
+/* map the chunk of the segment file, and check the pages */
+static uint32
+check_chunk(chunk * c, attribute_plan * plan)
+{
+	segment_file *seg = &segments[c->segment];
+	uint32		nerrs = 0;
+	char	   *data;
+	int			fd;
+	BlockNumber i;
+	off_t		offset = (off_t) c->blockFrom * BLCKSZ;
+	Size		length = (Size) c->nblocks * BLCKSZ;
+
+	cli_context = seg->path;
+
+	if ((c->blockFrom == 0) && (cli_min_elevel <= NOTICE))
+		fprintf(stderr, "%s: NOTICE:  checking %u blocks\n",
+				seg->path, seg->nblocks);
+
+	if ((fd = open(seg->path, O_RDONLY | PG_BINARY, 0)) < 0)
+	{
+		fprintf(stderr, "%s: WARNING:  could not open file: %s\n",
+				seg->path, strerror(errno));
+		return 1;
+	}
+
+	/*
+	 * Computing the checksum temporarily resets pd_checksum, so in that case
+	 * map the file privately (only the modified pages are copied).
+	 */
+	if (check_checksums)
+		data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+					offset);
+	else
+		data = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "%s: WARNING:  could not map file: %s\n",
+				seg->path, strerror(errno));
+		return 1;
+	}
+
+	/*
+	 * The advice values can't be combined, so pass them separately. Both are
+	 * just hints, so failures are not fatal.
+	 */
+	if ((madvise(data, length, MADV_SEQUENTIAL) != 0) &&
+		(cli_min_elevel <= DEBUG1))
+		fprintf(stderr, "%s: DEBUG:  could not advise sequential access: %s\n",
+				seg->path, strerror(errno));
+
+	if ((madvise(data, length, MADV_WILLNEED) != 0) &&
+		(cli_min_elevel <= DEBUG1))
+		fprintf(stderr, "%s: DEBUG:  could not advise prefetching: %s\n",
+				seg->path, strerror(errno));
+
+	for (i = 0; i < c->nblocks; i++)
+	{
+		char	   *page = data + (Size) i * BLCKSZ;
+		PageHeader	header = (PageHeader) page;
+		BlockNumber blkno = seg->segno * RELSEG_SIZE + c->blockFrom + i;
+
+		switch (seg->kind)
+		{
+			case RELATION_HEAP:
+				nerrs += check_page_header(header, blkno);
+				nerrs += check_heap_tuples(NULL, header, page, blkno, plan);
+				break;
+			case RELATION_BTREE:
+				nerrs += btree_check(NULL, header, blkno, page, plan);
+				break;
+			case RELATION_OTHER:
+				nerrs += check_page_header(header, blkno);
+				break;
+		}
+	}
+
+	munmap(data, length);
+
+	cli_context = NULL;
+
+	return nerrs;
+}
@@ -0,0 +1,293 @@
+-- Adjust this setting to control where the objects get created.
+SET search_path = public;
+
+--
+-- pg_check_table()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_table(table_relation regclass, check_indexes bool default true, cross_check bool default true, block_start bigint default null, block_end bigint default null,
+                                          sample_fraction float8 default null, sample_blocks bigint default null)
+RETURNS int4
+AS '$libdir/pg_check', 'pg_check_table'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pg_check_table(regclass, bool, bool, bigint, bigint, float8, bigint) IS 'checks consistency of a part of the table (range or sample of pages) and optionally all indexes on it';
+
+--
+-- pg_check_index()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_index(index_relation regclass, block_start bigint default null, block_end bigint default null,
+                                          sample_fraction float8 default null, sample_blocks bigint default null)
+RETURNS int4
+AS '$libdir/pg_check', 'pg_check_index'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pg_check_index(regclass, bigint, bigint, float8, bigint) IS 'checks consistency of a part of the index (range or sample of pages)';
+
+--
+-- pg_check_database()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_database(workers int4 default null)
+RETURNS int4
+AS '$libdir/pg_check', 'pg_check_database'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pg_check_database(int4) IS 'checks all tables and indexes in the current database, using parallel workers';
+
+--
+-- incremental checks
+--
+
+CREATE TABLE pg_check_watermarks (
+    relid       oid PRIMARY KEY,
+    lsn         text NOT NULL,
+    checked_at  timestamptz NOT NULL DEFAULT now()
+);
+
+SELECT pg_catalog.pg_extension_config_dump('pg_check_watermarks', '');
+
+COMMENT ON TABLE pg_check_watermarks IS 'LSN up to which the tables were checked by pg_check_table_incremental';
+
+CREATE OR REPLACE FUNCTION pg_check_table_since(table_relation regclass, since_lsn text, OUT issues int4, OUT start_lsn text)
+RETURNS record
+AS '$libdir/pg_check', 'pg_check_table_since'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_table_since(regclass, text) IS 'checks pages of the table modified since the LSN, returns the LSN to use for the next check';
+
+CREATE OR REPLACE FUNCTION pg_check_partitions_since(table_relation regclass, partitions oid[], since_lsns text[], OUT issues int4, OUT start_lsn text)
+RETURNS record
+AS '$libdir/pg_check', 'pg_check_partitions_since'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_partitions_since(regclass, oid[], text[]) IS 'checks pages of the partitions modified since the LSN of each partition (others are checked whole), returns the LSN to use for the next check';
+
+CREATE OR REPLACE FUNCTION pg_check_table_incremental(table_relation regclass)
+RETURNS int4
+AS $$
+DECLARE
+    v_since     text;
+    v_result    record;
+    v_relids    oid[];
+    v_partids   oid[];
+    v_lsns      text[];
+BEGIN
+    IF (SELECT relkind FROM pg_class WHERE oid = table_relation) = 'p' THEN
+        -- watermarks are kept for the leaf partitions
+        WITH RECURSIVE tree (relid) AS (
+            SELECT table_relation::oid
+            UNION ALL
+            SELECT i.inhrelid FROM pg_inherits i JOIN tree t ON (i.inhparent = t.relid)
+        )
+        SELECT array_agg(t.relid) INTO v_relids
+          FROM tree t JOIN pg_class c ON (c.oid = t.relid)
+         WHERE c.relkind = 'r';
+
+        -- each partition is checked since its own watermark (new ones have none)
+        SELECT array_agg(w.relid), array_agg(w.lsn) INTO v_partids, v_lsns
+          FROM pg_check_watermarks w WHERE w.relid = ANY (v_relids);
+
+        SELECT * INTO v_result FROM pg_check_partitions_since(table_relation, COALESCE(v_partids, '{}'), COALESCE(v_lsns, '{}'));
+    ELSE
+        v_relids := ARRAY[table_relation::oid];
+
+        SELECT lsn INTO v_since FROM pg_check_watermarks WHERE relid = table_relation;
+
+        SELECT * INTO v_result FROM pg_check_table_since(table_relation, COALESCE(v_since, '0/0'));
+    END IF;
+
+    -- only advance the watermark when the pages were found to be correct
+    IF v_result.issues = 0 THEN
+        DELETE FROM pg_check_watermarks WHERE relid = ANY (v_relids);
+        INSERT INTO pg_check_watermarks (relid, lsn) SELECT unnest(v_relids), v_result.start_lsn;
+    END IF;
+
+    RETURN v_result.issues;
+END;
+$$ LANGUAGE plpgsql;
+
+COMMENT ON FUNCTION pg_check_table_incremental(regclass) IS 'checks pages of the table modified since the last successful incremental check';
+
+--
+-- resumable checks
+--
+
+CREATE TABLE pg_check_cursors (
+    relid       oid PRIMARY KEY,
+    next_block  bigint NOT NULL,
+    issues      bigint NOT NULL DEFAULT 0,
+    started_at  timestamptz NOT NULL DEFAULT now(),
+    updated_at  timestamptz NOT NULL DEFAULT now()
+);
+
+SELECT pg_catalog.pg_extension_config_dump('pg_check_cursors', '');
+
+COMMENT ON TABLE pg_check_cursors IS 'position of the checks done by pg_check_table_resume';
+
+CREATE OR REPLACE FUNCTION pg_check_table_resume(table_relation regclass, nblocks bigint default 1024, OUT issues bigint, OUT next_block bigint, OUT done bool)
+RETURNS record
+AS $$
+DECLARE
+    v_from      bigint;
+    v_to        bigint;
+    v_size      bigint;
+    v_issues    bigint;
+BEGIN
+    IF nblocks <= 0 THEN
+        RAISE EXCEPTION 'number of blocks must be positive';
+    END IF;
+
+    SELECT c.next_block, c.issues INTO v_from, v_issues FROM pg_check_cursors c WHERE c.relid = table_relation FOR UPDATE;
+
+    IF NOT FOUND THEN
+        v_from := 0;
+        v_issues := 0;
+        INSERT INTO pg_check_cursors (relid, next_block) VALUES (table_relation, 0);
+    END IF;
+
+    -- the table may have been truncated since the last call
+    v_size := pg_relation_size(table_relation) / current_setting('block_size')::bigint;
+    v_to := LEAST(v_from + nblocks, v_size);
+
+    IF v_from < v_to THEN
+        issues := pg_check_table(table_relation, false, false, v_from, v_to);
+    ELSE
+        issues := 0;
+    END IF;
+
+    next_block := v_to;
+    done := (v_to >= v_size);
+
+    -- start from the beginning next time, once the whole table was checked
+    -- (the last call returns the issues found in the whole table)
+    IF done THEN
+        issues := v_issues + issues;
+        DELETE FROM pg_check_cursors c WHERE c.relid = table_relation;
+    ELSE
+        UPDATE pg_check_cursors c SET next_block = v_to, issues = c.issues + pg_check_table_resume.issues, updated_at = now()
+         WHERE c.relid = table_relation;
+    END IF;
+END;
+$$ LANGUAGE plpgsql;
+
+COMMENT ON FUNCTION pg_check_table_resume(regclass, bigint) IS 'checks the next range of pages of the table, continuing where the previous call stopped';
+
+--
+-- pg_check_table_issues(), pg_check_index_issues()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_table_issues(table_relation regclass, check_indexes bool default true, cross_check bool default true, max_issues int4 default 1000, aggregate bool default false,
+                                                 OUT relation regclass, OUT block bigint, OUT offnum int4, OUT check_code text, OUT detail text, OUT count bigint)
+RETURNS SETOF record
+AS '$libdir/pg_check', 'pg_check_table_issues'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pg_check_table_issues(regclass, bool, bool, int4, bool) IS 'checks consistency of the table and optionally all indexes on it, returns the issues found';
+
+CREATE OR REPLACE FUNCTION pg_check_index_issues(index_relation regclass, max_issues int4 default 1000, aggregate bool default false,
+                                                 OUT relation regclass, OUT block bigint, OUT offnum int4, OUT check_code text, OUT detail text, OUT count bigint)
+RETURNS SETOF record
+AS '$libdir/pg_check', 'pg_check_index_issues'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pg_check_index_issues(regclass, int4, bool) IS 'checks consistency of the index, returns the issues found';
+
+--
+-- pg_check_table_diff(), pg_check_table_diff_file()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_table_diff(table_relation regclass,
+                                               OUT index_relation regclass, OUT kind text, OUT block_start bigint, OUT offset_start int4,
+                                               OUT block_end bigint, OUT offset_end int4, OUT items bigint)
+RETURNS SETOF record
+AS '$libdir/pg_check', 'pg_check_table_diff'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_table_diff(regclass) IS 'cross-checks the table with all indexes, returns the differences as ranges of items';
+
+CREATE OR REPLACE FUNCTION pg_check_table_diff_file(table_relation regclass, path text)
+RETURNS bigint
+AS '$libdir/pg_check', 'pg_check_table_diff_file'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_table_diff_file(regclass, text) IS 'cross-checks the table with all indexes, writes the differences into a file';
+
+--
+-- pg_check_progress(), pg_stat_progress_check
+--
+
+CREATE OR REPLACE FUNCTION pg_check_progress(OUT pid int4, OUT datid oid, OUT relid oid, OUT phase text, OUT blocks_total bigint, OUT blocks_done bigint,
+                                             OUT index_relid oid, OUT indexes_total int4, OUT indexes_done int4, OUT issues_found bigint, OUT started_at timestamptz)
+RETURNS SETOF record
+AS '$libdir/pg_check', 'pg_check_progress'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pg_check_progress() IS 'returns progress of the running checks (requires shared_preload_libraries)';
+
+CREATE OR REPLACE VIEW pg_stat_progress_check AS
+SELECT p.pid, p.datid, d.datname, p.relid, p.phase, p.blocks_total, p.blocks_done,
+       p.index_relid, p.indexes_total, p.indexes_done, p.issues_found, p.started_at
+  FROM pg_check_progress() p
+  LEFT JOIN pg_database d ON (d.oid = p.datid);
+
+--
+-- pg_check_stats(), pg_check_stats_issues(), pg_check_stats_reset()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_stats(OUT datid oid, OUT relid oid, OUT pages_checked bigint, OUT issues bigint, OUT io_time float8, OUT cpu_time float8,
+                                          OUT io_histogram bigint[], OUT cpu_histogram bigint[], OUT last_check timestamptz, OUT last_full_check timestamptz,
+                                          OUT last_full_check_lsn text)
+RETURNS SETOF record
+AS '$libdir/pg_check', 'pg_check_stats'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pg_check_stats() IS 'returns cumulative statistics of the checks, per relation (requires shared_preload_libraries)';
+
+CREATE OR REPLACE FUNCTION pg_check_stats_issues(OUT datid oid, OUT relid oid, OUT check_code text, OUT count bigint)
+RETURNS SETOF record
+AS '$libdir/pg_check', 'pg_check_stats_issues'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pg_check_stats_issues() IS 'returns cumulative number of issues found, per relation and check code (requires shared_preload_libraries)';
+
+CREATE OR REPLACE FUNCTION pg_check_stats_reset()
+RETURNS void
+AS '$libdir/pg_check', 'pg_check_stats_reset'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pg_check_stats_reset() IS 'discards the cumulative statistics of all relations';
+
+CREATE OR REPLACE VIEW pg_check_stats AS
+SELECT s.datid, d.datname, s.relid, s.pages_checked, s.issues, s.io_time, s.cpu_time,
+       s.io_histogram, s.cpu_histogram, s.last_check, s.last_full_check, s.last_full_check_lsn
+  FROM pg_check_stats() s
+  LEFT JOIN pg_database d ON (d.oid = s.datid);
+
+CREATE OR REPLACE VIEW pg_check_stats_issues AS
+SELECT s.datid, d.datname, s.relid, s.check_code, s.count
+  FROM pg_check_stats_issues() s
+  LEFT JOIN pg_database d ON (d.oid = s.datid);
+
+--
+-- pg_check_bitmap_memory()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_bitmap_memory()
+RETURNS bigint
+AS '$libdir/pg_check', 'pg_check_bitmap_memory'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_bitmap_memory() IS 'returns peak memory used by the bitmaps during the last cross-check in this backend';
+
+--
+-- pg_check_memory()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_memory()
+RETURNS bigint
+AS '$libdir/pg_check', 'pg_check_memory'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_memory() IS 'returns peak memory used by the last check in this backend';
@@ -0,0 +1,451 @@
+#include "bitmap-container.h"
+
+/* maximum number of values in an array container (8kB, same as a bitset) */
+#define ARRAY_MAX_VALUES	4096
+
+/* maximum number of runs in a run container (8kB, same as a bitset) */
+#define RUN_MAX_RUNS		2048
+
+#define BITSET_BYTES		(CONTAINER_WORDS * sizeof(uint64))
+
+/* accessors for the (start, length-1) run pairs */
+#define RunStart(c,i)		((c)->data.values[2 * (i)])
+#define RunLength(c,i)		((c)->data.values[2 * (i) + 1])
+#define RunEnd(c,i)			((uint32) RunStart(c,i) + RunLength(c,i))
+
+static void array_set(bitmap_container * container, uint16 value);
+static bool array_get(bitmap_container * container, uint16 value);
+static void array_convert(bitmap_container * container);
+
+static void run_set(bitmap_container * container, uint16 value);
+static bool run_get(bitmap_container * container, uint16 value);
+static int	run_search(bitmap_container * container, uint16 value);
+
+static void bitset_set(bitmap_container * container, uint16 value);
+static bool bitset_get(bitmap_container * container, uint16 value);
+
+static void container_to_bitset(bitmap_container * container);
+
+/* allocate a new empty container (an empty array) */
+bitmap_container *
+container_init(void)
+{
+	bitmap_container *container;
+
+	container = (bitmap_container *) palloc0(sizeof(bitmap_container));
+
+	container->type = CONTAINER_ARRAY;
+
+	return container;
+}
+
+/* free the container and the data */
+void
+container_free(bitmap_container * container)
+{
+	if (container->data.values != NULL)
+		pfree(container->data.values);
+
+	pfree(container);
+}
+
+void
+container_set(bitmap_container * container, uint16 value)
+{
+	switch (container->type)
+	{
+		case CONTAINER_ARRAY:
+			array_set(container, value);
+			break;
+		case CONTAINER_RUN:
+			run_set(container, value);
+			break;
+		case CONTAINER_BITSET:
+			bitset_set(container, value);
+			break;
+	}
+}
+
+bool
+container_get(bitmap_container * container, uint16 value)
+{
+	switch (container->type)
+	{
+		case CONTAINER_ARRAY:
+			return array_get(container, value);
+		case CONTAINER_RUN:
+			return run_get(container, value);
+		case CONTAINER_BITSET:
+			return bitset_get(container, value);
+	}
+
+	return false;				/* keep compiler quiet */
+}
+
+/* expand the container into a plain bitset */
+void
+container_to_words(bitmap_container * container, uint64 *words)
+{
+	uint32		i;
+
+	if (container->type == CONTAINER_BITSET)
+	{
+		memcpy(words, container->data.words, BITSET_BYTES);
+		return;
+	}
+
+	memset(words, 0, BITSET_BYTES);
+
+	if (container->type == CONTAINER_ARRAY)
+	{
+		for (i = 0; i < container->nitems; i++)
+		{
+			uint16		value = container->data.values[i];
+
+			words[value / 64] |= (UINT64CONST(1) << (value % 64));
+		}
+
+		return;
+	}
+
+	/* run container, fill whole words where possible */
+	for (i = 0; i < container->nitems; i++)
+	{
+		uint32		bit = RunStart(container, i);
+		uint32		end = RunEnd(container, i);
+
+		while (bit <= end)
+		{
+			if ((bit % 64 == 0) && (bit + 63 <= end))
+			{
+				words[bit / 64] = ~UINT64CONST(0);
+				bit += 64;
+			}
+			else
+			{
+				words[bit / 64] |= (UINT64CONST(1) << (bit % 64));
+				bit++;
+			}
+		}
+	}
+}
+
+/* same representation and the same data? */
+bool
+container_identical(bitmap_container * a, bitmap_container * b)
+{
+	if ((a->type != b->type) || (a->cardinality != b->cardinality))
+		return false;
+
+	switch (a->type)
+	{
+		case CONTAINER_ARRAY:
+			return (a->nitems == b->nitems) &&
+				(memcmp(a->data.values, b->data.values,
+						a->nitems * sizeof(uint16)) == 0);
+		case CONTAINER_RUN:
+			return (a->nitems == b->nitems) &&
+				(memcmp(a->data.values, b->data.values,
+						a->nitems * 2 * sizeof(uint16)) == 0);
+		case CONTAINER_BITSET:
+			return (memcmp(a->data.words, b->data.words, BITSET_BYTES) == 0);
+	}
+
+	return false;				/* keep compiler quiet */
+}
+
+/* memory used by the container */
+Size
+container_size(bitmap_container * container)
+{
+	Size		size = sizeof(bitmap_container);
+
+	switch (container->type)
+	{
+		case CONTAINER_ARRAY:
+			return size + container->maxitems * sizeof(uint16);
+		case CONTAINER_RUN:
+			return size + container->maxitems * 2 * sizeof(uint16);
+		case CONTAINER_BITSET:
+			return size + BITSET_BYTES;
+	}
+
+	return size;				/* keep compiler quiet */
+}
+
+/*
+ * Array containers.
+ *
+ * Values are usually added in increasing order (heap pages are processed
+ * sequentially), so check the append case first.
+ */
+static void
+array_set(bitmap_container * container, uint16 value)
+{
+	int			lo = 0,
+				hi = container->nitems;
+
+	if ((container->nitems > 0) &&
+		(container->data.values[container->nitems - 1] >= value))
+	{
+		/* binary search for the first value >= the new one */
+		while (lo < hi)
+		{
+			int			mid = lo + (hi - lo) / 2;
+
+			if (container->data.values[mid] < value)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (container->data.values[lo] == value)
+			return;
+	}
+	else
+		lo = container->nitems;
+
+	/* the array is full, so switch to a different representation */
+	if (container->nitems == ARRAY_MAX_VALUES)
+	{
+		array_convert(container);
+		container_set(container, value);
+		return;
+	}
+
+	if (container->nitems == container->maxitems)
+	{
+		uint32		maxitems = Max(4, container->maxitems * 2);
+
+		maxitems = Min(maxitems, ARRAY_MAX_VALUES);
+
+		if (container->data.values == NULL)
+			container->data.values = palloc(maxitems * sizeof(uint16));
+		else
+			container->data.values = repalloc(container->data.values,
+											  maxitems * sizeof(uint16));
+
+		container->maxitems = maxitems;
+	}
+
+	memmove(&container->data.values[lo + 1], &container->data.values[lo],
+			(container->nitems - lo) * sizeof(uint16));
+
+	container->data.values[lo] = value;
+	container->nitems++;
+	container->cardinality++;
+}
+
+static bool
+array_get(bitmap_container * container, uint16 value)
+{
+	int			lo = 0,
+				hi = (int) container->nitems - 1;
+
+	while (lo <= hi)
+	{
+		int			mid = lo + (hi - lo) / 2;
+
+		if (container->data.values[mid] == value)
+			return true;
+		else if (container->data.values[mid] < value)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return false;
+}
+
+/*
+ * Convert a full array container to runs or a bitset, whichever is smaller.
+ * Heap pages usually have all items from 1 to N, so runs tend to win.
+ */
+static void
+array_convert(bitmap_container * container)
+{
+	uint32		i;
+	uint32		nruns = 0;
+	uint16	   *values = container->data.values;
+	uint16	   *runs;
+
+	for (i = 0; i < container->nitems; i++)
+	{
+		if ((i == 0) || (values[i] != values[i - 1] + 1))
+			nruns++;
+	}
+
+	if (nruns >= RUN_MAX_RUNS)
+	{
+		container_to_bitset(container);
+		return;
+	}
+
+	runs = palloc(nruns * 2 * sizeof(uint16));
+
+	nruns = 0;
+	for (i = 0; i < container->nitems; i++)
+	{
+		if ((i == 0) || (values[i] != values[i - 1] + 1))
+		{
+			runs[2 * nruns] = values[i];
+			runs[2 * nruns + 1] = 0;
+			nruns++;
+		}
+		else
+			runs[2 * nruns - 1]++;
+	}
+
+	pfree(values);
+
+	container->type = CONTAINER_RUN;
+	container->data.values = runs;
+	container->nitems = nruns;
+	container->maxitems = nruns;
+}
+
+/*
+ * Run containers.
+ */
+
+/* index of the last run starting at or before the value (-1 if none) */
+static int
+run_search(bitmap_container * container, uint16 value)
+{
+	int			lo = 0,
+				hi = (int) container->nitems - 1;
+
+	/* the common case - appending to (or after) the last run */
+	if ((container->nitems > 0) &&
+		(RunStart(container, container->nitems - 1) <= value))
+		return container->nitems - 1;
+
+	while (lo <= hi)
+	{
+		int			mid = lo + (hi - lo) / 2;
+
+		if (RunStart(container, mid) <= value)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return hi;
+}
+
+static void
+run_set(bitmap_container * container, uint16 value)
+{
+	int			idx = run_search(container, value);
+	int			next = idx + 1;
+
+	if (idx >= 0)
+	{
+		/* already set */
+		if (value <= RunEnd(container, idx))
+			return;
+
+		/* extends the preceding run (and maybe merges with the next one) */
+		if (value == RunEnd(container, idx) + 1)
+		{
+			RunLength(container, idx)++;
+			container->cardinality++;
+
+			if ((next < container->nitems) &&
+				(RunStart(container, next) == value + 1))
+			{
+				RunLength(container, idx) += RunLength(container, next) + 1;
+
+				memmove(&RunStart(container, next), &RunStart(container, next + 1),
+						(container->nitems - next - 1) * 2 * sizeof(uint16));
+				container->nitems--;
+			}
+
+			return;
+		}
+	}
+
+	/* extends the next run backwards */
+	if ((next < container->nitems) &&
+		(RunStart(container, next) == value + 1))
+	{
+		RunStart(container, next) = value;
+		RunLength(container, next)++;
+		container->cardinality++;
+		return;
+	}
+
+	/* a new run is needed - if there are too many, use a bitset instead */
+	if (container->nitems == RUN_MAX_RUNS)
+	{
+		container_to_bitset(container);
+		bitset_set(container, value);
+		return;
+	}
+
+	if (container->nitems == container->maxitems)
+	{
+		uint32		maxitems = Max(4, container->maxitems * 2);
+
+		maxitems = Min(maxitems, RUN_MAX_RUNS);
+
+		container->data.values = repalloc(container->data.values,
+										  maxitems * 2 * sizeof(uint16));
+		container->maxitems = maxitems;
+	}
+
+	memmove(&RunStart(container, next + 1), &RunStart(container, next),
+			(container->nitems - next) * 2 * sizeof(uint16));
+
+	RunStart(container, next) = value;
+	RunLength(container, next) = 0;
+
+	container->nitems++;
+	container->cardinality++;
+}
+
+static bool
+run_get(bitmap_container * container, uint16 value)
+{
+	int			idx = run_search(container, value);
+
+	return (idx >= 0) && (value <= RunEnd(container, idx));
+}
+
+/*
+ * Bitset containers.
+ */
+static void
+bitset_set(bitmap_container * container, uint16 value)
+{
+	uint64		mask = (UINT64CONST(1) << (value % 64));
+
+	if (!(container->data.words[value / 64] & mask))
+	{
+		container->data.words[value / 64] |= mask;
+		container->cardinality++;
+	}
+}
+
+static bool
+bitset_get(bitmap_container * container, uint16 value)
+{
+	return (container->data.words[value / 64] & (UINT64CONST(1) << (value % 64)));
+}
+
+/* convert any container to a bitset */
+static void
+container_to_bitset(bitmap_container * container)
+{
+	uint64	   *words = palloc(BITSET_BYTES);
+
+	container_to_words(container, words);
+
+	if (container->data.values != NULL)
+		pfree(container->data.values);
+
+	container->type = CONTAINER_BITSET;
+	container->data.words = words;
+	container->nitems = 0;
+	container->maxitems = 0;
+}
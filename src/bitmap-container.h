@@ -0,0 +1,63 @@
+#ifndef BITMAP_CONTAINER_H
+#define BITMAP_CONTAINER_H
+
+#include "postgres.h"
+
+/*
+ * Containers of the compressed item bitmap. Each container covers a range
+ * of CONTAINER_BITS consecutive bits, and uses one of three representations
+ * picked by density (just like in roaring bitmaps):
+ *
+ * - array : sorted array of the set bits (up to ARRAY_MAX_VALUES)
+ * - bitset : plain bitmap (CONTAINER_WORDS words)
+ * - run : sorted array of runs of set bits, as (start, length-1) pairs
+ *
+ * New containers start as arrays. A full array is converted to runs or to
+ * a bitset, depending on which is smaller, and a run container with too
+ * many runs is converted to a bitset.
+ */
+#define CONTAINER_BITS		65536
+#define CONTAINER_WORDS		(CONTAINER_BITS / 64)
+
+typedef enum
+{
+	CONTAINER_ARRAY,
+	CONTAINER_BITSET,
+	CONTAINER_RUN
+}			ContainerType;
+
+typedef struct bitmap_container
+{
+	ContainerType type;
+	uint32		cardinality;	/* number of bits set */
+	uint32		nitems;			/* used values (array) or runs (run) */
+	uint32		maxitems;		/* allocated values (array) or runs (run) */
+
+	union
+	{
+		uint16	   *values;		/* array: sorted values, run: pairs */
+		uint64	   *words;		/* bitset */
+	}			data;
+}			bitmap_container;
+
+/* Allocates a new (empty) container. */
+bitmap_container *container_init(void);
+
+/* Releases the container, including the data. */
+void		container_free(bitmap_container * container);
+
+/* Sets / checks a bit in the container. */
+void		container_set(bitmap_container * container, uint16 value);
+bool		container_get(bitmap_container * container, uint16 value);
+
+/* Expands the container into a bitset (CONTAINER_WORDS words). */
+void		container_to_words(bitmap_container * container, uint64 *words);
+
+/* Checks the containers have the same representation and contents (a fast
+ * path, containers with different representation are never identical). */
+bool		container_identical(bitmap_container * a, bitmap_container * b);
+
+/* Returns amount of memory used by the container (including the data). */
+Size		container_size(bitmap_container * container);
+
+#endif							/* BITMAP_CONTAINER_H */
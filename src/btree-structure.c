@@ -0,0 +1,711 @@
+#include "postgres.h"
+
+#include "access/itup.h"
+#include "access/nbtree.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#include "btree-structure.h"
+#include "issues.h"
+
+/* FNV-1a (32-bit) constants */
+#define FNV_OFFSET_32	2166136261U
+#define FNV_PRIME_32	16777619U
+
+/* b-trees with more levels than this are certainly corrupted */
+#define BTREE_MAX_LEVELS	64
+
+/* the number of downlinks is saturated at this value */
+#define MAX_DOWNLINKS		255
+
+/* links of pages not scanned (yet), and of deleted or new pages */
+#define LINK_NOT_SCANNED		InvalidBlockNumber
+#define LINK_RECYCLED			(InvalidBlockNumber - 1)
+
+#define SummaryIsDeleted(p)		(((p)->flags & BTP_DELETED) != 0)
+#define SummaryIsHalfDead(p)	(((p)->flags & BTP_HALF_DEAD) != 0)
+
+static uint32 hash_key(IndexTuple itup, Size len);
+static bool downlink_key(btree_summary * summary, BlockNumber block,
+			 uint32 *key);
+static BlockNumber left_sibling(btree_summary * summary, BlockNumber block);
+static uint32 verify_root(Relation rel, btree_summary * summary);
+static uint32 verify_siblings(Relation rel, btree_summary * summary,
+				BlockNumber block);
+static uint32 verify_downlink(Relation rel, btree_summary * summary,
+				BlockNumber block);
+static uint32 verify_chains(Relation rel, btree_summary * summary);
+
+btree_summary *
+btree_summary_init(BlockNumber nblocks)
+{
+	btree_summary *summary;
+	Size		size = mul_size(Max(1, nblocks), sizeof(btree_page_summary));
+
+	summary = (btree_summary *) palloc0(sizeof(btree_summary));
+
+	summary->nblocks = nblocks;
+
+	/* large indexes may need more than 1GB (32B per page) */
+#if (PG_VERSION_NUM >= 90500)
+	summary->pages = (btree_page_summary *)
+		MemoryContextAllocExtended(CurrentMemoryContext, size,
+								   MCXT_ALLOC_HUGE | MCXT_ALLOC_NO_OOM | MCXT_ALLOC_ZERO);
+#else
+	if (AllocSizeIsValid(size))
+		summary->pages = (btree_page_summary *) palloc0(size);
+#endif
+
+	if (summary->pages == NULL)
+	{
+		pfree(summary);
+		return NULL;
+	}
+
+	return summary;
+}
+
+void
+btree_summary_free(btree_summary * summary)
+{
+	pfree(summary->pages);
+	pfree(summary);
+}
+
+uint32
+btree_summary_add_page(btree_summary * summary, PageHeader header,
+					   BlockNumber block, bool valid)
+{
+	Page		page = (Page) header;
+	BTPageOpaque opaque;
+	btree_page_summary *p;
+	OffsetNumber off;
+	OffsetNumber maxoff;
+	uint32		nerrs = 0;
+
+	/* pages with issues (and pages added after the scan started) */
+	if (!valid || (block >= summary->nblocks) || PageIsNew(page))
+		return nerrs;
+
+	if (block == BTREE_METAPAGE)
+	{
+		BTMetaPageData *meta = BTPageGetMeta(page);
+
+		summary->has_meta = true;
+		summary->root = meta->btm_root;
+		summary->level = meta->btm_level;
+		summary->fastroot = meta->btm_fastroot;
+		summary->fastlevel = meta->btm_fastlevel;
+
+		return nerrs;
+	}
+
+	opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+	maxoff = PageGetMaxOffsetNumber(page);
+
+	p = &summary->pages[block];
+
+	p->seen = true;
+	p->prev = opaque->btpo_prev;
+	p->next = opaque->btpo_next;
+	p->flags = opaque->btpo_flags;
+
+	/* deleted pages don't have a level (and no keys we care about) */
+	if (P_ISDELETED(opaque))
+		return nerrs;
+
+	p->level = opaque->btpo.level;
+
+	if (!P_RIGHTMOST(opaque) && (maxoff >= P_HIKEY))
+	{
+		ItemId		lp = PageGetItemId(page, P_HIKEY);
+
+		p->highkey = hash_key((IndexTuple) PageGetItem(page, lp),
+							  ItemIdGetLength(lp));
+	}
+
+	if (P_ISLEAF(opaque))
+		return nerrs;
+
+	/* remember the downlinks in the children */
+	for (off = P_FIRSTDATAKEY(opaque); off <= maxoff; off++)
+	{
+		ItemId		lp = PageGetItemId(page, off);
+		IndexTuple	itup;
+		BlockNumber child;
+		btree_page_summary *c;
+
+		if (!ItemIdIsNormal(lp))
+			continue;
+
+		itup = (IndexTuple) PageGetItem(page, lp);
+		child = ItemPointerGetBlockNumber(&(itup->t_tid));
+
+		if ((child == BTREE_METAPAGE) || (child >= summary->nblocks))
+		{
+			report_issue("btree_downlink", block, off,
+						 "[%u:%u] downlink to invalid block %u (index has %u blocks)",
+						 block, off, child, summary->nblocks);
+			nerrs++;
+			continue;
+		}
+
+		c = &summary->pages[child];
+
+		if (c->ndownlinks < MAX_DOWNLINKS)
+			c->ndownlinks++;
+
+		c->parent = block;
+		c->downlink = hash_key(itup, ItemIdGetLength(lp));
+		c->minus_infinity = (off == P_FIRSTDATAKEY(opaque));
+	}
+
+	return nerrs;
+}
+
+uint32
+btree_summary_verify(Relation rel, btree_summary * summary)
+{
+	uint32		nerrs = 0;
+	BlockNumber block;
+
+	/* without a valid metapage we don't know where the tree starts */
+	if (!summary->has_meta)
+		return nerrs;
+
+	nerrs += verify_root(rel, summary);
+
+	for (block = BTREE_METAPAGE + 1; block < summary->nblocks; block++)
+	{
+		btree_page_summary *p = &summary->pages[block];
+
+		if (!p->seen || SummaryIsDeleted(p))
+			continue;
+
+		/* the level should not be above the root */
+		if ((summary->root != P_NONE) && (p->level > summary->level))
+		{
+			report_issue("btree_level", block, 0,
+						 "[%u] level %u is above the root level %u",
+						 block, p->level, summary->level);
+			nerrs++;
+			continue;
+		}
+
+		nerrs += verify_siblings(rel, summary, block);
+		nerrs += verify_downlink(rel, summary, block);
+	}
+
+	nerrs += verify_chains(rel, summary);
+
+	ereport(DEBUG1,
+			(errmsg("index \"%s\": verified structure of %u pages (%u issues)",
+					RelationGetRelationName(rel), summary->nblocks, nerrs)));
+
+	return nerrs;
+}
+
+/* FNV-1a hash of the key (i.e. the tuple without the header) */
+static uint32
+hash_key(IndexTuple itup, Size len)
+{
+	uint32		hash = FNV_OFFSET_32;
+	char	   *data = (char *) itup;
+	Size		i;
+
+	len = Min(len, IndexTupleSize(itup));
+
+	for (i = sizeof(IndexTupleData); i < len; i++)
+	{
+		hash ^= (unsigned char) data[i];
+		hash *= FNV_PRIME_32;
+	}
+
+	return hash;
+}
+
+/*
+ * Key of the downlink to the page. The first downlink on a non-leaf page
+ * has no key (minus infinity), in which case the key is the same as for
+ * the parent. Returns false if there's no key (the leftmost page on the
+ * level), or if it can't be determined.
+ */
+static bool
+downlink_key(btree_summary * summary, BlockNumber block, uint32 *key)
+{
+	int			i;
+
+	for (i = 0; i < BTREE_MAX_LEVELS; i++)
+	{
+		btree_page_summary *p = &summary->pages[block];
+
+		if (p->ndownlinks != 1)
+			return false;
+
+		if (!p->minus_infinity)
+		{
+			*key = p->downlink;
+			return true;
+		}
+
+		block = p->parent;
+	}
+
+	return false;
+}
+
+/*
+ * Left sibling the page's key range was split from, i.e. skipping half-dead
+ * pages (their downlink was already moved to the right sibling).
+ */
+static BlockNumber
+left_sibling(btree_summary * summary, BlockNumber block)
+{
+	BlockNumber prev = summary->pages[block].prev;
+	int			i;
+
+	for (i = 0; (i < BTREE_MAX_LEVELS) && (prev != P_NONE); i++)
+	{
+		btree_page_summary *l;
+
+		if ((prev == BTREE_METAPAGE) || (prev >= summary->nblocks))
+			return InvalidBlockNumber;
+
+		l = &summary->pages[prev];
+
+		if (!l->seen || SummaryIsDeleted(l))
+			return InvalidBlockNumber;
+
+		if (!SummaryIsHalfDead(l))
+			return prev;
+
+		prev = l->prev;
+	}
+
+	return (prev == P_NONE) ? P_NONE : InvalidBlockNumber;
+}
+
+/* root and fast root, as listed in the metapage */
+static uint32
+verify_root(Relation rel, btree_summary * summary)
+{
+	uint32		nerrs = 0;
+	btree_page_summary *r;
+
+	/* empty index */
+	if (summary->root == P_NONE)
+		return nerrs;
+
+	if ((summary->root == BTREE_METAPAGE) ||
+		(summary->root >= summary->nblocks))
+	{
+		report_issue("btree_root", BTREE_METAPAGE, 0,
+					 "[%u] root %u is not a valid block (index has %u blocks)",
+					 BTREE_METAPAGE, summary->root, summary->nblocks);
+		return ++nerrs;
+	}
+
+	r = &summary->pages[summary->root];
+
+	if (r->seen)
+	{
+		if (SummaryIsDeleted(r) || !(r->flags & BTP_ROOT))
+		{
+			report_issue("btree_root", summary->root, 0,
+						 "[%u] root page is deleted or not marked as root (flags %u)",
+						 summary->root, r->flags);
+			nerrs++;
+		}
+		else if (r->level != summary->level)
+		{
+			report_issue("btree_root", summary->root, 0,
+						 "[%u] root page has level %u, but metapage says %u",
+						 summary->root, r->level, summary->level);
+			nerrs++;
+		}
+
+		if ((r->prev != P_NONE) || (r->next != P_NONE))
+		{
+			report_issue("btree_root", summary->root, 0,
+						 "[%u] root page has siblings (%u, %u)",
+						 summary->root, r->prev, r->next);
+			nerrs++;
+		}
+	}
+
+	if (summary->fastroot == P_NONE)
+		return nerrs;
+
+	if ((summary->fastroot == BTREE_METAPAGE) ||
+		(summary->fastroot >= summary->nblocks))
+	{
+		report_issue("btree_fastroot", BTREE_METAPAGE, 0,
+					 "[%u] fast root %u is not a valid block (index has %u blocks)",
+					 BTREE_METAPAGE, summary->fastroot, summary->nblocks);
+		return ++nerrs;
+	}
+
+	if (summary->fastlevel > summary->level)
+	{
+		report_issue("btree_fastroot", BTREE_METAPAGE, 0,
+					 "[%u] fast root level %u is above the root level %u",
+					 BTREE_METAPAGE, summary->fastlevel, summary->level);
+		nerrs++;
+	}
+
+	r = &summary->pages[summary->fastroot];
+
+	if (r->seen && (SummaryIsDeleted(r) || (r->level != summary->fastlevel)))
+	{
+		report_issue("btree_fastroot", summary->fastroot, 0,
+					 "[%u] fast root page is deleted or has level %u, but metapage says %u",
+					 summary->fastroot, r->level, summary->fastlevel);
+		nerrs++;
+	}
+
+	return nerrs;
+}
+
+/* the siblings should point back to the page, and be at the same level */
+static uint32
+verify_siblings(Relation rel, btree_summary * summary, BlockNumber block)
+{
+	uint32		nerrs = 0;
+	btree_page_summary *p = &summary->pages[block];
+
+	if ((p->next != P_NONE) &&
+		((p->next == BTREE_METAPAGE) || (p->next >= summary->nblocks)))
+	{
+		report_issue("btree_sibling", block, 0,
+					 "[%u] right sibling %u is not a valid block",
+					 block, p->next);
+		nerrs++;
+	}
+	else if (p->next != P_NONE)
+	{
+		btree_page_summary *n = &summary->pages[p->next];
+
+		if (n->seen)
+		{
+			if (SummaryIsDeleted(n))
+			{
+				report_issue("btree_sibling", block, 0,
+							 "[%u] right sibling %u is deleted",
+							 block, p->next);
+				nerrs++;
+			}
+			else if (n->prev != block)
+			{
+				report_issue("btree_sibling", block, 0,
+							 "[%u] right sibling %u points back to %u",
+							 block, p->next, n->prev);
+				nerrs++;
+			}
+			else if (n->level != p->level)
+			{
+				report_issue("btree_sibling_level", block, 0,
+							 "[%u] right sibling %u is at level %u, not %u",
+							 block, p->next, n->level, p->level);
+				nerrs++;
+			}
+		}
+	}
+
+	if ((p->prev != P_NONE) &&
+		((p->prev == BTREE_METAPAGE) || (p->prev >= summary->nblocks)))
+	{
+		report_issue("btree_sibling", block, 0,
+					 "[%u] left sibling %u is not a valid block",
+					 block, p->prev);
+		nerrs++;
+	}
+	else if (p->prev != P_NONE)
+	{
+		btree_page_summary *l = &summary->pages[p->prev];
+
+		if (l->seen && !SummaryIsDeleted(l) && (l->next != block))
+		{
+			report_issue("btree_sibling", block, 0,
+						 "[%u] left sibling %u points to %u",
+						 block, p->prev, l->next);
+			nerrs++;
+		}
+	}
+
+	return nerrs;
+}
+
+/*
+ * Each page (except the root and half-dead pages) should have exactly one
+ * downlink, from a page one level up. The key of the downlink is the high
+ * key of the left sibling (it's copied to the parent when splitting it).
+ */
+static uint32
+verify_downlink(Relation rel, btree_summary * summary, BlockNumber block)
+{
+	uint32		nerrs = 0;
+	btree_page_summary *p = &summary->pages[block];
+	BlockNumber prev;
+	uint32		key;
+	bool		has_key;
+
+	if ((summary->root == P_NONE) || (block == summary->root) ||
+		SummaryIsHalfDead(p) || (p->level >= summary->level))
+		return nerrs;
+
+	if (p->ndownlinks == 0)
+	{
+		/*
+		 * The right half of an incomplete split has no downlink yet (the
+		 * left half is marked, the next insert finishes the split).
+		 */
+#ifdef BTP_INCOMPLETE_SPLIT
+		if ((p->prev != P_NONE) && (p->prev < summary->nblocks) &&
+			(summary->pages[p->prev].flags & BTP_INCOMPLETE_SPLIT))
+			return nerrs;
+#endif
+
+		report_issue("btree_downlink", block, 0,
+					 "[%u] page at level %u has no downlink",
+					 block, p->level);
+		return ++nerrs;
+	}
+
+	if (p->ndownlinks > 1)
+	{
+		report_issue("btree_downlink", block, 0,
+					 "[%u] page has %u downlinks",
+					 block, p->ndownlinks);
+		return ++nerrs;
+	}
+
+	/* the parent page may have issues, in which case it was not summarized */
+	if (!summary->pages[p->parent].seen)
+		return nerrs;
+
+	if (summary->pages[p->parent].level != p->level + 1)
+	{
+		report_issue("btree_downlink_level", block, 0,
+					 "[%u] downlink from page %u at level %u (page level %u)",
+					 block, p->parent, summary->pages[p->parent].level,
+					 p->level);
+		return ++nerrs;
+	}
+
+	prev = left_sibling(summary, block);
+	has_key = downlink_key(summary, block, &key);
+
+	/* left sibling unknown (e.g. with issues, or an invalid link) */
+	if (prev == InvalidBlockNumber)
+		return nerrs;
+
+	if ((prev == P_NONE) && has_key)
+	{
+		report_issue("btree_downlink_key", block, 0,
+					 "[%u] leftmost page at level %u has a downlink key",
+					 block, p->level);
+		nerrs++;
+	}
+	else if ((prev != P_NONE) && has_key &&
+			 (summary->pages[prev].highkey != key))
+	{
+		report_issue("btree_downlink_key", block, 0,
+					 "[%u] downlink key does not match high key of the left sibling %u",
+					 block, prev);
+		nerrs++;
+	}
+
+	return nerrs;
+}
+
+/*
+ * Walk the sibling links on each level, starting at the leftmost page, to
+ * detect cycles and pages not reachable through the links.
+ */
+static uint32
+verify_chains(Relation rel, btree_summary * summary)
+{
+	uint32		nerrs = 0;
+	BlockNumber block;
+	bool		complete = true;
+	uint8	   *visited;
+	int			nleftmost[BTREE_MAX_LEVELS];
+	int			maxlevel = -1;
+	int			level;
+
+	memset(nleftmost, 0, sizeof(nleftmost));
+
+	/* one bit per page, so at most 512MB */
+	visited = (uint8 *) palloc0(summary->nblocks / 8 + 1);
+
+	for (block = BTREE_METAPAGE + 1; block < summary->nblocks; block++)
+	{
+		btree_page_summary *p = &summary->pages[block];
+		BlockNumber cur;
+
+		if (!p->seen || SummaryIsDeleted(p) || (p->prev != P_NONE))
+			continue;
+
+		if (p->level < BTREE_MAX_LEVELS)
+		{
+			nleftmost[p->level]++;
+			maxlevel = Max(maxlevel, (int) p->level);
+		}
+
+		for (cur = block; cur != P_NONE; cur = summary->pages[cur].next)
+		{
+			/* invalid links and pages with issues were reported already */
+			if ((cur == BTREE_METAPAGE) || (cur >= summary->nblocks) ||
+				!summary->pages[cur].seen)
+			{
+				complete = false;
+				break;
+			}
+
+			if (visited[cur / 8] & (1 << (cur % 8)))
+			{
+				report_issue("btree_cycle", cur, 0,
+							 "[%u] reached twice through sibling links at level %u (starting at %u)",
+							 cur, p->level, block);
+				nerrs++;
+				complete = false;
+				break;
+			}
+
+			visited[cur / 8] |= (1 << (cur % 8));
+		}
+	}
+
+	for (level = 0; level <= maxlevel; level++)
+	{
+		if (nleftmost[level] > 1)
+		{
+			report_issue("btree_leftmost", InvalidBlockNumber, 0,
+						 "level %d has %d leftmost pages",
+						 level, nleftmost[level]);
+			nerrs++;
+		}
+	}
+
+	/* with broken chains, we'd report all the pages after the break */
+	for (block = BTREE_METAPAGE + 1; complete && (block < summary->nblocks); block++)
+	{
+		btree_page_summary *p = &summary->pages[block];
+
+		if (!p->seen || SummaryIsDeleted(p))
+			continue;
+
+		if (!(visited[block / 8] & (1 << (block % 8))))
+		{
+			report_issue("btree_unreachable", block, 0,
+						 "[%u] page at level %u is not reachable through the sibling links",
+						 block, p->level);
+			nerrs++;
+		}
+	}
+
+	pfree(visited);
+
+	return nerrs;
+}
+
+btree_splits *
+btree_splits_init(BlockNumber nblocks)
+{
+	btree_splits *splits;
+	Size		size = mul_size(Max(1, nblocks), sizeof(BlockNumber));
+
+	splits = (btree_splits *) palloc0(sizeof(btree_splits));
+
+	splits->nblocks = nblocks;
+
+	/* large indexes may need more than 1GB (4B per page) */
+#if (PG_VERSION_NUM >= 90500)
+	splits->links = (BlockNumber *)
+		MemoryContextAllocExtended(CurrentMemoryContext, size,
+								   MCXT_ALLOC_HUGE | MCXT_ALLOC_NO_OOM);
+#else
+	if (AllocSizeIsValid(size))
+		splits->links = (BlockNumber *) palloc(size);
+#endif
+
+	if (splits->links == NULL)
+	{
+		pfree(splits);
+		return NULL;
+	}
+
+	/* LINK_NOT_SCANNED is all ones */
+	memset(splits->links, 0xFF, size);
+
+	return splits;
+}
+
+void
+btree_splits_free(btree_splits * splits)
+{
+	pfree(splits->links);
+	pfree(splits);
+}
+
+/*
+ * A leaf page linked to a page scanned as deleted (or new) means the page
+ * was reused by a split after we scanned it, so the items moved to it by
+ * the split were not seen. A leaf page linked from a page scanned with a
+ * different right link means that page was split after we scanned it, so
+ * the moved items were seen twice. Pages added after the scan started may
+ * have items seen twice too.
+ *
+ * The page deleted between the two siblings may look like a split too, but
+ * that only makes us more careful.
+ */
+void
+btree_splits_add_page(btree_splits * splits, PageHeader header,
+					  BlockNumber block, bool valid)
+{
+	Page		page = (Page) header;
+	BTPageOpaque opaque;
+	BlockNumber prev;
+	BlockNumber next;
+
+	if (block >= splits->nblocks)
+		splits->duplicated = true;
+
+	if (!valid || (block == BTREE_METAPAGE))
+		return;
+
+	if (PageIsNew(page))
+	{
+		if (block < splits->nblocks)
+			splits->links[block] = LINK_RECYCLED;
+		return;
+	}
+
+	opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+
+	if (P_ISDELETED(opaque))
+	{
+		if (block < splits->nblocks)
+			splits->links[block] = LINK_RECYCLED;
+		return;
+	}
+
+	if (!P_ISLEAF(opaque))
+		return;
+
+	prev = opaque->btpo_prev;
+	next = opaque->btpo_next;
+
+	if ((next != P_NONE) && (next < splits->nblocks) &&
+		(splits->links[next] == LINK_RECYCLED))
+		splits->hidden = true;
+
+	if ((prev != P_NONE) && (prev < splits->nblocks) &&
+		(splits->links[prev] != LINK_NOT_SCANNED) &&
+		(splits->links[prev] != LINK_RECYCLED) &&
+		(splits->links[prev] != block))
+		splits->duplicated = true;
+
+	if (block < splits->nblocks)
+		splits->links[block] = next;
+}
@@ -0,0 +1,127 @@
+#ifndef BTREE_STRUCTURE_CHECK_H
+#define BTREE_STRUCTURE_CHECK_H
+
+#include "postgres.h"
+#include "access/nbtree.h"
+#include "utils/rel.h"
+
+/*
+ * Summaries of b-tree pages, collected during the sequential scan of the
+ * index and used to verify the structure of the whole tree afterwards
+ * (i.e. without descending the tree, which would mean random I/O).
+ *
+ * For each page we remember the sibling links, level and flags, a hash of
+ * the high key, and the downlink pointing to the page from its parent (the
+ * parent and a hash of the downlink key). That allows checking the root
+ * (as listed in the metapage), the sibling links (including cycles), that
+ * each page has exactly one downlink from the level above, and that the
+ * downlink key matches the high key of the left sibling.
+ *
+ * The structure is only consistent when the index can't be modified while
+ * it's scanned, so the caller must hold a lock blocking writes.
+ */
+typedef struct btree_page_summary
+{
+	BlockNumber prev;			/* left sibling */
+	BlockNumber next;			/* right sibling */
+	BlockNumber parent;			/* page with the downlink (or InvalidBlockNumber) */
+	uint32		level;			/* tree level (0 : leaf) */
+	uint32		highkey;		/* hash of the high key (if not rightmost) */
+	uint32		downlink;		/* hash of the downlink key */
+	uint16		flags;			/* btpo_flags */
+	uint8		ndownlinks;		/* number of downlinks (saturated) */
+	bool		seen;			/* summarized (valid page, no issues) */
+	bool		minus_infinity; /* downlink is the first one on the parent */
+}			btree_page_summary;
+
+typedef struct btree_summary
+{
+	BlockNumber nblocks;		/* number of pages of the index */
+
+	/* contents of the metapage */
+	bool		has_meta;
+	BlockNumber root;
+	uint32		level;
+	BlockNumber fastroot;
+	uint32		fastlevel;
+
+	btree_page_summary *pages;
+}			btree_summary;
+
+/* Allocates summaries for an index with nblocks pages.
+ *
+ * Returns the summary, or NULL if there's not enough memory for it.
+ */
+btree_summary *btree_summary_init(BlockNumber nblocks);
+
+/* Adds a page to the summary (called by the page checks).
+ *
+ * - summary : summary of the index
+ * - header : the page
+ * - block : block number of the page
+ * - valid : the page checks found no issues
+ *
+ * Pages with issues are not summarized, the structure checks involving
+ * them are skipped (the issues were reported already).
+ *
+ * Returns number of issues found (downlinks to invalid blocks).
+ */
+uint32		btree_summary_add_page(btree_summary * summary, PageHeader header,
+					   BlockNumber block, bool valid);
+
+/* Verifies structure of the tree from the page summaries.
+ *
+ * - rel : the index (for messages)
+ * - summary : summaries of all the pages
+ *
+ * Returns number of issues found.
+ */
+uint32		btree_summary_verify(Relation rel, btree_summary * summary);
+
+/* Releases the summary. */
+void		btree_summary_free(btree_summary * summary);
+
+/*
+ * Concurrent page splits observed by a scan of an index that is modified
+ * while it's scanned (snapshot mode). A split moves items from the page to
+ * its new right sibling, which is either a new page at the end of the index
+ * or a recycled (deleted) page. If the scan already passed the new right
+ * sibling (as a deleted page) but not the split page, the moved items are
+ * hidden from the scan. If it passed the split page but not the new right
+ * sibling, it sees the moved items twice.
+ *
+ * For each scanned leaf page we remember the right link (and which pages
+ * were deleted or new), so that both cases can be recognized from the
+ * sibling links of the pages scanned later.
+ */
+typedef struct btree_splits
+{
+	BlockNumber nblocks;		/* number of pages when the scan started */
+	BlockNumber *links;			/* right links of the scanned leaf pages */
+	bool		hidden;			/* items may be hidden from the scan */
+	bool		duplicated;		/* items may have been seen twice */
+}			btree_splits;
+
+/* Allocates the links for an index with nblocks pages.
+ *
+ * Returns the state, or NULL if there's not enough memory for it.
+ */
+btree_splits *btree_splits_init(BlockNumber nblocks);
+
+/* Adds a page to the links (called by the page checks).
+ *
+ * - splits : links of the scanned pages
+ * - header : the page
+ * - block : block number of the page
+ * - valid : the page checks found no issues
+ *
+ * The pages have to be added in the order of block numbers (pages added
+ * after the scan started last). Pages with issues are ignored.
+ */
+void		btree_splits_add_page(btree_splits * splits, PageHeader header,
+					  BlockNumber block, bool valid);
+
+/* Releases the state. */
+void		btree_splits_free(btree_splits * splits);
+
+#endif							/* BTREE_STRUCTURE_CHECK_H */
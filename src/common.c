@@ -1,4 +1,16 @@
 #include "common.h"
+#include "issues.h"
+
+#include "access/tupmacs.h"
+#include "storage/bufmgr.h"
+#include "utils/guc.h"
+
+#if (PG_VERSION_NUM >= 90300)
+#include "storage/checksum.h"
+#endif
+
+bool		check_checksums = false;
+int			check_level = CHECK_LEVEL_ATTRIBUTES;
 
 /*
  * check_page_header
@@ -10,7 +22,7 @@
  *
  *	pd_lsn		- identifies xlog record for last change to this page.
  *	pd_tli		- ditto. (up to 9.2)
- *	pd_checksum - page checksum, if set (since 9.3)
+ *	pd_checksum - page checksum, if set (since 9.3, see check_checksums)
  *	pd_flags	- flag bits.
  *	pd_lower	- offset to start of free space.
  *	pd_upper	- offset to end of free space.
@@ -36,9 +48,9 @@ check_page_header(PageHeader header, BlockNumber block)
 	/* check the page size (should be BLCKSZ) */
 	if (PageGetPageSize(header) != BLCKSZ)
 	{
-		ereport(WARNING,
-				(errmsg("[%d] invalid page size %d (%d)", block,
-						(int) PageGetPageSize(header), BLCKSZ)));
+		report_issue("page_size", block, 0,
+					 "[%d] invalid page size %d (%d)", block,
+					 (int) PageGetPageSize(header), BLCKSZ);
 		++nerrs;
 	}
 
@@ -51,17 +63,17 @@ check_page_header(PageHeader header, BlockNumber block)
 	if ((PageGetPageLayoutVersion(header) < 0) ||
 		(PageGetPageLayoutVersion(header) > 4))
 	{
-		ereport(WARNING,
-				(errmsg("[%d] invalid page layout version %d",
-						block, PageGetPageLayoutVersion(header))));
+		report_issue("page_layout_version", block, 0,
+					 "[%d] invalid page layout version %d",
+					 block, PageGetPageLayoutVersion(header));
 		++nerrs;
 	}
 	else if (PageGetPageLayoutVersion(header) != 4)
 	{
 		/* obsolete page version, so no further checks */
-		ereport(WARNING,
-				(errmsg("[%d] invalid page layout version %d",
-						block, PageGetPageLayoutVersion(header))));
+		report_issue("page_layout_version", block, 0,
+					 "[%d] invalid page layout version %d",
+					 block, PageGetPageLayoutVersion(header));
 
 		/*
 		 * Increment the counter, to inform caller that this page does not
@@ -77,8 +89,8 @@ check_page_header(PageHeader header, BlockNumber block)
 	if (PageIsNew(header))
 	{
 		/* obsolete page version, so no further checks */
-		ereport(WARNING,
-				(errmsg("[%d] page is new (pd_upper=0)", block)));
+		report_issue("page_new", block, 0,
+					 "[%d] page is new (pd_upper=0)", block);
 
 		/*
 		 * We intentionally do not increment the counter here, as new pages
@@ -91,6 +103,27 @@ check_page_header(PageHeader header, BlockNumber block)
 		return nerrs;
 	}
 
+	/*
+	 * Verify the checksum while the page is in cache anyway. The page is a
+	 * private copy, so it's fine that pg_checksum_page temporarily resets
+	 * pd_checksum. A mismatch is reported, but the page is still checked,
+	 * as the other issues may help to find out what happened to it.
+	 */
+#if (PG_VERSION_NUM >= 90300)
+	if (check_checksums)
+	{
+		uint16		checksum = pg_checksum_page((char *) header, block);
+
+		if (checksum != header->pd_checksum)
+		{
+			report_issue("page_checksum", block, 0,
+						 "[%d] checksum mismatch (computed %u, stored %u)",
+						 block, checksum, header->pd_checksum);
+			++nerrs;
+		}
+	}
+#endif
+
 	/*
 	 * All the pointers should be positive (greater than PageHeaderData) and
 	 * less than BLCKSZ.
@@ -98,48 +131,48 @@ check_page_header(PageHeader header, BlockNumber block)
 	if ((header->pd_lower < offsetof(PageHeaderData, pd_linp)) ||
 		(header->pd_lower > BLCKSZ))
 	{
-		ereport(WARNING,
-				(errmsg("[%d] lower %d not between %d and %d", block,
-						header->pd_lower,
-						(int) offsetof(PageHeaderData, pd_linp), BLCKSZ)));
+		report_issue("page_lower", block, 0,
+					 "[%d] lower %d not between %d and %d", block,
+					 header->pd_lower,
+					 (int) offsetof(PageHeaderData, pd_linp), BLCKSZ);
 		++nerrs;
 	}
 
 	if ((header->pd_upper < offsetof(PageHeaderData, pd_linp)) ||
 		(header->pd_upper > BLCKSZ))
 	{
-		ereport(WARNING,
-				(errmsg("[%d] upper %d not between %d and %d", block,
-						header->pd_upper,
-						(int) offsetof(PageHeaderData, pd_linp), BLCKSZ)));
+		report_issue("page_upper", block, 0,
+					 "[%d] upper %d not between %d and %d", block,
+					 header->pd_upper,
+					 (int) offsetof(PageHeaderData, pd_linp), BLCKSZ);
 		++nerrs;
 	}
 
 	if ((header->pd_special < offsetof(PageHeaderData, pd_linp)) ||
 		(header->pd_special > BLCKSZ))
 	{
-		ereport(WARNING,
-				(errmsg("[%d] special %d not between %d and %d", block,
-						header->pd_special,
-						(int) offsetof(PageHeaderData, pd_linp), BLCKSZ)));
+		report_issue("page_special", block, 0,
+					 "[%d] special %d not between %d and %d", block,
+					 header->pd_special,
+					 (int) offsetof(PageHeaderData, pd_linp), BLCKSZ);
 		++nerrs;
 	}
 
 	/* upper should be >= lower */
 	if (header->pd_lower > header->pd_upper)
 	{
-		ereport(WARNING,
-				(errmsg("[%d] lower > upper (%d > %d)",
-						block, header->pd_lower, header->pd_upper)));
+		report_issue("page_lower_upper", block, 0,
+					 "[%d] lower > upper (%d > %d)",
+					 block, header->pd_lower, header->pd_upper);
 		++nerrs;
 	}
 
 	/* special should be >= upper */
 	if (header->pd_upper > header->pd_special)
 	{
-		ereport(WARNING,
-				(errmsg("[%d] upper > special (%d > %d)",
-						block, header->pd_upper, header->pd_special)));
+		report_issue("page_upper_special", block, 0,
+					 "[%d] upper > special (%d > %d)",
+					 block, header->pd_upper, header->pd_special);
 		++nerrs;
 	}
 
@@ -148,16 +181,15 @@ check_page_header(PageHeader header, BlockNumber block)
 	 * replaced that with a checksum, so be careful when reading and
 	 * interpreting that value.
 	 *
-	 * We only check the timeline here, because we only deal with page headers
-	 * here. Checksums are verified elsewhere.
+	 * We only check the timeline here, the checksum was verified above.
 	 */
 #if (PG_VERSION_NUM < 90300)
 	/* The timeline must not be greater than the current one. */
 	if (header->pd_tli > ThisTimeLineID)
 	{
-		ereport(WARNING,
-				(errmsg("[%d] invalid timeline %u (current %u)",
-						block, header->pd_tli, ThisTimeLineID)));
+		report_issue("page_timeline", block, 0,
+					 "[%d] invalid timeline %u (current %u)",
+					 block, header->pd_tli, ThisTimeLineID);
 		++nerrs;
 	}
 #endif
@@ -167,11 +199,247 @@ check_page_header(PageHeader header, BlockNumber block)
 	 */
 	if ((header->pd_flags & PD_VALID_FLAG_BITS) != header->pd_flags)
 	{
-		ereport(WARNING,
-				(errmsg("[%d] page has invalid flags set %u",
-						block, header->pd_flags)));
+		report_issue("page_flags", block, 0,
+					 "[%d] page has invalid flags set %u",
+					 block, header->pd_flags);
 		++nerrs;
 	}
 
 	return nerrs;
 }
+
+/* maximum number of line pointers on a page */
+#define MaxPageItems	(BLCKSZ / sizeof(ItemIdData))
+
+/* storage of an item on the page, i.e. [off, end) */
+typedef struct item_extent
+{
+	uint16		off;
+	uint16		end;
+	uint16		item;			/* index of the line pointer */
+}			item_extent;
+
+/* the extents and the sort buffer, for all line pointers of a page */
+#define ExtentsBufferSize	(2 * MaxPageItems * sizeof(item_extent))
+
+static void sort_item_extents(item_extent * extents, item_extent * tmp, int n);
+
+/*
+ * check_page_items
+ *		Detect overlapping items in a single pass over sorted extents.
+ *
+ * After sorting the extents by offset, an item overlaps with an earlier
+ * one iff it starts before the largest end seen so far. It's reported
+ * against the item with that end. The gaps between the items and the
+ * free space are only accounted for (DEBUG1), as gaps are perfectly
+ * valid (e.g. alignment padding).
+ *
+ * The extents are collected in a buffer allocated with the plan, as they
+ * would need about 24kB of stack with 8kB pages (and the offline checks
+ * call this from multiple threads).
+ */
+uint32
+check_page_items(PageHeader header, BlockNumber block, attribute_plan * plan)
+{
+	item_extent *extents = plan->extents;
+	item_extent *tmp = plan->extents + MaxPageItems;
+	int			nitems = PageGetMaxOffsetNumber((Page) header);
+	int			nextents = 0;
+	int			i;
+	uint32		nerrs = 0;
+	bool		sorted = true;
+	item_extent *last = NULL;	/* extent with the largest end so far */
+	int			used = 0;
+	int			gaps = 0;
+
+	nitems = Min(nitems, (int) MaxPageItems);
+
+	/*
+	 * Collect the items with storage. Walk the line pointers backwards, as
+	 * the items are usually allocated from the end of the page, so the
+	 * extents are often sorted already.
+	 */
+	for (i = nitems - 1; i >= 0; i--)
+	{
+		ItemId		lp = &header->pd_linp[i];
+		item_extent *extent;
+
+		/*
+		 * Only LP_NORMAL and LP_DEAD items may have storage. Skip items
+		 * without storage (invalid lengths are reported elsewhere).
+		 */
+		if (((lp->lp_flags != LP_NORMAL) && (lp->lp_flags != LP_DEAD)) ||
+			(lp->lp_len == 0))
+			continue;
+
+		extent = &extents[nextents++];
+
+		extent->off = lp->lp_off;
+		extent->end = lp->lp_off + lp->lp_len;
+		extent->item = i;
+
+		if ((nextents > 1) && (extent->off < extents[nextents - 2].off))
+			sorted = false;
+	}
+
+	if (!sorted)
+		sort_item_extents(extents, tmp, nextents);
+
+	for (i = 0; i < nextents; i++)
+	{
+		item_extent *extent = &extents[i];
+
+		if ((last != NULL) && (extent->off < last->end))
+		{
+			report_issue("item_overlap", block, (extent->item + 1),
+						 "[%d:%d] intersects with [%d:%d] (%d,%d) vs. (%d,%d)",
+						 block, (extent->item + 1), block, (last->item + 1),
+						 extent->off, extent->end, last->off, last->end);
+			++nerrs;
+		}
+		else if ((last != NULL) && (extent->off > MAXALIGN(last->end)))
+			gaps += extent->off - MAXALIGN(last->end);
+
+		used += extent->end - extent->off;
+
+		if ((last == NULL) || (extent->end > last->end))
+			last = extent;
+	}
+
+	ereport(DEBUG1,
+			(errmsg("[%d] %d items with storage, %d bytes used, %d bytes in gaps, %d bytes free",
+					block, nextents, used, gaps,
+					(int) header->pd_upper - (int) header->pd_lower)));
+
+	return nerrs;
+}
+
+/*
+ * Sort the extents by offset, using radix sort (two 8-bit digits, enough
+ * for offsets up to 64kB). Linear in the number of items, and only needs
+ * a second buffer of the same size.
+ */
+static void
+sort_item_extents(item_extent * extents, item_extent * tmp, int n)
+{
+	int			shift;
+
+	for (shift = 0; shift < 16; shift += 8)
+	{
+		int			counts[256];
+		int			i;
+		item_extent *src = (shift == 0) ? extents : tmp;
+		item_extent *dst = (shift == 0) ? tmp : extents;
+
+		memset(counts, 0, sizeof(counts));
+
+		for (i = 0; i < n; i++)
+			counts[(src[i].off >> shift) & 0xFF]++;
+
+		/* prefix sums (starting positions of the buckets) */
+		for (i = 1; i < 256; i++)
+			counts[i] += counts[i - 1];
+
+		/* going backwards keeps the sort stable */
+		for (i = n - 1; i >= 0; i--)
+			dst[--counts[(src[i].off >> shift) & 0xFF]] = src[i];
+	}
+}
+
+/*
+ * attribute_plan_build
+ *		Precompute the offsets of the leading fixed-width attributes.
+ *
+ * The alignment is computed relative to the start of the data, which is
+ * equivalent to aligning the absolute offsets as long as the data starts
+ * at a MAXALIGN-ed offset (the checks don't use the plan otherwise).
+ */
+attribute_plan *
+attribute_plan_build(TupleDesc tupdesc)
+{
+	attribute_plan *plan;
+	int			j;
+	int			off = 0;
+
+	plan = (attribute_plan *) palloc0(sizeof(attribute_plan));
+
+	plan->extents = (item_extent *) palloc(ExtentsBufferSize);
+
+	if (tupdesc == NULL)
+		return plan;
+
+	plan->natts = tupdesc->natts;
+
+	for (j = 0; j < tupdesc->natts; j++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, j);
+
+		if (attr->attlen <= 0)
+			break;
+
+		off = att_align_nominal(off, attr->attalign);
+		off += attr->attlen;
+	}
+
+	plan->nfixed = j;
+	plan->fixed_size = off;
+
+	return plan;
+}
+
+void
+attribute_plan_free(attribute_plan * plan)
+{
+	pfree(plan->extents);
+	pfree(plan);
+}
+
+/*
+ * prefetch_blocks
+ *		Keep the I/O for the next few blocks in flight.
+ *
+ * The page loops read the blocks one by one, so without prefetching each
+ * read waits for the I/O to complete (which is expensive on storage with
+ * high latency). Called before reading each block, so the prefetch window
+ * moves along with the loop.
+ */
+BlockNumber
+prefetch_blocks(Relation rel, BlockNumber blkno, BlockNumber blockTo,
+				BlockNumber prefetched, int distance)
+{
+#if defined(USE_PREFETCH) && !defined(PG_CHECK_OFFLINE)
+	BlockNumber target;
+
+	if (distance <= 0)
+		return prefetched;
+
+	target = (BlockNumber) Min((uint64) blkno + distance, (uint64) blockTo);
+
+	if (prefetched < blkno)
+		prefetched = blkno;
+
+	for (; prefetched < target; prefetched++)
+		PrefetchBuffer(rel, MAIN_FORKNUM, prefetched);
+#endif
+
+	return prefetched;
+}
+
+/*
+ * check_debug_enabled
+ *		Decide which variant of the per-tuple checks to run.
+ *
+ * Evaluated once per page, so it's fine to look at the GUCs directly. The
+ * offline checks never print DEBUG messages.
+ */
+bool
+check_debug_enabled(void)
+{
+#if defined(PG_CHECK_OFFLINE)
+	return false;
+#elif (PG_VERSION_NUM >= 140000)
+	return message_level_is_interesting(DEBUG2);
+#else
+	return (log_min_messages <= DEBUG2) || (client_min_messages <= DEBUG2);
+#endif
+}
@@ -4,6 +4,119 @@
 #include "postgres.h"
 #include "access/heapam.h"
 
+/* attributes of a tuple descriptor (available since 10, and in later minors) */
+#ifndef TupleDescAttr
+#define TupleDescAttr(tupdesc, i)	((tupdesc)->attrs[(i)])
+#endif
+
+/*
+ * Verify data checksums of the pages in check_page_header (9.3+)? Set by
+ * the caller, i.e. only when the cluster has data checksums enabled.
+ */
+extern bool check_checksums;
+
+/*
+ * How deep the page checks go. Each level includes the checks of the
+ * lower levels, so the cheaper levels skip the per-tuple work, e.g. the
+ * line pointers level does not touch the tuples at all (so it runs at
+ * about the speed of reading the pages).
+ */
+typedef enum CheckLevel
+{
+	CHECK_LEVEL_HEADER,			/* page headers (and special space) */
+	CHECK_LEVEL_LINE_POINTERS,	/* line pointers, overlapping items */
+	CHECK_LEVEL_TUPLES,			/* tuple headers */
+	CHECK_LEVEL_ATTRIBUTES		/* all attributes of all tuples */
+}			CheckLevel;
+
+/* Level of the page checks (CheckLevel), set by the caller. */
+extern int	check_level;
+
+/* Checks the page header (and the checksum, see check_checksums).
+ *
+ * - header : the page (a private copy, modified while computing checksum)
+ * - block : block number (used to compute the checksum)
+ *
+ * Returns number of issues found.
+ */
 uint32		check_page_header(PageHeader header, BlockNumber block);
 
+/* Checks that storage of the items on the page does not overlap.
+ *
+ * - header : the page
+ * - block : block number (for messages)
+ * - plan : plan of the checks (provides the buffer for the extents)
+ *
+ * The extents of items with storage are sorted by offset, so this needs a
+ * single pass over them (instead of comparing all pairs of items). Each
+ * overlapping item is reported once.
+ *
+ * Returns number of issues found.
+ */
+uint32		check_page_items(PageHeader header, BlockNumber block,
+				 struct attribute_plan *plan);
+
+/*
+ * Plan of the attribute checks of a relation, built once before the page
+ * loop. The leading fixed-width attributes are at the same offsets in all
+ * tuples without NULLs (the data starts at a MAXALIGN-ed offset), so the
+ * checks can skip them with a single length check. When all attributes are
+ * fixed-width, that's the only check needed for such tuples. Only the
+ * remaining (variable-length) attributes go through the per-attribute
+ * checks.
+ */
+typedef struct attribute_plan
+{
+	int			natts;			/* number of attributes */
+	int			nfixed;			/* leading fixed-width attributes */
+	int			fixed_size;		/* end of the leading fixed-width attributes */
+	struct toast_check *toast;	/* collects TOAST pointers (may be NULL) */
+	struct item_extent *extents;	/* buffer of check_page_items */
+}			attribute_plan;
+
+/* Builds the attribute check plan for a tuple descriptor.
+ *
+ * - tupdesc : descriptor of the heap or index tuples (NULL if not known,
+ *   i.e. in the offline checks)
+ *
+ * Returns the plan (palloc'd).
+ */
+attribute_plan *attribute_plan_build(TupleDesc tupdesc);
+
+/* Frees the plan (including the buffers). */
+void		attribute_plan_free(attribute_plan * plan);
+
+/*
+ * The per-tuple checks are compiled in a verbose and a lean variant, by
+ * inlining the same code with a constant "verbose" flag.
+ */
+#ifndef pg_attribute_always_inline
+#define pg_attribute_always_inline inline
+#endif
+
+/* Are DEBUG messages of the per-tuple checks sent anywhere?
+ *
+ * Returns true if the DEBUG2 messages would be sent to the client or the
+ * server log, i.e. the checks need to run the verbose variant.
+ */
+bool		check_debug_enabled(void);
+
+/* Requests prefetch of blocks following the current one.
+ *
+ * - rel : relation being checked
+ * - blkno : block about to be read
+ * - blockTo : block after the last one to check
+ * - prefetched : first block not prefetched yet
+ * - distance : number of blocks to keep prefetched ahead of blkno
+ *
+ * Blocks [blkno, blkno + distance) are prefetched, except those already
+ * requested earlier. Does nothing without prefetch support (USE_PREFETCH)
+ * or when the distance is 0.
+ *
+ * Returns the new value of prefetched.
+ */
+BlockNumber prefetch_blocks(Relation rel, BlockNumber blkno,
+				BlockNumber blockTo, BlockNumber prefetched,
+				int distance);
+
 #endif
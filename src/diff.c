@@ -0,0 +1,247 @@
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+
+#include "diff.h"
+
+/* number of columns of the result (see pg_check_table_diff) */
+#define DIFF_NATTS	7
+
+diff_export *pgcheck_diff = NULL;
+
+static diff_pending *diff_get_pending(diff_export * diff, Oid indexid);
+static void diff_put_range(diff_export * diff, diff_record * range);
+static void diff_flush_file(diff_export * diff);
+
+diff_export *
+diff_init_srf(FunctionCallInfo fcinfo)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext oldcontext;
+	diff_export *diff;
+	TupleDesc	tupdesc;
+
+	if ((rsinfo == NULL) || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tupdesc->natts != DIFF_NATTS)
+		elog(ERROR, "incorrect number of output arguments");
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	diff = (diff_export *) palloc0(sizeof(diff_export));
+
+	diff->mcxt = rsinfo->econtext->ecxt_per_query_memory;
+	diff->tupdesc = CreateTupleDescCopy(tupdesc);
+	diff->tupstore = tuplestore_begin_heap(true, false, work_mem);
+	diff->fd = -1;
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = diff->tupstore;
+	rsinfo->setDesc = diff->tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return diff;
+}
+
+diff_export *
+diff_init_file(const char *path, Oid heapid)
+{
+	diff_export *diff;
+	char		header[16];
+
+	diff = (diff_export *) palloc0(sizeof(diff_export));
+
+	diff->mcxt = CurrentMemoryContext;
+	diff->path = pstrdup(path);
+	diff->buffer = (diff_record *) palloc(DIFF_FILE_BUFFER * sizeof(diff_record));
+
+#if (PG_VERSION_NUM >= 110000)
+	diff->fd = OpenTransientFile(diff->path,
+								 O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY);
+#else
+	diff->fd = OpenTransientFile(diff->path,
+								 O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY,
+								 S_IRUSR | S_IWUSR);
+#endif
+
+	if (diff->fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", diff->path)));
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, DIFF_FILE_MAGIC, 8);
+	memcpy(header + 8, &heapid, sizeof(Oid));
+
+	if (write(diff->fd, header, sizeof(header)) != sizeof(header))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", diff->path)));
+
+	return diff;
+}
+
+void
+diff_set_index(Oid indexid)
+{
+	if (pgcheck_diff != NULL)
+		pgcheck_diff->indexid = indexid;
+}
+
+/*
+ * The range continues on the next page only if it ended at the last item
+ * of its page, otherwise the items after it would seem to be in the range.
+ */
+void
+diff_add(diff_export * diff, Oid indexid, BlockNumber block,
+		 OffsetNumber offnum, OffsetNumber maxoff, DiffKind kind)
+{
+	diff_pending *pending = diff_get_pending(diff, indexid);
+	diff_record *range = &pending->range;
+
+	/* extend the range with the next item (or the first item on next page) */
+	if ((range->nitems > 0) && (range->kind == kind) &&
+		(((block == range->blockTo) && (offnum == range->offsetTo + 1)) ||
+		 ((block == range->blockTo + 1) && (offnum == FirstOffsetNumber) &&
+		  (range->offsetTo == pending->maxoff))))
+	{
+		range->blockTo = block;
+		range->offsetTo = offnum;
+		range->nitems++;
+		pending->maxoff = maxoff;
+		return;
+	}
+
+	if (range->nitems > 0)
+		diff_put_range(diff, range);
+
+	range->kind = kind;
+	range->blockFrom = range->blockTo = block;
+	range->offsetFrom = range->offsetTo = offnum;
+	range->nitems = 1;
+	pending->maxoff = maxoff;
+}
+
+void
+diff_finish(diff_export * diff)
+{
+	int			i;
+
+	for (i = 0; i < diff->npending; i++)
+	{
+		if (diff->pending[i].range.nitems > 0)
+			diff_put_range(diff, &diff->pending[i].range);
+	}
+
+	diff->npending = 0;
+
+	if (diff->fd < 0)
+		return;
+
+	diff_flush_file(diff);
+
+	if (CloseTransientFile(diff->fd) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not close file \"%s\": %m", diff->path)));
+
+	diff->fd = -1;
+}
+
+/* pending range of the index (a new empty one, if there's none yet) */
+static diff_pending *
+diff_get_pending(diff_export * diff, Oid indexid)
+{
+	int			i;
+
+	for (i = 0; i < diff->npending; i++)
+	{
+		if (diff->pending[i].range.indexid == indexid)
+			return &diff->pending[i];
+	}
+
+	if (diff->npending == diff->maxpending)
+	{
+		diff->maxpending = (diff->maxpending == 0) ? 8 : 2 * diff->maxpending;
+
+		if (diff->pending == NULL)
+			diff->pending = (diff_pending *)
+				MemoryContextAlloc(diff->mcxt, diff->maxpending * sizeof(diff_pending));
+		else
+			diff->pending = (diff_pending *)
+				repalloc(diff->pending, diff->maxpending * sizeof(diff_pending));
+	}
+
+	memset(&diff->pending[diff->npending], 0, sizeof(diff_pending));
+	diff->pending[diff->npending].range.indexid = indexid;
+
+	return &diff->pending[diff->npending++];
+}
+
+static void
+diff_put_range(diff_export * diff, diff_record * range)
+{
+	diff->nranges++;
+	diff->nitems += range->nitems;
+
+	if (diff->fd >= 0)
+	{
+		diff->buffer[diff->nbuffered++] = *range;
+
+		if (diff->nbuffered == DIFF_FILE_BUFFER)
+			diff_flush_file(diff);
+	}
+	else
+	{
+		Datum		values[DIFF_NATTS];
+		bool		nulls[DIFF_NATTS];
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(range->indexid);
+		values[1] = CStringGetTextDatum((range->kind == DIFF_MISSING_IN_INDEX) ?
+										"missing_in_index" : "missing_in_heap");
+		values[2] = Int64GetDatum((int64) range->blockFrom);
+		values[3] = Int32GetDatum((int32) range->offsetFrom);
+		values[4] = Int64GetDatum((int64) range->blockTo);
+		values[5] = Int32GetDatum((int32) range->offsetTo);
+		values[6] = Int64GetDatum((int64) range->nitems);
+
+		tuplestore_putvalues(diff->tupstore, diff->tupdesc, values, nulls);
+	}
+}
+
+static void
+diff_flush_file(diff_export * diff)
+{
+	Size		nbytes = diff->nbuffered * sizeof(diff_record);
+
+	if (nbytes == 0)
+		return;
+
+	if (write(diff->fd, diff->buffer, nbytes) != (ssize_t) nbytes)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", diff->path)));
+
+	diff->nbuffered = 0;
+}
@@ -0,0 +1,119 @@
+#ifndef DIFF_CHECK_H
+#define DIFF_CHECK_H
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "storage/block.h"
+#include "storage/off.h"
+#include "utils/tuplestore.h"
+
+/*
+ * Export of the differences found by the cross-check, instead of reporting
+ * each mismatched item as a WARNING (or dumping the whole bitmaps). The
+ * differences are coalesced into ranges of consecutive items of the same
+ * kind - a range ending at the last item of a page continues on the next
+ * page, if that starts at the first item (so e.g. a range of pages missing
+ * in the index is a single range).
+ *
+ * The ranges are either returned by a set-returning function, or written
+ * into a server-side file as they are found (so memory does not depend on
+ * the number of differences). The file starts with a header, followed by
+ * fixed-size records (native byte order):
+ *
+ *     header : "PGCKDIF1" (8B), heap relation OID (4B), zero padding (4B)
+ *     record : diff_record (32B)
+ */
+typedef enum
+{
+	DIFF_MISSING_IN_INDEX,		/* in heap, missing in index */
+	DIFF_MISSING_IN_HEAP		/* in index, missing in heap */
+}			DiffKind;
+
+#define DIFF_FILE_MAGIC		"PGCKDIF1"
+
+typedef struct diff_record
+{
+	Oid			indexid;		/* index with the differences */
+	uint32		kind;			/* DiffKind */
+	BlockNumber blockFrom;		/* first item of the range */
+	BlockNumber blockTo;		/* last item of the range */
+	uint16		offsetFrom;
+	uint16		offsetTo;
+	uint32		padding;
+	uint64		nitems;			/* number of items in the range */
+}			diff_record;
+
+/* range still being extended */
+typedef struct diff_pending
+{
+	diff_record range;
+	OffsetNumber maxoff;		/* last item on the last page of the range */
+}			diff_pending;
+
+/* number of records buffered before writing them to the file */
+#define DIFF_FILE_BUFFER	(BLCKSZ / sizeof(diff_record))
+
+typedef struct diff_export
+{
+	MemoryContext mcxt;			/* per-query context */
+
+	/* set-returning function */
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+
+	/* server-side file */
+	char	   *path;
+	int			fd;
+	int			nbuffered;
+	diff_record *buffer;
+
+	Oid			indexid;		/* index being compared */
+
+	/* ranges still being extended (one per index) */
+	int			npending;
+	int			maxpending;
+	diff_pending *pending;
+
+	uint64		nranges;		/* ranges exported */
+	uint64		nitems;			/* items in the ranges */
+}			diff_export;
+
+/* export of the running check (NULL when reporting WARNINGs) */
+extern diff_export *pgcheck_diff;
+
+/* Prepares the export for a set-returning function (materialize mode).
+ *
+ * - fcinfo : call info of the function
+ *
+ * Returns the export.
+ */
+diff_export *diff_init_srf(FunctionCallInfo fcinfo);
+
+/* Prepares the export into a server-side file (overwritten if exists).
+ *
+ * - path : path of the file (relative to the data directory)
+ * - heapid : the table being cross-checked (stored in the header)
+ *
+ * Returns the export.
+ */
+diff_export *diff_init_file(const char *path, Oid heapid);
+
+/* Sets the index the following differences belong to (if exporting). */
+void		diff_set_index(Oid indexid);
+
+/* Adds a mismatched item, extending the pending range of the index if
+ * possible. Items of each index have to be added in the TID order.
+ *
+ * - diff : the export
+ * - indexid : index with the difference
+ * - block, offnum : the item
+ * - maxoff : last item on the page (InvalidOffsetNumber if unknown)
+ * - kind : kind of the difference
+ */
+void		diff_add(diff_export * diff, Oid indexid, BlockNumber block,
+		 OffsetNumber offnum, OffsetNumber maxoff, DiffKind kind);
+
+/* Exports the pending ranges, and closes the file (if any). */
+void		diff_finish(diff_export * diff);
+
+#endif							/* DIFF_CHECK_H */
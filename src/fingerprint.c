@@ -0,0 +1,568 @@
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/htup.h"
+#if (PG_VERSION_NUM >= 90300)
+#include "access/htup_details.h"
+#endif
+#include "access/tupdesc.h"
+#include "fmgr.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+
+#include "common.h"
+#include "fingerprint.h"
+#include "issues.h"
+#include "item-bitmap.h"
+
+/*
+ * Fingerprints are 64-bit FNV-1a hashes, with the murmur3 finalizer mixed
+ * in (FNV alone does not spread entropy to the high bits well enough).
+ */
+#define FNV_OFFSET_BASIS	UINT64CONST(0xcbf29ce484222325)
+#define FNV_PRIME			UINT64CONST(0x100000001b3)
+
+/* limits of the filter size (the upper one keeps it below MaxAllocSize) */
+#define FILTER_MIN_BYTES	1024
+#define FILTER_MAX_BYTES	((Size) 512 * 1024 * 1024)
+
+/* bits per expected element (about 0.05% false positives) */
+#define FILTER_BITS_PER_ELEMENT	16
+
+#define FILTER_MAX_HASHES	10
+
+/*
+ * Varlena values are never detoasted, so keys with compressed or external
+ * values are not hashed, and only the TID is added / probed for those. The
+ * heap and the index may store the same value differently, but both know
+ * the length of the raw data - only values longer than this may be stored
+ * compressed (or external) in the heap, as the toaster only considers
+ * values longer than a TOAST pointer ...
+ */
+#define HEAP_PLAIN_MAX_LEN	(MAXALIGN(VARHDRSZ_EXTERNAL + sizeof(varatt_external)) - VARHDRSZ)
+
+/* ... and in the index (TOAST_INDEX_TARGET, used by index_form_tuple) */
+#define INDEX_PLAIN_MAX_LEN	((MaxHeapTupleSize / 16) - VARHDRSZ)
+
+static uint64 hash_bytes64(uint64 hash, const char *data, Size len);
+static uint64 hash_finalize(uint64 hash);
+static uint64 hash_datum(uint64 hash, Datum value, bool isnull,
+		   Form_pg_attribute attr, bool *toasted, Size *maxlen);
+static Size varlena_raw_length(struct varlena *v);
+static uint64 fingerprint_index_key(Relation index, IndexTuple itup,
+					  bool *toasted, Size *maxlen);
+static uint64 fingerprint_heap_key(index_fingerprints * index,
+					 HeapTuple tuple, TupleDesc tupdesc,
+					 bool *toasted, Size *maxlen);
+static uint64 fingerprint_tid(uint64 key, ItemPointer tid);
+
+/* allocate a filter */
+key_filter *
+filter_init(Size nbytes, double nelements)
+{
+	key_filter *filter;
+	uint64		nbits = FILTER_MIN_BYTES * 8;
+	double		target = Max(nelements, 1) * FILTER_BITS_PER_ELEMENT;
+	Size		maxbits = Min(Max(nbytes, FILTER_MIN_BYTES),
+							  FILTER_MAX_BYTES) * 8;
+
+	/* smallest power of two enough for the elements, but within the limit */
+	while ((nbits < target) && (nbits * 2 <= maxbits))
+		nbits *= 2;
+
+	filter = (key_filter *) palloc0(sizeof(key_filter));
+
+	filter->nbits = nbits;
+	filter->words = (uint64 *) palloc0(nbits / 8);
+
+	/* optimal number of hash functions is (m/n * ln(2)) */
+	filter->nhashes = (int) rint(log(2.0) * nbits / Max(nelements, 1));
+	filter->nhashes = Max(1, Min(filter->nhashes, FILTER_MAX_HASHES));
+
+	return filter;
+}
+
+void
+filter_free(key_filter * filter)
+{
+	pfree(filter->words);
+	pfree(filter);
+}
+
+/*
+ * The bit positions are computed by double hashing, i.e. (h1 + i * h2),
+ * using the two halves of the fingerprint (h2 is odd, so the positions
+ * are distinct).
+ */
+void
+filter_add(key_filter * filter, uint64 hash)
+{
+	uint64		h1 = (uint32) hash;
+	uint64		h2 = (hash >> 32) | 1;
+	uint64		mask = filter->nbits - 1;
+	int			i;
+
+	for (i = 0; i < filter->nhashes; i++)
+	{
+		uint64		bit = (h1 + i * h2) & mask;
+
+		filter->words[bit / 64] |= (UINT64CONST(1) << (bit % 64));
+	}
+
+	filter->nelements++;
+}
+
+bool
+filter_lacks(key_filter * filter, uint64 hash)
+{
+	uint64		h1 = (uint32) hash;
+	uint64		h2 = (hash >> 32) | 1;
+	uint64		mask = filter->nbits - 1;
+	int			i;
+
+	for (i = 0; i < filter->nhashes; i++)
+	{
+		uint64		bit = (h1 + i * h2) & mask;
+
+		if (!(filter->words[bit / 64] & (UINT64CONST(1) << (bit % 64))))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Keys with compressed values are added as TID only. Keys with values the
+ * heap may have compressed (or moved to TOAST) are added both with the key
+ * and as TID only, so that the heap pass finds them either way.
+ */
+void
+filter_add_index_tuple(key_filter * filter, Relation index, IndexTuple itup)
+{
+	uint64		key;
+	bool		toasted = false;
+	Size		maxlen = 0;
+
+	if (!filter->keys)
+	{
+		filter_add(filter, fingerprint_tid(FNV_OFFSET_BASIS, &itup->t_tid));
+		return;
+	}
+
+	key = fingerprint_index_key(index, itup, &toasted, &maxlen);
+
+	if (!toasted)
+		filter_add(filter, fingerprint_tid(key, &itup->t_tid));
+
+	if (toasted || (maxlen > HEAP_PLAIN_MAX_LEN))
+		filter_add(filter, fingerprint_tid(FNV_OFFSET_BASIS, &itup->t_tid));
+}
+
+/* fingerprint of the key stored in the index tuple */
+static uint64
+fingerprint_index_key(Relation index, IndexTuple itup, bool *toasted,
+					  Size *maxlen)
+{
+	TupleDesc	tupdesc = RelationGetDescr(index);
+	Datum		values[INDEX_MAX_KEYS];
+	bool		isnull[INDEX_MAX_KEYS];
+	uint64		hash = FNV_OFFSET_BASIS;
+	int			i;
+
+	index_deform_tuple(itup, tupdesc, values, isnull);
+
+	for (i = 0; i < tupdesc->natts; i++)
+		hash = hash_datum(hash, values[i], isnull[i],
+						  TupleDescAttr(tupdesc, i), toasted, maxlen);
+
+	return hash;
+}
+
+/* combine fingerprint of the key with the TID */
+static uint64
+fingerprint_tid(uint64 key, ItemPointer tid)
+{
+	BlockNumber block = ItemPointerGetBlockNumber(tid);
+	OffsetNumber offset = ItemPointerGetOffsetNumber(tid);
+
+	key = hash_bytes64(key, (char *) &block, sizeof(BlockNumber));
+	key = hash_bytes64(key, (char *) &offset, sizeof(OffsetNumber));
+
+	return hash_finalize(key);
+}
+
+fingerprint_probe *
+fingerprint_probe_init(int maxindexes, TransactionId horizon,
+					   TransactionId frozenxid)
+{
+	fingerprint_probe *probe;
+
+	probe = (fingerprint_probe *) palloc0(sizeof(fingerprint_probe));
+
+	probe->maxindexes = maxindexes;
+	probe->indexes = (index_fingerprints *)
+		palloc0(Max(1, maxindexes) * sizeof(index_fingerprints));
+	probe->horizon = horizon;
+	probe->frozenxid = frozenxid;
+
+	return probe;
+}
+
+void
+fingerprint_probe_free(fingerprint_probe * probe)
+{
+	int			i;
+
+	for (i = 0; i < probe->nindexes; i++)
+	{
+		filter_free(probe->indexes[i].filter);
+		FreeTupleDesc(probe->indexes[i].tupdesc);
+		pfree(probe->indexes[i].name);
+	}
+
+	pfree(probe->indexes);
+	pfree(probe);
+}
+
+bool
+fingerprint_index_supported(Relation index)
+{
+	return (RelationGetIndexPredicate(index) == NIL);
+}
+
+key_filter *
+fingerprint_add_index(fingerprint_probe * probe, Relation heap,
+					  Relation index, Size nbytes, double nelements)
+{
+	index_fingerprints *idx;
+	TupleDesc	heapdesc = RelationGetDescr(heap);
+	int			i;
+
+	Assert(probe->nindexes < probe->maxindexes);
+
+	idx = &probe->indexes[probe->nindexes++];
+
+	idx->name = pstrdup(RelationGetRelationName(index));
+	idx->natts = index->rd_index->indnatts;
+	idx->tupdesc = CreateTupleDescCopy(RelationGetDescr(index));
+	idx->filter = filter_init(nbytes, nelements);
+	idx->filter->keys = true;
+
+	/*
+	 * We can only compute the key from the heap tuple for plain attributes
+	 * stored as the same type (e.g. not for opclasses with a storage type).
+	 */
+	for (i = 0; i < idx->natts; i++)
+	{
+		AttrNumber	attnum = index->rd_index->indkey.values[i];
+
+		idx->attnums[i] = attnum;
+
+		if ((attnum <= 0) ||
+			(TupleDescAttr(heapdesc, attnum - 1)->atttypid !=
+			 TupleDescAttr(idx->tupdesc, i)->atttypid))
+			idx->filter->keys = false;
+	}
+
+	if (!idx->filter->keys)
+		ereport(NOTICE,
+				(errmsg("keys of index \"%s\" can't be computed from the table, only TIDs will be cross-checked",
+						idx->name)));
+
+	return idx->filter;
+}
+
+/*
+ * Probe the filters with all tuples on the page that should be in the
+ * indexes. Those are the same tuples bitmap_add_heap_items adds to the
+ * bitmap, except for dead line pointers (we don't know the key, and the
+ * index entry may or may not exist). For redirects, the key is taken from
+ * the tuple it points to (all tuples in a HOT chain have the same keys).
+ */
+uint32
+fingerprint_heap_page(fingerprint_probe * probe, Relation rel,
+					  PageHeader header, char *raw_page, BlockNumber block)
+{
+	uint32		nerrs = 0;
+	int			ntuples = PageGetMaxOffsetNumber(raw_page);
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	int			item;
+	int			i;
+
+	for (item = 0; item < ntuples; item++)
+	{
+		ItemId		lp = &header->pd_linp[item];
+		ItemPointerData tid;
+		HeapTupleData tuple;
+
+		if (lp->lp_flags == LP_DEAD)
+		{
+			probe->ndead++;
+			continue;
+		}
+
+		if (lp->lp_flags == LP_REDIRECT)
+		{
+			/* invalid redirects were already reported by the heap check */
+			if ((lp->lp_off < 1) || (lp->lp_off > ntuples))
+				continue;
+
+			lp = &header->pd_linp[lp->lp_off - 1];
+
+			if (lp->lp_flags != LP_NORMAL)
+				continue;
+		}
+		else if (lp->lp_flags != LP_NORMAL)
+			continue;
+
+		tuple.t_data = (HeapTupleHeader) (raw_page + lp->lp_off);
+		tuple.t_len = lp->lp_len;
+		tuple.t_tableOid = RelationGetRelid(rel);
+		ItemPointerSet(&tuple.t_self, block, (lp - header->pd_linp) + 1);
+
+		/* heap-only tuples are reached through the root of the chain */
+		if ((lp == &header->pd_linp[item]) &&
+			HeapTupleHeaderIsHeapOnly(tuple.t_data))
+			continue;
+
+		/* tuples on all-visible pages are settled */
+		if (TransactionIdIsValid(probe->horizon) && !PageIsAllVisible(raw_page) &&
+			!heap_tuple_is_settled(tuple.t_data, probe->horizon,
+								   probe->frozenxid))
+			continue;
+
+		ItemPointerSet(&tid, block, item + 1);
+
+		for (i = 0; i < probe->nindexes; i++)
+		{
+			index_fingerprints *idx = &probe->indexes[i];
+			uint64		hash = FNV_OFFSET_BASIS;
+			bool		toasted = false;
+			Size		maxlen = 0;
+
+			/* the index had corrupted pages, so we can't rely on it */
+			if (idx->filter->incomplete)
+				continue;
+
+			/* keys with compressed or external values are probed as TID */
+			if (idx->filter->keys)
+				hash = fingerprint_heap_key(idx, &tuple, tupdesc,
+											&toasted, &maxlen);
+
+			if (toasted)
+				hash = FNV_OFFSET_BASIS;
+
+			idx->nprobes++;
+
+			if (!filter_lacks(idx->filter, fingerprint_tid(hash, &tid)))
+				continue;
+
+			/* the index may have compressed the value (added as TID only) */
+			if (!toasted && (maxlen > INDEX_PLAIN_MAX_LEN) &&
+				!filter_lacks(idx->filter,
+							  fingerprint_tid(FNV_OFFSET_BASIS, &tid)))
+				continue;
+
+			/* concurrent page splits may hide entries from the index scan */
+			if (idx->filter->hidden)
+			{
+				ereport(DEBUG1,
+						(errmsg("[%d:%d] tuple not found in index \"%s\", possibly moved by a concurrent page split",
+								block, (item + 1), idx->name)));
+				idx->nunconfirmed++;
+				continue;
+			}
+
+			report_issue("index_missing_tuple", block, (item + 1),
+						 "[%d:%d] tuple not found in index \"%s\" (missing entry or mismatching key)",
+						 block, (item + 1), idx->name);
+			idx->nmissing++;
+			nerrs++;
+		}
+	}
+
+	return nerrs;
+}
+
+/*
+ * Dead line pointers may or may not have index entries (the entries are
+ * removed by vacuum before the line pointers, but b-tree may also remove
+ * entries pointing to dead tuples on its own), so we only know a range of
+ * the expected number of entries.
+ */
+uint32
+fingerprint_report(fingerprint_probe * probe)
+{
+	uint32		nerrs = 0;
+	int			i;
+
+	for (i = 0; i < probe->nindexes; i++)
+	{
+		index_fingerprints *idx = &probe->indexes[i];
+		uint64		nentries = idx->filter->nelements;
+		uint64		nmin = idx->nprobes - idx->nmissing;
+		uint64		nmax = nmin + probe->ndead;
+
+		ereport(DEBUG1,
+				(errmsg("index \"%s\": " UINT64_FORMAT " entries, " UINT64_FORMAT " tuples probed, " UINT64_FORMAT " missing (filter " UINT64_FORMAT " bits, %d hashes)",
+						idx->name, nentries, idx->nprobes, idx->nmissing,
+						idx->filter->nbits, idx->filter->nhashes)));
+
+		if (idx->filter->incomplete)
+		{
+			report_issue("index_corrupted", InvalidBlockNumber, 0,
+						 "index \"%s\" has corrupted pages, cross-check skipped",
+						 idx->name);
+			continue;
+		}
+
+		if (idx->nunconfirmed != 0)
+			ereport(NOTICE,
+					(errmsg("index \"%s\": " UINT64_FORMAT " tuples not found, possibly moved by concurrent page splits (not counted as differences)",
+							idx->name, idx->nunconfirmed)));
+
+		if (probe->incomplete)
+			continue;
+
+		/* entries of tuples ignored in snapshot mode (see above) */
+		if ((nentries > nmax) && !TransactionIdIsValid(probe->horizon))
+		{
+			report_issue("index_extra_entries", InvalidBlockNumber, 0,
+						 "index \"%s\" has " UINT64_FORMAT " entries not matching any tuple in the table",
+						 idx->name, nentries - nmax);
+			nerrs += (nentries - nmax);
+		}
+		else if ((nentries < nmin) && !idx->filter->hidden)
+		{
+			/* some missing entries were hidden by false positives */
+			report_issue("index_missing_entries", InvalidBlockNumber, 0,
+						 "index \"%s\" has " UINT64_FORMAT " entries less than the table",
+						 idx->name, nmin - nentries);
+			nerrs += (nmin - nentries);
+		}
+	}
+
+	return nerrs;
+}
+
+/* FNV-1a hash of the bytes, continuing from the hash value */
+static uint64
+hash_bytes64(uint64 hash, const char *data, Size len)
+{
+	Size		i;
+
+	for (i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char) data[i];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+/* murmur3 64-bit finalizer */
+static uint64
+hash_finalize(uint64 hash)
+{
+	hash ^= hash >> 33;
+	hash *= UINT64CONST(0xff51afd7ed558ccd);
+	hash ^= hash >> 33;
+	hash *= UINT64CONST(0xc4ceb9fe1a85ec53);
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+/*
+ * Hash a (normalized) attribute value. For varlena values only the data is
+ * hashed (without the header, which may be short or long depending on where
+ * the value is stored). Compressed and external values are not hashed at
+ * all (detoasting would be far too expensive), those only set the toasted
+ * flag. The maxlen tracks length of the longest (raw) varlena value.
+ */
+static uint64
+hash_datum(uint64 hash, Datum value, bool isnull, Form_pg_attribute attr,
+		   bool *toasted, Size *maxlen)
+{
+	char		null = (isnull) ? 1 : 0;
+
+	hash = hash_bytes64(hash, &null, 1);
+
+	if (isnull)
+		return hash;
+
+	if (attr->attbyval)
+		return hash_bytes64(hash, (char *) &value, sizeof(Datum));
+
+	if (attr->attlen == -1)
+	{
+		struct varlena *v = (struct varlena *) DatumGetPointer(value);
+
+		*maxlen = Max(*maxlen, varlena_raw_length(v));
+
+		if (VARATT_IS_EXTERNAL(v) || VARATT_IS_COMPRESSED(v))
+		{
+			*toasted = true;
+			return hash;
+		}
+
+		return hash_bytes64(hash, VARDATA_ANY(v), VARSIZE_ANY_EXHDR(v));
+	}
+
+	if (attr->attlen == -2)
+		return hash_bytes64(hash, DatumGetCString(value),
+							strlen(DatumGetCString(value)));
+
+	return hash_bytes64(hash, DatumGetPointer(value), attr->attlen);
+}
+
+/* length of the data of a varlena value, once detoasted (without doing it) */
+static Size
+varlena_raw_length(struct varlena *v)
+{
+	if (VARATT_IS_EXTERNAL_ONDISK(v))
+	{
+		varatt_external toast_pointer;
+
+		/* the pointer may not be aligned */
+		memcpy(&toast_pointer, VARDATA_EXTERNAL(v), sizeof(toast_pointer));
+
+		return toast_pointer.va_rawsize - VARHDRSZ;
+	}
+
+	/* other external values are not stored on disk, so just assume long */
+	if (VARATT_IS_EXTERNAL(v))
+		return MaxAllocSize;
+
+	if (VARATT_IS_COMPRESSED(v))
+#if (PG_VERSION_NUM >= 140000)
+		return VARDATA_COMPRESSED_GET_EXTSIZE(v);
+#else
+		return VARRAWSIZE_4B_C(v);
+#endif
+
+	return VARSIZE_ANY_EXHDR(v);
+}
+
+/* fingerprint of the index key, computed from the heap tuple */
+static uint64
+fingerprint_heap_key(index_fingerprints * index, HeapTuple tuple,
+					 TupleDesc tupdesc, bool *toasted, Size *maxlen)
+{
+	uint64		hash = FNV_OFFSET_BASIS;
+	int			i;
+
+	for (i = 0; i < index->natts; i++)
+	{
+		bool		isnull;
+		Datum		value = heap_getattr(tuple, index->attnums[i], tupdesc,
+										 &isnull);
+
+		hash = hash_datum(hash, value, isnull,
+						  TupleDescAttr(index->tupdesc, i), toasted, maxlen);
+	}
+
+	return hash;
+}
@@ -0,0 +1,133 @@
+#ifndef FINGERPRINT_CHECK_H
+#define FINGERPRINT_CHECK_H
+
+#include "postgres.h"
+#include "access/heapam.h"
+#include "access/itup.h"
+#include "utils/rel.h"
+
+/*
+ * Bloom filter of (TID, key) fingerprints of index tuples. The number of
+ * bits is a power of two, so that positions can be computed by masking.
+ */
+typedef struct key_filter
+{
+	uint64		nbits;			/* number of bits (power of two) */
+	int			nhashes;		/* number of bit positions per element */
+	uint64		nelements;		/* number of added fingerprints */
+	bool		keys;			/* fingerprints include keys (not just TIDs) */
+	bool		incomplete;		/* some index pages were not fingerprinted */
+	bool		hidden;			/* concurrent splits may have hidden entries */
+	uint64	   *words;			/* the bits (nbits / 64 words) */
+}			key_filter;
+
+/* index probed by the heap pass */
+typedef struct index_fingerprints
+{
+	char	   *name;			/* name of the index (for messages) */
+	int			natts;			/* number of index attributes */
+	AttrNumber	attnums[INDEX_MAX_KEYS];	/* heap attributes */
+	TupleDesc	tupdesc;		/* descriptor of index tuples (a copy) */
+	key_filter *filter;			/* fingerprints of the index tuples */
+	uint64		nprobes;		/* number of heap tuples probed */
+	uint64		nmissing;		/* heap tuples not found in the filter */
+	uint64		nunconfirmed;	/* not found, but may be hidden by splits */
+}			index_fingerprints;
+
+/* state of the heap pass, probing filters of all the indexes */
+typedef struct fingerprint_probe
+{
+	int			nindexes;
+	int			maxindexes;
+	index_fingerprints *indexes;
+	TransactionId horizon;		/* snapshot mode (InvalidTransactionId if not) */
+	TransactionId frozenxid;	/* relfrozenxid of the heap relation */
+	uint64		ndead;			/* dead line pointers (may have entries) */
+	bool		incomplete;		/* some heap pages were not probed */
+}			fingerprint_probe;
+
+/* Allocates a Bloom filter.
+ *
+ * - nbytes : maximum size of the filter
+ * - nelements : expected number of elements (used to pick the number of
+ *               hash functions, and to not waste memory on small tables)
+ *
+ * Returns the allocated filter.
+ */
+key_filter *filter_init(Size nbytes, double nelements);
+
+/* Releases the filter (including the bits). */
+void		filter_free(key_filter * filter);
+
+/* Adds a fingerprint to the filter. */
+void		filter_add(key_filter * filter, uint64 hash);
+
+/* Returns true if the fingerprint is definitely not in the filter. */
+bool		filter_lacks(key_filter * filter, uint64 hash);
+
+/* Adds fingerprint of an index tuple (TID and the key) to the filter.
+ *
+ * Varlena values are not detoasted, so keys with values that may be stored
+ * compressed (or in TOAST) in the index or the heap are added as TID only
+ * (and with the key, when not compressed in the index).
+ */
+void		filter_add_index_tuple(key_filter * filter, Relation index,
+					   IndexTuple itup);
+
+/* Allocates state of the heap pass, for up to maxindexes indexes.
+ *
+ * - horizon : only settled tuples are probed in snapshot mode
+ * - frozenxid : relfrozenxid of the heap relation (bounds the clog lookups)
+ */
+fingerprint_probe *fingerprint_probe_init(int maxindexes, TransactionId horizon,
+					   TransactionId frozenxid);
+
+/* Releases the probe state, including the filters. */
+void		fingerprint_probe_free(fingerprint_probe * probe);
+
+/* Checks the index can be cross-checked using fingerprints, i.e. that it
+ * has no predicate (partial indexes don't have entries for all tuples). */
+bool		fingerprint_index_supported(Relation index);
+
+/* Registers an index with the probe, and allocates a filter for it.
+ *
+ * - probe : state of the heap pass
+ * - heap : the table (to check types of the index attributes)
+ * - index : the index (already locked by the caller)
+ * - nbytes, nelements : size of the filter (see filter_init)
+ *
+ * Keys of expression indexes (and those with types different from the
+ * heap attribute) can't be computed from the heap tuple, so only TIDs of
+ * such indexes are fingerprinted.
+ *
+ * Returns the filter to be populated by the index check.
+ */
+key_filter *fingerprint_add_index(fingerprint_probe * probe, Relation heap,
+					  Relation index, Size nbytes, double nelements);
+
+/* Probes filters of all indexes with fingerprints of tuples on a heap page.
+ *
+ * - probe : state of the heap pass
+ * - rel : the table
+ * - header : page header
+ * - raw_page : raw page data
+ * - block : number of the page
+ *
+ * Returns number of issues (heap tuples missing in an index).
+ */
+uint32		fingerprint_heap_page(fingerprint_probe * probe, Relation rel,
+					  PageHeader header, char *raw_page,
+					  BlockNumber block);
+
+/* Compares number of index entries and probed heap tuples (for each index).
+ *
+ * Fingerprints only detect heap tuples missing in the index, so superfluous
+ * index entries are detected by counting. That is not possible in snapshot
+ * mode (the index may have entries for tuples ignored by the heap pass),
+ * only too few entries are detected (unless hidden by concurrent splits).
+ *
+ * Returns number of issues.
+ */
+uint32		fingerprint_report(fingerprint_probe * probe);
+
+#endif							/* FINGERPRINT_CHECK_H */
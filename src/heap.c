@@ -7,50 +7,110 @@
 #include "funcapi.h"
 #include "utils/rel.h"
 
+#include "common.h"
 #include "heap.h"
+#include "issues.h"
+#ifndef PG_CHECK_OFFLINE
+#include "toast.h"
+#endif
 
 
-static uint32 check_heap_tuple(Relation rel, PageHeader header,
-				 BlockNumber block, int i, char *buffer);
-
-static uint32 check_heap_tuple_attributes(Relation rel, PageHeader header,
-							BlockNumber block, int i, char *buffer);
-
-/* checks heap tuples (table) on the page, one by one */
+static uint32 check_heap_tuples_lean(Relation rel, PageHeader header,
+					   char *buffer, BlockNumber block,
+					   attribute_plan * plan);
+static uint32 check_heap_tuples_verbose(Relation rel, PageHeader header,
+						  char *buffer, BlockNumber block,
+						  attribute_plan * plan);
+static pg_attribute_always_inline uint32
+			check_heap_tuples_impl(Relation rel, PageHeader header,
+					   char *buffer, BlockNumber block,
+					   attribute_plan * plan, bool verbose);
+
+static pg_attribute_always_inline uint32
+			check_heap_tuple(Relation rel, PageHeader header,
+				 BlockNumber block, int i, char *buffer,
+				 attribute_plan * plan, bool verbose);
+
+static pg_attribute_always_inline uint32
+			check_heap_tuple_attributes(Relation rel, PageHeader header,
+							BlockNumber block, int i, char *buffer,
+							attribute_plan * plan, bool verbose);
+
+/*
+ * checks heap tuples (table) on the page, one by one
+ *
+ * The tuple checks are compiled in two variants - a verbose one, with the
+ * DEBUG messages, and a lean one without them (used unless the messages
+ * would be sent to the client or the server log). The checks run for each
+ * line pointer and attribute, so even evaluating the elevel adds up.
+ *
+ * With check_level at the page headers, there's nothing to check here.
+ */
 uint32
 check_heap_tuples(Relation rel, PageHeader header, char *buffer,
-				  BlockNumber block)
+				  BlockNumber block, attribute_plan * plan)
 {
-	/* tuple checks */
 	int			ntuples = PageGetMaxOffsetNumber(buffer);
-	int			i;
 	uint32		nerrs = 0;
 
+	if (check_level < CHECK_LEVEL_LINE_POINTERS)
+		return nerrs;
+
 	ereport(DEBUG1,
 			(errmsg("[%d] max number of tuples = %d", block, ntuples)));
 
-	for (i = 0; i < ntuples; i++)
-		nerrs += check_heap_tuple(rel, header, block, i, buffer);
+	if (check_debug_enabled())
+		nerrs = check_heap_tuples_verbose(rel, header, buffer, block, plan);
+	else
+		nerrs = check_heap_tuples_lean(rel, header, buffer, block, plan);
+
+	/* check that the tuples don't overlap */
+	nerrs += check_page_items(header, block, plan);
 
 	if (nerrs > 0)
-		ereport(WARNING,
-				(errmsg("[%d] is probably corrupted, there were %d errors reported",
-						block, nerrs)));
+		report_issue("page_corrupted", block, 0,
+					 "[%d] is probably corrupted, there were %d errors reported",
+					 block, nerrs);
 
 	return nerrs;
 }
 
-/* checks that the tuples do not overlap and then the individual attributes */
 static uint32
+check_heap_tuples_lean(Relation rel, PageHeader header, char *buffer,
+					   BlockNumber block, attribute_plan * plan)
+{
+	return check_heap_tuples_impl(rel, header, buffer, block, plan, false);
+}
+
+static uint32
+check_heap_tuples_verbose(Relation rel, PageHeader header, char *buffer,
+						  BlockNumber block, attribute_plan * plan)
+{
+	return check_heap_tuples_impl(rel, header, buffer, block, plan, true);
+}
+
+static pg_attribute_always_inline uint32
+check_heap_tuples_impl(Relation rel, PageHeader header, char *buffer,
+					   BlockNumber block, attribute_plan * plan, bool verbose)
+{
+	/* tuple checks */
+	int			ntuples = PageGetMaxOffsetNumber(buffer);
+	int			i;
+	uint32		nerrs = 0;
+
+	for (i = 0; i < ntuples; i++)
+		nerrs += check_heap_tuple(rel, header, block, i, buffer, plan,
+								  verbose);
+
+	return nerrs;
+}
+
+/* checks that the tuples do not overlap and then the individual attributes */
+static pg_attribute_always_inline uint32
 check_heap_tuple(Relation rel, PageHeader header, BlockNumber block,
-				 int i, char *buffer)
+				 int i, char *buffer, attribute_plan * plan, bool verbose)
 {
 	uint32		nerrs = 0;
-	int			j,
-				a,
-				b,
-				c,
-				d;
 	ItemId		lp;
 
 	/* get pointer to the line pointer */
@@ -62,15 +122,16 @@ check_heap_tuple(Relation rel, PageHeader header, BlockNumber block,
 		OffsetNumber offnum,
 					maxoff;
 
-		ereport(DEBUG2,
-				(errmsg("[%d:%d] tuple is LP_REDIRECT", block, (i + 1))));
+		if (verbose)
+			ereport(DEBUG2,
+					(errmsg("[%d:%d] tuple is LP_REDIRECT", block, (i + 1))));
 
 		/* redirected line pointers must not have any storage associated */
 		if (lp->lp_len != 0)
 		{
-			ereport(WARNING,
-					(errmsg("[%d:%d] tuple with LP_REDIRECT and len != 0 (%d)",
-							block, (i + 1), lp->lp_len)));
+			report_issue("redirect_length", block, (i + 1),
+						 "[%d:%d] tuple with LP_REDIRECT and len != 0 (%d)",
+						 block, (i + 1), lp->lp_len);
 			++nerrs;
 		}
 
@@ -85,17 +146,17 @@ check_heap_tuple(Relation rel, PageHeader header, BlockNumber block,
 		/* the target offset is bogus */
 		if (offnum > maxoff)
 		{
-			ereport(WARNING,
-					(errmsg("[%d:%d] LP_REDIRECT item points to invalid offset %u (max %u)",
-							block, (i + 1), offnum, maxoff)));
+			report_issue("redirect_offset", block, (i + 1),
+						 "[%d:%d] LP_REDIRECT item points to invalid offset %u (max %u)",
+						 block, (i + 1), offnum, maxoff);
 			++nerrs;
 		}
 		else if ((header->pd_linp[offnum - 1].lp_flags != LP_NORMAL) &&
 				 (header->pd_linp[offnum - 1].lp_flags != LP_DEAD))
 		{
-			ereport(WARNING,
-					(errmsg("[%d:%d] LP_REDIRECT item points to item that is not LP_NORMAL/LP_DEAD (flag %u)",
-							block, (i + 1), header->pd_linp[offnum - 1].lp_flags)));
+			report_issue("redirect_target", block, (i + 1),
+						 "[%d:%d] LP_REDIRECT item points to item that is not LP_NORMAL/LP_DEAD (flag %u)",
+						 block, (i + 1), header->pd_linp[offnum - 1].lp_flags);
 			++nerrs;
 		}
 
@@ -103,15 +164,16 @@ check_heap_tuple(Relation rel, PageHeader header, BlockNumber block,
 	}
 	else if (lp->lp_flags == LP_UNUSED)
 	{
-		ereport(DEBUG2,
-				(errmsg("[%d:%d] tuple is LP_UNUSED", block, (i + 1))));
+		if (verbose)
+			ereport(DEBUG2,
+					(errmsg("[%d:%d] tuple is LP_UNUSED", block, (i + 1))));
 
 		/* LP_UNUSED => (len = 0) */
 		if (lp->lp_len != 0)
 		{
-			ereport(WARNING,
-					(errmsg("[%d:%d] tuple with LP_UNUSED and len != 0 (%d)",
-							block, (i + 1), lp->lp_len)));
+			report_issue("unused_length", block, (i + 1),
+						 "[%d:%d] tuple with LP_UNUSED and len != 0 (%d)",
+						 block, (i + 1), lp->lp_len);
 			++nerrs;
 		}
 
@@ -125,8 +187,9 @@ check_heap_tuple(Relation rel, PageHeader header, BlockNumber block,
 		 * have anything to check. If there is storage, we do the same check
 		 * as for LP_NORMAL.
 		 */
-		ereport(DEBUG2,
-				(errmsg("[%d:%d] tuple is LP_DEAD", block, (i + 1))));
+		if (verbose)
+			ereport(DEBUG2,
+					(errmsg("[%d:%d] tuple is LP_DEAD", block, (i + 1))));
 
 		/*
 		 * No storage, so we're done with this item pointer.
@@ -138,14 +201,15 @@ check_heap_tuple(Relation rel, PageHeader header, BlockNumber block,
 	}
 	else if (lp->lp_flags == LP_NORMAL)
 	{
-		ereport(DEBUG2,
-				(errmsg("[%d:%d] tuple is LP_NORMAL", block, (i + 1))));
+		if (verbose)
+			ereport(DEBUG2,
+					(errmsg("[%d:%d] tuple is LP_NORMAL", block, (i + 1))));
 	}
 	else
 	{
-		ereport(WARNING,
-				(errmsg("[%d:%d] item has unknown lp_flag %u",
-						block, (i + 1), lp->lp_flags)));
+		report_issue("item_flags", block, (i + 1),
+					 "[%d:%d] item has unknown lp_flag %u",
+					 block, (i + 1), lp->lp_flags);
 		return ++nerrs;
 	}
 
@@ -159,17 +223,17 @@ check_heap_tuple(Relation rel, PageHeader header, BlockNumber block,
 	 */
 	if (lp->lp_len == 0)
 	{
-		ereport(WARNING,
-				(errmsg("[%d:%d] tuple with length = 0 (%d)",
-						block, (i + 1), lp->lp_len)));
+		report_issue("item_length", block, (i + 1),
+					 "[%d:%d] tuple with length = 0 (%d)",
+					 block, (i + 1), lp->lp_len);
 		++nerrs;
 	}
 
 	if (lp->lp_off == 0)
 	{
-		ereport(WARNING,
-				(errmsg("[%d:%d] tuple with offset <= 0 (%d)",
-						block, (i + 1), lp->lp_off)));
+		report_issue("item_offset", block, (i + 1),
+					 "[%d:%d] tuple with offset <= 0 (%d)",
+					 block, (i + 1), lp->lp_off);
 		++nerrs;
 	}
 
@@ -180,65 +244,36 @@ check_heap_tuple(Relation rel, PageHeader header, BlockNumber block,
 	 */
 	if (lp->lp_off < header->pd_upper)
 	{
-		ereport(WARNING,
-				(errmsg("[%d:%d] tuple with offset - length < upper (%d - %d < %d)",
-						block, (i + 1), lp->lp_off,
-						lp->lp_len, header->pd_upper)));
+		report_issue("item_overflow", block, (i + 1),
+					 "[%d:%d] tuple with offset - length < upper (%d - %d < %d)",
+					 block, (i + 1), lp->lp_off,
+					 lp->lp_len, header->pd_upper);
 		++nerrs;
 	}
 
 	if (lp->lp_off + lp->lp_len > header->pd_special)
 	{
-		ereport(WARNING,
-				(errmsg("[%d:%d] tuple with offset > special (%d > %d)",
-						block, (i + 1), lp->lp_off, header->pd_special)));
+		report_issue("item_special", block, (i + 1),
+					 "[%d:%d] tuple with offset > special (%d > %d)",
+					 block, (i + 1), lp->lp_off, header->pd_special);
 		++nerrs;
 	}
 
-	/*
-	 * Check intersection with other tuples on the page. We only check
-	 * preceding line pointers, as the subsequent will be cross-checked when
-	 * check_heap_tuple is called for them.
-	 */
-
-	/* [A,B] vs [C,D] */
-	a = lp->lp_off;
-	b = lp->lp_off + lp->lp_len;
-
-	for (j = 0; j < i; j++)
-	{
-		ItemId		lp2 = &header->pd_linp[j];
-
-		/*
-		 * We care about items with storage here, so we can skip LP_UNUSED and
-		 * LP_REDIRECT right away, and LP_DEAD if they have no storage.
-		 */
-		if (lp2->lp_flags == LP_UNUSED ||
-			lp2->lp_flags == LP_REDIRECT ||
-			(lp2->lp_flags == LP_DEAD && lp2->lp_len == 0))
-			continue;
-
-		c = lp2->lp_off;
-		d = lp2->lp_off + lp2->lp_len;
-
-		/* [A,C,B] or [A,D,B] or [C,A,D] or [C,B,D] */
-		if (((a < c) && (c < b)) || ((a < d) && (d < b)) ||
-			((c < a) && (a < d)) || ((c < b) && (b < d)))
-		{
-			ereport(WARNING,
-					(errmsg("[%d:%d] intersects with [%d:%d] (%d,%d) vs. (%d,%d)",
-							block, (i + 1), block, j, a, b, c, d)));
-			++nerrs;
-		}
-	}
+	if (check_level < CHECK_LEVEL_TUPLES)
+		return nerrs;
 
-	return nerrs + check_heap_tuple_attributes(rel, header, block, i, buffer);
+	return nerrs + check_heap_tuple_attributes(rel, header, block, i, buffer,
+											   plan, verbose);
 }
 
-/* checks the individual attributes of the tuple */
-static uint32
+/*
+ * checks the tuple header, and then the individual attributes of the tuple
+ * (with check_level at the attributes)
+ */
+static pg_attribute_always_inline uint32
 check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
-							int i, char *buffer)
+							int i, char *buffer, attribute_plan * plan,
+							bool verbose)
 {
 	HeapTupleHeader tupheader;
 	uint32		nerrs = 0;
@@ -247,18 +282,32 @@ check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
 				endoff;
 	int			tuplenatts;
 	bool		has_nulls = false;
+	bool		is_toasted;
 
 	ItemId		lp = &header->pd_linp[i];
 
-	ereport(DEBUG2,
-			(errmsg("[%d:%d] checking attributes for the tuple", block, (i + 1))));
-
 	/*
 	 * Get the header of the tuple (it starts at the 'lp_off' offset and it's
 	 * t_hoff long (incl. bitmap)).
 	 */
 	tupheader = (HeapTupleHeader) (buffer + lp->lp_off);
 
+	/* the header (incl. the NULL bitmap) has to fit into the tuple */
+	if ((lp->lp_len < SizeofHeapTupleHeader) ||
+		(tupheader->t_hoff < SizeofHeapTupleHeader) ||
+		(tupheader->t_hoff > lp->lp_len) ||
+		(tupheader->t_hoff != MAXALIGN(tupheader->t_hoff)))
+	{
+		report_issue("tuple_header", block, (i + 1),
+					 "[%d:%d] tuple has invalid header length %d (tuple length %d)",
+					 block, (i + 1), tupheader->t_hoff, lp->lp_len);
+		return ++nerrs;
+	}
+
+	/* without a tuple descriptor (offline checks) we can't check attributes */
+	if (rel == NULL)
+		return nerrs;
+
 	/* attribute offset - always starts at (buffer + off) */
 	off = lp->lp_off + tupheader->t_hoff;
 
@@ -274,22 +323,49 @@ check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
 	 */
 	if (tuplenatts > rel->rd_att->natts)
 	{
-		ereport(WARNING,
-				(errmsg("[%d:%d] tuple has too many attributes. %d found, %d expected",
-						block, (i + 1),
-						HeapTupleHeaderGetNatts(tupheader),
-						RelationGetNumberOfAttributes(rel))));
+		report_issue("attribute_count", block, (i + 1),
+					 "[%d:%d] tuple has too many attributes. %d found, %d expected",
+					 block, (i + 1),
+					 HeapTupleHeaderGetNatts(tupheader),
+					 RelationGetNumberOfAttributes(rel));
 		return ++nerrs;
 	}
 
-	ereport(DEBUG3,
-			(errmsg("[%d:%d] tuple has %d attributes (%d in relation)",
-					block, (i + 1), tuplenatts, rel->rd_att->natts)));
+	if (verbose)
+		ereport(DEBUG3,
+				(errmsg("[%d:%d] tuple has %d attributes (%d in relation)",
+						block, (i + 1), tuplenatts, rel->rd_att->natts)));
+
+	if (check_level < CHECK_LEVEL_ATTRIBUTES)
+		return nerrs;
+
+	if (verbose)
+		ereport(DEBUG2,
+				(errmsg("[%d:%d] checking attributes for the tuple", block, (i + 1))));
+
+	/*
+	 * Skip the leading fixed-width attributes using the plan, when the tuple
+	 * has no NULLs and the data starts at the expected (aligned) offset. If
+	 * the attributes don't fit into the tuple, do the per-attribute checks
+	 * to report which one overflows. The verbose variant always does the
+	 * per-attribute checks, to print all the details.
+	 */
+	j = 0;
+	endoff = lp->lp_off + lp->lp_len;
 
-	/* check all the attributes */
-	for (j = 0; j < tuplenatts; j++)
+	if (!verbose && (plan != NULL) && (plan->nfixed > 0) &&
+		!(tupheader->t_infomask & HEAP_HASNULL) &&
+		(tuplenatts >= plan->nfixed) && (off == MAXALIGN(off)) &&
+		(off + plan->fixed_size <= endoff))
 	{
-		Form_pg_attribute attr = rel->rd_att->attrs[j];
+		j = plan->nfixed;
+		off += plan->fixed_size;
+	}
+
+	/* check all the (remaining) attributes */
+	for (; j < tuplenatts; j++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(rel->rd_att, j);
 
 		/* actual length of the attribute value */
 		int			len;
@@ -298,6 +374,8 @@ check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
 		bool		is_varlena = (!attr->attbyval && attr->attlen == -1);
 		bool		is_varwidth = (!attr->attbyval && attr->attlen < 0);
 
+		is_toasted = false;
+
 		/*
 		 * If the attribute is marked as NULL (in the tuple header), skip to
 		 * the next attribute. The bitmap is only present when the tuple has
@@ -306,9 +384,10 @@ check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
 		if ((tupheader->t_infomask & HEAP_HASNULL) &&
 			att_isnull(j, tupheader->t_bits))
 		{
-			ereport(DEBUG3,
-					(errmsg("[%d:%d] attribute '%s' is NULL (skipping)",
-							block, (i + 1), attr->attname.data)));
+			if (verbose)
+				ereport(DEBUG3,
+						(errmsg("[%d:%d] attribute '%s' is NULL (skipping)",
+								block, (i + 1), attr->attname.data)));
 			has_nulls = true;	/* remember we've seen NULL value */
 			continue;
 		}
@@ -328,9 +407,9 @@ check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
 
 			if (len < 0)
 			{
-				ereport(WARNING,
-						(errmsg("[%d:%d] attribute '%s' has negative length < 0 (%d)",
-								block, (i + 1), attr->attname.data, len)));
+				report_issue("attribute_length", block, (i + 1),
+							 "[%d:%d] attribute '%s' has negative length < 0 (%d)",
+							 block, (i + 1), attr->attname.data, len);
 				++nerrs;
 				break;
 			}
@@ -341,9 +420,9 @@ check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
 				if ((VARRAWSIZE_4B_C(buffer + off) < 0) ||
 					(VARRAWSIZE_4B_C(buffer + off) > 1024 * 1024))
 				{
-					ereport(WARNING,
-							(errmsg("[%d:%d]  attribute '%s' has invalid length %d (should be between 0 and 1G)",
-									block, (i + 1), attr->attname.data, VARRAWSIZE_4B_C(buffer + off))));
+					report_issue("attribute_varlena_length", block, (i + 1),
+								 "[%d:%d]  attribute '%s' has invalid length %d (should be between 0 and 1G)",
+								 block, (i + 1), attr->attname.data, VARRAWSIZE_4B_C(buffer + off));
 					++nerrs;
 
 					/*
@@ -359,9 +438,12 @@ check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
 			}
 
 			/*
-			 * FIXME  Check if the varlena value can be detoasted - see
-			 * heap_tuple_untoast_attr in backend/access/heap/tuptoaster.c.
+			 * Values stored in the TOAST relation are verified in a separate
+			 * pass (see toast.c), with pg_check.verify_toast enabled.
 			 */
+#ifndef PG_CHECK_OFFLINE
+			is_toasted = VARATT_IS_EXTERNAL_ONDISK(buffer + off);
+#endif
 		}
 		else if (is_varwidth)
 		{
@@ -372,8 +454,21 @@ check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
 			/*
 			 * if the string is not properly terminated, then this returns
 			 * 'remaining space + 1' so it's detected
+			 *
+			 * the string has to start before the tuple end, otherwise the
+			 * remaining space would wrap around
 			 */
-			len = strnlen(buffer + off, lp->lp_off + len + lp->lp_len - off) + 1;
+			if (off >= endoff)
+			{
+				report_issue("attribute_overflow", block, (i + 1),
+							 "[%d:%d] attribute '%s' (off=%d) starts after tuple end (off=%d, len=%d)",
+							 block, (i + 1), attr->attname.data,
+							 off, lp->lp_off, lp->lp_len);
+				++nerrs;
+				break;
+			}
+
+			len = strnlen(buffer + off, endoff - off) + 1;
 		}
 		else
 			/* attributes with fixed length */
@@ -387,36 +482,44 @@ check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
 		endoff = lp->lp_off + lp->lp_len;
 		if (off + len > endoff)
 		{
-			ereport(WARNING,
-					(errmsg("[%d:%d] attribute '%s' (off=%d len=%d) overflows tuple end (off=%d, len=%d)",
-							block, (i + 1), attr->attname.data,
-							off, len, lp->lp_off, lp->lp_len)));
+			report_issue("attribute_overflow", block, (i + 1),
+						 "[%d:%d] attribute '%s' (off=%d len=%d) overflows tuple end (off=%d, len=%d)",
+						 block, (i + 1), attr->attname.data,
+						 off, len, lp->lp_off, lp->lp_len);
 			++nerrs;
 			break;
 		}
 
 		Assert(len >= 0);
 
+#ifndef PG_CHECK_OFFLINE
+		if (is_toasted && (plan != NULL) && (plan->toast != NULL))
+			nerrs += toast_check_add(plan->toast, tupheader, buffer + off,
+									 block, (i + 1));
+#endif
+
 		/* skip to the next attribute */
 		off += len;
 
-		ereport(DEBUG3,
-				(errmsg("[%d:%d] attribute '%s' length=%d",
-						block, (i + 1), attr->attname.data, len)));
+		if (verbose)
+			ereport(DEBUG3,
+					(errmsg("[%d:%d] attribute '%s' length=%d",
+							block, (i + 1), attr->attname.data, len)));
 	}
 
-	ereport(DEBUG3,
-			(errmsg("[%d:%d] last attribute ends at %d, tuple ends at %d",
-					block, (i + 1), off, lp->lp_off + lp->lp_len)));
+	if (verbose)
+		ereport(DEBUG3,
+				(errmsg("[%d:%d] last attribute ends at %d, tuple ends at %d",
+						block, (i + 1), off, lp->lp_off + lp->lp_len)));
 
 	/*
 	 * Check if tuples with HEAP_HASNULL actually have NULL attribute.
 	 */
 	if ((tupheader->t_infomask & HEAP_HASNULL) && !has_nulls)
 	{
-		ereport(WARNING,
-				(errmsg("[%d:%d] has HEAP_HASNULL flag but no NULLs",
-						block, (i + 1))));
+		report_issue("null_bitmap", block, (i + 1),
+					 "[%d:%d] has HEAP_HASNULL flag but no NULLs",
+					 block, (i + 1));
 		++nerrs;
 	}
 
@@ -427,9 +530,9 @@ check_heap_tuple_attributes(Relation rel, PageHeader header, BlockNumber block,
 	endoff = lp->lp_off + lp->lp_len;
 	if (off > endoff)
 	{
-		ereport(WARNING,
-				(errmsg("[%d:%d] the last attribute ends at %d but the tuple ends at %d",
-						block, (i + 1), off, endoff)));
+		report_issue("tuple_end", block, (i + 1),
+					 "[%d:%d] the last attribute ends at %d but the tuple ends at %d",
+					 block, (i + 1), off, endoff);
 		++nerrs;
 	}
 
@@ -3,7 +3,9 @@
 
 #include "postgres.h"
 #include "access/heapam.h"
+#include "common.h"
 
-uint32		check_heap_tuples(Relation rel, PageHeader header, char *buffer, BlockNumber block);
+uint32		check_heap_tuples(Relation rel, PageHeader header, char *buffer,
+				  BlockNumber block, attribute_plan * plan);
 
 #endif							/* HEAP_CHECK_H */
@@ -5,9 +5,14 @@
 #include "funcapi.h"
 #include "utils/rel.h"
 
+#include "btree-structure.h"
 #include "common.h"
 #include "index.h"
+#include "issues.h"
 #include "item-bitmap.h"
+#ifndef PG_CHECK_OFFLINE
+#include "tid-sort.h"
+#endif
 
 #if (PG_VERSION_NUM >= 90600)
 #include "catalog/pg_am.h"
@@ -20,22 +25,39 @@
 /* generic check */
 static uint32 generic_check_page(Relation rel, PageHeader header,
 				   BlockNumber block, char *raw_page,
-				   item_bitmap * bitmap);
+				   attribute_plan * plan);
 
 /* btree checks */
 static uint32 btree_check_page(Relation rel, PageHeader header,
 				 BlockNumber block, char *raw_page,
-				 item_bitmap * bitmap);
+				 attribute_plan * plan);
 static uint32 btree_check_tuples(Relation rel, PageHeader header,
-				   BlockNumber block, char *raw_page);
-static uint32 btree_check_tuple(Relation rel, PageHeader header,
-				  BlockNumber block, int i, char *raw_page);
-static uint32 btree_check_attributes(Relation rel, PageHeader header,
+				   BlockNumber block, char *raw_page,
+				   attribute_plan * plan);
+static uint32 btree_check_tuples_lean(Relation rel, PageHeader header,
+						BlockNumber block, char *raw_page,
+						attribute_plan * plan);
+static uint32 btree_check_tuples_verbose(Relation rel, PageHeader header,
+						   BlockNumber block, char *raw_page,
+						   attribute_plan * plan);
+static pg_attribute_always_inline uint32
+			btree_check_tuples_impl(Relation rel, PageHeader header,
+						BlockNumber block, char *raw_page,
+						attribute_plan * plan, bool verbose);
+static pg_attribute_always_inline uint32
+			btree_check_tuple(Relation rel, PageHeader header,
+				  BlockNumber block, int i, char *raw_page,
+				  attribute_plan * plan, bool verbose);
+static pg_attribute_always_inline uint32
+			btree_check_attributes(Relation rel, PageHeader header,
 					   BlockNumber block, OffsetNumber offnum,
-					   char *raw_page, int dlen);
+					   char *raw_page, int dlen,
+					   attribute_plan * plan, bool verbose);
+#ifndef PG_CHECK_OFFLINE
 static uint32 btree_add_tuples(Relation rel, PageHeader header,
 				 BlockNumber block, char *raw_page,
-				 item_bitmap * bitmap);
+				 index_items * items);
+#endif
 
 struct index_check_methods
 {
@@ -62,7 +84,8 @@ lookup_check_method(Oid oid, bool *crosscheck)
 {
 	int			i;
 
-	*crosscheck = false;
+	if (crosscheck)
+		*crosscheck = false;
 
 	i = 0;
 	while (methods[i].oid != InvalidOid)
@@ -74,6 +97,8 @@ lookup_check_method(Oid oid, bool *crosscheck)
 
 			return methods[i].check_page;
 		}
+
+		i++;
 	}
 
 	return generic_check_page;
@@ -94,9 +119,8 @@ lookup_check_method(Oid oid, bool *crosscheck)
  * FIXME Check that there are no duplicate tuples in the index and that
  * all the table tuples are referenced (need to count tuples).
  *
- * FIXME This does not check that the tree structure is valid, just
- * individual pages. This might check that there are no cycles in the
- * index, that all the pages are actually used in the tree.
+ * The structure of the tree (root, levels, sibling links, downlinks) is
+ * verified after the scan, from summaries of the pages (see btree-structure.c).
  *
  * FIXME Does not check (tid) referenced in the leaf-nodes, in the data
  * section.
@@ -104,7 +128,7 @@ lookup_check_method(Oid oid, bool *crosscheck)
 
 uint32
 generic_check_page(Relation rel, PageHeader header, BlockNumber block,
-				   char *raw_page, item_bitmap * bitmap)
+				   char *raw_page, attribute_plan * plan)
 {
 	/* check basic page header */
 	return check_page_header(header, block);
@@ -112,13 +136,13 @@ generic_check_page(Relation rel, PageHeader header, BlockNumber block,
 
 uint32
 btree_check_page(Relation rel, PageHeader header, BlockNumber block,
-				 char *raw_page, item_bitmap * bitmap)
+				 char *raw_page, attribute_plan * plan)
 {
 	uint32		nerrs = 0;
 	BTPageOpaque opaque = NULL;
 
 	/* make sure we only ever call this for b-tree indexes */
-	Assert(rel->rd_rel->relam == BTREE_AM_OID);
+	Assert((rel == NULL) || (rel->rd_rel->relam == BTREE_AM_OID));
 
 	/* check basic page header */
 	nerrs += check_page_header(header, block);
@@ -134,30 +158,20 @@ btree_check_page(Relation rel, PageHeader header, BlockNumber block,
 
 		if (mpdata->btm_magic != BTREE_MAGIC)
 		{
-			ereport(WARNING,
-					(errmsg("[%d] metapage contains invalid magic number %d (should be %d)",
-							block, mpdata->btm_magic, BTREE_MAGIC)));
+			report_issue("btree_meta_magic", block, 0,
+						 "[%d] metapage contains invalid magic number %d (should be %d)",
+						 block, mpdata->btm_magic, BTREE_MAGIC);
 			nerrs++;
 		}
 
 		if (mpdata->btm_version != BTREE_VERSION)
 		{
-			ereport(WARNING,
-					(errmsg("[%d] metapage contains invalid version %d (should be %d)",
-							block, mpdata->btm_version, BTREE_VERSION)));
+			report_issue("btree_meta_version", block, 0,
+						 "[%d] metapage contains invalid version %d (should be %d)",
+						 block, mpdata->btm_version, BTREE_VERSION);
 			nerrs++;
 		}
 
-		/*
-		 * FIXME Check that the btm_root/btm_fastroot is between 1 and number
-		 * of index blocks
-		 */
-
-		/*
-		 * FIXME Check that the btm_level/btm_fastlevel is equal to the level
-		 * fo the root block
-		 */
-
 		return nerrs;
 	}
 
@@ -167,11 +181,11 @@ btree_check_page(Relation rel, PageHeader header, BlockNumber block,
 	/* check there's enough space for index-relevant data */
 	if (header->pd_special > BLCKSZ - sizeof(BTPageOpaque))
 	{
-		ereport(WARNING,
-				(errmsg("[%d] there's not enough special space for index data (%d > %d)",
-						block,
-						(int) sizeof(BTPageOpaque),
-						BLCKSZ - header->pd_special)));
+		report_issue("btree_special", block, 0,
+					 "[%d] there's not enough special space for index data (%d > %d)",
+					 block,
+					 (int) sizeof(BTPageOpaque),
+					 BLCKSZ - header->pd_special);
 		nerrs++;
 	}
 
@@ -186,9 +200,9 @@ btree_check_page(Relation rel, PageHeader header, BlockNumber block,
 		{
 			if (opaque->btpo.level != 0)
 			{
-				ereport(WARNING,
-						(errmsg("[%d] is leaf page, but level %d is not zero",
-								block, opaque->btpo.level)));
+				report_issue("btree_leaf_level", block, 0,
+							 "[%d] is leaf page, but level %d is not zero",
+							 block, opaque->btpo.level);
 				nerrs++;
 			}
 		}
@@ -196,9 +210,9 @@ btree_check_page(Relation rel, PageHeader header, BlockNumber block,
 		{
 			if (opaque->btpo.level == 0)
 			{
-				ereport(WARNING,
-						(errmsg("[%d] is a non-leaf page, but level is zero",
-								block)));
+				report_issue("btree_level", block, 0,
+							 "[%d] is a non-leaf page, but level is zero",
+							 block);
 				nerrs++;
 			}
 		}
@@ -209,30 +223,111 @@ btree_check_page(Relation rel, PageHeader header, BlockNumber block,
 	 * page header is corrupted. So check what check_index_page returns, and
 	 * only proceed if there are no errors detected.
 	 */
-	nerrs += btree_check_tuples(rel, header, block, raw_page);
+	if (check_level >= CHECK_LEVEL_LINE_POINTERS)
+		nerrs += btree_check_tuples(rel, header, block, raw_page, plan);
 
-	/*
-	 * If this is a leaf page (containing actual pointers to the heap), then
-	 * update the bitmap.
-	 */
-	if (bitmap && P_ISLEAF(opaque))
-		nerrs += btree_add_tuples(rel, header, block, raw_page, bitmap);
+	return nerrs;
+}
+
+#ifndef PG_CHECK_OFFLINE
+/*
+ * The root / fast root on the metapage are verified with the structure (if
+ * enabled). If this is a leaf page (containing actual pointers to the heap),
+ * then update the bitmap (or the fingerprints). We don't decode keys stored
+ * on corrupted pages, so the fingerprints are incomplete in that case.
+ */
+uint32
+index_collect_items(Relation rel, PageHeader header, BlockNumber block,
+					char *raw_page, index_items * items, bool valid)
+{
+	uint32		nerrs = 0;
+	BTPageOpaque opaque;
+
+	/* only b-tree pages have items we collect */
+	if (rel->rd_rel->relam != BTREE_AM_OID)
+		return nerrs;
+
+	if (items->summary)
+		nerrs += btree_summary_add_page(items->summary, header, block, valid);
+
+	/* before adding the items, which may be duplicated by the splits */
+	if (items->splits)
+		btree_splits_add_page(items->splits, header, block, valid);
+
+	if ((block == BTREE_METAPAGE) ||
+		!(items->bitmap || items->filter || items->tids))
+		return nerrs;
+
+	opaque = (BTPageOpaque) (raw_page + header->pd_special);
+
+	if (P_ISLEAF(opaque))
+	{
+		if (items->filter && !valid)
+			items->filter->incomplete = true;
+
+		nerrs += btree_add_tuples(rel, header, block, raw_page, items);
+	}
 
 	return nerrs;
 }
+#endif
 
-/* checks index tuples on the page, one by one */
+/*
+ * checks index tuples on the page, one by one
+ *
+ * The tuple checks are compiled in two variants - a verbose one, with the
+ * DEBUG messages, and a lean one without them (used unless the messages
+ * would be sent to the client or the server log).
+ */
 uint32
-btree_check_tuples(Relation rel, PageHeader header, BlockNumber block, char *raw_page)
+btree_check_tuples(Relation rel, PageHeader header, BlockNumber block,
+				   char *raw_page, attribute_plan * plan)
 {
-	/* tuple checks */
 	int			ntuples = PageGetMaxOffsetNumber(raw_page);
-	int			i;
 	uint32		nerrs = 0;
 
 	ereport(DEBUG1,
 			(errmsg("[%d] max number of tuples = %d", block, ntuples)));
 
+	if (check_debug_enabled())
+		nerrs = btree_check_tuples_verbose(rel, header, block, raw_page, plan);
+	else
+		nerrs = btree_check_tuples_lean(rel, header, block, raw_page, plan);
+
+	/* check that the tuples don't overlap */
+	nerrs += check_page_items(header, block, plan);
+
+	if (nerrs > 0)
+		report_issue("page_corrupted", block, 0,
+					 "[%d] is probably corrupted, there were %d errors reported",
+					 block, nerrs);
+
+	return nerrs;
+}
+
+static uint32
+btree_check_tuples_lean(Relation rel, PageHeader header, BlockNumber block,
+						char *raw_page, attribute_plan * plan)
+{
+	return btree_check_tuples_impl(rel, header, block, raw_page, plan, false);
+}
+
+static uint32
+btree_check_tuples_verbose(Relation rel, PageHeader header, BlockNumber block,
+						   char *raw_page, attribute_plan * plan)
+{
+	return btree_check_tuples_impl(rel, header, block, raw_page, plan, true);
+}
+
+static pg_attribute_always_inline uint32
+btree_check_tuples_impl(Relation rel, PageHeader header, BlockNumber block,
+						char *raw_page, attribute_plan * plan, bool verbose)
+{
+	/* tuple checks */
+	int			ntuples = PageGetMaxOffsetNumber(raw_page);
+	int			i;
+	uint32		nerrs = 0;
+
 	/*
 	 * FIXME check btpo_flags (BTP_LEAF, BTP_ROOT, BTP_DELETED, BTP_META,
 	 * BTP_HALF_DEAD, BTP_SPLIT_END and BTP_HAS_GARBAGE) and act accordingly.
@@ -240,29 +335,20 @@ btree_check_tuples(Relation rel, PageHeader header, BlockNumber block, char *raw
 
 	/* FIXME this should check lp_flags, just as the heap check */
 	for (i = 0; i < ntuples; i++)
-		nerrs += btree_check_tuple(rel, header, block, i, raw_page);
-
-	if (nerrs > 0)
-		ereport(WARNING,
-				(errmsg("[%d] is probably corrupted, there were %d errors reported",
-						block, nerrs)));
+		nerrs += btree_check_tuple(rel, header, block, i, raw_page, plan,
+								   verbose);
 
 	return nerrs;
 }
 
 /* checks that the tuples do not overlap and then the individual attributes */
 /* FIXME This should do exactly the same checks of lp_flags as in heap.c */
-uint32
+static pg_attribute_always_inline uint32
 btree_check_tuple(Relation rel, PageHeader header, BlockNumber block,
-				  int i, char *raw_page)
+				  int i, char *raw_page, attribute_plan * plan, bool verbose)
 {
 	int			dlen;
 	uint32		nerrs = 0;
-	int			j,
-				a,
-				b,
-				c,
-				d;
 
 	ItemId		lp = &header->pd_linp[i];
 	IndexTuple	itup;
@@ -270,94 +356,69 @@ btree_check_tuple(Relation rel, PageHeader header, BlockNumber block,
 	/* we can ignore unused items */
 	if (lp->lp_flags == LP_UNUSED)
 	{
-		ereport(DEBUG2,
-				(errmsg("[%d:%d] index item is unused",
-						block, (i + 1))));
+		if (verbose)
+			ereport(DEBUG2,
+					(errmsg("[%d:%d] index item is unused",
+							block, (i + 1))));
 		return nerrs;
 	}
 
 	/*
-	 * We only expect LP_NORMAL and LP_UNUSED items in indexes, so report any
-	 * items with unexpected status.
+	 * We only expect LP_NORMAL, LP_DEAD and LP_UNUSED items in indexes, so
+	 * report any items with unexpected status. LP_DEAD are entries killed
+	 * by scans (pointing to dead heap tuples), and those keep the storage.
 	 */
-	if (lp->lp_flags != LP_NORMAL)
+	if ((lp->lp_flags != LP_NORMAL) && (lp->lp_flags != LP_DEAD))
 	{
-		ereport(DEBUG2,
-				(errmsg("[%d:%d] index item has unexpected lp_flags (%u)",
-						block, (i + 1), lp->lp_flags)));
+		report_issue("item_flags", block, (i + 1),
+					 "[%d:%d] index item with unexpected flags (%d)",
+					 block, (i + 1), lp->lp_flags);
 		return ++nerrs;
 	}
 
-	/* OK, so this is LP_NORMAL index item, and we can inspect it. */
+	/* OK, so this is LP_NORMAL (or killed) index item, and we can inspect it. */
 
 	itup = (IndexTuple) (raw_page + lp->lp_off);
 
-	ereport(DEBUG2,
-			(errmsg("[%d:%d] off=%d len=%d tid=(%d,%d)", block, (i + 1),
-					lp->lp_off, lp->lp_len,
-					ItemPointerGetBlockNumber(&(itup->t_tid)),
-					ItemPointerGetOffsetNumber(&(itup->t_tid)))));
-
-	/* check intersection with other tuples */
-
-	/* [A,B] vs [C,D] */
-	a = lp->lp_off;
-	b = lp->lp_off + lp->lp_len;
+	if (verbose)
+		ereport(DEBUG2,
+				(errmsg("[%d:%d] off=%d len=%d tid=(%d,%d)", block, (i + 1),
+						lp->lp_off, lp->lp_len,
+						ItemPointerGetBlockNumber(&(itup->t_tid)),
+						ItemPointerGetOffsetNumber(&(itup->t_tid)))));
 
-	ereport(DEBUG2,
-			(errmsg("[%d:%d] checking intersection with other tuples",
-					block, (i + 1))));
+	if (check_level < CHECK_LEVEL_TUPLES)
+		return nerrs;
 
-	for (j = 0; j < i; j++)
+	/* the tuple has to fit into the item */
+	if ((lp->lp_len < sizeof(IndexTupleData)) ||
+		(IndexTupleSize(itup) < sizeof(IndexTupleData)) ||
+		(IndexTupleSize(itup) > lp->lp_len))
 	{
-		ItemId		lp2 = &header->pd_linp[j];
-
-		/*
-		 * We only expect LP_NORMAL and LP_UNUSED items in (btree) indexes,
-		 * and we can skip the unused ones.
-		 */
-		if (lp2->lp_flags == LP_UNUSED)
-		{
-			ereport(DEBUG3,
-					(errmsg("[%d:%d] skipped (LP_UNUSED)", block, (j + 1))));
-			continue;
-		}
-		else if (lp2->lp_flags != LP_NORMAL)
-		{
-			ereport(WARNING,
-					(errmsg("[%d:%d] index item with unexpected flags (%d)",
-							block, (j + 1), lp2->lp_flags)));
-			continue;
-		}
-
-		c = lp2->lp_off;
-		d = lp2->lp_off + lp2->lp_len;
-
-		/* [A,C,B] or [A,D,B] or [C,A,D] or [C,B,D] */
-		if (((a < c) && (c < b)) || ((a < d) && (d < b)) ||
-			((c < a) && (a < d)) || ((c < b) && (b < d)))
-		{
-			ereport(WARNING,
-					(errmsg("[%d:%d] intersects with [%d:%d] (%d,%d) vs. (%d,%d)",
-							block, (i + 1), block, j, a, b, c, d)));
-			++nerrs;
-		}
+		report_issue("index_tuple_size", block, (i + 1),
+					 "[%d:%d] index tuple has invalid size %d (item length %d)",
+					 block, (i + 1), (int) IndexTupleSize(itup), lp->lp_len);
+		return ++nerrs;
 	}
 
+	if (check_level < CHECK_LEVEL_ATTRIBUTES)
+		return nerrs;
+
 	/* compute size of the data stored in the index tuple */
 	dlen = IndexTupleSize(itup) - IndexInfoFindDataOffset(itup->t_info);
 
-	/* check attributes only for tuples with (lp_flags==LP_NORMAL) */
+	/* check attributes only for tuples with storage (LP_NORMAL, LP_DEAD) */
 	nerrs += btree_check_attributes(rel, header, block, i + 1,
-									raw_page, dlen);
+									raw_page, dlen, plan, verbose);
 
 	return nerrs;
 }
 
 /* checks the individual attributes of the tuple */
-static uint32
+static pg_attribute_always_inline uint32
 btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
-					   OffsetNumber offnum, char *raw_page, int dlen)
+					   OffsetNumber offnum, char *raw_page, int dlen,
+					   attribute_plan * plan, bool verbose)
 {
 	IndexTuple	tuple;
 	uint32		nerrs = 0;
@@ -369,8 +430,13 @@ btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
 	ItemId		linp;
 	bool		has_nulls = false;
 
-	ereport(DEBUG2,
-			(errmsg("[%d:%d] checking attributes for the tuple", block, offnum)));
+	/* without a tuple descriptor (offline checks) we can't check attributes */
+	if (rel == NULL)
+		return nerrs;
+
+	if (verbose)
+		ereport(DEBUG2,
+				(errmsg("[%d:%d] checking attributes for the tuple", block, offnum)));
 
 	/* get the index tuple and info about the page */
 	linp = &header->pd_linp[offnum - 1];
@@ -380,9 +446,10 @@ btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
 	/* current attribute offset - always starts at (raw_page + off) */
 	off = linp->lp_off + IndexInfoFindDataOffset(tuple->t_info);
 
-	ereport(DEBUG3,
-			(errmsg("[%d:%d] tuple has %d attributes", block, offnum,
-					RelationGetNumberOfAttributes(rel))));
+	if (verbose)
+		ereport(DEBUG3,
+				(errmsg("[%d:%d] tuple has %d attributes", block, offnum,
+						RelationGetNumberOfAttributes(rel))));
 
 	/* XXX: MAXALIGN */
 	bitmap = (bits8 *) (raw_page + linp->lp_off + sizeof(IndexTupleData));
@@ -394,21 +461,36 @@ btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
 	 */
 	if (!P_ISLEAF(opaque) && offnum == P_FIRSTDATAKEY(opaque) && dlen == 0)
 	{
-		ereport(DEBUG3,
-				(errmsg("[%d:%d] first data key tuple on non-leaf block => no data, skipping",
-						block, offnum)));
+		if (verbose)
+			ereport(DEBUG3,
+					(errmsg("[%d:%d] first data key tuple on non-leaf block => no data, skipping",
+							block, offnum)));
 		return nerrs;
 	}
 
 	/*
-	 * check all the index attributes
+	 * Skip the leading fixed-width attributes using the plan (see the same
+	 * thing in check_heap_tuple_attributes).
+	 */
+	j = 0;
+
+	if (!verbose && (plan != NULL) && (plan->nfixed > 0) &&
+		!IndexTupleHasNulls(tuple) && (dlen > 0) && (off == MAXALIGN(off)) &&
+		(off + plan->fixed_size <= linp->lp_off + linp->lp_len))
+	{
+		j = plan->nfixed;
+		off += plan->fixed_size;
+	}
+
+	/*
+	 * check all the (remaining) index attributes
 	 *
 	 * TODO This is mostly copy'n'paste from check_heap_tuple_attributes, so
 	 * maybe it could be refactored to share the code.
 	 */
-	for (j = 0; j < rel->rd_att->natts; j++)
+	for (; j < rel->rd_att->natts; j++)
 	{
-		Form_pg_attribute attr = rel->rd_att->attrs[j];
+		Form_pg_attribute attr = TupleDescAttr(rel->rd_att, j);
 
 		/* actual length of the attribute value */
 		int			len;
@@ -423,9 +505,10 @@ btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
 		 */
 		if (IndexTupleHasNulls(tuple) && att_isnull(j, bitmap))
 		{
-			ereport(DEBUG3,
-					(errmsg("[%d:%d] attribute '%s' is NULL (skipping)",
-							block, offnum, attr->attname.data)));
+			if (verbose)
+				ereport(DEBUG3,
+						(errmsg("[%d:%d] attribute '%s' is NULL (skipping)",
+								block, offnum, attr->attname.data)));
 			has_nulls = true;
 			continue;
 		}
@@ -444,9 +527,9 @@ btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
 
 			if (len < 0)
 			{
-				ereport(WARNING,
-						(errmsg("[%d:%d] attribute '%s' has negative length < 0 (%d)",
-								block, offnum, attr->attname.data, len)));
+				report_issue("attribute_length", block, offnum,
+							 "[%d:%d] attribute '%s' has negative length < 0 (%d)",
+							 block, offnum, attr->attname.data, len);
 				++nerrs;
 				break;
 			}
@@ -457,9 +540,9 @@ btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
 				if ((VARRAWSIZE_4B_C(raw_page + off) < 0) ||
 					(VARRAWSIZE_4B_C(raw_page + off) > 1024 * 1024))
 				{
-					ereport(WARNING,
-							(errmsg("[%d:%d]  attribute '%s' has invalid length %d (should be between 0 and 1G)",
-									block, offnum, attr->attname.data, VARRAWSIZE_4B_C(raw_page + off))));
+					report_issue("attribute_varlena_length", block, offnum,
+								 "[%d:%d]  attribute '%s' has invalid length %d (should be between 0 and 1G)",
+								 block, offnum, attr->attname.data, VARRAWSIZE_4B_C(raw_page + off));
 					++nerrs;
 
 					/*
@@ -480,8 +563,23 @@ btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
 			 *
 			 * if the string is not properly terminated, then this returns
 			 * 'remaining space + 1' so it's detected
+			 *
+			 * the string has to start before the tuple end, otherwise the
+			 * remaining space would wrap around (tuples without data are
+			 * not checked, see below)
 			 */
-			len = strnlen(raw_page + off, linp->lp_off + len + linp->lp_len - off) + 1;
+			if ((dlen > 0) && (off >= linp->lp_off + linp->lp_len))
+			{
+				report_issue("attribute_overflow", block, offnum,
+							 "[%d:%d] attribute '%s' (off=%d) starts after tuple end (off=%d, len=%d)",
+							 block, offnum, attr->attname.data,
+							 off, linp->lp_off, linp->lp_len);
+				++nerrs;
+				break;
+			}
+
+			len = (dlen > 0) ?
+				strnlen(raw_page + off, linp->lp_off + linp->lp_len - off) + 1 : 0;
 		}
 		else
 			/* attributes with fixed length */
@@ -496,10 +594,10 @@ btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
 		 */
 		if ((dlen > 0) && (off + len > (linp->lp_off + linp->lp_len)))
 		{
-			ereport(WARNING,
-					(errmsg("[%d:%d] attribute '%s' (off=%d len=%d) overflows tuple end (off=%d, len=%d)",
-							block, offnum, attr->attname.data,
-							off, len, linp->lp_off, linp->lp_len)));
+			report_issue("attribute_overflow", block, offnum,
+						 "[%d:%d] attribute '%s' (off=%d len=%d) overflows tuple end (off=%d, len=%d)",
+						 block, offnum, attr->attname.data,
+						 off, len, linp->lp_off, linp->lp_len);
 			++nerrs;
 			break;
 		}
@@ -507,23 +605,25 @@ btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
 		/* skip to the next attribute */
 		off += (dlen > 0) ? len : 0;
 
-		ereport(DEBUG3,
-				(errmsg("[%d:%d] attribute '%s' len=%d",
-						block, offnum, attr->attname.data, len)));
+		if (verbose)
+			ereport(DEBUG3,
+					(errmsg("[%d:%d] attribute '%s' len=%d",
+							block, offnum, attr->attname.data, len)));
 	}
 
-	ereport(DEBUG3,
-			(errmsg("[%d:%d] last attribute ends at %d, tuple ends at %d",
-					block, offnum, off, linp->lp_off + linp->lp_len)));
+	if (verbose)
+		ereport(DEBUG3,
+				(errmsg("[%d:%d] last attribute ends at %d, tuple ends at %d",
+						block, offnum, off, linp->lp_off + linp->lp_len)));
 
 	/*
 	 * Check if tuples with nulls (INDEX_NULL_MASK) actually have NULLs.
 	 */
 	if (IndexTupleHasNulls(tuple) && !has_nulls)
 	{
-		ereport(WARNING,
-				(errmsg("[%d:%d] tuple has INDEX_NULL_MASKL flag but no NULLs",
-						block, offnum)));
+		report_issue("null_bitmap", block, offnum,
+					 "[%d:%d] tuple has INDEX_NULL_MASKL flag but no NULLs",
+					 block, offnum);
 		++nerrs;
 	}
 
@@ -533,19 +633,20 @@ btree_check_attributes(Relation rel, PageHeader header, BlockNumber block,
 	 */
 	if (MAXALIGN(off) > linp->lp_off + linp->lp_len)
 	{
-		ereport(WARNING,
-				(errmsg("[%d:%d] the last attribute ends at %d but the tuple ends at %d",
-						block, offnum, off, linp->lp_off + linp->lp_len)));
+		report_issue("tuple_end", block, offnum,
+					 "[%d:%d] the last attribute ends at %d but the tuple ends at %d",
+					 block, offnum, off, linp->lp_off + linp->lp_len);
 		++nerrs;
 	}
 
 	return nerrs;
 }
 
+#ifndef PG_CHECK_OFFLINE
 /* checks index tuples on the page, one by one */
 static uint32
 btree_add_tuples(Relation rel, PageHeader header, BlockNumber block,
-				 char *raw_page, item_bitmap * bitmap)
+				 char *raw_page, index_items * items)
 {
 	/* tuple checks */
 	int			nerrs = 0;
@@ -564,8 +665,12 @@ btree_add_tuples(Relation rel, PageHeader header, BlockNumber block,
 		OffsetNumber offset;
 		ItemId		lp = &header->pd_linp[item];
 
-		/* we only care about LP_NORMAL items, skip others */
-		if (lp->lp_flags != LP_NORMAL)
+		/*
+		 * We only care about items with storage. Killed items (LP_DEAD)
+		 * still point to heap line pointers, which are not removed until
+		 * the index entries are, so those are expected in the heap too.
+		 */
+		if ((lp->lp_flags != LP_NORMAL) && (lp->lp_flags != LP_DEAD))
 			continue;
 
 		itup = (IndexTuple) (raw_page + lp->lp_off);
@@ -573,12 +678,25 @@ btree_add_tuples(Relation rel, PageHeader header, BlockNumber block,
 		offset = ItemPointerGetOffsetNumber(&(itup->t_tid)) - 1;
 		block = ItemPointerGetBlockNumber(&(itup->t_tid));
 
-		/* we should not have two index items pointing to the same tuple */
-		if (bitmap_get(bitmap, block, offset))
+		if (items->filter && !items->filter->incomplete)
+			filter_add_index_tuple(items->filter, rel, itup);
+
+		if (items->tids)
+			tid_sort_add(items->tids, &itup->t_tid);
+
+		if (items->bitmap == NULL)
+			continue;
+
+		/*
+		 * We should not have two index items pointing to the same tuple,
+		 * unless a concurrent page split made us see the items twice.
+		 */
+		if (!bitmap_get(items->bitmap, block, offset))
+			bitmap_set(items->bitmap, block, offset);
+		else if (!(items->splits && items->splits->duplicated))
 			nerrs++;
-		else
-			bitmap_set(bitmap, block, offset);
 	}
 
 	return nerrs;
 }
+#endif
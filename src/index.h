@@ -3,12 +3,45 @@
 
 #include "postgres.h"
 #include "access/heapam.h"
+#include "common.h"
 #include "heap.h"
 #include "item-bitmap.h"
+#include "fingerprint.h"
+
+struct btree_summary;
+struct btree_splits;
+struct tid_sort;
+
+/*
+ * items collected from the index, for the cross-check with the heap (and
+ * summaries of the pages, for the structure checks)
+ */
+typedef struct index_items
+{
+	item_bitmap *bitmap;		/* TIDs of the index tuples (or NULL) */
+	key_filter *filter;			/* fingerprints of (TID, key) (or NULL) */
+	struct btree_summary *summary;	/* b-tree page summaries (or NULL) */
+	struct tid_sort *tids;		/* sorted TIDs of the index tuples (or NULL) */
+	struct btree_splits *splits;	/* concurrent page splits (or NULL) */
+}			index_items;
 
 typedef uint32 (*check_page_cb) (Relation, PageHeader, BlockNumber,
-								 char *, item_bitmap *);
+								 char *, attribute_plan *);
 
 check_page_cb lookup_check_method(Oid oid, bool *crosscheck);
 
+/* Collects items of a checked index page (for the cross-check with the heap,
+ * or the structure checks).
+ *
+ * - rel : the index
+ * - header, block, raw_page : the page
+ * - items : the collected items
+ * - valid : no issues were found on the page
+ *
+ * Returns number of issues found (duplicate TIDs).
+ */
+uint32		index_collect_items(Relation rel, PageHeader header,
+					BlockNumber block, char *raw_page,
+					index_items * items, bool valid);
+
 #endif
@@ -0,0 +1,218 @@
+#include "postgres.h"
+
+#include <stdarg.h>
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+
+#include "issues.h"
+
+/* number of columns of the result (see pg_check_table_issues) */
+#define ISSUES_NATTS	6
+
+issue_collector *pgcheck_issues = NULL;
+bool		pgcheck_issues_quiet = false;
+
+static issue_stats *issues_get_stats(issue_collector * collector,
+				 const char *code);
+static void issues_put_row(issue_collector * collector, Oid relid,
+			   BlockNumber block, int offnum, const char *code,
+			   const char *detail, uint64 count);
+
+issue_collector *
+issues_init(FunctionCallInfo fcinfo, int max_issues, bool aggregate)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext oldcontext;
+	issue_collector *collector;
+	TupleDesc	tupdesc;
+
+	if ((rsinfo == NULL) || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tupdesc->natts != ISSUES_NATTS)
+		elog(ERROR, "incorrect number of output arguments");
+
+	if (max_issues < -1)
+		elog(ERROR, "invalid max_issues value %d", max_issues);
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	collector = (issue_collector *) palloc0(sizeof(issue_collector));
+
+	collector->tupdesc = CreateTupleDescCopy(tupdesc);
+	collector->tupstore = tuplestore_begin_heap(true, false, work_mem);
+	collector->mcxt = rsinfo->econtext->ecxt_per_query_memory;
+	collector->max_issues = max_issues;
+	collector->aggregate = aggregate;
+
+	collector->maxstats = 16;
+	collector->stats = (issue_stats *) palloc(collector->maxstats * sizeof(issue_stats));
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = collector->tupstore;
+	rsinfo->setDesc = collector->tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return collector;
+}
+
+void
+issues_add(issue_collector * collector, const char *code,
+		   BlockNumber block, int offnum, const char *fmt,...)
+{
+	issue_stats *stats = issues_get_stats(collector, code);
+	char		message[1024];
+	char	   *detail = message;
+	va_list		args;
+
+	stats->count++;
+
+	/* Only the first issue is kept in aggregate mode (and counted). */
+	if (collector->aggregate && (stats->count > 1))
+		return;
+
+	/* Past the limit, only count the issues (don't even format them). */
+	if (!collector->aggregate && (collector->max_issues >= 0) &&
+		(collector->nissues >= collector->max_issues))
+	{
+		stats->ndropped++;
+		return;
+	}
+
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+
+	/* strip the "[block:item] " prefix, those are separate columns */
+	if ((detail[0] == '[') && (strstr(detail, "] ") != NULL))
+		detail = strstr(detail, "] ") + 2;
+
+	while (*detail == ' ')
+		detail++;
+
+	if (collector->aggregate)
+	{
+		stats->block = block;
+		stats->offnum = offnum;
+		stats->detail = MemoryContextStrdup(collector->mcxt, detail);
+		return;
+	}
+
+	issues_put_row(collector, collector->relid, block, offnum, code, detail, 1);
+
+	collector->nissues++;
+}
+
+void
+issues_set_relation(Oid relid)
+{
+	stats_set_relation(relid);
+
+	pgcheck_issues_quiet = false;
+
+	if (pgcheck_issues != NULL)
+		pgcheck_issues->relid = relid;
+}
+
+void
+issues_finish(issue_collector * collector)
+{
+	int			i;
+
+	for (i = 0; i < collector->nstats; i++)
+	{
+		issue_stats *stats = &collector->stats[i];
+
+		if (collector->aggregate)
+			issues_put_row(collector, stats->relid, stats->block, stats->offnum,
+						   stats->code, stats->detail, stats->count);
+		else if (stats->ndropped > 0)
+		{
+			char		detail[128];
+
+			snprintf(detail, sizeof(detail),
+					 UINT64_FORMAT " more issues not reported (limit reached)",
+					 stats->ndropped);
+
+			issues_put_row(collector, stats->relid, InvalidBlockNumber, 0,
+						   stats->code, detail, stats->ndropped);
+		}
+	}
+}
+
+/*
+ * Find counters for the code (and the current relation), or add them. The
+ * codes are string constants, so comparing the pointers is usually enough.
+ * There are only a few distinct codes, so a linear search is fine.
+ */
+static issue_stats *
+issues_get_stats(issue_collector * collector, const char *code)
+{
+	int			i;
+	issue_stats *stats;
+
+	for (i = 0; i < collector->nstats; i++)
+	{
+		stats = &collector->stats[i];
+
+		if ((stats->relid == collector->relid) &&
+			((stats->code == code) || (strcmp(stats->code, code) == 0)))
+			return stats;
+	}
+
+	if (collector->nstats == collector->maxstats)
+	{
+		collector->maxstats *= 2;
+		collector->stats = (issue_stats *) repalloc(collector->stats,
+													collector->maxstats * sizeof(issue_stats));
+	}
+
+	stats = &collector->stats[collector->nstats++];
+
+	memset(stats, 0, sizeof(issue_stats));
+	stats->relid = collector->relid;
+	stats->code = code;
+
+	return stats;
+}
+
+static void
+issues_put_row(issue_collector * collector, Oid relid, BlockNumber block,
+			   int offnum, const char *code, const char *detail,
+			   uint64 count)
+{
+	Datum		values[ISSUES_NATTS];
+	bool		nulls[ISSUES_NATTS];
+
+	memset(nulls, 0, sizeof(nulls));
+
+	values[0] = ObjectIdGetDatum(relid);
+	values[1] = Int64GetDatum((int64) block);
+	values[2] = Int32GetDatum(offnum);
+	values[3] = CStringGetTextDatum(code);
+	values[4] = CStringGetTextDatum(detail);
+	values[5] = Int64GetDatum((int64) count);
+
+	nulls[1] = (block == InvalidBlockNumber);
+	nulls[2] = (offnum == 0);
+
+	tuplestore_putvalues(collector->tupstore, collector->tupdesc,
+						 values, nulls);
+
+	/* the tuplestore has a copy */
+	pfree(DatumGetPointer(values[3]));
+	pfree(DatumGetPointer(values[4]));
+}
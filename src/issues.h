@@ -0,0 +1,111 @@
+#ifndef ISSUES_CHECK_H
+#define ISSUES_CHECK_H
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "storage/block.h"
+#include "utils/tuplestore.h"
+
+#ifndef PG_CHECK_OFFLINE
+#include "stats.h"
+#endif
+
+/*
+ * Collector of the issues found by the checks, used by the set-returning
+ * functions (pg_check_table_issues etc.) instead of reporting each issue
+ * as a WARNING.
+ *
+ * At most max_issues issues are returned individually, the rest is only
+ * counted (per relation and check code), so that checking a relation with
+ * millions of issues does not spend most of the time formatting messages.
+ * In aggregate mode, only a single row per (relation, code) is returned,
+ * with the first issue and the number of issues.
+ */
+typedef struct issue_stats
+{
+	Oid			relid;			/* relation with the issues */
+	const char *code;			/* check code */
+	uint64		count;			/* number of issues */
+	uint64		ndropped;		/* issues not returned individually */
+	BlockNumber block;			/* first issue (aggregate mode) */
+	int			offnum;
+	char	   *detail;
+}			issue_stats;
+
+typedef struct issue_collector
+{
+	Tuplestorestate *tupstore;	/* rows returned by the function */
+	TupleDesc	tupdesc;
+	MemoryContext mcxt;			/* per-query context (for the stats) */
+
+	Oid			relid;			/* relation being checked */
+	int			max_issues;		/* issues returned individually (-1 : all) */
+	bool		aggregate;		/* one row per (relation, code) */
+	uint64		nissues;		/* issues returned individually */
+
+	int			nstats;
+	int			maxstats;
+	issue_stats *stats;
+}			issue_collector;
+
+/* collector of the running check (NULL when reporting WARNINGs) */
+extern issue_collector *pgcheck_issues;
+
+/*
+ * Issues are only counted by the checks, not reported (used when checking
+ * a page read from the file, which is re-read and checked again if there
+ * are any issues, see check_heap_range).
+ */
+extern bool pgcheck_issues_quiet;
+
+/*
+ * Reports an issue found by a check, i.e. a WARNING or a row collected by
+ * the active collector. The format is the same in both cases (the "[block]"
+ * or "[block:item]" prefix of the message is stripped from the detail).
+ * The issue is also counted in the cumulative statistics (pg_check_stats).
+ * Nothing is reported while pgcheck_issues_quiet is set. The offline checks
+ * always report WARNINGs.
+ *
+ * - code : check code (string constant)
+ * - block : block with the issue (InvalidBlockNumber if not applicable)
+ * - offnum : item with the issue (0 if not applicable)
+ */
+#ifdef PG_CHECK_OFFLINE
+#define report_issue(code, block, offnum, ...) \
+	ereport(WARNING, (errmsg(__VA_ARGS__)))
+#else
+#define report_issue(code, block, offnum, ...) \
+	do { \
+		if (pgcheck_issues_quiet) \
+			break; \
+		stats_count_issue(code); \
+		if (pgcheck_issues != NULL) \
+			issues_add(pgcheck_issues, (code), (block), (offnum), __VA_ARGS__); \
+		else \
+			ereport(WARNING, (errmsg(__VA_ARGS__))); \
+	} while (0)
+#endif
+
+/* Prepares the collector for a set-returning function (materialize mode).
+ *
+ * - fcinfo : call info of the function
+ * - max_issues : issues returned individually (-1 : all)
+ * - aggregate : return a single row per (relation, code)
+ *
+ * Returns the collector.
+ */
+issue_collector *issues_init(FunctionCallInfo fcinfo, int max_issues,
+			bool aggregate);
+
+/* Records an issue (see report_issue). */
+void		issues_add(issue_collector * collector, const char *code,
+		   BlockNumber block, int offnum, const char *fmt,...);
+
+/* Sets relation the following issues belong to (if collecting), and
+ * resets pgcheck_issues_quiet (in case the previous check failed). */
+void		issues_set_relation(Oid relid);
+
+/* Adds the aggregated rows, or rows for the issues over the limit. */
+void		issues_finish(issue_collector * collector);
+
+#endif							/* ISSUES_CHECK_H */
@@ -1,6 +1,11 @@
 #include "item-bitmap.h"
+#include "bitmap-container.h"
+#include "diff.h"
+#include "issues.h"
+#include "memory.h"
 
 #include "access/itup.h"
+#include "access/transam.h"
 
 #if (PG_VERSION_NUM >= 90300)
 #include <math.h>
@@ -12,20 +17,73 @@
  * The bitmap is allocated as one chunk of memory, assuming space for
  * MaxHeapTuplesPerPage items on each page. That means about 40B for
  * 8kB pages and 150B for 32kB pages.
+ *
+ * Each page starts at a word (uint64) boundary, so that processes updating
+ * bits for disjoint ranges of pages never touch the same byte, and so that
+ * the bitmaps can be compared/counted a word at a time.
  */
-#define BITMAP_BYTES_PER_PAGE	((Size)(MaxHeapTuplesPerPage + 7) / 8)
+#define BITMAP_BYTES_PER_PAGE	\
+	TYPEALIGN(sizeof(uint64), (Size)(MaxHeapTuplesPerPage + 7) / 8)
 
 #define GetBitmapIndex(b,p,o)	\
-	((p - (b)->startpage) * MaxHeapTuplesPerPage + (o))
+	((Size) ((p) - (b)->startpage) * BITMAP_BYTES_PER_PAGE * 8 + (o))
+
+/* largest bitmap printed with the data (larger ones only get a summary) */
+#define BITMAP_PRINT_MAX_BYTES	(64 * 1024)
 
 #define GetBitmapByte(b,p,o)	(GetBitmapIndex(b,p,o) / 8)
 #define GetBitmapBit(b,p,o)		(GetBitmapIndex(b,p,o) % 8)
 
-static int	count_digits(uint64 values[], BlockNumber n);
-static char *itoa(int value, char *str, int maxlen);
-static char *hex(const char *data, int n);
-static char *binary(const char *data, int n);
-static char *base64(const char *data, int n);
+/*
+ * Compressed bitmaps don't need any padding, so the items are simply
+ * numbered (page * MaxHeapTuplesPerPage + item), and each container
+ * covers CONTAINER_BITS of those numbers.
+ */
+#define GetCompressedIndex(b,p,o)	\
+	((uint64) ((p) - (b)->startpage) * MaxHeapTuplesPerPage + (o))
+
+#if (PG_VERSION_NUM >= 90600)
+/*
+ * Header of a bitmap stored in a DSM segment, followed by the pages,
+ * skipped pages and data arrays (in this order).
+ */
+typedef struct item_bitmap_shared
+{
+	BlockNumber startpage;
+	BlockNumber npages;
+	Size		nbytes;
+	TransactionId horizon;		/* snapshot mode, ignored items follow data */
+	TransactionId frozenxid;	/* relfrozenxid of the heap relation */
+}			item_bitmap_shared;
+
+#define SHARED_BITMAP_PAGES(s)	\
+	((uint64 *) ((char *) (s) + MAXALIGN(sizeof(item_bitmap_shared))))
+
+#define SHARED_BITMAP_SKIPPED(s)	\
+	((bool *) ((char *) SHARED_BITMAP_PAGES(s) + MAXALIGN(sizeof(uint64) * (s)->npages)))
+
+#define SHARED_BITMAP_DATA(s)	\
+	((char *) SHARED_BITMAP_SKIPPED(s) + MAXALIGN(sizeof(bool) * (s)->npages))
+
+static item_bitmap *bitmap_from_shared(dsm_segment *segment);
+#endif
+
+static uint64 report_mismatches(item_bitmap * bitmap, item_bitmap * bitmap_b,
+				  uint64 index, uint64 diff, uint64 bits_a);
+static OffsetNumber bitmap_page_maxoff(item_bitmap * bitmap_a,
+				   item_bitmap * bitmap_b, BlockNumber page);
+static uint64 bitmap_compare_compressed(item_bitmap * bitmap_a,
+						  item_bitmap * bitmap_b);
+static void bitmap_print_compressed(item_bitmap * bitmap);
+static void bitmap_set_ignore(item_bitmap * bitmap, BlockNumber page, int item);
+static void containers_set(bitmap_container ** containers, uint64 index);
+static inline int popcount64(uint64 word);
+
+static Size count_digits(uint64 values[], BlockNumber n);
+static char *itoa(uint64 value, char *str, Size maxlen);
+static char *hex(const char *data, Size n);
+static char *binary(const char *data, Size n);
+static char *base64(const char *data, Size n);
 
 /* init the bitmap (allocate, set default values) */
 item_bitmap *
@@ -40,13 +98,157 @@ bitmap_init(BlockNumber startpage, BlockNumber npages)
 
 	bitmap->startpage = startpage;
 	bitmap->npages = npages;
-	bitmap->pages = (uint64 *) palloc0(sizeof(uint64) * npages);
+	bitmap->pages = (uint64 *) check_alloc_huge(sizeof(uint64) * npages);
 
 	bitmap->nbytes = npages * BITMAP_BYTES_PER_PAGE;
-	bitmap->data = (char *) palloc0(bitmap->nbytes);
+	bitmap->data = (char *) check_alloc_huge(bitmap->nbytes);
+
+	return bitmap;
+}
+
+/* init a compressed bitmap (containers are allocated on demand) */
+item_bitmap *
+bitmap_init_compressed(BlockNumber startpage, BlockNumber npages)
+{
+	item_bitmap *bitmap;
+	uint64		nitems = (uint64) npages * MaxHeapTuplesPerPage;
+
+	bitmap = (item_bitmap *) palloc0(sizeof(item_bitmap));
+
+	bitmap->type = BITMAP_TYPE_COMPRESSED;
+	bitmap->startpage = startpage;
+	bitmap->npages = npages;
+
+	bitmap->ncontainers = (nitems + CONTAINER_BITS - 1) / CONTAINER_BITS;
+	bitmap->containers = (bitmap_container **)
+		palloc0(Max(1, bitmap->ncontainers) * sizeof(bitmap_container *));
+
+	return bitmap;
+}
+
+#if (PG_VERSION_NUM >= 90600)
+/* init the bitmap in a new DSM segment */
+item_bitmap *
+bitmap_init_shared(BlockNumber startpage, BlockNumber npages,
+				   TransactionId horizon, TransactionId frozenxid)
+{
+	dsm_segment *segment;
+	item_bitmap_shared *shared;
+	Size		nbytes = npages * BITMAP_BYTES_PER_PAGE;
+	Size		size = bitmap_estimate_shared_size(npages,
+												   TransactionIdIsValid(horizon));
+
+	segment = dsm_create(size, 0);
+
+	shared = (item_bitmap_shared *) dsm_segment_address(segment);
+
+	/* the segment is not zeroed, so do that explicitly */
+	memset(shared, 0, size);
+
+	shared->startpage = startpage;
+	shared->npages = npages;
+	shared->nbytes = nbytes;
+	shared->horizon = horizon;
+	shared->frozenxid = frozenxid;
+
+	return bitmap_from_shared(segment);
+}
+
+/* size of the DSM segment of a shared bitmap */
+Size
+bitmap_estimate_shared_size(BlockNumber npages, bool snapshot)
+{
+	Size		nbytes = (Size) npages * BITMAP_BYTES_PER_PAGE;
+	Size		size;
+
+	size = MAXALIGN(sizeof(item_bitmap_shared)) +
+		MAXALIGN(sizeof(uint64) * npages) +
+		MAXALIGN(sizeof(bool) * npages) + nbytes;
+
+	/* in snapshot mode, the ignored items follow the data */
+	if (snapshot)
+		size += nbytes;
+
+	return size;
+}
+
+/* handle of the DSM segment (for bitmap_attach in other processes) */
+dsm_handle
+bitmap_get_handle(item_bitmap * bitmap)
+{
+	Assert(bitmap->segment != NULL);
+
+	return dsm_segment_handle(bitmap->segment);
+}
+
+/* attach a bitmap created by bitmap_init_shared */
+item_bitmap *
+bitmap_attach(dsm_handle handle)
+{
+	dsm_segment *segment = dsm_attach(handle);
+
+	if (segment == NULL)
+		elog(ERROR, "could not attach to shared bitmap segment");
+
+	return bitmap_from_shared(segment);
+}
+
+/* build a backend-local bitmap struct, pointing into the segment */
+static item_bitmap *
+bitmap_from_shared(dsm_segment *segment)
+{
+	item_bitmap *bitmap;
+	item_bitmap_shared *shared;
+
+	shared = (item_bitmap_shared *) dsm_segment_address(segment);
+
+	bitmap = (item_bitmap *) palloc0(sizeof(item_bitmap));
+
+	bitmap->startpage = shared->startpage;
+	bitmap->npages = shared->npages;
+	bitmap->nbytes = shared->nbytes;
+	bitmap->pages = SHARED_BITMAP_PAGES(shared);
+	bitmap->skipped = SHARED_BITMAP_SKIPPED(shared);
+	bitmap->data = SHARED_BITMAP_DATA(shared);
+	bitmap->segment = segment;
+
+	bitmap->horizon = shared->horizon;
+	bitmap->frozenxid = shared->frozenxid;
+	if (TransactionIdIsValid(shared->horizon))
+		bitmap->ignore = bitmap->data + shared->nbytes;
 
 	return bitmap;
 }
+#endif
+
+/* enable the snapshot mode (allocate space for the ignored items) */
+void
+bitmap_enable_snapshot(item_bitmap * bitmap, TransactionId horizon,
+					   TransactionId frozenxid)
+{
+	Assert(TransactionIdIsValid(horizon));
+	Assert(!bitmap_is_shared(bitmap));
+
+	bitmap->horizon = horizon;
+	bitmap->frozenxid = frozenxid;
+
+	if (bitmap->type == BITMAP_TYPE_DENSE)
+		bitmap->ignore = (char *) check_alloc_huge(bitmap->nbytes);
+	else
+		bitmap->ignore_containers = (bitmap_container **)
+			palloc0(Max(1, bitmap->ncontainers) * sizeof(bitmap_container *));
+}
+
+/* is the bitmap in a DSM segment? */
+bool
+bitmap_is_shared(item_bitmap * bitmap)
+{
+#if (PG_VERSION_NUM >= 90600)
+	return (bitmap->segment != NULL);
+#else
+	return false;
+#endif
+}
 
 /* copy the bitmap (except the actual bitmap data, keep zeroes) */
 item_bitmap *
@@ -57,17 +259,19 @@ bitmap_copy(item_bitmap * src)
 	/* sanity check */
 	Assert(src != NULL);
 
+	if (src->type == BITMAP_TYPE_COMPRESSED)
+		return bitmap_init_compressed(src->startpage, src->npages);
+
 	bitmap = (item_bitmap *) palloc0(sizeof(item_bitmap));
 
 	bitmap->startpage = src->startpage;
 	bitmap->npages = src->npages;
 	bitmap->nbytes = src->nbytes;
 
-	bitmap->pages = (uint64 *) palloc(sizeof(uint64) * src->npages);
+	bitmap->pages = (uint64 *) check_alloc_huge(sizeof(uint64) * src->npages);
 	memcpy(bitmap->pages, src->pages, sizeof(uint64) * src->npages);
 
-	bitmap->data = (char *) palloc(src->nbytes);
-	memset(bitmap->data, 0, src->nbytes);
+	bitmap->data = (char *) check_alloc_huge(src->nbytes);
 
 	return bitmap;
 }
@@ -76,7 +280,21 @@ bitmap_copy(item_bitmap * src)
 void
 bitmap_reset(item_bitmap * bitmap)
 {
-	memset(bitmap->data, 0, bitmap->nbytes);
+	uint32		i;
+
+	if (bitmap->type == BITMAP_TYPE_DENSE)
+	{
+		memset(bitmap->data, 0, bitmap->nbytes);
+		return;
+	}
+
+	for (i = 0; i < bitmap->ncontainers; i++)
+	{
+		if (bitmap->containers[i] != NULL)
+			container_free(bitmap->containers[i]);
+
+		bitmap->containers[i] = NULL;
+	}
 }
 
 /* free the allocated resources */
@@ -85,8 +303,50 @@ bitmap_free(item_bitmap * bitmap)
 {
 	Assert(bitmap != NULL);
 
+	if (bitmap->type == BITMAP_TYPE_COMPRESSED)
+	{
+		bitmap_reset(bitmap);
+		pfree(bitmap->containers);
+
+		if (bitmap->skipped != NULL)
+			pfree(bitmap->skipped);
+
+		if (bitmap->ignore_containers != NULL)
+		{
+			uint32		i;
+
+			for (i = 0; i < bitmap->ncontainers; i++)
+			{
+				if (bitmap->ignore_containers[i] != NULL)
+					container_free(bitmap->ignore_containers[i]);
+			}
+
+			pfree(bitmap->ignore_containers);
+		}
+
+		pfree(bitmap);
+		return;
+	}
+
+#if (PG_VERSION_NUM >= 90600)
+	/* the shared bitmap goes away with the segment */
+	if (bitmap->segment != NULL)
+	{
+		dsm_detach(bitmap->segment);
+		pfree(bitmap);
+		return;
+	}
+#endif
+
 	pfree(bitmap->pages);
 	pfree(bitmap->data);
+
+	if (bitmap->ignore != NULL)
+		pfree(bitmap->ignore);
+
+	if (bitmap->skipped != NULL)
+		pfree(bitmap->skipped);
+
 	pfree(bitmap);
 }
 
@@ -99,31 +359,93 @@ bitmap_add_heap_items(item_bitmap * bitmap, PageHeader header,
 	int			nerrs = 0;
 	int			ntuples = PageGetMaxOffsetNumber(raw_page);
 	int			item;
-	Page		p = (Page) raw_page;
 	bool		add[MaxHeapTuplesPerPage];
+	bool		ignore[MaxHeapTuplesPerPage];
 
 	/* should we ignore this page entirely? */
 	if ((page < bitmap->startpage) ||
 		(page >= bitmap->startpage + bitmap->npages))
 		return nerrs;
 
+	heap_page_indexed_items(header, raw_page, bitmap->horizon,
+							bitmap->frozenxid, add, ignore);
+
+	for (item = 0; item < MaxHeapTuplesPerPage; item++)
+	{
+		if (ignore[item])
+			bitmap_set_ignore(bitmap, page, item);
+		else if (add[item] && (item < ntuples))
+		{
+			/* increment number of items tracked on this page */
+			if (bitmap->pages != NULL)
+				bitmap->pages[page - bitmap->startpage]++;
+			bitmap_set(bitmap, page, item);
+		}
+	}
+
+	return nerrs;
+}
+
+/* exclude a (corrupted) heap page from the comparison */
+void
+bitmap_skip_page(item_bitmap * bitmap, BlockNumber page)
+{
+	if ((page < bitmap->startpage) ||
+		(page >= bitmap->startpage + bitmap->npages))
+		return;
+
+	/* shared bitmaps have the array in the segment */
+	if (bitmap->skipped == NULL)
+		bitmap->skipped = (bool *) check_alloc_huge(sizeof(bool) * bitmap->npages);
+
+	bitmap->skipped[page - bitmap->startpage] = true;
+}
+
+void
+heap_page_indexed_items(PageHeader header, char *raw_page,
+						TransactionId horizon, TransactionId frozenxid,
+						bool *add, bool *ignore)
+{
+	int			ntuples = PageGetMaxOffsetNumber(raw_page);
+	int			item;
+	Page		p = (Page) raw_page;
+	bool		snapshot = TransactionIdIsValid(horizon);
+
+	/* corrupted pages were already reported, just don't overrun the arrays */
+	ntuples = Min(ntuples, MaxHeapTuplesPerPage);
+
 	/* assume we're adding all items from this heap page */
-	memset(add, 1, sizeof(add));
+	memset(add, 1, MaxHeapTuplesPerPage * sizeof(bool));
+	memset(ignore, 0, MaxHeapTuplesPerPage * sizeof(bool));
 
 	/*
 	 * Walk and remove all LP_UNUSED pointers, and LP_REDIRECT targets.
 	 *
 	 * XXX Do we need to do something about LP_DEAD rows here? At this point
 	 * we keep them in the bitmap.
+	 *
+	 * In snapshot mode the unused and dead line pointers may be reused by
+	 * concurrent inserts (or removed by vacuum) at any moment, so we have
+	 * to ignore them.
 	 */
 	for (item = 0; item < ntuples; item++)
 	{
 		ItemId		lp = &header->pd_linp[item];
 
 		if (lp->lp_flags == LP_UNUSED)
+		{
+			add[item] = false;
+			ignore[item] = snapshot;
+		}
+
+		if ((lp->lp_flags == LP_DEAD) && snapshot)
+		{
 			add[item] = false;
+			ignore[item] = true;
+		}
 
-		if (lp->lp_flags == LP_REDIRECT)
+		if ((lp->lp_flags == LP_REDIRECT) &&
+			(lp->lp_off >= 1) && (lp->lp_off <= ntuples))
 			add[lp->lp_off - 1] = false;
 	}
 
@@ -131,6 +453,12 @@ bitmap_add_heap_items(item_bitmap * bitmap, PageHeader header,
 	 * Deal with HOT chains. For every LP_NORMAL, and LP_DEAD pointer with
 	 * storage (i.e. lp_len>0), see if the tuple is HOT-updated (i.e. if it
 	 * has HEAP_HOT_UPDATED set). If yes, remove it from the bitmap.
+	 *
+	 * In snapshot mode, ignore tuples that are not settled (those may be
+	 * pruned, or not have index entries yet). A redirect is ignored when
+	 * the tuple it points to is not settled. Tuples on all-visible pages
+	 * are visible to everyone, so those are settled without looking at
+	 * the transaction status.
 	 */
 	for (item = 0; item < ntuples; item++)
 	{
@@ -141,50 +469,179 @@ bitmap_add_heap_items(item_bitmap * bitmap, PageHeader header,
 		{
 			HeapTupleHeader htup;
 
+			/* don't read past the page (line pointers may be unchecked) */
+			if ((lp->lp_len < SizeofHeapTupleHeader) ||
+				(lp->lp_off + lp->lp_len > BLCKSZ))
+				continue;
+
 			htup = (HeapTupleHeader) PageGetItem(p, lp);
 
 			if (HeapTupleHeaderIsHeapOnly(htup))
 				add[item] = false;
+
+			if (snapshot && !PageIsAllVisible(p) &&
+				!heap_tuple_is_settled(htup, horizon, frozenxid))
+			{
+				add[item] = false;
+				ignore[item] = true;
+			}
 		}
 	}
 
-	for (item = 0; item < ntuples; item++)
+	if (snapshot)
 	{
-		if (add[item])
+		for (item = 0; item < ntuples; item++)
 		{
-			/* increment number of items tracked on this page */
-			bitmap->pages[page]++;
-			bitmap_set(bitmap, page, item);
+			ItemId		lp = &header->pd_linp[item];
+
+			if ((lp->lp_flags == LP_REDIRECT) &&
+				(lp->lp_off >= 1) && (lp->lp_off <= ntuples) &&
+				ignore[lp->lp_off - 1])
+			{
+				add[item] = false;
+				ignore[item] = true;
+			}
 		}
+
+		/* new items may be added to the page at any moment */
+		for (item = ntuples; item < MaxHeapTuplesPerPage; item++)
+			ignore[item] = true;
 	}
+}
 
-	return nerrs;
+/*
+ * Is the heap tuple settled with respect to the horizon (xmin of the
+ * snapshot)? That is, was it inserted by a transaction committed before
+ * the horizon, and is it not deleted (or deleted by a transaction that
+ * may still be running for the snapshot)? Such tuples have all the index
+ * entries, and can't be pruned while the snapshot exists.
+ *
+ * This looks at a copy of the page, so we can't set hint bits. When not
+ * sure, we consider the tuple not settled (which only means it's ignored
+ * by the cross-check). That includes xmin outside the range of the clog,
+ * which happens only for corrupted tuples - looking it up would fail.
+ */
+bool
+heap_tuple_is_settled(HeapTupleHeader htup, TransactionId horizon,
+					  TransactionId frozenxid)
+{
+	TransactionId xmin = HeapTupleHeaderGetXmin(htup);
+	TransactionId xmax;
+
+	if (!HeapTupleHeaderXminFrozen(htup) && TransactionIdIsNormal(xmin))
+	{
+		if (!TransactionIdPrecedes(xmin, horizon))
+			return false;
+
+		if (!(htup->t_infomask & HEAP_XMIN_COMMITTED) &&
+			(!xid_in_clog_range(xmin, frozenxid) ||
+			 !TransactionIdDidCommit(xmin)))
+			return false;
+	}
+
+	if ((htup->t_infomask & HEAP_XMAX_INVALID) ||
+		HEAP_XMAX_IS_LOCKED_ONLY(htup->t_infomask))
+		return true;
+
+	/* we don't want to look into multixacts */
+	if (htup->t_infomask & HEAP_XMAX_IS_MULTI)
+		return false;
+
+	xmax = HeapTupleHeaderGetRawXmax(htup);
+
+	if (!TransactionIdIsValid(xmax))
+		return true;
+
+	/* deleted after the horizon, so it can't be removed yet */
+	return !TransactionIdPrecedes(xmax, horizon);
+}
+
+/*
+ * Is the transaction status available in the clog, i.e. is the XID between
+ * relfrozenxid (older ones may be truncated already) and the next XID?
+ * Tuples of a healthy relation only reference such XIDs (the older ones
+ * have to be frozen), so anything outside the range is garbage, and the
+ * lookup would fail with an error.
+ */
+bool
+xid_in_clog_range(TransactionId xid, TransactionId frozenxid)
+{
+	TransactionId nextxid;
+
+	if (!TransactionIdIsNormal(xid))
+		return false;
+
+	if (TransactionIdIsNormal(frozenxid) && TransactionIdPrecedes(xid, frozenxid))
+		return false;
+
+#if (PG_VERSION_NUM >= 130000)
+	nextxid = ReadNextTransactionId();
+#else
+	nextxid = ReadNewTransactionId();
+#endif
+
+	return TransactionIdPrecedes(xid, nextxid);
+}
+
+/* mark the (page,item) as ignored by the cross-check */
+static void
+bitmap_set_ignore(item_bitmap * bitmap, BlockNumber page, int item)
+{
+	if (bitmap->type == BITMAP_TYPE_COMPRESSED)
+	{
+		containers_set(bitmap->ignore_containers,
+					   GetCompressedIndex(bitmap, page, item));
+		return;
+	}
+
+	bitmap->ignore[GetBitmapByte(bitmap, page, item)] |=
+		(0x01 << GetBitmapBit(bitmap, page, item));
+}
+
+/* set a bit in an array of containers (allocating the container) */
+static void
+containers_set(bitmap_container ** containers, uint64 index)
+{
+	bitmap_container **container = &containers[index / CONTAINER_BITS];
+
+	if (*container == NULL)
+		*container = container_init();
+
+	container_set(*container, index % CONTAINER_BITS);
 }
 
 /* mark the (page,item) as occupied */
 void
 bitmap_set(item_bitmap * bitmap, BlockNumber page, int item)
 {
-	int			byte = GetBitmapByte(bitmap, page, item);
-	int			bit = GetBitmapBit(bitmap, page, item);
+	Size		byte;
+	int			bit;
 
 	/* ignore pages outside the range */
 	if ((page < bitmap->startpage) ||
 		(page >= bitmap->startpage + bitmap->npages))
 		return;
 
-	if (page >= bitmap->npages)
+	/* items beyond the per-page space would spill into the next page */
+	if ((item < 0) || (item >= MaxHeapTuplesPerPage))
 	{
-		elog(WARNING, "invalid page %d (max page %d)", page, bitmap->npages - 1);
+		elog(WARNING, "invalid item %d on page %u (max item %d)",
+			 item, page, (int) MaxHeapTuplesPerPage - 1);
 		return;
 	}
 
-	if (byte > bitmap->nbytes)
+	if (bitmap->type == BITMAP_TYPE_COMPRESSED)
 	{
-		elog(WARNING, "invalid byte %d (max byte %zu)", byte, bitmap->nbytes);
+		containers_set(bitmap->containers,
+					   GetCompressedIndex(bitmap, page, item));
 		return;
 	}
 
+	byte = GetBitmapByte(bitmap, page, item);
+	bit = GetBitmapBit(bitmap, page, item);
+
+	Assert(byte < bitmap->nbytes);
+
 	/* set the bit (OR) */
 	bitmap->data[byte] |= (0x01 << bit);
 }
@@ -193,96 +650,375 @@ bitmap_set(item_bitmap * bitmap, BlockNumber page, int item)
 bool
 bitmap_get(item_bitmap * bitmap, BlockNumber page, int item)
 {
-	int			byte = GetBitmapByte(bitmap, page, item);
-	int			bit = GetBitmapBit(bitmap, page, item);
+	Size		byte;
+	int			bit;
 
 	/* ignore pages outside the range */
 	if ((page < bitmap->startpage) ||
 		(page >= bitmap->startpage + bitmap->npages))
 		return false;
 
-	if (page >= bitmap->npages)
-	{
-		elog(WARNING, "invalid page %d (max page %d)", page, bitmap->npages - 1);
+	if ((item < 0) || (item >= MaxHeapTuplesPerPage))
 		return false;
-	}
 
-	if (byte > bitmap->nbytes)
+	if (bitmap->type == BITMAP_TYPE_COMPRESSED)
 	{
-		elog(WARNING, "invalid byte %d (max byte %zu)", byte, bitmap->nbytes);
-		return false;
+		uint64		index = GetCompressedIndex(bitmap, page, item);
+		bitmap_container *container;
+
+		container = bitmap->containers[index / CONTAINER_BITS];
+
+		return (container != NULL) &&
+			container_get(container, index % CONTAINER_BITS);
 	}
 
+	byte = GetBitmapByte(bitmap, page, item);
+	bit = GetBitmapBit(bitmap, page, item);
+
+	Assert(byte < bitmap->nbytes);
+
 	return (bitmap->data[byte] & (0x01 << bit));
 }
 
-/* counts bits set to 1 in the bitmap */
+/* counts bits set to 1 in the bitmap (a word at a time) */
 uint64
 bitmap_count(item_bitmap * bitmap)
 {
 	Size		i;
-	int			j;
 	uint64		items = 0;
+	uint64	   *words = (uint64 *) bitmap->data;
+	Size		nwords = bitmap->nbytes / sizeof(uint64);
 
-	for (i = 0; i < bitmap->nbytes; i++)
+	/* containers track the number of bits set */
+	if (bitmap->type == BITMAP_TYPE_COMPRESSED)
 	{
-		for (j = 0; j < 8; j++)
+		for (i = 0; i < bitmap->ncontainers; i++)
 		{
-			if (bitmap->data[i] & (1 << j))
-				items++;
+			if (bitmap->containers[i] != NULL)
+				items += bitmap->containers[i]->cardinality;
 		}
+
+		return items;
 	}
 
+	for (i = 0; i < nwords; i++)
+		items += popcount64(words[i]);
+
 	return items;
 }
 
-/* compare bitmaps, returns number of differences */
+/*
+ * compare bitmaps, returns number of differences
+ *
+ * The pages are compared a word at a time (XOR of the two bitmaps), and
+ * only words with some differences are inspected bit by bit, to report
+ * the mismatching items. The bitmaps are expected to be mostly the same,
+ * so this is mostly a sequential pass over the two arrays.
+ */
 uint64
 bitmap_compare(item_bitmap * bitmap_a, item_bitmap * bitmap_b)
 {
-	BlockNumber block;
-	OffsetNumber offset;
-	uint64		ndiff;
+	Size		i;
+	uint64		ndiff = 0;
+	uint64	   *words_a = (uint64 *) bitmap_a->data;
+	uint64	   *words_b = (uint64 *) bitmap_b->data;
+	Size		nwords = bitmap_a->nbytes / sizeof(uint64);
 
+	Assert(bitmap_a->type == bitmap_b->type);
 	Assert(bitmap_a->nbytes == bitmap_b->nbytes);
 	Assert(bitmap_a->npages == bitmap_b->npages);
 	Assert(bitmap_a->startpage == bitmap_b->startpage);
 
-	/* the actual check, compares the bits one by one */
-	ndiff = 0;
-	for (block = bitmap_a->startpage; block < bitmap_a->startpage + bitmap_a->npages; block++)
+	bitmap_a->nunconfirmed = 0;
+
+	if (bitmap_a->type == BITMAP_TYPE_COMPRESSED)
+		return bitmap_compare_compressed(bitmap_a, bitmap_b);
+
+	for (i = 0; i < nwords; i++)
+	{
+		uint64		diff = words_a[i] ^ words_b[i];
+
+		if (diff == 0)
+			continue;
+
+		/* skip items ignored in snapshot mode */
+		if (bitmap_a->ignore != NULL)
+			diff &= ~((uint64 *) bitmap_a->ignore)[i];
+
+		if (diff == 0)
+			continue;
+
+		ndiff += report_mismatches(bitmap_a, bitmap_b, (uint64) i * 64, diff,
+								   words_a[i]);
+	}
+
+	return ndiff;
+}
+
+/*
+ * compare compressed bitmaps, one container at a time
+ *
+ * Containers with the same representation and contents (e.g. runs built
+ * from the same heap pages) are skipped right away, the other ones are
+ * expanded into bitsets and compared a word at a time.
+ */
+static uint64
+bitmap_compare_compressed(item_bitmap * bitmap_a, item_bitmap * bitmap_b)
+{
+	uint32		i;
+	int			j;
+	uint64		ndiff = 0;
+	uint64	   *words_a = palloc(CONTAINER_WORDS * sizeof(uint64));
+	uint64	   *words_b = palloc(CONTAINER_WORDS * sizeof(uint64));
+	uint64	   *words_ignore = NULL;
+
+	if (bitmap_a->ignore_containers != NULL)
+		words_ignore = palloc(CONTAINER_WORDS * sizeof(uint64));
+
+	for (i = 0; i < bitmap_a->ncontainers; i++)
+	{
+		bitmap_container *a = bitmap_a->containers[i];
+		bitmap_container *b = bitmap_b->containers[i];
+		bitmap_container *ignore = NULL;
+
+		if (words_ignore != NULL)
+		{
+			ignore = bitmap_a->ignore_containers[i];
+
+			if (ignore != NULL)
+				container_to_words(ignore, words_ignore);
+		}
+
+		if ((a == NULL) && (b == NULL))
+			continue;
+
+		if ((a != NULL) && (b != NULL) && container_identical(a, b))
+			continue;
+
+		if (a != NULL)
+			container_to_words(a, words_a);
+		else
+			memset(words_a, 0, CONTAINER_WORDS * sizeof(uint64));
+
+		if (b != NULL)
+			container_to_words(b, words_b);
+		else
+			memset(words_b, 0, CONTAINER_WORDS * sizeof(uint64));
+
+		for (j = 0; j < CONTAINER_WORDS; j++)
+		{
+			uint64		diff = words_a[j] ^ words_b[j];
+
+			/* skip items ignored in snapshot mode */
+			if (ignore != NULL)
+				diff &= ~words_ignore[j];
+
+			if (diff == 0)
+				continue;
+
+			ndiff += report_mismatches(bitmap_a, bitmap_b,
+									   (uint64) i * CONTAINER_BITS + (uint64) j * 64,
+									   diff, words_a[j]);
+		}
+	}
+
+	pfree(words_a);
+	pfree(words_b);
+
+	if (words_ignore != NULL)
+		pfree(words_ignore);
+
+	return ndiff;
+}
+
+/*
+ * Reports the items that differ in a word of the bitmap (bits set in
+ * the diff), starting at the given bit index. The word of the first
+ * bitmap tells which side has them. When exporting the differences, the
+ * first bitmap is the heap one, and the items are exported instead of
+ * reporting a WARNING for each of them. Items on pages skipped by the
+ * heap pass (corrupted pages) are not compared. In snapshot mode, items
+ * missing in the index are only counted as unconfirmed (see nunconfirmed)
+ * if the index scan observed concurrent page splits.
+ *
+ * Returns number of differences reported.
+ */
+static uint64
+report_mismatches(item_bitmap * bitmap, item_bitmap * bitmap_b, uint64 index,
+				  uint64 diff, uint64 bits_a)
+{
+	int			j;
+	uint64		ndiff = 0;
+	BlockNumber maxoff_page = InvalidBlockNumber;
+	OffsetNumber maxoff = InvalidOffsetNumber;
+
+	/* number of bits reserved for each page */
+	uint64		bits_per_page = (bitmap->type == BITMAP_TYPE_COMPRESSED) ?
+	MaxHeapTuplesPerPage : BITMAP_BYTES_PER_PAGE * 8;
+
+	for (j = 0; j < 64; j++)
 	{
-		for (offset = 0; offset < MaxHeapTuplesPerPage; offset++)
+		BlockNumber block;
+		int			offset;
+
+		if (!(diff & (UINT64CONST(1) << j)))
+			continue;
+
+		/* bit index within the bitmap, translated to (block, offset) */
+		block = bitmap->startpage + (index + j) / bits_per_page;
+		offset = (index + j) % bits_per_page;
+
+		if ((bitmap->skipped != NULL) &&
+			bitmap->skipped[block - bitmap->startpage])
+			continue;
+
+		if (TransactionIdIsValid(bitmap->horizon) && bitmap_b->hidden &&
+			(bits_a & (UINT64CONST(1) << j)))
+		{
+			ereport(DEBUG1,
+					(errmsg("item [%u,%d] not found in the index, possibly moved by a concurrent page split",
+							block, offset)));
+			bitmap->nunconfirmed++;
+			continue;
+		}
+
+		ndiff++;
+
+		if (pgcheck_diff != NULL)
 		{
-			if (bitmap_get(bitmap_a, block, offset) != bitmap_get(bitmap_a, block, offset))
+			/* a word spans at most two pages */
+			if (block != maxoff_page)
 			{
-				elog(WARNING, "bitmap mismatch of [%u,%d]", block, offset);
-				ndiff++;
+				maxoff_page = block;
+				maxoff = bitmap_page_maxoff(bitmap, bitmap_b, block);
 			}
+
+			diff_add(pgcheck_diff, pgcheck_diff->indexid, block, offset + 1,
+					 maxoff, (bits_a & (UINT64CONST(1) << j)) ?
+					 DIFF_MISSING_IN_INDEX : DIFF_MISSING_IN_HEAP);
+			continue;
 		}
+
+		report_issue("index_mismatch", block, offset,
+					 "bitmap mismatch of [%u,%d] (%s)", block, offset,
+					 (bits_a & (UINT64CONST(1) << j)) ? "only in the first bitmap" : "only in the second bitmap");
 	}
 
-	return 0;
+	return ndiff;
 }
 
-/* Prints the info about the bitmap and the data as a series of 0/1. */
-/* TODO print details about differences (items missing in heap, items missing in index) */
+/*
+ * last item of the page in either of the bitmaps (the bitmaps don't know
+ * the number of items on the heap page, but those are the items compared)
+ */
+static OffsetNumber
+bitmap_page_maxoff(item_bitmap * bitmap_a, item_bitmap * bitmap_b,
+				   BlockNumber page)
+{
+	int			item;
+
+	for (item = MaxHeapTuplesPerPage - 1; item >= 0; item--)
+	{
+		if (bitmap_get(bitmap_a, page, item) || bitmap_get(bitmap_b, page, item))
+			return (item + 1);
+	}
+
+	return InvalidOffsetNumber;
+}
+
+/*
+ * memory needed by a bitmap for npages (dense bitmaps are allocated in
+ * advance, for compressed ones this assumes a run of items on each page)
+ */
+Size
+bitmap_estimate_size(BitmapType type, BlockNumber npages, bool snapshot)
+{
+	Size		size = sizeof(item_bitmap);
+	uint64		ncontainers;
+
+	if (type == BITMAP_TYPE_DENSE)
+	{
+		size += (Size) npages * (BITMAP_BYTES_PER_PAGE + sizeof(uint64));
+
+		if (snapshot)
+			size += (Size) npages * BITMAP_BYTES_PER_PAGE;
+
+		return size;
+	}
+
+	ncontainers = ((uint64) npages * MaxHeapTuplesPerPage + CONTAINER_BITS - 1) /
+		CONTAINER_BITS;
+
+	size += ncontainers * (sizeof(bitmap_container *) + sizeof(bitmap_container));
+	size += (Size) npages * 2 * sizeof(uint16);
+
+	if (snapshot)
+		size *= 2;
+
+	return size;
+}
+
+/* memory used by the bitmap */
+Size
+bitmap_size(item_bitmap * bitmap)
+{
+	uint32		i;
+	Size		size = sizeof(item_bitmap);
+
+	if (bitmap->type == BITMAP_TYPE_DENSE)
+		return size + bitmap->nbytes + sizeof(uint64) * bitmap->npages;
+
+	size += bitmap->ncontainers * sizeof(bitmap_container *);
+
+	for (i = 0; i < bitmap->ncontainers; i++)
+	{
+		if (bitmap->containers[i] != NULL)
+			size += container_size(bitmap->containers[i]);
+	}
+
+	return size;
+}
+
+/*
+ * Prints the info about the bitmap and the data as a series of 0/1. The
+ * data (and page counts) are only printed for small bitmaps - for larger
+ * ones that would mean huge log messages, and the differences can be
+ * exported using pg_check_table_diff() instead.
+ */
 void
 bitmap_print(item_bitmap * bitmap, BitmapFormat format)
 {
-	int			i = 0;
-	int			len = count_digits(bitmap->pages, bitmap->npages) + bitmap->npages;
-	char		pages[len];
-	char	   *ptr = pages;
+	BlockNumber i = 0;
+	Size		len;
+	char	   *pages;
+	char	   *ptr;
 	char	   *data = NULL;
 
+	/* compressed bitmaps have no page counts, so just print the summary */
+	if (bitmap->type == BITMAP_TYPE_COMPRESSED)
+	{
+		bitmap_print_compressed(bitmap);
+		return;
+	}
+
+	if (bitmap->nbytes > BITMAP_PRINT_MAX_BYTES)
+	{
+		elog(WARNING, "bitmap nbytes=%zu nbits=" UINT64_FORMAT " npages=%d (data not printed, use pg_check_table_diff)",
+			 bitmap->nbytes, bitmap_count(bitmap), bitmap->npages);
+		return;
+	}
+
+	len = count_digits(bitmap->pages, bitmap->npages) + bitmap->npages + 1;
+	pages = check_alloc_huge(len);
+	ptr = pages;
+
 	ptr[0] = '\0';
 	for (i = 0; i < bitmap->npages; i++)
 	{
+		if (i > 0)
+			*(ptr++) = ',';
 		ptr = itoa(bitmap->pages[i], ptr, len - (ptr - pages));
-		*(ptr++) = ',';
 	}
-	*(--ptr) = '\0';
 
 	/* encode as binary or hex */
 	if (format == BITMAP_BINARY)
@@ -299,46 +1035,91 @@ bitmap_print(item_bitmap * bitmap, BitmapFormat format)
 
 	if (format == BITMAP_NONE)
 	{
-		elog(WARNING, "bitmap nbytes=%zu nbits=%ld npages=%d pages=[%s]",
+		elog(WARNING, "bitmap nbytes=%zu nbits=" UINT64_FORMAT " npages=%d pages=[%s]",
 			 bitmap->nbytes, bitmap_count(bitmap), bitmap->npages, pages);
 	}
 	else
 	{
-		elog(WARNING, "bitmap nbytes=%zu nbits=%ld npages=%d pages=[%s] data=[%s]",
+		elog(WARNING, "bitmap nbytes=%zu nbits=" UINT64_FORMAT " npages=%d pages=[%s] data=[%s]",
 			 bitmap->nbytes, bitmap_count(bitmap), bitmap->npages, pages, data);
 	}
 
 	pfree(data);
+	pfree(pages);
+}
+
+/* Prints a summary of a compressed bitmap (containers, memory) */
+static void
+bitmap_print_compressed(item_bitmap * bitmap)
+{
+	uint32		i;
+	uint32		counts[3] = {0, 0, 0};
+
+	for (i = 0; i < bitmap->ncontainers; i++)
+	{
+		if (bitmap->containers[i] != NULL)
+			counts[bitmap->containers[i]->type]++;
+	}
+
+	elog(WARNING, "bitmap compressed nbytes=%zu nbits=" UINT64_FORMAT " npages=%d containers=%u (array=%u bitset=%u run=%u)",
+		 bitmap_size(bitmap), bitmap_count(bitmap), bitmap->npages,
+		 bitmap->ncontainers, counts[CONTAINER_ARRAY],
+		 counts[CONTAINER_BITSET], counts[CONTAINER_RUN]);
+}
+
+/* number of bits set in a word */
+static inline int
+popcount64(uint64 word)
+{
+#if defined(HAVE__BUILTIN_POPCOUNT) || defined(__GNUC__)
+	return __builtin_popcountll(word);
+#else
+	/* the usual SWAR approach */
+	word = word - ((word >> 1) & UINT64CONST(0x5555555555555555));
+	word = (word & UINT64CONST(0x3333333333333333)) +
+		((word >> 2) & UINT64CONST(0x3333333333333333));
+	word = (word + (word >> 4)) & UINT64CONST(0x0F0F0F0F0F0F0F0F);
+
+	return (int) ((word * UINT64CONST(0x0101010101010101)) >> 56);
+#endif
 }
 
 /* count digits to print the array (in ASCII) */
-static int
+static Size
 count_digits(uint64 values[], BlockNumber n)
 {
-	int			i,
-				digits = 0;
+	BlockNumber i;
+	Size		digits = 0;
 
 	for (i = 0; i < n; i++)
-		digits += (int) ceil(log(values[i]) / log(10));
+	{
+		uint64		value = values[i];
+
+		do
+		{
+			digits++;
+			value /= 10;
+		} while (value > 0);
+	}
 
 	return digits;
 }
 
 /* utility to fill an integer value in a given value */
 static char *
-itoa(int value, char *str, int maxlen)
+itoa(uint64 value, char *str, Size maxlen)
 {
-	return str + snprintf(str, maxlen, "%d", value);
+	return str + snprintf(str, maxlen, UINT64_FORMAT, value);
 }
 
 /* encode data to hex */
 static char *
-hex(const char *data, int n)
+hex(const char *data, Size n)
 {
-	int			i,
+	Size		i,
 				w = 0;
 	static const char hex[] = "0123456789abcdef";
-	char	   *result = palloc(n * 2 + 1);
+	char	   *result = check_alloc_huge(n * 2 + 1);
 
 	for (i = 0; i < n; i++)
 	{
@@ -352,12 +1133,12 @@ hex(const char *data, int n)
 }
 
 static char *
-binary(const char *data, int n)
+binary(const char *data, Size n)
 {
-	int			i,
-				j,
+	Size		i,
 				k = 0;
-	char	   *result = palloc(n * 8 + 10);
+	int			j;
+	char	   *result = check_alloc_huge(n * 8 + 10);
 
 	for (i = 0; i < n; i++)
 	{
@@ -377,12 +1158,12 @@ binary(const char *data, int n)
 
 /* encode data to base64 */
 static char *
-base64(const char *data, int n)
+base64(const char *data, Size n)
 {
-	int			i,
+	Size		i,
 				k = 0;
 	static const char _base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-	char	   *result = palloc(4 * ((n + 2) / 3) + 1);
+	char	   *result = check_alloc_huge(4 * ((n + 2) / 3) + 1);
 	uint32		buf = 0;
 	int			pos = 2;
 
@@ -4,6 +4,10 @@
 #include "postgres.h"
 #include "access/heapam.h"
 
+#if (PG_VERSION_NUM >= 90600)
+#include "storage/dsm.h"
+#endif
+
 #define MAX(a,b) ((a > b) ? a : b)
 
 /* bitmap format */
@@ -15,9 +19,20 @@ typedef enum
 	BITMAP_NONE
 }			BitmapFormat;
 
+/* bitmap representation */
+typedef enum
+{
+	BITMAP_TYPE_DENSE,			/* fixed space for each page */
+	BITMAP_TYPE_COMPRESSED		/* containers (array, bitset, runs) */
+}			BitmapType;
+
+struct bitmap_container;
+
 /* bitmap, used to cross-check heap and indexes */
 typedef struct item_bitmap
 {
+	BitmapType	type;
+
 	/* current number of tracked pages */
 	BlockNumber startpage;
 	BlockNumber npages;
@@ -32,6 +47,42 @@ typedef struct item_bitmap
 
 	/* data of the bitmap (0/1 for each item) */
 	char	   *data;
+
+	/* containers of a compressed bitmap (NULL for empty ranges) */
+	uint32		ncontainers;
+	struct bitmap_container **containers;
+
+	/*
+	 * Snapshot mode (lock-light cross-check) - only tuples settled before
+	 * the horizon are added, and items that may change while the check is
+	 * running are marked as ignored (in the same layout as the data).
+	 */
+	TransactionId horizon;		/* InvalidTransactionId if not enabled */
+	TransactionId frozenxid;	/* relfrozenxid (bounds the clog lookups) */
+	char	   *ignore;			/* dense bitmaps */
+	struct bitmap_container **ignore_containers;	/* compressed bitmaps */
+
+	/* heap pages with issues, excluded from the comparison (or NULL) */
+	bool	   *skipped;
+
+	/*
+	 * The index scan building the bitmap observed concurrent page splits,
+	 * which may have moved items to pages the scan already passed (only in
+	 * snapshot mode, see btree_splits).
+	 */
+	bool		hidden;
+
+	/*
+	 * Items missing in the index in snapshot mode (found by the last
+	 * comparison), when the index bitmap may have items hidden by splits.
+	 * Those are not counted as differences.
+	 */
+	uint64		nunconfirmed;
+
+#if (PG_VERSION_NUM >= 90600)
+	/* DSM segment with the pages/data (NULL for backend-local bitmaps) */
+	dsm_segment *segment;
+#endif
 }			item_bitmap;
 
 
@@ -49,6 +100,87 @@ typedef struct item_bitmap
  */
 item_bitmap *bitmap_init(BlockNumber startpage, BlockNumber npages);
 
+/* Allocates new compressed item bitmap, sized for n pages.
+ *
+ * The parameters are the same as for bitmap_init. Instead of reserving
+ * space for MaxHeapTuplesPerPage items on each page, the items are kept
+ * in containers covering ranges of pages, each using an array, a bitset
+ * or runs, depending on the density. Heap pages usually have items 1..N
+ * on the page, which makes the bitmap an order of magnitude smaller.
+ *
+ * The bitmap does not track the running sum of items on pages (pages is
+ * NULL), and can't be placed in shared memory.
+ *
+ * Returns the allocated bitmap.
+ */
+item_bitmap *bitmap_init_compressed(BlockNumber startpage, BlockNumber npages);
+
+#if (PG_VERSION_NUM >= 90600)
+/* Allocates new item bitmap in a dynamic shared memory segment.
+ *
+ * The parameters are the same as for bitmap_init. The pages/data arrays
+ * live in the DSM segment, so other processes (e.g. parallel workers) may
+ * attach the bitmap using the handle from bitmap_get_handle.
+ *
+ * Each page occupies whole bytes of the bitmap, so processes updating
+ * disjoint page ranges (e.g. chunks of the heap) require no locking.
+ *
+ * - horizon : enables the snapshot mode (see bitmap_enable_snapshot), the
+ *             space for ignored items is allocated in the segment too
+ * - frozenxid : relfrozenxid of the heap relation (snapshot mode)
+ *
+ * Returns the allocated bitmap.
+ */
+item_bitmap *bitmap_init_shared(BlockNumber startpage, BlockNumber npages,
+				   TransactionId horizon, TransactionId frozenxid);
+
+/* Returns size of the DSM segment of a shared bitmap (the parameters are
+ * the same as for bitmap_estimate_size). */
+Size		bitmap_estimate_shared_size(BlockNumber npages, bool snapshot);
+
+/* Returns handle of the DSM segment backing a shared bitmap. */
+dsm_handle	bitmap_get_handle(item_bitmap * bitmap);
+
+/* Attaches a shared bitmap created by bitmap_init_shared (in a different
+ * process). The bitmap should be released by bitmap_free, which detaches
+ * the segment.
+ *
+ * Returns the attached bitmap.
+ */
+item_bitmap *bitmap_attach(dsm_handle handle);
+#endif
+
+/* Enables the snapshot mode for a heap bitmap (not for shared bitmaps).
+ *
+ * - bitmap : bitmap to be populated by bitmap_add_heap_items
+ * - horizon : xmin of the snapshot used by the check
+ * - frozenxid : relfrozenxid of the heap relation (older XIDs are not
+ *               looked up in the clog)
+ *
+ * Only tuples settled before the horizon (i.e. inserted by a transaction
+ * committed before the horizon, and not deleted before it) are added to
+ * the bitmap. Other items (and unused/dead line pointers, which may be
+ * reused at any moment) are marked as ignored, and bitmap_compare skips
+ * them. This allows cross-checking without blocking concurrent writes.
+ */
+void		bitmap_enable_snapshot(item_bitmap * bitmap, TransactionId horizon,
+					   TransactionId frozenxid);
+
+/* Is the heap tuple settled with respect to the horizon (xmin of the
+ * snapshot used in snapshot mode)? Settled tuples have all the index
+ * entries, and can't be pruned until the check completes. XIDs outside
+ * the clog (see xid_in_clog_range) are considered not settled. */
+bool		heap_tuple_is_settled(HeapTupleHeader htup, TransactionId horizon,
+					  TransactionId frozenxid);
+
+/* Is the XID between relfrozenxid and the next XID, i.e. can its status
+ * be looked up in the clog? Corrupted tuples may contain any XID, and the
+ * clog lookup would fail with an error. */
+bool		xid_in_clog_range(TransactionId xid, TransactionId frozenxid);
+
+/* Is the bitmap in shared memory (i.e. created by bitmap_init_shared)? */
+bool		bitmap_is_shared(item_bitmap * bitmap);
+
 /* Copies the item bitmap (except the actual bitmap data, keeps zeroes).
  *
  * This is used to prepare a bitmap for index, matching the heap bitmap.
@@ -56,7 +188,8 @@ item_bitmap *bitmap_init(BlockNumber startpage, BlockNumber npages);
  * Returns the new bitmap. */
 item_bitmap *bitmap_copy(item_bitmap * src);	/* preallocate empty bitmap */
 
-/* Releases the bitmap, including the inner resources (allocated memory). */
+/* Releases the bitmap, including the inner resources (allocated memory).
+ * For shared bitmaps this detaches the DSM segment. */
 void		bitmap_free(item_bitmap * bitmap);
 
 /* Resets the bitmap data (not the page counts) so that it can be reused
@@ -70,11 +203,40 @@ void		bitmap_reset(item_bitmap * bitmap);
  * - raw_page : raw page data
  * - page : number of the page (0, 1, 2, ...)
  *
+ * Pages with issues should be skipped instead (see bitmap_skip_page),
+ * as their line pointers and tuples can't be trusted.
+ *
  * Returns number of issues (already set items).
  */
 int bitmap_add_heap_items(item_bitmap * bitmap, PageHeader header,
 					  char *raw_page, BlockNumber page);
 
+/* Excludes a heap page from the comparison (i.e. a page with issues, not
+ * added to the bitmap). Index entries pointing to the page are not
+ * reported as differences - the page issues were reported already.
+ *
+ * - bitmap : the heap bitmap
+ * - page : number of the page
+ */
+void		bitmap_skip_page(item_bitmap * bitmap, BlockNumber page);
+
+/* Determines items of the heap page expected to have index entries.
+ *
+ * - header : page header
+ * - raw_page : raw page data
+ * - horizon : snapshot mode (InvalidTransactionId if not)
+ * - frozenxid : relfrozenxid of the heap relation (snapshot mode)
+ * - add : items expected in the indexes (MaxHeapTuplesPerPage elements)
+ * - ignore : items not to compare in snapshot mode (MaxHeapTuplesPerPage
+ *            elements, including those after the last item on the page)
+ *
+ * That is, all items except for unused line pointers, redirect targets
+ * and heap-only tuples (and in snapshot mode those that are not settled).
+ */
+void		heap_page_indexed_items(PageHeader header, char *raw_page,
+						TransactionId horizon, TransactionId frozenxid,
+						bool *add, bool *ignore);
+
 /* Updates the bitmap with all items from the index (b-tree leaf) page.
  *
  * - bitmap : bitmap to update
@@ -101,10 +263,26 @@ uint64		bitmap_count(item_bitmap * bitmap);
  * - bitmap_b : input bitmap
  *
  * Returns number of differences, i.e. bits set to 0 in bitmap_a
- * and 1 in bitmap_b, or vice versa.
+ * and 1 in bitmap_b, or vice versa. Items marked as ignored in bitmap_a
+ * (in snapshot mode) are not compared.
  */
 uint64		bitmap_compare(item_bitmap * bitmap_a, item_bitmap * bitmap_b);
 
+/* Estimates memory needed by a bitmap.
+ *
+ * - type : bitmap representation
+ * - npages : number of pages
+ * - snapshot : snapshot mode (space for the ignored items)
+ *
+ * Returns the size of a dense bitmap, or the expected size of a compressed
+ * one (assuming a run of items on each page, as usual for heap pages).
+ */
+Size		bitmap_estimate_size(BitmapType type, BlockNumber npages,
+					 bool snapshot);
+
+/* Returns amount of memory used by the bitmap (data and page counts). */
+Size		bitmap_size(item_bitmap * bitmap);
+
 /* Prints the info about the bitmap and the data as a series of 0/1. */
 void		bitmap_print(item_bitmap * bitmap, BitmapFormat format);
 
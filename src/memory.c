@@ -0,0 +1,158 @@
+#include "postgres.h"
+
+#include "utils/memutils.h"
+
+#include "memory.h"
+#include "pg_check.h"
+
+/* name of the memory contexts of the checks (used to detect nesting) */
+#define CHECK_MEMORY_CONTEXT	"pg_check"
+
+/* memory reserved by the running checks, and the peak (this backend) */
+static Size memory_reserved = 0;
+static Size memory_peak = 0;
+
+/* peak memory of the last (outermost) check */
+static Size memory_last_peak = 0;
+
+static MemoryContext check_memory_outer(MemoryContext context);
+static void check_memory_update_peak(MemoryContext context);
+
+/*
+ * A check running in a pg_check context (i.e. an index checked by a table
+ * check) is nested, and shares the limit with the outer check. Otherwise
+ * this is a new check, and the accounting starts from scratch - that also
+ * takes care of the counters after a check failed with an error (the
+ * contexts are released with the caller's context).
+ */
+void
+check_memory_begin(check_memory * state)
+{
+	if (check_memory_outer(CurrentMemoryContext) == NULL)
+	{
+		memory_reserved = 0;
+		memory_peak = 0;
+	}
+
+	state->reserved = memory_reserved;
+
+#if (PG_VERSION_NUM >= 90600)
+	state->context = AllocSetContextCreate(CurrentMemoryContext,
+										   CHECK_MEMORY_CONTEXT,
+										   ALLOCSET_DEFAULT_SIZES);
+#else
+	state->context = AllocSetContextCreate(CurrentMemoryContext,
+										   CHECK_MEMORY_CONTEXT,
+										   ALLOCSET_DEFAULT_MINSIZE,
+										   ALLOCSET_DEFAULT_INITSIZE,
+										   ALLOCSET_DEFAULT_MAXSIZE);
+#endif
+
+	state->oldcontext = MemoryContextSwitchTo(state->context);
+}
+
+void
+check_memory_end(check_memory * state)
+{
+	check_memory_update_peak(state->context);
+
+	MemoryContextSwitchTo(state->oldcontext);
+	MemoryContextDelete(state->context);
+
+	memory_reserved = state->reserved;
+
+	/* the outermost check is done, remember and report the peak */
+	if (check_memory_outer(CurrentMemoryContext) == NULL)
+	{
+		memory_last_peak = memory_peak;
+
+		ereport(DEBUG1,
+				(errmsg("peak memory used by the check: %lu kB",
+						(unsigned long) (memory_peak / 1024))));
+	}
+}
+
+bool
+check_memory_reserve(Size nbytes)
+{
+	Size		limit = (Size) pgcheck_max_memory * 1024L;
+
+	if ((limit > 0) && (memory_reserved + nbytes > limit))
+		return false;
+
+	memory_reserved += nbytes;
+
+	check_memory_update_peak(CurrentMemoryContext);
+
+	return true;
+}
+
+Size
+check_memory_reserve_upto(Size nbytes, Size minbytes)
+{
+	Size		limit = (Size) pgcheck_max_memory * 1024L;
+
+	if (limit > 0)
+	{
+		Size		available = (memory_reserved < limit) ?
+		(limit - memory_reserved) : 0;
+
+		nbytes = Max(Min(nbytes, available), minbytes);
+	}
+
+	memory_reserved += nbytes;
+
+	check_memory_update_peak(CurrentMemoryContext);
+
+	return nbytes;
+}
+
+Size
+check_memory_peak(void)
+{
+	return memory_last_peak;
+}
+
+void *
+check_alloc_huge(Size nbytes)
+{
+#if (PG_VERSION_NUM >= 90500)
+	return MemoryContextAllocExtended(CurrentMemoryContext, nbytes,
+									  MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+#else
+	return palloc0(nbytes);
+#endif
+}
+
+/* the outermost pg_check context the context belongs to (or NULL) */
+static MemoryContext
+check_memory_outer(MemoryContext context)
+{
+	MemoryContext outer = NULL;
+
+	for (; context != NULL; context = context->parent)
+	{
+		if (strcmp(context->name, CHECK_MEMORY_CONTEXT) == 0)
+			outer = context;
+	}
+
+	return outer;
+}
+
+/*
+ * The peak includes the reservations, and on 13+ also the memory actually
+ * allocated in the contexts of the check (including the smaller stuff we
+ * don't reserve), whichever is higher.
+ */
+static void
+check_memory_update_peak(MemoryContext context)
+{
+	memory_peak = Max(memory_peak, memory_reserved);
+
+#if (PG_VERSION_NUM >= 130000)
+	context = check_memory_outer(context);
+
+	if (context != NULL)
+		memory_peak = Max(memory_peak, MemoryContextMemAllocated(context, true));
+#endif
+}
@@ -0,0 +1,70 @@
+#ifndef MEMORY_CHECK_H
+#define MEMORY_CHECK_H
+
+#include "postgres.h"
+#include "utils/memutils.h"
+
+/*
+ * Memory used by the checks. Each check runs in its own memory context
+ * (a child of the caller's context, so everything is released even after
+ * an error), and the checks of indexes started by a table check run in
+ * child contexts of the table check.
+ *
+ * The large structures (bitmaps, page summaries, buffers) reserve their
+ * size against pg_check.max_memory before allocating it, so that the
+ * check may pick a cheaper approach (e.g. a compressed bitmap, or sorted
+ * TIDs spilled to temporary files) instead of failing with out of memory.
+ * The reservations are released at the end of the check that made them.
+ */
+typedef struct check_memory
+{
+	MemoryContext context;		/* context of the check */
+	MemoryContext oldcontext;	/* context of the caller */
+	Size		reserved;		/* memory reserved when the check started */
+}			check_memory;
+
+/* Starts a check, switching to a new memory context.
+ *
+ * - state : state of the check (to be passed to check_memory_end)
+ */
+void		check_memory_begin(check_memory * state);
+
+/* Ends a check, releasing the reservations and the memory context (and
+ * everything allocated in it), and switching back to the caller's context.
+ * The outermost check reports the peak memory usage.
+ *
+ * - state : state initialized by check_memory_begin
+ */
+void		check_memory_end(check_memory * state);
+
+/* Reserves memory for a structure, if it fits into pg_check.max_memory.
+ *
+ * - nbytes : size of the structure
+ *
+ * Returns true if reserved, false if the limit would be exceeded.
+ */
+bool		check_memory_reserve(Size nbytes);
+
+/* Reserves as much memory as available, but at most nbytes (and at least
+ * minbytes, even if that exceeds the limit).
+ *
+ * - nbytes : memory requested (e.g. pg_check.cross_check_memory)
+ * - minbytes : memory needed for the structure to work at all
+ *
+ * Returns the reserved amount.
+ */
+Size		check_memory_reserve_upto(Size nbytes, Size minbytes);
+
+/* Returns peak memory used by the last check in this backend (in bytes). */
+Size		check_memory_peak(void);
+
+/* Allocates a zeroed chunk of memory in the current context, which may
+ * be larger than the 1GB palloc limit (on 9.5+).
+ *
+ * - nbytes : size of the chunk
+ *
+ * Returns the allocated memory.
+ */
+void	   *check_alloc_huge(Size nbytes);
+
+#endif							/* MEMORY_CHECK_H */
@@ -0,0 +1,603 @@
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+
+#if (PG_VERSION_NUM >= 90600)
+#include "access/parallel.h"
+#include "access/xact.h"
+#include "port/atomics.h"
+#include "storage/spin.h"
+#endif
+
+#include "pg_check.h"
+#include "parallel.h"
+#include "progress.h"
+
+/*
+ * Number of blocks handed out to a worker at once. Small enough to keep
+ * the workers busy until the very end of the range, large enough to keep
+ * the coordination overhead (an atomic increment) negligible.
+ */
+#define PARALLEL_CHUNK_BLOCKS	256
+
+#if (PG_VERSION_NUM >= 90600)
+
+/* keys of the shared state in the TOC of the parallel context */
+#define PARALLEL_KEY_HEAP_CHECK		UINT64CONST(0xC4EC000000000001)
+#define PARALLEL_KEY_INDEX_CHECK	UINT64CONST(0xC4EC000000000002)
+#define PARALLEL_KEY_DATABASE_CHECK	UINT64CONST(0xC4EC000000000003)
+
+/*
+ * State shared by the leader and the workers checking a heap. The block
+ * range is consumed in chunks, using the atomic counter - it's 64-bit so
+ * that it can't wrap around even for ranges ending at MaxBlockNumber.
+ */
+typedef struct ParallelHeapCheck
+{
+	Oid			relid;			/* heap relation to check */
+	BlockNumber blockFrom;		/* first block of the range */
+	BlockNumber blockTo;		/* block after the last one */
+
+	pg_atomic_uint64 nextBlock; /* first block of the next chunk */
+
+	bool		has_bitmap;		/* build the heap bitmap too? */
+	dsm_handle	bitmap_handle;	/* segment with the shared heap bitmap */
+
+	slock_t		mutex;			/* protects nerrs */
+	uint32		nerrs;			/* issues found by all the processes */
+
+	int			progress_slot;	/* progress slot of the leader (or -1) */
+} ParallelHeapCheck;
+
+/*
+ * State shared by the leader and the workers checking indexes of a table.
+ * Each process grabs the next unchecked index, until all are checked.
+ */
+typedef struct ParallelIndexCheck
+{
+	pg_atomic_uint32 nextIndex; /* next index to check */
+
+	bool		has_bitmap;		/* cross-check with the heap? */
+	dsm_handle	bitmap_handle;	/* segment with the shared heap bitmap */
+
+	slock_t		mutex;			/* protects nerrs */
+	uint32		nerrs;			/* issues found by all the processes */
+
+	int			progress_slot;	/* progress slot of the leader (or -1) */
+
+	int			nindexes;		/* number of indexes */
+	Oid			indexes[FLEXIBLE_ARRAY_MEMBER];
+} ParallelIndexCheck;
+
+/*
+ * State shared by the leader and the workers checking a database. Each
+ * process grabs the next chunk from the queue (ordered by size), until
+ * all are checked. Each process reports progress of its own chunks.
+ */
+typedef struct ParallelDatabaseCheck
+{
+	pg_atomic_uint32 nextChunk; /* next chunk to check */
+
+	slock_t		mutex;			/* protects nerrs */
+	uint32		nerrs;			/* issues found by all the processes */
+
+	int			nchunks;		/* number of chunks */
+	database_chunk chunks[FLEXIBLE_ARRAY_MEMBER];
+} ParallelDatabaseCheck;
+
+static ParallelContext *create_parallel_context(char *function, int nworkers);
+
+static uint32 parallel_heap_scan(Relation rel, ParallelHeapCheck * shared,
+				   item_bitmap * bitmap);
+
+static uint32 parallel_index_scan(ParallelIndexCheck * shared,
+					item_bitmap * bitmap_heap);
+
+static uint32 parallel_database_scan(ParallelDatabaseCheck * shared);
+
+/*
+ * Create a parallel context for one of the worker entry points (the main
+ * functions need to be looked up by name, as it's an extension).
+ */
+static ParallelContext *
+create_parallel_context(char *function, int nworkers)
+{
+#if (PG_VERSION_NUM >= 110000) && (PG_VERSION_NUM < 120000)
+	return CreateParallelContext("pg_check", function, nworkers, true);
+#elif (PG_VERSION_NUM >= 100000)
+	return CreateParallelContext("pg_check", function, nworkers);
+#else
+	return CreateParallelContextForExternalFunction("pg_check", function,
+													nworkers);
+#endif
+}
+
+/*
+ * check_heap_parallel
+ *		Check a range of heap blocks in parallel.
+ *
+ * The leader participates in the scan too, so this works fine even when
+ * no background workers are available at the moment.
+ */
+uint32
+check_heap_parallel(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+					int nworkers, item_bitmap * bitmap)
+{
+	ParallelContext *pcxt;
+	ParallelHeapCheck *shared;
+	uint32		nerrs;
+
+	/* the workers can only update a bitmap in shared memory */
+	Assert((bitmap == NULL) || (bitmap->segment != NULL));
+
+	/* don't bother with workers for tiny ranges, or when already parallel */
+	if ((blockTo - blockFrom <= PARALLEL_CHUNK_BLOCKS) || IsInParallelMode())
+	{
+		BufferAccessStrategy strategy = GetAccessStrategy(BAS_BULKREAD);
+
+		nerrs = check_heap_range(rel, blockFrom, blockTo, strategy, bitmap,
+								 NULL, NULL, NULL, NULL, 0);
+
+		FreeAccessStrategy(strategy);
+
+		return nerrs;
+	}
+
+	/* no point in starting more workers than there are chunks */
+	nworkers = Min(nworkers,
+				   (blockTo - blockFrom) / PARALLEL_CHUNK_BLOCKS);
+
+	EnterParallelMode();
+
+	pcxt = create_parallel_context("pg_check_parallel_main", nworkers);
+
+	shm_toc_estimate_chunk(&pcxt->estimator, sizeof(ParallelHeapCheck));
+	shm_toc_estimate_keys(&pcxt->estimator, 1);
+
+	InitializeParallelDSM(pcxt);
+
+	shared = (ParallelHeapCheck *) shm_toc_allocate(pcxt->toc,
+													sizeof(ParallelHeapCheck));
+
+	shared->relid = RelationGetRelid(rel);
+	shared->blockFrom = blockFrom;
+	shared->blockTo = blockTo;
+	pg_atomic_init_u64(&shared->nextBlock, blockFrom);
+	SpinLockInit(&shared->mutex);
+	shared->nerrs = 0;
+	shared->progress_slot = progress_get_slot();
+
+	shared->has_bitmap = (bitmap != NULL);
+	if (bitmap != NULL)
+		shared->bitmap_handle = bitmap_get_handle(bitmap);
+
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_HEAP_CHECK, shared);
+
+	LaunchParallelWorkers(pcxt);
+
+	elog(DEBUG1, "checking heap \"%s\" using %d parallel workers",
+		 RelationGetRelationName(rel), pcxt->nworkers_launched);
+
+	/* the leader checks chunks too, until there are none left */
+	nerrs = parallel_heap_scan(rel, shared, bitmap);
+
+	WaitForParallelWorkersToFinish(pcxt);
+
+	/* the workers are done now, so no need for the spinlock */
+	nerrs += shared->nerrs;
+
+	DestroyParallelContext(pcxt);
+
+	ExitParallelMode();
+
+	return nerrs;
+}
+
+/*
+ * pg_check_parallel_main
+ *		Main function of the parallel workers.
+ *
+ * Checks chunks of the heap until the whole range is exhausted, and then
+ * adds the number of issues to the shared counter. When cross-checking,
+ * the items are added to the shared heap bitmap - the chunks are disjoint
+ * ranges of whole pages, so this needs no locking. The leader holds a lock
+ * on the relation, so (with group locking) acquiring AccessShareLock here
+ * does not conflict even when the leader is cross-checking.
+ */
+void
+pg_check_parallel_main(dsm_segment *seg, shm_toc *toc)
+{
+	ParallelHeapCheck *shared;
+	Relation	rel;
+	uint32		nerrs;
+	item_bitmap *bitmap = NULL;
+
+#if (PG_VERSION_NUM >= 100000)
+	shared = (ParallelHeapCheck *) shm_toc_lookup(toc, PARALLEL_KEY_HEAP_CHECK,
+												  false);
+#else
+	shared = (ParallelHeapCheck *) shm_toc_lookup(toc, PARALLEL_KEY_HEAP_CHECK);
+#endif
+
+	progress_attach(shared->progress_slot);
+
+	if (shared->has_bitmap)
+		bitmap = bitmap_attach(shared->bitmap_handle);
+
+	rel = relation_open(shared->relid, AccessShareLock);
+
+	nerrs = parallel_heap_scan(rel, shared, bitmap);
+
+	relation_close(rel, AccessShareLock);
+
+	if (bitmap != NULL)
+		bitmap_free(bitmap);
+
+	progress_detach();
+
+	SpinLockAcquire(&shared->mutex);
+	shared->nerrs += nerrs;
+	SpinLockRelease(&shared->mutex);
+}
+
+/*
+ * Grab chunks of the shared block range and check them, until there are
+ * no chunks left. Returns number of issues found by this process.
+ */
+static uint32
+parallel_heap_scan(Relation rel, ParallelHeapCheck * shared,
+				   item_bitmap * bitmap)
+{
+	uint32		nerrs = 0;
+	BufferAccessStrategy strategy = GetAccessStrategy(BAS_BULKREAD);
+
+	while (true)
+	{
+		uint64		chunkFrom;
+		uint64		chunkTo;
+
+		chunkFrom = pg_atomic_fetch_add_u64(&shared->nextBlock,
+											PARALLEL_CHUNK_BLOCKS);
+
+		if (chunkFrom >= shared->blockTo)
+			break;
+
+		chunkTo = Min(chunkFrom + PARALLEL_CHUNK_BLOCKS, shared->blockTo);
+
+		nerrs += check_heap_range(rel, (BlockNumber) chunkFrom,
+								  (BlockNumber) chunkTo, strategy, bitmap,
+								  NULL, NULL, NULL, NULL, 0);
+	}
+
+	FreeAccessStrategy(strategy);
+
+	return nerrs;
+}
+
+/*
+ * check_indexes_parallel
+ *		Check (and cross-check) indexes of a table in parallel.
+ *
+ * Each process (including the leader) checks one index at a time, with
+ * its own index bitmap, compared to the shared heap bitmap.
+ */
+uint32
+check_indexes_parallel(List *indexes, int nworkers, item_bitmap * bitmap)
+{
+	ParallelContext *pcxt;
+	ParallelIndexCheck *shared;
+	Size		size;
+	ListCell   *lc;
+	uint32		nerrs;
+	int			i;
+
+	Assert((bitmap == NULL) || bitmap_is_shared(bitmap));
+
+	if (IsInParallelMode())
+	{
+		item_bitmap *bitmap_idx = (bitmap) ? bitmap_copy(bitmap) : NULL;
+
+		nerrs = 0;
+		foreach(lc, indexes)
+			nerrs += check_table_index(lfirst_oid(lc), bitmap, bitmap_idx);
+
+		if (bitmap_idx)
+			bitmap_free(bitmap_idx);
+
+		return nerrs;
+	}
+
+	/* the leader checks one of the indexes */
+	nworkers = Min(nworkers, list_length(indexes) - 1);
+
+	size = offsetof(ParallelIndexCheck, indexes) +
+		list_length(indexes) * sizeof(Oid);
+
+	EnterParallelMode();
+
+	pcxt = create_parallel_context("pg_check_parallel_index_main", nworkers);
+
+	shm_toc_estimate_chunk(&pcxt->estimator, size);
+	shm_toc_estimate_keys(&pcxt->estimator, 1);
+
+	InitializeParallelDSM(pcxt);
+
+	shared = (ParallelIndexCheck *) shm_toc_allocate(pcxt->toc, size);
+
+	pg_atomic_init_u32(&shared->nextIndex, 0);
+	SpinLockInit(&shared->mutex);
+	shared->nerrs = 0;
+	shared->progress_slot = progress_get_slot();
+
+	shared->has_bitmap = (bitmap != NULL);
+	if (bitmap != NULL)
+		shared->bitmap_handle = bitmap_get_handle(bitmap);
+
+	i = 0;
+	foreach(lc, indexes)
+		shared->indexes[i++] = lfirst_oid(lc);
+	shared->nindexes = i;
+
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_INDEX_CHECK, shared);
+
+	LaunchParallelWorkers(pcxt);
+
+	elog(DEBUG1, "checking %d indexes using %d parallel workers",
+		 shared->nindexes, pcxt->nworkers_launched);
+
+	nerrs = parallel_index_scan(shared, bitmap);
+
+	WaitForParallelWorkersToFinish(pcxt);
+
+	/* the workers are done now, so no need for the spinlock */
+	nerrs += shared->nerrs;
+
+	DestroyParallelContext(pcxt);
+
+	ExitParallelMode();
+
+	return nerrs;
+}
+
+/*
+ * pg_check_parallel_index_main
+ *		Main function of the parallel workers checking indexes.
+ *
+ * The index bitmap is private to the worker, only the heap bitmap (which
+ * is not modified anymore) is shared.
+ */
+void
+pg_check_parallel_index_main(dsm_segment *seg, shm_toc *toc)
+{
+	ParallelIndexCheck *shared;
+	item_bitmap *bitmap = NULL;
+	uint32		nerrs;
+
+#if (PG_VERSION_NUM >= 100000)
+	shared = (ParallelIndexCheck *) shm_toc_lookup(toc, PARALLEL_KEY_INDEX_CHECK,
+												   false);
+#else
+	shared = (ParallelIndexCheck *) shm_toc_lookup(toc, PARALLEL_KEY_INDEX_CHECK);
+#endif
+
+	progress_attach(shared->progress_slot);
+
+	if (shared->has_bitmap)
+		bitmap = bitmap_attach(shared->bitmap_handle);
+
+	nerrs = parallel_index_scan(shared, bitmap);
+
+	if (bitmap != NULL)
+		bitmap_free(bitmap);
+
+	progress_detach();
+
+	SpinLockAcquire(&shared->mutex);
+	shared->nerrs += nerrs;
+	SpinLockRelease(&shared->mutex);
+}
+
+/*
+ * Grab indexes from the shared list and check them, until there are none
+ * left. Returns number of issues found by this process.
+ */
+static uint32
+parallel_index_scan(ParallelIndexCheck * shared, item_bitmap * bitmap_heap)
+{
+	uint32		nerrs = 0;
+	item_bitmap *bitmap_idx = NULL;
+
+	while (true)
+	{
+		uint32		idx = pg_atomic_fetch_add_u32(&shared->nextIndex, 1);
+
+		if ((int) idx >= shared->nindexes)
+			break;
+
+		/* allocate the (private) index bitmap on the first index */
+		if (bitmap_heap && !bitmap_idx)
+			bitmap_idx = bitmap_copy(bitmap_heap);
+
+		nerrs += check_table_index(shared->indexes[idx], bitmap_heap,
+								   bitmap_idx);
+	}
+
+	if (bitmap_idx)
+		bitmap_free(bitmap_idx);
+
+	return nerrs;
+}
+
+/*
+ * check_database_parallel
+ *		Check chunks of relations of a database in parallel.
+ *
+ * The workers open the relations themselves, so (unlike when checking a
+ * single table) the leader does not hold any locks protecting them. The
+ * chunks of relations dropped in the meantime are skipped.
+ */
+uint32
+check_database_parallel(database_chunk * chunks, int nchunks, int nworkers)
+{
+	ParallelContext *pcxt;
+	ParallelDatabaseCheck *shared;
+	Size		size;
+	uint32		nerrs = 0;
+	int			i;
+
+	/* no workers needed, or already parallel */
+	if ((nworkers <= 0) || (nchunks <= 1) || IsInParallelMode())
+	{
+		for (i = 0; i < nchunks; i++)
+			nerrs += check_database_chunk(&chunks[i]);
+
+		return nerrs;
+	}
+
+	/* the leader checks one of the chunks */
+	nworkers = Min(nworkers, nchunks - 1);
+
+	size = offsetof(ParallelDatabaseCheck, chunks) +
+		nchunks * sizeof(database_chunk);
+
+	EnterParallelMode();
+
+	pcxt = create_parallel_context("pg_check_parallel_database_main", nworkers);
+
+	shm_toc_estimate_chunk(&pcxt->estimator, size);
+	shm_toc_estimate_keys(&pcxt->estimator, 1);
+
+	InitializeParallelDSM(pcxt);
+
+	shared = (ParallelDatabaseCheck *) shm_toc_allocate(pcxt->toc, size);
+
+	pg_atomic_init_u32(&shared->nextChunk, 0);
+	SpinLockInit(&shared->mutex);
+	shared->nerrs = 0;
+
+	memcpy(shared->chunks, chunks, nchunks * sizeof(database_chunk));
+	shared->nchunks = nchunks;
+
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_DATABASE_CHECK, shared);
+
+	LaunchParallelWorkers(pcxt);
+
+	elog(DEBUG1, "checking %d chunks using %d parallel workers",
+		 shared->nchunks, pcxt->nworkers_launched);
+
+	nerrs = parallel_database_scan(shared);
+
+	WaitForParallelWorkersToFinish(pcxt);
+
+	/* the workers are done now, so no need for the spinlock */
+	nerrs += shared->nerrs;
+
+	DestroyParallelContext(pcxt);
+
+	ExitParallelMode();
+
+	return nerrs;
+}
+
+/*
+ * pg_check_parallel_database_main
+ *		Main function of the parallel workers checking a database.
+ */
+void
+pg_check_parallel_database_main(dsm_segment *seg, shm_toc *toc)
+{
+	ParallelDatabaseCheck *shared;
+	uint32		nerrs;
+
+#if (PG_VERSION_NUM >= 100000)
+	shared = (ParallelDatabaseCheck *) shm_toc_lookup(toc,
+													  PARALLEL_KEY_DATABASE_CHECK,
+													  false);
+#else
+	shared = (ParallelDatabaseCheck *) shm_toc_lookup(toc,
+													  PARALLEL_KEY_DATABASE_CHECK);
+#endif
+
+	nerrs = parallel_database_scan(shared);
+
+	SpinLockAcquire(&shared->mutex);
+	shared->nerrs += nerrs;
+	SpinLockRelease(&shared->mutex);
+}
+
+/*
+ * Grab chunks from the shared queue and check them, until there are none
+ * left. Returns number of issues found by this process.
+ */
+static uint32
+parallel_database_scan(ParallelDatabaseCheck * shared)
+{
+	uint32		nerrs = 0;
+
+	while (true)
+	{
+		uint32		idx = pg_atomic_fetch_add_u32(&shared->nextChunk, 1);
+
+		if ((int) idx >= shared->nchunks)
+			break;
+
+		nerrs += check_database_chunk(&shared->chunks[idx]);
+	}
+
+	return nerrs;
+}
+
+#else							/* PG_VERSION_NUM < 90600 */
+
+/*
+ * Parallel infrastructure is not available before 9.6, so just check the
+ * whole range in this backend.
+ */
+uint32
+check_heap_parallel(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+					int nworkers, item_bitmap * bitmap)
+{
+	uint32		nerrs;
+	BufferAccessStrategy strategy = GetAccessStrategy(BAS_BULKREAD);
+
+	nerrs = check_heap_range(rel, blockFrom, blockTo, strategy, bitmap,
+							 NULL, NULL, NULL, NULL, 0);
+
+	FreeAccessStrategy(strategy);
+
+	return nerrs;
+}
+
+/* check the indexes one by one, in this backend */
+uint32
+check_indexes_parallel(List *indexes, int nworkers, item_bitmap * bitmap)
+{
+	uint32		nerrs = 0;
+	ListCell   *lc;
+	item_bitmap *bitmap_idx = (bitmap) ? bitmap_copy(bitmap) : NULL;
+
+	foreach(lc, indexes)
+		nerrs += check_table_index(lfirst_oid(lc), bitmap, bitmap_idx);
+
+	if (bitmap_idx)
+		bitmap_free(bitmap_idx);
+
+	return nerrs;
+}
+
+/* check the chunks one by one, in this backend */
+uint32
+check_database_parallel(database_chunk * chunks, int nchunks, int nworkers)
+{
+	uint32		nerrs = 0;
+	int			i;
+
+	for (i = 0; i < nchunks; i++)
+		nerrs += check_database_chunk(&chunks[i]);
+
+	return nerrs;
+}
+
+#endif
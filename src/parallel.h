@@ -0,0 +1,96 @@
+#ifndef PARALLEL_CHECK_H
+#define PARALLEL_CHECK_H
+
+#include "postgres.h"
+#include "nodes/pg_list.h"
+#include "utils/rel.h"
+
+#include "item-bitmap.h"
+
+#if (PG_VERSION_NUM >= 90600)
+#include "storage/dsm.h"
+#include "storage/shm_toc.h"
+#endif
+
+/*
+ * A chunk of work of pg_check_database - a range of blocks of a heap, or a
+ * whole index (so that the structure of b-tree indexes is verified). The
+ * heap of the index is locked first, to lock relations in the same order
+ * as the other commands (table before index).
+ *
+ * When checking a partitioned table, each chunk is a whole leaf partition
+ * (or its TOAST table), checked including the indexes and cross-check.
+ */
+typedef struct database_chunk
+{
+	Oid			relid;			/* heap or index to check */
+	Oid			heapid;			/* heap of the index (InvalidOid for heaps) */
+	BlockNumber blockFrom;		/* first block of the heap range */
+	BlockNumber blockTo;		/* block after the last one (or
+								 * InvalidBlockNumber for the end of heap) */
+	BlockNumber nblocks;		/* size of the chunk when queued */
+
+	/* check of a whole partition */
+	bool		partition;		/* check the whole table (with indexes) */
+	bool		checkIndexes;	/* check indexes of the partition */
+	bool		crossCheck;		/* cross-check the indexes */
+	uint64		sinceLsn;		/* only pages modified since the LSN */
+}			database_chunk;
+
+/* Checks heap blocks [blockFrom, blockTo) using parallel workers.
+ *
+ * - rel : heap relation (already locked by the leader)
+ * - blockFrom : first block to check
+ * - blockTo : block after the last one to check
+ * - nworkers : number of workers to request (in addition to the leader)
+ * - bitmap : shared bitmap of heap items for the cross-check (may be NULL),
+ *            has to be allocated by bitmap_init_shared
+ *
+ * The block range is split into chunks of PARALLEL_CHUNK_BLOCKS blocks,
+ * handed out to the workers (and the leader) on a first-come basis. When
+ * no workers can be started, the leader simply checks all the chunks.
+ *
+ * Returns number of issues found (summed over all the processes).
+ */
+uint32		check_heap_parallel(Relation rel,
+								BlockNumber blockFrom, BlockNumber blockTo,
+								int nworkers, item_bitmap * bitmap);
+
+/* Checks (and cross-checks) indexes of a table using parallel workers.
+ *
+ * - indexes : list of index OIDs (the heap is locked by the leader)
+ * - nworkers : number of workers to request (in addition to the leader)
+ * - bitmap : shared bitmap of heap items for the cross-check (may be NULL),
+ *            has to be allocated by bitmap_init_shared
+ *
+ * All the indexes are checked at the same time, each process (including
+ * the leader) checks one index at a time, using a private index bitmap.
+ *
+ * Returns number of issues found (summed over all the processes).
+ */
+uint32		check_indexes_parallel(List *indexes, int nworkers,
+								   item_bitmap * bitmap);
+
+/* Checks chunks of the relations of a database using parallel workers.
+ *
+ * - chunks : the chunks to check, ordered from the largest one
+ * - nchunks : number of chunks
+ * - nworkers : number of workers to request (in addition to the leader)
+ *
+ * The processes (including the leader) take the chunks from the shared
+ * queue one by one, until there are none left. Processing the largest
+ * chunks first means the processes finish at about the same time.
+ *
+ * Returns number of issues found (summed over all the processes).
+ */
+uint32		check_database_parallel(database_chunk * chunks, int nchunks,
+									int nworkers);
+
+#if (PG_VERSION_NUM >= 90600)
+/* Entry points of the parallel workers (looked up by name). */
+PGDLLEXPORT void pg_check_parallel_main(dsm_segment *seg, shm_toc *toc);
+PGDLLEXPORT void pg_check_parallel_index_main(dsm_segment *seg, shm_toc *toc);
+PGDLLEXPORT void pg_check_parallel_database_main(dsm_segment *seg, shm_toc *toc);
+#endif
+
+#endif							/* PARALLEL_CHECK_H */
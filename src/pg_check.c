@@ -11,8 +11,17 @@
 
 #include "postgres.h"
 
+#if (PG_VERSION_NUM >= 90300)
+#include "access/htup_details.h"
+#endif
+#include "access/heapam.h"
 #include "access/itup.h"
 #include "access/nbtree.h"
+#if (PG_VERSION_NUM >= 120000)
+#include "access/tableam.h"
+#endif
+#include "access/xact.h"
+#include "access/xlog.h"
 #include "catalog/namespace.h"
 
 #if (PG_VERSION_NUM >= 90600)
@@ -20,18 +29,38 @@
 #endif
 
 #include "catalog/pg_class.h"
+#if (PG_VERSION_NUM >= 110000)
+#include "catalog/pg_inherits.h"
+#elif (PG_VERSION_NUM >= 100000)
+#include "catalog/pg_inherits_fn.h"
+#endif
+#include "catalog/pg_type.h"
 #include "funcapi.h"
 #include "miscadmin.h"
 #include "storage/bufmgr.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
 #include "utils/guc.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
 
+#include "btree-structure.h"
 #include "common.h"
+#include "diff.h"
+#include "fingerprint.h"
 #include "index.h"
 #include "heap.h"
+#include "issues.h"
+#include "progress.h"
 #include "item-bitmap.h"
+#include "parallel.h"
+#include "pg_check.h"
+#include "reader.h"
+#include "sample.h"
+#include "stats.h"
+#include "toast.h"
 
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
@@ -39,6 +68,13 @@ PG_MODULE_MAGIC;
 
 #define BTPageGetOpaque(page) ((BTPageOpaque) PageGetSpecialPointer(page))
 
+/*
+ * Heaps are checked by pg_check_database in chunks of this many blocks
+ * (1GB with 8kB pages), so that a single large table can be checked by
+ * multiple processes. Indexes are always checked as a whole.
+ */
+#define DATABASE_CHUNK_BLOCKS	131072
+
 /* bitmap format (when pg_check.debug = true) */
 static const struct config_enum_entry bitmap_options[] = {
 	{"base64", BITMAP_BASE64, false},
@@ -48,23 +84,121 @@ static const struct config_enum_entry bitmap_options[] = {
 	{NULL, 0, false}
 };
 
+/* bitmap representation (when cross-checking) */
+static const struct config_enum_entry bitmap_type_options[] = {
+	{"dense", BITMAP_TYPE_DENSE, false},
+	{"compressed", BITMAP_TYPE_COMPRESSED, false},
+	{NULL, 0, false}
+};
+
+/* cross-check method */
+static const struct config_enum_entry cross_check_method_options[] = {
+	{"bitmap", CROSS_CHECK_BITMAP, false},
+	{"fingerprint", CROSS_CHECK_FINGERPRINT, false},
+	{"sorted", CROSS_CHECK_SORTED, false},
+	{NULL, 0, false}
+};
+
+/* depth of the page checks */
+static const struct config_enum_entry check_level_options[] = {
+	{"header", CHECK_LEVEL_HEADER, false},
+	{"line_pointers", CHECK_LEVEL_LINE_POINTERS, false},
+	{"tuples", CHECK_LEVEL_TUPLES, false},
+	{"attributes", CHECK_LEVEL_ATTRIBUTES, false},
+	{NULL, 0, false}
+};
+
 void		_PG_init(void);
 
 bool		pgcheck_debug;
 int			pgcheck_bitmap_format = BITMAP_BINARY;
+int			pgcheck_max_parallel_workers = 0;
+int			pgcheck_bitmap_type = BITMAP_TYPE_DENSE;
+bool		pgcheck_snapshot_cross_check = false;
+int			pgcheck_cross_check_method = CROSS_CHECK_BITMAP;
+int			pgcheck_cross_check_memory = 65536;
+int			pgcheck_prefetch_distance = 32;
+bool		pgcheck_direct_read = false;
+int			pgcheck_cost_delay = 0;
+int			pgcheck_cost_limit = 200;
+int			pgcheck_cost_page_hit = 1;
+int			pgcheck_cost_page_miss = 10;
+bool		pgcheck_verify_checksums = true;
+bool		pgcheck_verify_btree_structure = false;
+bool		pgcheck_verify_toast = false;
+int			pgcheck_toast_memory = 65536;
+bool		pgcheck_verify_maps = false;
+int			pgcheck_max_memory = 0;
+int			pgcheck_check_level = CHECK_LEVEL_ATTRIBUTES;
+bool		pgcheck_track_stats = true;
+int			pgcheck_stats_max_relations = 1000;
+
+/* peak memory used by the item bitmaps during the last check (in bytes) */
+static Size bitmap_memory_peak = 0;
+
+#if (PG_VERSION_NUM >= 100000)
+/*
+ * LSNs to check the partitions since, in an incremental check of a
+ * partitioned table by pg_check_partitions_since (NULL otherwise).
+ */
+static Oid *partition_relids = NULL;
+static uint64 *partition_lsns = NULL;
+static int	npartition_lsns = 0;
+#endif
 
 Datum		pg_check_table(PG_FUNCTION_ARGS);
 Datum		pg_check_index(PG_FUNCTION_ARGS);
+Datum		pg_check_table_since(PG_FUNCTION_ARGS);
+Datum		pg_check_partitions_since(PG_FUNCTION_ARGS);
+Datum		pg_check_table_issues(PG_FUNCTION_ARGS);
+Datum		pg_check_index_issues(PG_FUNCTION_ARGS);
+Datum		pg_check_bitmap_memory(PG_FUNCTION_ARGS);
+Datum		pg_check_database(PG_FUNCTION_ARGS);
 
 static uint32 check_table(Oid relid,
 			bool checkIndexes, bool crossCheckIndexes,
 			BlockNumber blockFrom, BlockNumber blockTo,
-			bool blockRangeGiven);
+			bool blockRangeGiven, uint64 sinceLsn,
+			sample_options * sampleOptions);
+static sample_options *get_sample_options(FunctionCallInfo fcinfo, int argno,
+				   sample_options * options);
+static void track_bitmap_memory(item_bitmap * bitmap_a,
+					item_bitmap * bitmap_b);
+static bool verify_checksums(void);
+static uint64 current_lsn(void);
+static uint64 parse_lsn(const char *lsn);
+static database_chunk *database_chunks(int *nchunks);
+static database_chunk *add_database_chunk(database_chunk * chunks,
+				   int *nchunks, int *maxchunks, Oid relid, Oid heapid,
+				   BlockNumber blockFrom, BlockNumber blockTo,
+				   BlockNumber nblocks);
+static int	database_chunk_cmp(const void *a, const void *b);
+static LOCKMODE check_lock_mode(bool crossCheck);
+#if (PG_VERSION_NUM >= 100000)
+static uint32 check_partitioned_table(Oid relid, bool checkIndexes,
+						bool crossCheckIndexes, uint64 sinceLsn,
+						int nworkers);
+static database_chunk *add_partition_chunk(database_chunk * chunks,
+					int *nchunks, int *maxchunks, Oid relid,
+					bool checkIndexes, bool crossCheckIndexes,
+					uint64 sinceLsn, Oid *toastid);
+static uint64 partition_since_lsn(Oid relid, uint64 sinceLsn);
+#endif
+static uint32 verify_toast(toast_check * toast);
+static uint32 check_table_fingerprints(Relation rel,
+						 BlockNumber blockFrom, BlockNumber blockTo,
+						 BufferAccessStrategy strategy,
+						 TransactionId horizon, toast_check * toast);
+static int	reserve_bitmaps(Relation rel, BlockNumber npages, bool snapshot,
+				BitmapType * bitmapType, int *nworkers);
+static uint32 check_table_sorted(Relation rel,
+				   BlockNumber blockFrom, BlockNumber blockTo,
+				   bool blockRangeGiven, BufferAccessStrategy strategy,
+				   TransactionId horizon, toast_check * toast);
+static uint32 check_heap_page(Relation rel, PageHeader header, char *raw_page,
+				BlockNumber blkno, attribute_plan * plan,
+				page_reader * reader, bool checksums);
 
-static uint32 check_index(Oid indexOid,
-			BlockNumber blockFrom, BlockNumber blockTo,
-			bool blockRangeGiven,
-			item_bitmap * bitmap, bool *crossCheck);
 
 /*
  * pg_check_table
@@ -84,6 +218,8 @@ pg_check_table(PG_FUNCTION_ARGS)
 	int64		blockFrom;		/* starting block */
 	int64		blockTo;		/* end block */
 	bool		blockRange = false; /* block range specified */
+	sample_options sample;		/* sample of blocks to check */
+	sample_options *sampleOptions = get_sample_options(fcinfo, 5, &sample);
 
 	/* we only allow either both block_start/block_end, or neither */
 	if (PG_ARGISNULL(3) && PG_ARGISNULL(4))
@@ -118,13 +254,340 @@ pg_check_table(PG_FUNCTION_ARGS)
 	if (crossCheckIndexes && (!checkIndexes))
 		elog(ERROR, "index cross-check can only be requested with index check");
 
+	/* the sampled heap would not match the indexes */
+	if (crossCheckIndexes && sampleOptions)
+		elog(ERROR, "index cross-check not possible when sampling blocks");
+
 	nerrs = check_table(relid, checkIndexes, crossCheckIndexes,
 						(BlockNumber) blockFrom, (BlockNumber) blockTo,
-						blockRange);
+						blockRange, 0, sampleOptions);
 
 	PG_RETURN_INT32(nerrs);
 }
 
+/*
+ * pg_check_table_since
+ *
+ * Checks pages of the table modified since the given LSN (i.e. pages with
+ * a newer LSN), returns number of issues found and LSN to use for the next
+ * incremental check.
+ *
+ * The LSN is determined before the check starts, so pages modified while
+ * the check is running will be checked again next time.
+ *
+ * XXX The pages still have to be read to look at the LSN, so this saves
+ * the CPU time spent checking the tuples, but not the I/O.
+ */
+PG_FUNCTION_INFO_V1(pg_check_table_since);
+
+Datum
+pg_check_table_since(PG_FUNCTION_ARGS)
+{
+#if (PG_VERSION_NUM >= 90300)
+	Oid			relid = PG_GETARG_OID(0);
+	uint64		sinceLsn = parse_lsn(text_to_cstring(PG_GETARG_TEXT_PP(1)));
+	XLogRecPtr	startLsn;
+	uint32		nerrs;
+	TupleDesc	tupdesc;
+	Datum		values[2];
+	bool		nulls[2] = {false, false};
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	/* anything modified after this point will be checked next time */
+	startLsn = current_lsn();
+
+	nerrs = check_table(relid, false, false, 0, 0, false, sinceLsn, NULL);
+
+	values[0] = Int32GetDatum(nerrs);
+	values[1] = CStringGetTextDatum(psprintf("%X/%X",
+											 (uint32) (startLsn >> 32),
+											 (uint32) startLsn));
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+#else
+	elog(ERROR, "incremental checks require PostgreSQL 9.3 or newer");
+	PG_RETURN_NULL();
+#endif
+}
+
+/*
+ * pg_check_partitions_since
+ *
+ * Incremental check of a partitioned table, with a separate LSN for each
+ * leaf partition (e.g. the watermarks of the previous checks). Partitions
+ * not listed are checked whole. Returns the same thing as
+ * pg_check_table_since, the LSN applies to all the partitions.
+ *
+ * XXX Partitions not modified since their LSN are still read, but none of
+ * their pages are checked.
+ */
+PG_FUNCTION_INFO_V1(pg_check_partitions_since);
+
+Datum
+pg_check_partitions_since(PG_FUNCTION_ARGS)
+{
+#if (PG_VERSION_NUM >= 100000)
+	Oid			relid = PG_GETARG_OID(0);
+	ArrayType  *partitions = PG_GETARG_ARRAYTYPE_P(1);
+	ArrayType  *lsns = PG_GETARG_ARRAYTYPE_P(2);
+	Datum	   *partdatums;
+	Datum	   *lsndatums;
+	bool	   *partnulls;
+	bool	   *lsnnulls;
+	int			nparts;
+	int			nlsns;
+	Oid		   *relids;
+	uint64	   *sinceLsns;
+	XLogRecPtr	startLsn;
+	uint32		nerrs;
+	TupleDesc	tupdesc;
+	Datum		values[2];
+	bool		nulls[2] = {false, false};
+	int			i;
+
+	if (get_rel_relkind(relid) != RELKIND_PARTITIONED_TABLE)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a partitioned table",
+						get_rel_name(relid))));
+
+	deconstruct_array(partitions, OIDOID, sizeof(Oid), true, 'i',
+					  &partdatums, &partnulls, &nparts);
+	deconstruct_array(lsns, TEXTOID, -1, false, 'i',
+					  &lsndatums, &lsnnulls, &nlsns);
+
+	if (nparts != nlsns)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of partitions (%d) and LSNs (%d) does not match",
+						nparts, nlsns)));
+
+	relids = (Oid *) palloc(Max(1, nparts) * sizeof(Oid));
+	sinceLsns = (uint64 *) palloc(Max(1, nparts) * sizeof(uint64));
+
+	for (i = 0; i < nparts; i++)
+	{
+		if (partnulls[i] || lsnnulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("partitions and LSNs must not be NULL")));
+
+		relids[i] = DatumGetObjectId(partdatums[i]);
+		sinceLsns[i] = parse_lsn(TextDatumGetCString(lsndatums[i]));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	/* anything modified after this point will be checked next time */
+	startLsn = current_lsn();
+
+	PG_TRY();
+	{
+		partition_relids = relids;
+		partition_lsns = sinceLsns;
+		npartition_lsns = nparts;
+
+		nerrs = check_table(relid, false, false, 0, 0, false, 0, NULL);
+	}
+	PG_CATCH();
+	{
+		partition_relids = NULL;
+		partition_lsns = NULL;
+		npartition_lsns = 0;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	partition_relids = NULL;
+	partition_lsns = NULL;
+	npartition_lsns = 0;
+
+	values[0] = Int32GetDatum(nerrs);
+	values[1] = CStringGetTextDatum(psprintf("%X/%X",
+											 (uint32) (startLsn >> 32),
+											 (uint32) startLsn));
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+#else
+	elog(ERROR, "partitioned tables require PostgreSQL 10 or newer");
+	PG_RETURN_NULL();
+#endif
+}
+
+/*
+ * pg_check_table_issues
+ *
+ * Checks the table (and optionally the indexes) just like pg_check_table,
+ * but returns the issues as rows instead of reporting WARNINGs. At most
+ * max_issues issues are returned individually (the rest is counted per
+ * check code, NULL means no limit), or just one row per code in aggregate
+ * mode.
+ *
+ * The whole table is checked by this backend, i.e. without parallel
+ * workers (the issues found by the workers would be reported as WARNINGs).
+ */
+PG_FUNCTION_INFO_V1(pg_check_table_issues);
+
+Datum
+pg_check_table_issues(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	bool		checkIndexes = PG_GETARG_BOOL(1);
+	bool		crossCheckIndexes = PG_GETARG_BOOL(2);
+	int			maxIssues = PG_ARGISNULL(3) ? -1 : PG_GETARG_INT32(3);
+	bool		aggregate = PG_GETARG_BOOL(4);
+	issue_collector *collector;
+
+	if (crossCheckIndexes && (!checkIndexes))
+		elog(ERROR, "index cross-check can only be requested with index check");
+
+	collector = issues_init(fcinfo, maxIssues, aggregate);
+
+	PG_TRY();
+	{
+		pgcheck_issues = collector;
+
+		check_table(relid, checkIndexes, crossCheckIndexes, 0, 0, false, 0,
+					NULL);
+	}
+	PG_CATCH();
+	{
+		pgcheck_issues = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	pgcheck_issues = NULL;
+
+	issues_finish(collector);
+
+	return (Datum) 0;
+}
+
+/*
+ * pg_check_index_issues
+ *
+ * Checks a single index, returns the issues as rows (see
+ * pg_check_table_issues).
+ */
+PG_FUNCTION_INFO_V1(pg_check_index_issues);
+
+Datum
+pg_check_index_issues(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	int			maxIssues = PG_ARGISNULL(1) ? -1 : PG_GETARG_INT32(1);
+	bool		aggregate = PG_GETARG_BOOL(2);
+	issue_collector *collector;
+
+	collector = issues_init(fcinfo, maxIssues, aggregate);
+
+	PG_TRY();
+	{
+		pgcheck_issues = collector;
+
+		check_index(relid, 0, 0, false, NULL, NULL, NULL);
+	}
+	PG_CATCH();
+	{
+		pgcheck_issues = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	pgcheck_issues = NULL;
+
+	issues_finish(collector);
+
+	return (Datum) 0;
+}
+
+/*
+ * pg_check_table_diff
+ *
+ * Cross-checks the table with all the indexes, and returns the differences
+ * as ranges of items (missing in the index, or missing in the heap) instead
+ * of reporting a WARNING for each item. Other issues are still reported
+ * as WARNINGs.
+ *
+ * Just like with pg_check_table_issues, the table is checked without
+ * parallel workers.
+ */
+PG_FUNCTION_INFO_V1(pg_check_table_diff);
+
+Datum
+pg_check_table_diff(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	diff_export *diff;
+
+	diff = diff_init_srf(fcinfo);
+
+	PG_TRY();
+	{
+		pgcheck_diff = diff;
+
+		check_table(relid, true, true, 0, 0, false, 0, NULL);
+	}
+	PG_CATCH();
+	{
+		pgcheck_diff = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	pgcheck_diff = NULL;
+
+	diff_finish(diff);
+
+	return (Datum) 0;
+}
+
+/*
+ * pg_check_table_diff_file
+ *
+ * Same as pg_check_table_diff, but writes the ranges into a server-side
+ * binary file (see diff.h for the format), returns number of the ranges.
+ */
+PG_FUNCTION_INFO_V1(pg_check_table_diff_file);
+
+Datum
+pg_check_table_diff_file(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	char	   *path = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	diff_export *diff;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to write the differences into a file")));
+
+	diff = diff_init_file(path, relid);
+
+	PG_TRY();
+	{
+		pgcheck_diff = diff;
+
+		check_table(relid, true, true, 0, 0, false, 0, NULL);
+	}
+	PG_CATCH();
+	{
+		pgcheck_diff = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	pgcheck_diff = NULL;
+
+	diff_finish(diff);
+
+	PG_RETURN_INT64((int64) diff->nranges);
+}
+
 /*
  * pg_check_index
  *
@@ -140,9 +603,11 @@ pg_check_index(PG_FUNCTION_ARGS)
 	int64		blockFrom;		/* starting block */
 	int64		blockTo;		/* end block */
 	bool		blockRange = false; /* block range specified */
+	sample_options sample;		/* sample of blocks to check */
+	sample_options *sampleOptions = get_sample_options(fcinfo, 3, &sample);
 
 	/* we only allow either both block_start/block_end, or neither */
-	if (PG_ARGISNULL(3) && PG_ARGISNULL(4))
+	if (PG_ARGISNULL(1) && PG_ARGISNULL(2))
 	{
 		blockFrom = 0;
 		blockTo = 0;
@@ -150,7 +615,7 @@ pg_check_index(PG_FUNCTION_ARGS)
 	else if ((!PG_ARGISNULL(1)) && (!PG_ARGISNULL(2)))
 	{
 		blockFrom = PG_GETARG_INT64(1);
-		blockTo = PG_GETARG_INT64(1);
+		blockTo = PG_GETARG_INT64(2);
 		blockRange = true;
 	}
 	else
@@ -172,202 +637,1489 @@ pg_check_index(PG_FUNCTION_ARGS)
 
 	nerrs = check_index(relid,
 						(BlockNumber) blockFrom, (BlockNumber) blockTo,
-						blockRange, NULL, NULL);
+						blockRange, NULL, NULL, sampleOptions);
 
 	PG_RETURN_INT32(nerrs);
 }
 
 /*
- * Check the table, all indexes on the table, and cross-check indexes.
+ * Get the sample options from the sample_fraction / sample_blocks arguments
+ * (at most one of them may be specified). Returns the options, or NULL if
+ * the relation should be checked whole.
+ */
+static sample_options *
+get_sample_options(FunctionCallInfo fcinfo, int argno, sample_options * options)
+{
+	/* the functions of version 0.1.0 have no sample arguments */
+	if (PG_NARGS() <= argno + 1)
+		return NULL;
+
+	if (PG_ARGISNULL(argno) && PG_ARGISNULL(argno + 1))
+		return NULL;
+
+	if (!PG_ARGISNULL(argno) && !PG_ARGISNULL(argno + 1))
+		elog(ERROR, "only one of sample_fraction/sample_blocks may be specified");
+
+	options->fraction = 0;
+	options->nblocks = 0;
+
+	if (!PG_ARGISNULL(argno))
+	{
+		options->fraction = PG_GETARG_FLOAT8(argno);
+
+		if ((options->fraction <= 0) || (options->fraction > 1))
+			elog(ERROR, "invalid sample_fraction value %f (allowed (0,1])",
+				 options->fraction);
+	}
+	else
+	{
+		options->nblocks = PG_GETARG_INT64(argno + 1);
+
+		if (options->nblocks <= 0)
+			elog(ERROR, "invalid sample_blocks value " INT64_FORMAT " (has to be > 0)",
+				 options->nblocks);
+	}
+
+	return options;
+}
+
+/*
+ * pg_check_database
  *
- * The function acquires ShareRowExclusiveLock or AccessShareLock.The
- * stronger lock (AccessShareLock) is used when cross-check is requested.
+ * Checks all tables and indexes in the current database (without the
+ * cross-check), using parallel workers. Returns number of issues found.
  *
- * XXX The index cross-check is only allowed for full table check, but
- * that is not really needed - we can scan indexes and only consider
- * pointers to the specified block range.
+ * The heaps are split into chunks, and the chunks and indexes are put
+ * into a queue ordered by size, so that the largest ones are checked
+ * first. The processes then take the chunks from the queue one by one,
+ * so a huge table does not leave the other processes idle at the end.
  */
-static uint32
-check_table(Oid relid, bool checkIndexes, bool crossCheckIndexes,
-			BlockNumber blockFrom, BlockNumber blockTo, bool blockRangeGiven)
-{
-	Relation	rel;			/* relation for the 'relname' */
-	char	   *raw_page;		/* raw data of the page */
-	Buffer		buf;			/* buffer the page is read into */
-	uint32		nerrs = 0;		/* number of errors found */
-	BlockNumber blkno;			/* current block */
-	PageHeader	header;			/* page header */
-	BufferAccessStrategy strategy;	/* bulk strategy to avoid polluting cache */
+PG_FUNCTION_INFO_V1(pg_check_database);
 
-	/* used to cross-check heap and indexes */
-	item_bitmap *bitmap_heap = NULL;
+Datum
+pg_check_database(PG_FUNCTION_ARGS)
+{
+	int			nworkers = pgcheck_max_parallel_workers;
+	database_chunk *chunks;
+	int			nchunks;
+	uint32		nerrs;
 
 	if (!superuser())
 		ereport(ERROR,
 				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
 				 (errmsg("must be superuser to use pg_check functions"))));
 
-	if (blockRangeGiven && checkIndexes)	/* shouldn't happen */
-		elog(ERROR, "cross-check with indexes not possible with explicit block range");
-
-	/* When cross-checking, a more restrictive lock mode is needed. */
-	if (crossCheckIndexes)
-		rel = relation_open(relid, ShareRowExclusiveLock);
-	else
-		rel = relation_open(relid, AccessShareLock);
-
-	/* Check that this relation has storage */
-	if (rel->rd_rel->relkind != RELKIND_RELATION &&
-		rel->rd_rel->relkind != RELKIND_TOASTVALUE)
-		ereport(ERROR,
-				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
-				 errmsg("object \"%s\" is not a table",
-						RelationGetRelationName(rel))));
+	if (!PG_ARGISNULL(0))
+		nworkers = PG_GETARG_INT32(0);
 
-	/* Initialize buffer to copy data to */
-	raw_page = (char *) palloc(BLCKSZ);
+	if (nworkers < 0)
+		elog(ERROR, "invalid number of workers %d (has to be >= 0)", nworkers);
 
-	if (!blockRangeGiven)
-	{
-		blockFrom = 0;
-		blockTo = RelationGetNumberOfBlocks(rel);
-	}
+	chunks = database_chunks(&nchunks);
 
-	/* build the bitmap only when we need to do the cross-check */
-	if (crossCheckIndexes)
-		bitmap_heap = bitmap_init(blockFrom, blockTo);
+	elog(DEBUG1, "checking database using %d chunks", nchunks);
 
-	strategy = GetAccessStrategy(BAS_BULKREAD);
+	nerrs = check_database_parallel(chunks, nchunks, nworkers);
 
-	/* Take a verbatim copy of each page, and check it */
-	for (blkno = blockFrom; blkno < blockTo; blkno++)
-	{
-		buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, strategy);
-		LockBuffer(buf, BUFFER_LOCK_SHARE);
+	pfree(chunks);
 
-		memcpy(raw_page, BufferGetPage(buf), BLCKSZ);
+	PG_RETURN_INT32(nerrs);
+}
 
-		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
-		ReleaseBuffer(buf);
+/*
+ * Build the queue of chunks of all the tables (incl. TOAST) and indexes in
+ * the current database, ordered by size (largest first). Each table is
+ * locked (briefly, to get the size) before its indexes. Temporary tables
+ * are skipped, as those can't be read by other processes.
+ */
+static database_chunk *
+database_chunks(int *nchunks)
+{
+	Relation	classRel;
+#if (PG_VERSION_NUM >= 120000)
+	TableScanDesc scan;
+#else
+	HeapScanDesc scan;
+#endif
+	HeapTuple	tuple;
+	List	   *tables = NIL;
+	ListCell   *lc;
+	database_chunk *chunks = NULL;
+	int			maxchunks = 0;
+
+	*nchunks = 0;
+
+	classRel = relation_open(RelationRelationId, AccessShareLock);
+
+#if (PG_VERSION_NUM >= 120000)
+	scan = table_beginscan_catalog(classRel, 0, NULL);
+#elif (PG_VERSION_NUM >= 90400)
+	scan = heap_beginscan_catalog(classRel, 0, NULL);
+#else
+	scan = heap_beginscan(classRel, SnapshotNow, 0, NULL);
+#endif
 
-		/* Call the 'check' routines - first just the header, then the tuples */
-		header = (PageHeader) raw_page;
+	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Form_pg_class classForm = (Form_pg_class) GETSTRUCT(tuple);
 
-		nerrs += check_page_header(header, blkno);
+		if ((classForm->relkind != RELKIND_RELATION) &&
+			(classForm->relkind != RELKIND_TOASTVALUE))
+			continue;
 
-		/*
-		 * FIXME Does that make sense to check the tuples if the page header
-		 * is corrupted?
-		 */
-		nerrs += check_heap_tuples(rel, header, raw_page, blkno);
+#if (PG_VERSION_NUM >= 90100)
+		if (classForm->relpersistence == RELPERSISTENCE_TEMP)
+			continue;
+#else
+		if (classForm->relistemp)
+			continue;
+#endif
 
-		/* update the bitmap with items from this page (but only when needed) */
-		if (bitmap_heap)
-			bitmap_add_heap_items(bitmap_heap, header, raw_page, blkno);
+#if (PG_VERSION_NUM >= 120000)
+		tables = lappend_oid(tables, classForm->oid);
+#else
+		tables = lappend_oid(tables, HeapTupleGetOid(tuple));
+#endif
 	}
 
-	if (pgcheck_debug)
-		bitmap_print(bitmap_heap, pgcheck_bitmap_format);
+#if (PG_VERSION_NUM >= 120000)
+	table_endscan(scan);
+#else
+	heap_endscan(scan);
+#endif
+
+	relation_close(classRel, AccessShareLock);
 
-	/* check indexes */
-	if (checkIndexes)
+	foreach(lc, tables)
 	{
+		Oid			relid = lfirst_oid(lc);
+		Relation	rel;
+		BlockNumber nblocks;
+		BlockNumber blkno;
 		List	   *list_of_indexes;
 		ListCell   *index;
 
-		item_bitmap *bitmap_idx = NULL;
-
-		/*
-		 * Create a bitmap with the same size as the heap bitmap, which we
-		 * will populate for each index.
-		 *
-		 * XXX this also does memcpy() of the contents, which is not really
-		 * necessary.
-		 */
-		if (bitmap_heap)
-			bitmap_idx = bitmap_copy(bitmap_heap);
+		/* the table may have been dropped since */
+		rel = try_relation_open(relid, AccessShareLock);
+		if (rel == NULL)
+			continue;
 
-		list_of_indexes = RelationGetIndexList(rel);
+		nblocks = RelationGetNumberOfBlocks(rel);
 
-		/*
-		 * XXX This should probably cross-check only btree indexes.
-		 */
-		foreach(index, list_of_indexes)
+		/* the last chunk extends to the end (the table may grow) */
+		for (blkno = 0; blkno < nblocks; blkno += DATABASE_CHUNK_BLOCKS)
 		{
-			bool		cross_check;
+			BlockNumber blockTo = InvalidBlockNumber;
 
-			/* reset the bitmap (if needed) */
-			if (bitmap_heap)
-				bitmap_reset(bitmap_idx);
+			if (nblocks - blkno > DATABASE_CHUNK_BLOCKS)
+				blockTo = blkno + DATABASE_CHUNK_BLOCKS;
 
-			nerrs += check_index(lfirst_oid(index), 0, 0, false,
-								 bitmap_idx, &cross_check);
+			chunks = add_database_chunk(chunks, nchunks, &maxchunks,
+										relid, InvalidOid, blkno, blockTo,
+										Min(nblocks - blkno, DATABASE_CHUNK_BLOCKS));
+		}
 
-			/* evaluate the bitmap difference (if needed) */
-			if (bitmap_heap && cross_check)
-			{
-				/* compare the bitmaps */
-				int			ndiffs = bitmap_compare(bitmap_heap, bitmap_idx);
+		list_of_indexes = RelationGetIndexList(rel);
+
+		foreach(index, list_of_indexes)
+		{
+			Oid			indexOid = lfirst_oid(index);
+			Relation	irel = try_relation_open(indexOid, AccessShareLock);
 
-				if (pgcheck_debug)
-					bitmap_print(bitmap_idx, pgcheck_bitmap_format);
+			if (irel == NULL)
+				continue;
 
-				if (ndiffs != 0)
-					elog(WARNING, "there are %d differences between the table and the index", ndiffs);
+			chunks = add_database_chunk(chunks, nchunks, &maxchunks,
+										indexOid, relid, 0, 0,
+										RelationGetNumberOfBlocks(irel));
 
-				nerrs += ndiffs;
-			}
+			relation_close(irel, AccessShareLock);
 		}
 
-		if (bitmap_heap)
-			bitmap_free(bitmap_idx);
-
 		list_free(list_of_indexes);
-	}
 
-	/* release the the heap bitmap */
-	if (bitmap_heap)
-		bitmap_free(bitmap_heap);
+		relation_close(rel, AccessShareLock);
 
-	FreeAccessStrategy(strategy);
+		CHECK_FOR_INTERRUPTS();
+	}
 
-	if (crossCheckIndexes)
-		relation_close(rel, ShareRowExclusiveLock);
-	else
-		relation_close(rel, AccessShareLock);
+	list_free(tables);
 
-	return nerrs;
+	if (*nchunks > 0)
+		qsort(chunks, *nchunks, sizeof(database_chunk), database_chunk_cmp);
+
+	return chunks;
 }
 
-/*
- * check the index, acquires AccessShareLock
+static database_chunk *
+add_database_chunk(database_chunk * chunks, int *nchunks, int *maxchunks,
+				   Oid relid, Oid heapid, BlockNumber blockFrom,
+				   BlockNumber blockTo, BlockNumber nblocks)
+{
+	database_chunk *chunk;
+
+	if (*nchunks == *maxchunks)
+	{
+		*maxchunks = (*maxchunks == 0) ? 1024 : 2 * (*maxchunks);
+
+		if (chunks == NULL)
+			chunks = (database_chunk *) palloc(*maxchunks * sizeof(database_chunk));
+		else
+			chunks = (database_chunk *) repalloc(chunks,
+												 *maxchunks * sizeof(database_chunk));
+	}
+
+	chunk = &chunks[(*nchunks)++];
+
+	chunk->relid = relid;
+	chunk->heapid = heapid;
+	chunk->blockFrom = blockFrom;
+	chunk->blockTo = blockTo;
+	chunk->nblocks = nblocks;
+
+	chunk->partition = false;
+	chunk->checkIndexes = false;
+	chunk->crossCheck = false;
+	chunk->sinceLsn = 0;
+
+	return chunks;
+}
+
+/* largest chunks first, then in the order of relations and blocks */
+static int
+database_chunk_cmp(const void *a, const void *b)
+{
+	const database_chunk *ca = (const database_chunk *) a;
+	const database_chunk *cb = (const database_chunk *) b;
+
+	if (ca->nblocks != cb->nblocks)
+		return (ca->nblocks > cb->nblocks) ? -1 : 1;
+
+	if (ca->relid != cb->relid)
+		return (ca->relid < cb->relid) ? -1 : 1;
+
+	if (ca->blockFrom != cb->blockFrom)
+		return (ca->blockFrom < cb->blockFrom) ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * Check a chunk of pg_check_database. The heap is locked first (even when
+ * checking an index), and then we check the relation still exists - it
+ * might have been dropped after building the queue.
+ */
+uint32
+check_database_chunk(database_chunk * chunk)
+{
+	Relation	heap;
+	uint32		nerrs = 0;
+	Oid			heapid = OidIsValid(chunk->heapid) ? chunk->heapid : chunk->relid;
+	LOCKMODE	lockmode = AccessShareLock;
+
+	/* lock the partition the same way as the check (no lock upgrades) */
+	if (chunk->partition)
+		lockmode = check_lock_mode(chunk->crossCheck);
+
+	heap = try_relation_open(heapid, lockmode);
+	if (heap == NULL)
+		return nerrs;
+
+	if (chunk->partition)
+		nerrs = check_table(chunk->relid, chunk->checkIndexes,
+							chunk->crossCheck, 0, 0, false, chunk->sinceLsn,
+							NULL);
+	else if (OidIsValid(chunk->heapid))
+	{
+		if (SearchSysCacheExists1(RELOID, ObjectIdGetDatum(chunk->relid)))
+			nerrs = check_index(chunk->relid, 0, 0, false, NULL, NULL, NULL);
+	}
+	else
+	{
+		BlockNumber blockTo = Min(chunk->blockTo,
+								  RelationGetNumberOfBlocks(heap));
+
+		if (chunk->blockFrom < blockTo)
+			nerrs = check_table(chunk->relid, false, false,
+								chunk->blockFrom, blockTo, true, 0, NULL);
+	}
+
+	relation_close(heap, lockmode);
+
+	CHECK_FOR_INTERRUPTS();
+
+	return nerrs;
+}
+
+#if (PG_VERSION_NUM >= 100000)
+/*
+ * Check all leaf partitions of a partitioned table, including their TOAST
+ * tables and indexes. Each partition (or TOAST table) is a chunk checked
+ * as a whole by one process, the processes take the chunks from a queue
+ * ordered by size, just like pg_check_database. A partition is only locked
+ * while queueing it (briefly, to get the size) and while being checked.
+ *
+ * The parent is locked by AccessShareLock, so that it can't be dropped
+ * during the check. Partitions of temporary tables can't be read by other
+ * processes, so those are checked by this backend.
+ *
+ * In incremental mode, pages not modified since sinceLsn are skipped in
+ * all the partitions, or since the LSN of each partition when checked by
+ * pg_check_partitions_since (see partition_since_lsn). Partitions not
+ * modified since then are only read, none of their pages is checked.
+ */
+static uint32
+check_partitioned_table(Oid relid, bool checkIndexes, bool crossCheckIndexes,
+						uint64 sinceLsn, int nworkers)
+{
+	Relation	parent;
+	List	   *partitions;
+	ListCell   *lc;
+	database_chunk *chunks = NULL;
+	int			nchunks = 0;
+	int			maxchunks = 0;
+	uint32		nerrs;
+
+	parent = relation_open(relid, AccessShareLock);
+
+	if (parent->rd_rel->relpersistence == RELPERSISTENCE_TEMP)
+		nworkers = 0;
+
+	/* don't lock the partitions yet, only the leaf ones are locked below */
+	partitions = find_all_inheritors(relid, NoLock, NULL);
+
+	foreach(lc, partitions)
+	{
+		Oid			partid = lfirst_oid(lc);
+		Oid			toastid;
+		uint64		partLsn;
+
+		/* only the leaf partitions have storage (foreign tables don't) */
+		if (get_rel_relkind(partid) != RELKIND_RELATION)
+			continue;
+
+		/* the TOAST table is checked since the same LSN as the partition */
+		partLsn = partition_since_lsn(partid, sinceLsn);
+
+		chunks = add_partition_chunk(chunks, &nchunks, &maxchunks, partid,
+									 checkIndexes, crossCheckIndexes,
+									 partLsn, &toastid);
+
+		if (OidIsValid(toastid))
+			chunks = add_partition_chunk(chunks, &nchunks, &maxchunks,
+										 toastid, checkIndexes,
+										 crossCheckIndexes, partLsn, NULL);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	list_free(partitions);
+
+	if (nchunks > 0)
+		qsort(chunks, nchunks, sizeof(database_chunk), database_chunk_cmp);
+
+	elog(DEBUG1, "checking partitioned table \"%s\" using %d chunks",
+		 RelationGetRelationName(parent), nchunks);
+
+	nerrs = check_database_parallel(chunks, nchunks, nworkers);
+
+	if (chunks)
+		pfree(chunks);
+
+	relation_close(parent, AccessShareLock);
+
+	return nerrs;
+}
+
+/*
+ * Queue a whole partition (or its TOAST table), sized by the heap. Returns
+ * the TOAST table of the partition in toastid (if requested), so that it
+ * can be queued too. Partitions dropped in the meantime are skipped.
+ */
+static database_chunk *
+add_partition_chunk(database_chunk * chunks, int *nchunks, int *maxchunks,
+					Oid relid, bool checkIndexes, bool crossCheckIndexes,
+					uint64 sinceLsn, Oid *toastid)
+{
+	Relation	rel;
+	database_chunk *chunk;
+
+	if (toastid)
+		*toastid = InvalidOid;
+
+	rel = try_relation_open(relid, AccessShareLock);
+	if (rel == NULL)
+		return chunks;
+
+	chunks = add_database_chunk(chunks, nchunks, maxchunks, relid,
+								InvalidOid, 0, InvalidBlockNumber,
+								RelationGetNumberOfBlocks(rel));
+
+	if (toastid)
+		*toastid = rel->rd_rel->reltoastrelid;
+
+	relation_close(rel, AccessShareLock);
+
+	chunk = &chunks[*nchunks - 1];
+
+	chunk->partition = true;
+	chunk->checkIndexes = checkIndexes;
+	chunk->crossCheck = crossCheckIndexes;
+	chunk->sinceLsn = sinceLsn;
+
+	return chunks;
+}
+
+/*
+ * LSN to check the partition since - the one passed to
+ * pg_check_partitions_since (or zero when not listed, i.e. the whole
+ * partition), or the LSN for the whole table otherwise.
+ */
+static uint64
+partition_since_lsn(Oid relid, uint64 sinceLsn)
+{
+	int			i;
+
+	if (partition_relids == NULL)
+		return sinceLsn;
+
+	for (i = 0; i < npartition_lsns; i++)
+	{
+		if (partition_relids[i] == relid)
+			return partition_lsns[i];
+	}
+
+	return 0;
+}
+#endif
+
+/*
+ * pg_check_bitmap_memory
+ *
+ * Returns peak memory used by the item bitmaps during the last cross-check
+ * in this backend (used by the benchmarks). Bitmaps of the indexes checked
+ * by parallel workers are not included.
+ */
+PG_FUNCTION_INFO_V1(pg_check_bitmap_memory);
+
+Datum
+pg_check_bitmap_memory(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64((int64) bitmap_memory_peak);
+}
+
+/*
+ * pg_check_memory
+ *
+ * Returns peak memory used by the last check in this backend (see the
+ * memory contexts in memory.h), including the bitmaps.
+ */
+PG_FUNCTION_INFO_V1(pg_check_memory);
+
+Datum
+pg_check_memory(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64((int64) check_memory_peak());
+}
+
+/* verify the TOAST pointers collected by the heap pass (if any) */
+static uint32
+verify_toast(toast_check * toast)
+{
+	uint32		nerrs;
+
+	if (toast == NULL)
+		return 0;
+
+	nerrs = toast_check_finish(toast);
+
+	progress_add_blocks(0, nerrs);
+
+	return nerrs;
+}
+
+/* remember the memory used by the bitmaps, if more than seen so far */
+static void
+track_bitmap_memory(item_bitmap * bitmap_a, item_bitmap * bitmap_b)
+{
+	Size		size = 0;
+
+	if (bitmap_a)
+		size += bitmap_size(bitmap_a);
+
+	if (bitmap_b)
+		size += bitmap_size(bitmap_b);
+
+	bitmap_memory_peak = Max(bitmap_memory_peak, size);
+}
+
+/*
+ * Should the checks verify checksums of the pages read from the files? The
+ * buffer manager verifies pages it reads, and the checksums of (possibly
+ * dirty) pages in shared buffers are not updated until the page is written
+ * out, so only pages read directly from the files (see page_reader) are
+ * verified by the checks. A checksum failure is reported only if the page
+ * fails the check again after reader_reread - the page may have been in
+ * the middle of a write, or loaded into shared buffers in the meantime.
+ */
+static bool
+verify_checksums(void)
+{
+#if (PG_VERSION_NUM >= 90300)
+	return pgcheck_verify_checksums && DataChecksumsEnabled();
+#else
+	return false;
+#endif
+}
+
+/*
+ * Current WAL position (replayed on a standby), i.e. pages modified after
+ * this point have higher LSN. Zero on releases without 64-bit LSNs.
+ */
+static uint64
+current_lsn(void)
+{
+#if (PG_VERSION_NUM >= 90300)
+	if (RecoveryInProgress())
+		return GetXLogReplayRecPtr(NULL);
+
+	return GetXLogInsertRecPtr();
+#else
+	return 0;
+#endif
+}
+
+/* parse LSN in the usual text format (e.g. "16/B374D848") */
+static uint64
+parse_lsn(const char *lsn)
+{
+	uint32		hi,
+				lo;
+
+	if (sscanf(lsn, "%X/%X", &hi, &lo) != 2)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid LSN \"%s\"", lsn)));
+
+	return ((uint64) hi << 32) | lo;
+}
+
+/*
+ * Lock mode needed to cross-check the table with indexes (or not). The
+ * snapshot mode allows concurrent writes, so it uses AccessShareLock.
+ */
+static LOCKMODE
+check_lock_mode(bool crossCheck)
+{
+	if (crossCheck && !pgcheck_snapshot_cross_check)
+		return ShareRowExclusiveLock;
+
+	return AccessShareLock;
+}
+
+/*
+ * Check the table, all indexes on the table, and cross-check indexes.
+ *
+ * The function acquires ShareRowExclusiveLock or AccessShareLock. The
+ * stronger lock (ShareRowExclusiveLock) is used when cross-check is
+ * requested, unless it's done in snapshot mode.
+ *
+ * With sample options, only a sample of the heap blocks is checked (and
+ * of the index blocks, when checking indexes).
+ *
+ * The indexes can be checked with an explicit block range only when
+ * cross-checking by merging sorted TIDs - the indexes are still checked
+ * whole, but only entries pointing to the block range are cross-checked.
+ *
+ * Partitioned tables are expanded to the leaf partitions, see
+ * check_partitioned_table.
+ */
+static uint32
+check_table(Oid relid, bool checkIndexes, bool crossCheckIndexes,
+			BlockNumber blockFrom, BlockNumber blockTo, bool blockRangeGiven,
+			uint64 sinceLsn, sample_options * sampleOptions)
+{
+	Relation	rel;			/* relation for the 'relname' */
+	uint32		nerrs = 0;		/* number of errors found */
+	BufferAccessStrategy strategy;	/* bulk strategy to avoid polluting cache */
+	LOCKMODE	lockmode = check_lock_mode(crossCheckIndexes);
+	TransactionId horizon = InvalidTransactionId;
+
+	/*
+	 * Issues found by parallel workers are reported as WARNINGs by the
+	 * leader, so collecting them (or exporting the differences) requires
+	 * checking in this backend. Partitions checked by parallel workers are
+	 * not split any further.
+	 */
+	int			nworkers = ((pgcheck_issues == NULL) && (pgcheck_diff == NULL) &&
+							!IsInParallelMode()) ?
+	pgcheck_max_parallel_workers : 0;
+
+	/* workers checking the indexes (may be limited by the bitmaps) */
+	int			nindexworkers = nworkers;
+
+	/* used to cross-check heap and indexes */
+	item_bitmap *bitmap_heap = NULL;
+
+	/* used to verify the TOAST pointers */
+	toast_check *toast = NULL;
+
+	/* sampled heap blocks (NULL checks all blocks) */
+	block_sample *sample = NULL;
+
+	/* method and bitmaps used by the cross-check (may fall back) */
+	int			crossCheckMethod = pgcheck_cross_check_method;
+	BitmapType	bitmapType = pgcheck_bitmap_type;
+
+	/* memory context of the check */
+	check_memory memory;
+
+	/* WAL position at the start, and is the whole table checked? (stats) */
+	uint64		startLsn = current_lsn();
+	bool		fullCheck;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to use pg_check functions"))));
+
+	if (blockRangeGiven && checkIndexes &&
+		!(crossCheckIndexes && (pgcheck_cross_check_method == CROSS_CHECK_SORTED)))
+		elog(ERROR, "cross-check with indexes and explicit block range requires pg_check.cross_check_method = sorted");
+
+#if (PG_VERSION_NUM >= 100000)
+	if (get_rel_relkind(relid) == RELKIND_PARTITIONED_TABLE)
+	{
+		if (blockRangeGiven || (sampleOptions != NULL))
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("block range or sample can't be checked on partitioned table \"%s\"",
+							get_rel_name(relid))));
+
+		return check_partitioned_table(relid, checkIndexes, crossCheckIndexes,
+									   sinceLsn, nworkers);
+	}
+#endif
+
+	check_memory_begin(&memory);
+
+	/* When cross-checking, a more restrictive lock mode may be needed. */
+	rel = relation_open(relid, lockmode);
+
+	/* Check that this relation has storage */
+	if (rel->rd_rel->relkind != RELKIND_RELATION &&
+		rel->rd_rel->relkind != RELKIND_TOASTVALUE)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("object \"%s\" is not a table",
+						RelationGetRelationName(rel))));
+
+	if (!blockRangeGiven)
+	{
+		blockFrom = 0;
+		blockTo = RelationGetNumberOfBlocks(rel);
+	}
+
+	sample = block_sample_init(blockFrom, blockTo, sampleOptions);
+
+	progress_start(relid);
+	stats_start();
+	progress_set_phase(PROGRESS_PHASE_HEAP, InvalidOid,
+					   (sample) ? sample->nsampled : (blockTo - blockFrom));
+
+	bitmap_memory_peak = 0;
+
+	/*
+	 * Changes of unlogged and temporary relations are not WAL-logged, so
+	 * the page LSNs don't tell us anything. Check all the pages.
+	 */
+#if (PG_VERSION_NUM >= 90100)
+	if (rel->rd_rel->relpersistence != RELPERSISTENCE_PERMANENT)
+		sinceLsn = 0;
+#endif
+
+	fullCheck = !blockRangeGiven && (sampleOptions == NULL) && (sinceLsn == 0);
+
+	/*
+	 * In snapshot mode, only tuples settled before the xmin of our snapshot
+	 * are expected to be in the indexes (those can't be removed until the
+	 * check completes), everything else on the page is ignored.
+	 */
+	if (crossCheckIndexes && pgcheck_snapshot_cross_check)
+	{
+		if (!ActiveSnapshotSet())
+			elog(ERROR, "snapshot cross-check requires an active snapshot");
+
+		horizon = GetActiveSnapshot()->xmin;
+	}
+
+	strategy = GetAccessStrategy(BAS_BULKREAD);
+
+	/*
+	 * The TOAST pointers are collected by the heap pass, and verified by
+	 * scanning the TOAST relation. The chunks of values not settled before
+	 * the xmin of our snapshot may be removed, so those are not verified.
+	 */
+	if (pgcheck_verify_toast && (pgcheck_check_level == CHECK_LEVEL_ATTRIBUTES))
+	{
+		if (!ActiveSnapshotSet())
+			elog(ERROR, "TOAST verification requires an active snapshot");
+
+		toast = toast_check_init(rel, strategy, GetActiveSnapshot()->xmin,
+								 check_memory_reserve_upto((Size) pgcheck_toast_memory * 1024L,
+														   64 * 1024L));
+	}
+
+	/*
+	 * Fingerprints only tell which pages differ, not which items, so the
+	 * differences are exported using the sorted TIDs instead. Fingerprints
+	 * also decode the heap tuples, which is not safe unless the attributes
+	 * were checked.
+	 */
+	if (((pgcheck_diff != NULL) ||
+		 (pgcheck_check_level < CHECK_LEVEL_ATTRIBUTES)) &&
+		(crossCheckMethod == CROSS_CHECK_FINGERPRINT))
+		crossCheckMethod = CROSS_CHECK_SORTED;
+
+	/*
+	 * The bitmaps have to fit into pg_check.max_memory, otherwise fall back
+	 * to compressed bitmaps, and then to merging sorted TIDs (which spills
+	 * to temporary files, and can handle any amount of memory).
+	 */
+	if (checkIndexes && crossCheckIndexes &&
+		(crossCheckMethod == CROSS_CHECK_BITMAP))
+		crossCheckMethod = reserve_bitmaps(rel, blockTo - blockFrom,
+										   TransactionIdIsValid(horizon),
+										   &bitmapType, &nindexworkers);
+
+	/*
+	 * With fingerprints, the indexes are checked first (building the
+	 * filters), and then probed by the heap pass. That does not need any
+	 * bitmaps.
+	 */
+	if (checkIndexes && crossCheckIndexes &&
+		(crossCheckMethod == CROSS_CHECK_FINGERPRINT))
+	{
+		nerrs = check_table_fingerprints(rel, blockFrom, blockTo, strategy,
+										 horizon, toast);
+	}
+	/* The sorted TIDs are merged with the heap, just like fingerprints. */
+	else if (checkIndexes && crossCheckIndexes &&
+			 (crossCheckMethod == CROSS_CHECK_SORTED))
+	{
+		nerrs = check_table_sorted(rel, blockFrom, blockTo, blockRangeGiven,
+								   strategy, horizon, toast);
+	}
+	else
+	{
+		/*
+		 * Build the bitmap only when we need to do the cross-check. With
+		 * parallel workers the bitmap has to be in shared memory, so that
+		 * the workers can add items from the pages they checked.
+		 * Compressed bitmaps are always backend-local.
+		 */
+		if (crossCheckIndexes && (bitmapType == BITMAP_TYPE_COMPRESSED))
+			bitmap_heap = bitmap_init_compressed(blockFrom, blockTo);
+#if (PG_VERSION_NUM >= 90600)
+		else if (crossCheckIndexes && (nworkers > 0))
+			bitmap_heap = bitmap_init_shared(blockFrom, blockTo, horizon,
+											 rel->rd_rel->relfrozenxid);
+#endif
+		else if (crossCheckIndexes)
+			bitmap_heap = bitmap_init(blockFrom, blockTo);
+
+		if (bitmap_heap && TransactionIdIsValid(horizon) &&
+			!bitmap_is_shared(bitmap_heap))
+			bitmap_enable_snapshot(bitmap_heap, horizon,
+								   rel->rd_rel->relfrozenxid);
+
+		/*
+		 * Check the heap blocks, using parallel workers if requested (and
+		 * if the workers can update the bitmap, when building one). The
+		 * TOAST pointers are collected in a private buffer, so verifying
+		 * them requires checking in this backend.
+		 */
+		if ((nworkers > 0) && (sinceLsn == 0) && (toast == NULL) &&
+			(sample == NULL) &&
+			((bitmap_heap == NULL) ||
+			 (bitmap_heap->type == BITMAP_TYPE_DENSE)))
+			nerrs += check_heap_parallel(rel, blockFrom, blockTo,
+										 nworkers,
+										 bitmap_heap);
+		else
+			nerrs += check_heap_range(rel, blockFrom, blockTo, strategy,
+									  bitmap_heap, NULL, NULL, toast, sample,
+									  sinceLsn);
+
+		if (sample)
+		{
+			block_sample_report(sample, rel);
+			block_sample_free(sample);
+		}
+
+		track_bitmap_memory(bitmap_heap, NULL);
+
+		if (pgcheck_debug && bitmap_heap)
+			bitmap_print(bitmap_heap, pgcheck_bitmap_format);
+
+		/* check indexes */
+		if (checkIndexes)
+		{
+			List	   *list_of_indexes;
+			ListCell   *index;
+
+			item_bitmap *bitmap_idx = NULL;
+
+			list_of_indexes = RelationGetIndexList(rel);
+
+			progress_set_indexes(list_length(list_of_indexes));
+
+			/*
+			 * With parallel workers, check all the indexes at the same time
+			 * (each process checks one index at a time, using its own index
+			 * bitmap). That way the lock on the heap is held only for about
+			 * as long as it takes to check the largest index. The workers
+			 * need to attach the heap bitmap, so it has to be in shared
+			 * memory.
+			 */
+			if ((nindexworkers > 0) && (sampleOptions == NULL) &&
+				(list_length(list_of_indexes) > 1) &&
+				((bitmap_heap == NULL) || bitmap_is_shared(bitmap_heap)))
+			{
+				nerrs += check_indexes_parallel(list_of_indexes,
+												nindexworkers,
+												bitmap_heap);
+
+				list_free(list_of_indexes);
+				list_of_indexes = NIL;
+			}
+
+			/*
+			 * Create a bitmap with the same size as the heap bitmap, which
+			 * we will populate for each index.
+			 */
+			if (bitmap_heap && (list_of_indexes != NIL))
+				bitmap_idx = bitmap_copy(bitmap_heap);
+
+			/*
+			 * XXX This should probably cross-check only btree indexes.
+			 */
+			foreach(index, list_of_indexes)
+			{
+				/* sampling means no cross-check */
+				if (sampleOptions)
+				{
+					nerrs += check_index(lfirst_oid(index), 0, 0, false, NULL,
+										 NULL, sampleOptions);
+					progress_index_done();
+					continue;
+				}
+
+				nerrs += check_table_index(lfirst_oid(index), bitmap_heap,
+										   bitmap_idx);
+			}
+
+			if (bitmap_idx)
+				bitmap_free(bitmap_idx);
+
+			list_free(list_of_indexes);
+		}
+
+		/* release the the heap bitmap */
+		if (bitmap_heap)
+			bitmap_free(bitmap_heap);
+	}
+
+	/* the TOAST pointers were collected by the heap pass */
+	nerrs += verify_toast(toast);
+
+	FreeAccessStrategy(strategy);
+
+	relation_close(rel, lockmode);
+
+	if (fullCheck)
+		stats_full_check(relid, startLsn);
+
+	stats_end();
+	progress_end();
+
+	check_memory_end(&memory);
+
+	return nerrs;
+}
+
+/*
+ * Reserve memory for the heap and index bitmaps. When the bitmaps don't
+ * fit into pg_check.max_memory, fall back to compressed bitmaps (unless
+ * already compressed), and when even those don't fit (or rather are not
+ * expected to fit - the compressed size depends on the data), to merging
+ * sorted TIDs. Returns the cross-check method to use.
+ *
+ * With parallel workers, the dense heap bitmap is in a DSM segment, and
+ * each process checking the indexes (the leader and the workers) has its
+ * own index bitmap. When those don't fit, fewer workers check the indexes
+ * (nworkers is set to the number of workers the index bitmaps fit for).
+ */
+static int
+reserve_bitmaps(Relation rel, BlockNumber npages, bool snapshot,
+				BitmapType * bitmapType, int *nworkers)
+{
+	if (*bitmapType == BITMAP_TYPE_DENSE)
+	{
+		Size		heap_size;
+		Size		index_size = bitmap_estimate_size(BITMAP_TYPE_DENSE,
+													  npages, false);
+		int			nprocs = 1;
+		int			n;
+
+		heap_size = bitmap_estimate_size(BITMAP_TYPE_DENSE, npages, snapshot);
+
+#if (PG_VERSION_NUM >= 90600)
+		if (*nworkers > 0)
+		{
+			List	   *list_of_indexes = RelationGetIndexList(rel);
+
+			heap_size = bitmap_estimate_shared_size(npages, snapshot);
+
+			/* the leader checks one of the indexes (see check_indexes_parallel) */
+			if (list_length(list_of_indexes) > 1)
+				nprocs += Min(*nworkers, list_length(list_of_indexes) - 1);
+
+			list_free(list_of_indexes);
+		}
+#endif
+
+		for (n = nprocs; n >= 1; n--)
+		{
+			if (!check_memory_reserve(add_size(heap_size,
+											   mul_size(n, index_size))))
+				continue;
+
+			if (n < nprocs)
+				ereport(NOTICE,
+						(errmsg("relation \"%s\": index bitmaps exceed pg_check.max_memory, checking indexes using %d parallel workers",
+								RelationGetRelationName(rel), (n - 1))));
+
+			*nworkers = Min(*nworkers, n - 1);
+
+			return CROSS_CHECK_BITMAP;
+		}
+	}
+
+	if (check_memory_reserve(bitmap_estimate_size(BITMAP_TYPE_COMPRESSED, npages, snapshot) +
+							 bitmap_estimate_size(BITMAP_TYPE_COMPRESSED, npages, false)))
+	{
+		if (*bitmapType == BITMAP_TYPE_DENSE)
+			ereport(NOTICE,
+					(errmsg("relation \"%s\": bitmaps exceed pg_check.max_memory, using compressed bitmaps",
+							RelationGetRelationName(rel))));
+
+		*bitmapType = BITMAP_TYPE_COMPRESSED;
+
+		return CROSS_CHECK_BITMAP;
+	}
+
+	ereport(NOTICE,
+			(errmsg("relation \"%s\": bitmaps exceed pg_check.max_memory, cross-checking using sorted TIDs",
+					RelationGetRelationName(rel))));
+
+	return CROSS_CHECK_SORTED;
+}
+
+/*
+ * Cross-check the table with indexes using fingerprints. The indexes are
+ * checked first, adding fingerprints of (TID, key) of each index tuple to
+ * a Bloom filter, and then the heap pass probes the filters with
+ * fingerprints computed from the heap tuples. So unlike the bitmaps, this
+ * also detects index entries with keys not matching the heap tuple, and
+ * the memory is limited by pg_check.cross_check_memory (split between
+ * the indexes) no matter how large the table is.
+ *
+ * Indexes that can't be cross-checked (other access methods, partial
+ * indexes) are still checked, just not cross-checked.
+ *
+ * XXX This does not use parallel workers - the filters are private.
+ */
+static uint32
+check_table_fingerprints(Relation rel, BlockNumber blockFrom,
+						 BlockNumber blockTo, BufferAccessStrategy strategy,
+						 TransactionId horizon, toast_check * toast)
+{
+	uint32		nerrs = 0;
+	List	   *list_of_indexes;
+	List	   *list_of_probed = NIL;
+	ListCell   *index;
+	fingerprint_probe *probe;
+	uint32		ndiffs;
+	Size		nbytes;
+	double		ntuples = rel->rd_rel->reltuples;
+
+	/* expected number of index entries (for tables not analyzed yet) */
+	if (ntuples <= 0)
+		ntuples = (double) (blockTo - blockFrom) * MaxHeapTuplesPerPage / 4;
+
+	list_of_indexes = RelationGetIndexList(rel);
+
+	/* pick the indexes we can cross-check first, to split the memory */
+	foreach(index, list_of_indexes)
+	{
+		Relation	irel = index_open(lfirst_oid(index), AccessShareLock);
+		bool		cross_check;
+
+		lookup_check_method(irel->rd_rel->relam, &cross_check);
+
+		if (cross_check && fingerprint_index_supported(irel))
+			list_of_probed = lappend_oid(list_of_probed, lfirst_oid(index));
+		else
+			ereport(NOTICE,
+					(errmsg("index \"%s\" can't be cross-checked using fingerprints",
+							RelationGetRelationName(irel))));
+
+		index_close(irel, AccessShareLock);
+	}
+
+	progress_set_indexes(list_length(list_of_indexes));
+
+	probe = fingerprint_probe_init(list_length(list_of_probed), horizon,
+								   rel->rd_rel->relfrozenxid);
+
+	nbytes = check_memory_reserve_upto((Size) pgcheck_cross_check_memory * 1024L,
+									   64 * 1024L * list_length(list_of_probed)) /
+		Max(1, list_length(list_of_probed));
+
+	foreach(index, list_of_indexes)
+	{
+		Oid			indexOid = lfirst_oid(index);
+		index_items items = {NULL, NULL};
+		Relation	irel;
+		bool		cross_check;
+
+		if (!list_member_oid(list_of_probed, indexOid))
+		{
+			nerrs += check_index(indexOid, 0, 0, false, NULL, &cross_check,
+								 NULL);
+			progress_index_done();
+			continue;
+		}
+
+		irel = index_open(indexOid, AccessShareLock);
+		items.filter = fingerprint_add_index(probe, rel, irel, nbytes, ntuples);
+		index_close(irel, AccessShareLock);
+
+		nerrs += check_index(indexOid, 0, 0, false, &items, &cross_check,
+							 NULL);
+		progress_index_done();
+	}
+
+	/* the heap pass probes the filters of all the indexes */
+	progress_set_phase(PROGRESS_PHASE_COMPARE, InvalidOid, blockTo - blockFrom);
+
+	nerrs += check_heap_range(rel, blockFrom, blockTo, strategy, NULL, probe,
+							  NULL, toast, NULL, 0);
+
+	ndiffs = fingerprint_report(probe);
+
+	progress_add_blocks(0, ndiffs);
+
+	nerrs += ndiffs;
+
+	fingerprint_probe_free(probe);
+
+	list_free(list_of_probed);
+	list_free(list_of_indexes);
+
+	return nerrs;
+}
+
+/*
+ * Cross-check the table with indexes by merging sorted TIDs. The indexes
+ * are checked first, feeding the TIDs of the index tuples into sorts, and
+ * then the heap pass merges the items of each page with the sorted TIDs of
+ * all the indexes. The sorts spill to temporary files, so the memory is
+ * limited by pg_check.cross_check_memory (split between the indexes) no
+ * matter how large the table is, and unlike the bitmaps the differences
+ * are attributed to a particular index.
+ *
+ * With a block range, index entries pointing outside the range are
+ * ignored, so large tables may be cross-checked in chunks.
+ *
+ * Indexes that can't be cross-checked (other access methods, partial
+ * indexes) are still checked, just not cross-checked.
+ *
+ * XXX This does not use parallel workers - the sorts are private.
+ */
+static uint32
+check_table_sorted(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+				   bool blockRangeGiven, BufferAccessStrategy strategy,
+				   TransactionId horizon, toast_check * toast)
+{
+	uint32		nerrs = 0;
+	List	   *list_of_indexes;
+	List	   *list_of_merged = NIL;
+	ListCell   *index;
+	tid_merge  *merge;
+	Size		nbytes;
+
+	list_of_indexes = RelationGetIndexList(rel);
+
+	/* pick the indexes we can cross-check first, to split the memory */
+	foreach(index, list_of_indexes)
+	{
+		Relation	irel = index_open(lfirst_oid(index), AccessShareLock);
+		bool		cross_check;
+
+		lookup_check_method(irel->rd_rel->relam, &cross_check);
+
+		if (cross_check && (RelationGetIndexPredicate(irel) == NIL))
+			list_of_merged = lappend_oid(list_of_merged, lfirst_oid(index));
+		else
+			ereport(NOTICE,
+					(errmsg("index \"%s\" can't be cross-checked using sorted TIDs",
+							RelationGetRelationName(irel))));
+
+		index_close(irel, AccessShareLock);
+	}
+
+	progress_set_indexes(list_length(list_of_indexes));
+
+	merge = tid_merge_init(list_length(list_of_merged), horizon,
+						   rel->rd_rel->relfrozenxid, blockFrom, blockTo,
+						   blockRangeGiven);
+
+	nbytes = check_memory_reserve_upto((Size) pgcheck_cross_check_memory * 1024L,
+									   64 * 1024L * list_length(list_of_merged)) /
+		Max(1, list_length(list_of_merged));
+
+	foreach(index, list_of_indexes)
+	{
+		Oid			indexOid = lfirst_oid(index);
+		index_items items = {NULL, NULL, NULL, NULL};
+		Relation	irel;
+		bool		cross_check;
+
+		if (!list_member_oid(list_of_merged, indexOid))
+		{
+			nerrs += check_index(indexOid, 0, 0, false, NULL, &cross_check,
+								 NULL);
+			progress_index_done();
+			continue;
+		}
+
+		irel = index_open(indexOid, AccessShareLock);
+		items.tids = tid_merge_add_index(merge, irel, nbytes);
+		index_close(irel, AccessShareLock);
+
+		nerrs += check_index(indexOid, 0, 0, false, &items, &cross_check,
+							 NULL);
+		progress_index_done();
+	}
+
+	/* the heap pass merges the TIDs of all the indexes */
+	progress_set_phase(PROGRESS_PHASE_COMPARE, InvalidOid, blockTo - blockFrom);
+
+	nerrs += check_heap_range(rel, blockFrom, blockTo, strategy, NULL, NULL,
+							  merge, toast, NULL, 0);
+
+	nerrs += tid_merge_finish(merge);
+
+	list_free(list_of_merged);
+	list_free(list_of_indexes);
+
+	return nerrs;
+}
+
+/*
+ * Check a heap page - first just the header, then the tuples, and finally
+ * the map bits (only for pages that passed the other checks). Checksums
+ * are verified only for pages read from the file, shared buffers may
+ * contain dirty pages (and those were verified when read).
+ */
+static uint32
+check_heap_page(Relation rel, PageHeader header, char *raw_page,
+				BlockNumber blkno, attribute_plan * plan, page_reader * reader,
+				bool checksums)
+{
+	uint32		nerrs;
+
+	check_checksums = checksums && reader->from_file;
+
+	nerrs = check_page_header(header, blkno);
+
+	/*
+	 * FIXME Does that make sense to check the tuples if the page header is
+	 * corrupted?
+	 */
+	nerrs += check_heap_tuples(rel, header, raw_page, blkno, plan);
+
+	if (pgcheck_verify_maps && (nerrs == 0))
+	{
+		nerrs += check_heap_visibility(rel, header, raw_page, blkno,
+									   reader->vmstatus);
+		nerrs += check_heap_free_space(rel, raw_page, blkno,
+									   reader->vmstatus);
+	}
+
+	return nerrs;
+}
+
+/*
+ * Check a range of heap blocks (the caller is responsible for locking).
+ *
+ * Each page is copied into a private buffer while holding a share lock
+ * on the buffer (or read directly from the file, see page_reader), and
+ * the checks are performed on the copy.
+ */
+uint32
+check_heap_range(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+				 BufferAccessStrategy strategy, item_bitmap * bitmap,
+				 fingerprint_probe * probe, tid_merge * merge,
+				 toast_check * toast, block_sample * sample, uint64 sinceLsn)
+{
+	char	   *raw_page;		/* raw data of the page */
+	page_reader *reader;		/* reads the pages (buffers or files) */
+	uint32		nerrs = 0;		/* number of errors found */
+	uint32		page_nerrs;		/* number of errors found on the page */
+	BlockNumber blkno;			/* current block */
+	PageHeader	header;			/* page header */
+	BlockNumber nskipped = 0;	/* pages skipped (older than sinceLsn) */
+	attribute_plan *plan;		/* plan of the attribute checks */
+	bool		checksums = verify_checksums();
+	bool		timing = stats_enabled();	/* time the pages (stats) */
+	instr_time	start,
+				read,
+				done;
+
+	issues_set_relation(RelationGetRelid(rel));
+
+	/* the attribute layout is the same for all the pages */
+	plan = attribute_plan_build(RelationGetDescr(rel));
+	plan->toast = toast;
+
+	check_level = pgcheck_check_level;
+
+	reader = reader_init(rel, strategy, pgcheck_direct_read);
+	reader_set_sample(reader, sample);
+
+	if (pgcheck_verify_maps)
+		reader_track_vm(reader);
+
+	/* Take a verbatim copy of each page (or each sampled page), and check it */
+	for (blkno = block_sample_next(sample, InvalidBlockNumber, blockFrom, blockTo);
+		 blkno < blockTo;
+		 blkno = block_sample_next(sample, blkno, blockFrom, blockTo))
+	{
+		if (timing)
+			INSTR_TIME_SET_CURRENT(start);
+
+		raw_page = reader_read(reader, blkno, blockTo);
+
+		if (timing)
+			INSTR_TIME_SET_CURRENT(read);
+
+		/*
+		 * In incremental mode, skip pages not modified since the last check
+		 * (new pages have no LSN, so those are checked every time).
+		 */
+#if (PG_VERSION_NUM >= 90300)
+		if ((sinceLsn != 0) && !PageIsNew(raw_page) &&
+			(PageGetLSN(raw_page) < sinceLsn))
+		{
+			nskipped++;
+			progress_add_blocks(1, 0);
+			CHECK_FOR_INTERRUPTS();
+			continue;
+		}
+#endif
+
+		/* the TOAST pointers of the page are discarded if it's re-read */
+		nerrs += toast_check_mark(toast);
+
+		/*
+		 * Pages read from the file may be torn or stale (see reader_read),
+		 * so the issues found on those are only counted at first. If there
+		 * are any, the page is re-read through the buffer manager and the
+		 * issues found on the consistent copy are reported.
+		 */
+		pgcheck_issues_quiet = reader->from_file;
+
+		page_nerrs = check_heap_page(rel, (PageHeader) raw_page, raw_page,
+									 blkno, plan, reader, checksums);
+
+		if (pgcheck_issues_quiet && (page_nerrs > 0))
+		{
+			pgcheck_issues_quiet = false;
+
+			toast_check_rollback(toast);
+
+			raw_page = reader_reread(reader, blkno);
+
+			page_nerrs = check_heap_page(rel, (PageHeader) raw_page, raw_page,
+										 blkno, plan, reader, checksums);
+		}
+
+		pgcheck_issues_quiet = false;
+
+		header = (PageHeader) raw_page;
+
+		nerrs += page_nerrs;
+
+		block_sample_checked(sample, page_nerrs);
+
+		/*
+		 * Update the bitmap with items from this page (but only when needed).
+		 * Line pointers and tuples of corrupted pages can't be trusted, so
+		 * those pages are excluded from the comparison.
+		 */
+		if (bitmap && (page_nerrs == 0))
+			bitmap_add_heap_items(bitmap, header, raw_page, blkno);
+		else if (bitmap)
+			bitmap_skip_page(bitmap, blkno);
+
+		/* probe the index fingerprints (but don't decode corrupted tuples) */
+		if (probe && (page_nerrs == 0))
+			nerrs += fingerprint_heap_page(probe, rel, header, raw_page, blkno);
+		else if (probe)
+			probe->incomplete = true;
+
+		/* merge with the sorted index TIDs (skipped for corrupted pages) */
+		if (merge)
+			nerrs += tid_merge_heap_page(merge, header, raw_page, blkno,
+										 (page_nerrs > 0));
+
+		if (timing)
+		{
+			INSTR_TIME_SET_CURRENT(done);
+			stats_add_page(start, read, done);
+		}
+
+		progress_add_blocks(1, page_nerrs);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	if (sinceLsn != 0)
+		ereport(DEBUG1,
+				(errmsg("skipped %u of %u pages not modified since the last check",
+						nskipped, blockTo - blockFrom)));
+
+	reader_free(reader);
+	attribute_plan_free(plan);
+
+	return nerrs;
+}
+
+/*
+ * Check an index of the table, and cross-check it with the heap bitmap
+ * (if given). The index bitmap is reset and then populated by the index
+ * check, so it may be reused for all the indexes.
  */
-static uint32
+uint32
+check_table_index(Oid indexOid, item_bitmap * bitmap_heap,
+				  item_bitmap * bitmap_idx)
+{
+	uint32		nerrs;
+	bool		cross_check;
+	index_items items = {bitmap_idx, NULL};
+
+	/* reset the bitmap (if needed) */
+	if (bitmap_heap)
+		bitmap_reset(bitmap_idx);
+
+	nerrs = check_index(indexOid, 0, 0, false,
+						(bitmap_heap) ? &items : NULL, &cross_check, NULL);
+
+	/* evaluate the bitmap difference (if needed) */
+	if (bitmap_heap && cross_check)
+	{
+		uint64		ndiffs;
+
+		track_bitmap_memory(bitmap_heap, bitmap_idx);
+
+		progress_set_phase(PROGRESS_PHASE_COMPARE, indexOid, 0);
+
+		/* differences are exported for this index (if exporting) */
+		diff_set_index(indexOid);
+
+		/* compare the bitmaps */
+		ndiffs = bitmap_compare(bitmap_heap, bitmap_idx);
+
+		progress_add_blocks(0, ndiffs);
+
+		if (pgcheck_debug)
+			bitmap_print(bitmap_idx, pgcheck_bitmap_format);
+
+		if (bitmap_heap->nunconfirmed != 0)
+			ereport(NOTICE,
+					(errmsg("index \"%s\": " UINT64_FORMAT " items not found, possibly moved by concurrent page splits (not counted as differences)",
+							get_rel_name(indexOid), bitmap_heap->nunconfirmed)));
+
+		if (ndiffs != 0)
+			report_issue("index_differences", InvalidBlockNumber, 0,
+						 "there are " UINT64_FORMAT " differences between the table and the index",
+						 ndiffs);
+
+		nerrs += ndiffs;
+	}
+
+	progress_index_done();
+
+	return nerrs;
+}
+
+/*
+ * check the index, acquires AccessShareLock
+ */
+uint32
 check_index(Oid indexOid, BlockNumber blockFrom, BlockNumber blockTo,
-			bool blockRangeGiven, item_bitmap * bitmap, bool *crossCheck)
+			bool blockRangeGiven, index_items * items, bool *crossCheck,
+			sample_options * sampleOptions)
 {
 	Relation	rel;			/* relation for the 'relname' */
 	char	   *raw_page;		/* raw data of the page */
-	Buffer		buf;			/* buffer the page is read into */
+	page_reader *reader;		/* reads the pages (buffers or files) */
 	uint32		nerrs = 0;		/* number of errors found */
+	uint32		page_nerrs;		/* number of errors found on the page */
 	BlockNumber blkno;			/* current block */
 	PageHeader	header;			/* page header */
 	int			lmode;			/* lock mode */
 	BufferAccessStrategy strategy;	/* bulk strategy to avoid polluting cache */
 	check_page_cb check_page;
+	attribute_plan *plan;		/* plan of the attribute checks */
+	bool		checksums = verify_checksums();
+	index_items page_items = {NULL, NULL, NULL};	/* items + summaries */
+	block_sample *sample;		/* sampled blocks (NULL checks all blocks) */
+	check_memory memory;		/* memory context of the check */
+	uint64		startLsn = current_lsn();	/* WAL position at the start */
+	bool		timing = stats_enabled();	/* time the pages (stats) */
+	instr_time	start,
+				read,
+				done;
 
 	if (!superuser())
 		ereport(ERROR,
 				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
 				 (errmsg("must be superuser to use pg_check functions"))));
 
-	/* when a bitmap is provided, use stricted lock mode */
-	lmode = (bitmap != NULL) ? ShareRowExclusiveLock : AccessShareLock;
+	check_memory_begin(&memory);
+
+	/* when cross-checking, use stricter lock mode (unless snapshot) */
+	lmode = check_lock_mode(items != NULL);
+
+	/*
+	 * Verifying the structure requires blocking writes to the index, but
+	 * the snapshot mode is meant not to block writes, so the structure is
+	 * not verified in that case (see below).
+	 */
+	if (pgcheck_verify_btree_structure && !pgcheck_snapshot_cross_check &&
+		(lmode < ShareLock))
+		lmode = ShareLock;
 
 	rel = index_open(indexOid, lmode);
 
 	elog(NOTICE, "checking index: %s", RelationGetRelationName(rel));
 
+	issues_set_relation(indexOid);
+
 	/* Check that this relation is an index */
 	if (rel->rd_rel->relkind != RELKIND_INDEX)
 	{
@@ -384,9 +2136,6 @@ check_index(Oid indexOid, BlockNumber blockFrom, BlockNumber blockTo,
 	 */
 	check_page = lookup_check_method(rel->rd_rel->relam, crossCheck);
 
-	/* Initialize buffer to copy to */
-	raw_page = (char *) palloc(BLCKSZ);
-
 	/* Take a verbatim copies of the pages and check them */
 	if (!blockRangeGiven)
 	{
@@ -394,31 +2143,206 @@ check_index(Oid indexOid, BlockNumber blockFrom, BlockNumber blockTo,
 		blockTo = RelationGetNumberOfBlocks(rel);
 	}
 
+	/* sampling is not possible when collecting the items */
+	Assert(!(items && sampleOptions));
+
+	sample = block_sample_init(blockFrom, blockTo, sampleOptions);
+
+	progress_start(indexOid);
+	stats_start();
+	progress_set_phase(PROGRESS_PHASE_INDEX, indexOid,
+					   (sample) ? sample->nsampled : (blockTo - blockFrom));
+
+	/*
+	 * Collect summaries of the b-tree pages, to verify the structure of the
+	 * whole tree after the scan. That's only possible when the whole index
+	 * is scanned, and when it can't be modified concurrently. The summaries
+	 * are built from the index tuples, so those have to be checked.
+	 */
+	if ((rel->rd_rel->relam == BTREE_AM_OID) && !blockRangeGiven &&
+		(sample == NULL) && (lmode >= ShareLock) &&
+		(pgcheck_check_level >= CHECK_LEVEL_TUPLES))
+	{
+		if (check_memory_reserve(mul_size(Max(1, blockTo),
+										  sizeof(btree_page_summary))))
+			page_items.summary = btree_summary_init(blockTo);
+
+		if (page_items.summary == NULL)
+			ereport(NOTICE,
+					(errmsg("not enough memory to verify structure of index \"%s\"",
+							RelationGetRelationName(rel))));
+	}
+	else if ((rel->rd_rel->relam == BTREE_AM_OID) &&
+			 pgcheck_verify_btree_structure && (lmode < ShareLock))
+		ereport(NOTICE,
+				(errmsg("structure of index \"%s\" is not verified in snapshot mode (would block writes)",
+						RelationGetRelationName(rel))));
+
+	/*
+	 * In snapshot mode the index may be modified while we're scanning it,
+	 * so remember the sibling links to recognize concurrent page splits,
+	 * which may hide items from us (or make us see them twice).
+	 */
+	if (items && pgcheck_snapshot_cross_check &&
+		(rel->rd_rel->relam == BTREE_AM_OID))
+	{
+		if (check_memory_reserve(mul_size(Max(1, blockTo),
+										  sizeof(BlockNumber))))
+			page_items.splits = btree_splits_init(blockTo);
+
+		if (page_items.splits == NULL)
+			ereport(NOTICE,
+					(errmsg("not enough memory to track page splits of index \"%s\", items not found in it are not counted as differences",
+							RelationGetRelationName(rel))));
+	}
+
+	if (items)
+	{
+		page_items.bitmap = items->bitmap;
+		page_items.filter = items->filter;
+		page_items.tids = items->tids;
+	}
+
 	strategy = GetAccessStrategy(BAS_BULKREAD);
 
-	for (blkno = blockFrom; blkno < blockTo; blkno++)
+	plan = attribute_plan_build(RelationGetDescr(rel));
+
+	check_level = pgcheck_check_level;
+
+	reader = reader_init(rel, strategy, pgcheck_direct_read);
+	reader_set_sample(reader, sample);
+
+	for (blkno = block_sample_next(sample, InvalidBlockNumber, blockFrom, blockTo);
+		 blkno < blockTo;
+		 blkno = block_sample_next(sample, blkno, blockFrom, blockTo))
 	{
-		buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, strategy);
-		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		if (timing)
+			INSTR_TIME_SET_CURRENT(start);
 
-		memcpy(raw_page, BufferGetPage(buf), BLCKSZ);
+		raw_page = reader_read(reader, blkno, blockTo);
 
-		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
-		ReleaseBuffer(buf);
+		if (timing)
+			INSTR_TIME_SET_CURRENT(read);
 
 		/*
 		 * Call the 'check' routines - first just the header, then the
-		 * contents of the page.
+		 * contents of the page. Issues found on pages read from the file
+		 * are reported only after re-reading the page through the buffer
+		 * manager (see check_heap_range).
 		 */
+		check_checksums = checksums && reader->from_file;
+		pgcheck_issues_quiet = reader->from_file;
+
+		page_nerrs = check_page(rel, (PageHeader) raw_page, blkno, raw_page,
+								plan);
+
+		if (pgcheck_issues_quiet && (page_nerrs > 0))
+		{
+			pgcheck_issues_quiet = false;
+
+			raw_page = reader_reread(reader, blkno);
+
+			check_checksums = checksums && reader->from_file;
+
+			page_nerrs = check_page(rel, (PageHeader) raw_page, blkno,
+									raw_page, plan);
+		}
+
+		pgcheck_issues_quiet = false;
+
 		header = (PageHeader) raw_page;
 
-		nerrs += check_page(rel, header, blkno, raw_page, bitmap);
+		/* collect the items (from corrupted pages too, see btree_check_page) */
+		if (items || page_items.summary)
+			page_nerrs += index_collect_items(rel, header, blkno, raw_page,
+											  &page_items, (page_nerrs == 0));
+
+		if (timing)
+		{
+			INSTR_TIME_SET_CURRENT(done);
+			stats_add_page(start, read, done);
+		}
+
+		nerrs += page_nerrs;
+
+		block_sample_checked(sample, page_nerrs);
+
+		progress_add_blocks(1, page_nerrs);
+
+		/*
+		 * In snapshot mode the index may grow while we're scanning it (page
+		 * splits move items to new pages at the end), so before finishing
+		 * see if there are any new pages.
+		 *
+		 * Splits into recycled pages we've already scanned may still hide
+		 * some items from us (or make us see them twice), so when we observe
+		 * such splits, the cross-check does not count items missing in the
+		 * index (or duplicates) as differences, it only reports them in a
+		 * NOTICE.
+		 */
+		if ((items != NULL) && pgcheck_snapshot_cross_check &&
+			!blockRangeGiven && (blkno + 1 == blockTo))
+			blockTo = RelationGetNumberOfBlocks(rel);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	reader_free(reader);
+	attribute_plan_free(plan);
+
+	if (sample)
+	{
+		block_sample_report(sample, rel);
+		block_sample_free(sample);
+	}
+
+	/* tell the cross-check about the splits (without the links, assume some) */
+	if (items)
+	{
+		bool		hidden = (page_items.splits) ?
+		page_items.splits->hidden : pgcheck_snapshot_cross_check;
+		bool		duplicated = (page_items.splits) ?
+		page_items.splits->duplicated : pgcheck_snapshot_cross_check;
+
+		if (items->bitmap)
+			items->bitmap->hidden = hidden;
+
+		if (items->filter)
+			items->filter->hidden = hidden;
+
+		if (items->tids)
+		{
+			items->tids->hidden = hidden;
+			items->tids->duplicated = duplicated;
+		}
+	}
+
+	if (page_items.splits)
+		btree_splits_free(page_items.splits);
+
+	if (page_items.summary)
+	{
+		page_nerrs = btree_summary_verify(rel, page_items.summary);
+
+		nerrs += page_nerrs;
+
+		progress_add_blocks(0, page_nerrs);
+
+		btree_summary_free(page_items.summary);
 	}
 
 	FreeAccessStrategy(strategy);
 
 	relation_close(rel, lmode);
 
+	if (!blockRangeGiven && (sampleOptions == NULL))
+		stats_full_check(indexOid, startLsn);
+
+	stats_end();
+	progress_end();
+
+	check_memory_end(&memory);
+
 	return nerrs;
 }
 
@@ -456,5 +2380,294 @@ _PG_init(void)
 							 NULL,
 							 NULL);
 
+	DefineCustomEnumVariable("pg_check.bitmap_type",
+							 "representation of the bitmaps used to cross-check",
+							 NULL,
+							 &pgcheck_bitmap_type,
+							 BITMAP_TYPE_DENSE,
+							 bitmap_type_options,
+							 PGC_SUSET,
+							 0,
+#if (PG_VERSION_NUM >= 90100)
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("pg_check.snapshot_cross_check",
+							 "cross-check using a snapshot, without blocking writes.",
+							 NULL,
+							 &pgcheck_snapshot_cross_check,
+							 false,
+							 PGC_SUSET,
+							 0,
+#if (PG_VERSION_NUM >= 90100)
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	DefineCustomEnumVariable("pg_check.cross_check_method",
+							 "method used to cross-check the table with indexes",
+							 NULL,
+							 &pgcheck_cross_check_method,
+							 CROSS_CHECK_BITMAP,
+							 cross_check_method_options,
+							 PGC_SUSET,
+							 0,
+#if (PG_VERSION_NUM >= 90100)
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("pg_check.cross_check_memory",
+							"memory for the fingerprints or sorts used to cross-check indexes",
+							"Split between the indexes of the table.",
+							&pgcheck_cross_check_memory,
+							65536,
+							64,
+							524288,
+							PGC_SUSET,
+							GUC_UNIT_KB,
+#if (PG_VERSION_NUM >= 90100)
+							NULL,
+#endif
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_check.max_memory",
+							"maximum memory used by a check (bitmaps, summaries, buffers)",
+							"Zero means no limit. When exceeded, the checks fall back to approaches using less memory.",
+							&pgcheck_max_memory,
+							0,
+							0,
+							MAX_KILOBYTES,
+							PGC_SUSET,
+							GUC_UNIT_KB,
+#if (PG_VERSION_NUM >= 90100)
+							NULL,
+#endif
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_check.max_parallel_workers",
+							"maximum number of parallel workers used to check a table",
+							"Zero disables parallel checking.",
+							&pgcheck_max_parallel_workers,
+							0,
+							0,
+							1024,
+							PGC_SUSET,
+							0,
+#if (PG_VERSION_NUM >= 90100)
+							NULL,
+#endif
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_check.prefetch_distance",
+							"number of blocks to prefetch ahead of the check",
+							"Zero disables prefetching.",
+							&pgcheck_prefetch_distance,
+							32,
+							0,
+							1024,
+							PGC_SUSET,
+							0,
+#if (PG_VERSION_NUM >= 90100)
+							NULL,
+#endif
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_check.cost_delay",
+							"cost delay in milliseconds (like vacuum_cost_delay)",
+							"Zero disables the cost-based delay.",
+							&pgcheck_cost_delay,
+							0,
+							0,
+							100,
+							PGC_SUSET,
+							GUC_UNIT_MS,
+#if (PG_VERSION_NUM >= 90100)
+							NULL,
+#endif
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_check.cost_limit",
+							"cost amount available before sleeping",
+							NULL,
+							&pgcheck_cost_limit,
+							200,
+							1,
+							10000,
+							PGC_SUSET,
+							0,
+#if (PG_VERSION_NUM >= 90100)
+							NULL,
+#endif
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_check.cost_page_hit",
+							"cost of a page found in shared buffers",
+							NULL,
+							&pgcheck_cost_page_hit,
+							1,
+							0,
+							10000,
+							PGC_SUSET,
+							0,
+#if (PG_VERSION_NUM >= 90100)
+							NULL,
+#endif
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_check.cost_page_miss",
+							"cost of a page read from disk",
+							NULL,
+							&pgcheck_cost_page_miss,
+							10,
+							0,
+							10000,
+							PGC_SUSET,
+							0,
+#if (PG_VERSION_NUM >= 90100)
+							NULL,
+#endif
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("pg_check.direct_read",
+							 "read the relation files directly, not through shared buffers.",
+							 NULL,
+							 &pgcheck_direct_read,
+							 false,
+							 PGC_SUSET,
+							 0,
+#if (PG_VERSION_NUM >= 90100)
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("pg_check.verify_checksums",
+							 "verify data checksums of pages read from the files.",
+							 NULL,
+							 &pgcheck_verify_checksums,
+							 true,
+							 PGC_SUSET,
+							 0,
+#if (PG_VERSION_NUM >= 90100)
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("pg_check.verify_toast",
+							 "verify TOAST pointers against the TOAST relation.",
+							 "Requires checking the heap without parallel workers.",
+							 &pgcheck_verify_toast,
+							 false,
+							 PGC_SUSET,
+							 0,
+#if (PG_VERSION_NUM >= 90100)
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	DefineCustomEnumVariable("pg_check.check_level",
+							 "how deep the checks of the pages go",
+							 "Each level includes the lower ones: header, line_pointers, tuples, attributes.",
+							 &pgcheck_check_level,
+							 CHECK_LEVEL_ATTRIBUTES,
+							 check_level_options,
+							 PGC_SUSET,
+							 0,
+#if (PG_VERSION_NUM >= 90100)
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("pg_check.verify_maps",
+							 "verify the visibility map and free space map against the heap pages.",
+							 NULL,
+							 &pgcheck_verify_maps,
+							 false,
+							 PGC_SUSET,
+							 0,
+#if (PG_VERSION_NUM >= 90100)
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("pg_check.toast_memory",
+							"memory for the TOAST pointers verified in one scan of the TOAST relation",
+							"When exceeded, the TOAST relation is scanned multiple times.",
+							&pgcheck_toast_memory,
+							65536,
+							64,
+							524288,
+							PGC_SUSET,
+							GUC_UNIT_KB,
+#if (PG_VERSION_NUM >= 90100)
+							NULL,
+#endif
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("pg_check.verify_btree_structure",
+							 "verify structure of b-tree indexes (blocks writes to the index).",
+							 "Not done in the snapshot mode (pg_check.snapshot_cross_check).",
+							 &pgcheck_verify_btree_structure,
+							 false,
+							 PGC_SUSET,
+							 0,
+#if (PG_VERSION_NUM >= 90100)
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("pg_check.track_stats",
+							 "collect cumulative statistics of the checks (see pg_check_stats).",
+							 "Requires loading the library using shared_preload_libraries.",
+							 &pgcheck_track_stats,
+							 true,
+							 PGC_SUSET,
+							 0,
+#if (PG_VERSION_NUM >= 90100)
+							 NULL,
+#endif
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("pg_check.stats_max_relations",
+							"number of relations tracked by the cumulative statistics",
+							NULL,
+							&pgcheck_stats_max_relations,
+							1000,
+							100,
+							1000000,
+							PGC_POSTMASTER,
+							0,
+#if (PG_VERSION_NUM >= 90100)
+							NULL,
+#endif
+							NULL,
+							NULL);
+
 	EmitWarningsOnPlaceholders("pg_check");
+
+	/* shared memory for the progress reporting (when preloaded) */
+	progress_shmem_request();
+
+	/* shared memory for the cumulative statistics (when preloaded) */
+	stats_shmem_request();
 }
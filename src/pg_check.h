@@ -0,0 +1,119 @@
+#ifndef PG_CHECK_H
+#define PG_CHECK_H
+
+#include "postgres.h"
+#include "storage/bufmgr.h"
+#include "utils/rel.h"
+
+#include "diff.h"
+#include "fingerprint.h"
+#include "index.h"
+#include "item-bitmap.h"
+#include "memory.h"
+#include "parallel.h"
+#include "sample.h"
+#include "tid-sort.h"
+#include "toast.h"
+#include "visibility.h"
+
+/* method used to cross-check the table with indexes */
+typedef enum
+{
+	CROSS_CHECK_BITMAP,			/* compare bitmaps of TIDs */
+	CROSS_CHECK_FINGERPRINT,	/* probe Bloom filters of (TID, key) */
+	CROSS_CHECK_SORTED			/* merge sorted TIDs with the heap pages */
+}			CrossCheckMethod;
+
+/* GUC variables (defined in pg_check.c) */
+extern bool pgcheck_debug;
+extern int	pgcheck_bitmap_format;
+extern int	pgcheck_max_parallel_workers;
+extern int	pgcheck_bitmap_type;
+extern bool pgcheck_snapshot_cross_check;
+extern int	pgcheck_cross_check_method;
+extern int	pgcheck_cross_check_memory;
+extern int	pgcheck_prefetch_distance;
+extern bool pgcheck_direct_read;
+extern int	pgcheck_cost_delay;
+extern int	pgcheck_cost_limit;
+extern int	pgcheck_cost_page_hit;
+extern int	pgcheck_cost_page_miss;
+extern bool pgcheck_verify_checksums;
+extern bool pgcheck_verify_btree_structure;
+extern bool pgcheck_verify_toast;
+extern int	pgcheck_toast_memory;
+extern bool pgcheck_verify_maps;
+extern int	pgcheck_max_memory;
+extern int	pgcheck_check_level;
+extern bool pgcheck_track_stats;
+extern int	pgcheck_stats_max_relations;
+
+/* Checks heap blocks [blockFrom, blockTo), updating the bitmap if given,
+ * and probing the index fingerprints or merging the sorted index TIDs if
+ * given.
+ *
+ * - rel : heap relation (already locked by the caller)
+ * - blockFrom : first block to check
+ * - blockTo : block after the last one to check
+ * - strategy : buffer access strategy used to read the blocks
+ * - bitmap : bitmap of heap items for the cross-check (may be NULL)
+ * - probe : fingerprints of the indexes for the cross-check (may be NULL)
+ * - merge : sorted TIDs of the indexes for the cross-check (may be NULL)
+ * - toast : collects the TOAST pointers to verify (may be NULL)
+ * - sample : check only the sampled blocks (may be NULL)
+ * - sinceLsn : skip pages with LSN older than this (0 checks all pages)
+ *
+ * Returns number of issues found.
+ */
+uint32		check_heap_range(Relation rel,
+							 BlockNumber blockFrom, BlockNumber blockTo,
+							 BufferAccessStrategy strategy,
+							 item_bitmap * bitmap,
+							 fingerprint_probe * probe,
+							 tid_merge * merge,
+							 toast_check * toast,
+							 block_sample * sample,
+							 uint64 sinceLsn);
+
+/* Checks an index, optionally collecting items (when cross-checking).
+ *
+ * - indexOid : index to check
+ * - blockFrom, blockTo, blockRangeGiven : range of blocks to check
+ * - items : bitmap / fingerprints / sorted TIDs populated from the index
+ *           (may be NULL)
+ * - crossCheck : set to true if the index supports cross-checking
+ * - sampleOptions : check only a sample of the blocks (may be NULL)
+ *
+ * Returns number of issues found.
+ */
+uint32		check_index(Oid indexOid,
+						BlockNumber blockFrom, BlockNumber blockTo,
+						bool blockRangeGiven,
+						index_items * items, bool *crossCheck,
+						sample_options * sampleOptions);
+
+/* Checks an index of a table, and compares the index bitmap to the heap
+ * bitmap (if cross-checking).
+ *
+ * - indexOid : index to check
+ * - bitmap_heap : bitmap built from the heap (NULL without cross-check)
+ * - bitmap_idx : bitmap for the index items, reset by this function
+ *
+ * Returns number of issues found (including the differences).
+ */
+uint32		check_table_index(Oid indexOid, item_bitmap * bitmap_heap,
+							  item_bitmap * bitmap_idx);
+
+/* Checks a chunk of pg_check_database (a range of heap blocks or an index),
+ * or a partition of a partitioned table.
+ *
+ * - chunk : the chunk to check
+ *
+ * Chunks of relations dropped since being queued are skipped, and the
+ * heap ranges are limited to the current size of the heap.
+ *
+ * Returns number of issues found.
+ */
+uint32		check_database_chunk(database_chunk * chunk);
+
+#endif							/* PG_CHECK_H */
@@ -0,0 +1,494 @@
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+
+#if (PG_VERSION_NUM >= 90600)
+#include "port/atomics.h"
+#include "postmaster/autovacuum.h"
+#include "replication/walsender.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#if (PG_VERSION_NUM < 170000)
+#include "storage/backendid.h"
+#endif
+#endif
+
+#include "progress.h"
+
+PG_FUNCTION_INFO_V1(pg_check_progress);
+
+/* number of columns of pg_check_progress() */
+#define PROGRESS_NATTS	11
+
+#if (PG_VERSION_NUM >= 90600)
+
+static const char *phase_names[] = {
+	"initializing",
+	"scanning heap",
+	"scanning index",
+	"comparing with heap"
+};
+
+/*
+ * Progress of a check. The counters are updated by parallel workers too,
+ * so those are atomic. The other fields are only written by the owner,
+ * and readers may see a slightly inconsistent state (which is fine for
+ * progress reporting). The pid is set last, once the slot is initialized.
+ */
+typedef struct check_progress
+{
+	int			pid;			/* backend running the check (0 : unused) */
+	Oid			datid;
+	Oid			relid;			/* relation being checked */
+	int			phase;
+	Oid			index_relid;	/* index being checked */
+	int			indexes_total;
+	TimestampTz started_at;
+	uint64		blocks_total;	/* blocks to scan in the current phase */
+	pg_atomic_uint64 blocks_done;
+	pg_atomic_uint64 issues_found;
+	pg_atomic_uint32 indexes_done;
+}			check_progress;
+
+typedef struct progress_shared
+{
+	int			nslots;
+	check_progress slots[FLEXIBLE_ARRAY_MEMBER];
+}			progress_shared;
+
+static progress_shared *progress = NULL;
+
+/* slot this process reports to (own slot, or the leader's in workers) */
+static check_progress *my_progress = NULL;
+static bool my_owner = false;
+static int	my_depth = 0;
+static SubTransactionId my_subid = InvalidSubTransactionId;
+static bool callback_registered = false;
+
+#if (PG_VERSION_NUM >= 150000)
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static int	progress_nslots(void);
+static Size progress_shmem_size(void);
+#if (PG_VERSION_NUM >= 150000)
+static void progress_request_hook(void);
+#endif
+static void progress_startup_hook(void);
+static void progress_release(void);
+static void progress_xact_callback(XactEvent event, void *arg);
+static void progress_subxact_callback(SubXactEvent event,
+									  SubTransactionId mySubid,
+									  SubTransactionId parentSubid,
+									  void *arg);
+
+/*
+ * Number of slots - one for each backend (incl. background workers). The
+ * size is requested before MaxBackends is calculated (on older versions),
+ * so do the same calculation here.
+ */
+static int
+progress_nslots(void)
+{
+#if (PG_VERSION_NUM >= 150000)
+	return MaxBackends;
+#elif (PG_VERSION_NUM >= 120000)
+	return MaxConnections + autovacuum_max_workers + 1 +
+		max_worker_processes + max_wal_senders;
+#else
+	return MaxConnections + autovacuum_max_workers + 1 +
+		max_worker_processes;
+#endif
+}
+
+static Size
+progress_shmem_size(void)
+{
+	return add_size(offsetof(progress_shared, slots),
+					mul_size(progress_nslots(), sizeof(check_progress)));
+}
+
+void
+progress_shmem_request(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if (PG_VERSION_NUM >= 150000)
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = progress_request_hook;
+#else
+	RequestAddinShmemSpace(progress_shmem_size());
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = progress_startup_hook;
+}
+
+#if (PG_VERSION_NUM >= 150000)
+static void
+progress_request_hook(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(progress_shmem_size());
+}
+#endif
+
+static void
+progress_startup_hook(void)
+{
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	progress = ShmemInitStruct("pg_check progress", progress_shmem_size(),
+							   &found);
+
+	if (!found)
+	{
+		int			i;
+
+		progress->nslots = progress_nslots();
+
+		for (i = 0; i < progress->nslots; i++)
+		{
+			check_progress *slot = &progress->slots[i];
+
+			slot->pid = 0;
+			pg_atomic_init_u64(&slot->blocks_done, 0);
+			pg_atomic_init_u64(&slot->issues_found, 0);
+			pg_atomic_init_u32(&slot->indexes_done, 0);
+		}
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/* release the slot of a failed check (and forget about nested checks) */
+static void
+progress_release(void)
+{
+	if (my_owner && my_progress)
+		my_progress->pid = 0;
+
+	my_progress = NULL;
+	my_owner = false;
+	my_depth = 0;
+}
+
+/* release the slot when the check fails */
+static void
+progress_xact_callback(XactEvent event, void *arg)
+{
+	if ((event != XACT_EVENT_ABORT) && (event != XACT_EVENT_PARALLEL_ABORT))
+		return;
+
+	progress_release();
+}
+
+/*
+ * Release the slot when the check fails in a subtransaction (e.g. in a
+ * savepoint or a plpgsql block with an exception handler). The check may
+ * have started in the aborted subtransaction or in one of its children.
+ */
+static void
+progress_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+						  SubTransactionId parentSubid, void *arg)
+{
+	if ((event != SUBXACT_EVENT_ABORT_SUB) || (my_depth == 0))
+		return;
+
+	if (my_subid >= mySubid)
+		progress_release();
+}
+
+void
+progress_start(Oid relid)
+{
+	check_progress *slot;
+	int			idx;
+
+	if (progress == NULL)
+		return;
+
+	/* nested check, or a parallel worker reporting to the leader's slot */
+	if ((my_depth++ > 0) || (my_progress != NULL))
+		return;
+
+	if (!callback_registered)
+	{
+		RegisterXactCallback(progress_xact_callback, NULL);
+		RegisterSubXactCallback(progress_subxact_callback, NULL);
+		callback_registered = true;
+	}
+
+	my_subid = GetCurrentSubTransactionId();
+
+#if (PG_VERSION_NUM >= 170000)
+	idx = MyProcNumber;
+#else
+	idx = MyBackendId - 1;
+#endif
+
+	if ((idx < 0) || (idx >= progress->nslots))
+		return;
+
+	slot = &progress->slots[idx];
+
+	slot->datid = MyDatabaseId;
+	slot->relid = relid;
+	slot->phase = PROGRESS_PHASE_INITIALIZING;
+	slot->index_relid = InvalidOid;
+	slot->indexes_total = 0;
+	slot->started_at = GetCurrentTimestamp();
+	slot->blocks_total = 0;
+	pg_atomic_write_u64(&slot->blocks_done, 0);
+	pg_atomic_write_u64(&slot->issues_found, 0);
+	pg_atomic_write_u32(&slot->indexes_done, 0);
+
+	pg_write_barrier();
+
+	slot->pid = MyProcPid;
+
+	my_progress = slot;
+	my_owner = true;
+}
+
+void
+progress_end(void)
+{
+	if ((progress == NULL) || (my_depth == 0))
+		return;
+
+	if ((--my_depth > 0) || !my_owner)
+		return;
+
+	my_progress->pid = 0;
+
+	my_progress = NULL;
+	my_owner = false;
+}
+
+void
+progress_set_phase(int phase, Oid indexOid, BlockNumber nblocks)
+{
+	if (!my_owner || (my_progress == NULL))
+		return;
+
+	my_progress->phase = phase;
+	my_progress->index_relid = indexOid;
+	my_progress->blocks_total = nblocks;
+	pg_atomic_write_u64(&my_progress->blocks_done, 0);
+}
+
+void
+progress_set_indexes(int nindexes)
+{
+	if (!my_owner || (my_progress == NULL))
+		return;
+
+	my_progress->indexes_total = nindexes;
+	pg_atomic_write_u32(&my_progress->indexes_done, 0);
+}
+
+void
+progress_add_blocks(uint32 nblocks, uint32 nissues)
+{
+	if (my_progress == NULL)
+		return;
+
+	if (nblocks > 0)
+		pg_atomic_fetch_add_u64(&my_progress->blocks_done, nblocks);
+
+	if (nissues > 0)
+		pg_atomic_fetch_add_u64(&my_progress->issues_found, nissues);
+}
+
+void
+progress_index_done(void)
+{
+	if (my_progress == NULL)
+		return;
+
+	pg_atomic_fetch_add_u32(&my_progress->indexes_done, 1);
+}
+
+int
+progress_get_slot(void)
+{
+	if (!my_owner || (my_progress == NULL))
+		return -1;
+
+	return (int) (my_progress - progress->slots);
+}
+
+void
+progress_attach(int slot)
+{
+	if ((progress == NULL) || (slot < 0) || (slot >= progress->nslots))
+		return;
+
+	my_progress = &progress->slots[slot];
+	my_owner = false;
+}
+
+void
+progress_detach(void)
+{
+	if (!my_owner)
+		my_progress = NULL;
+}
+
+#else							/* PG_VERSION_NUM < 90600 */
+
+/* no atomics / parallel infrastructure, so no progress reporting */
+
+void
+progress_shmem_request(void)
+{
+}
+
+void
+progress_start(Oid relid)
+{
+}
+
+void
+progress_end(void)
+{
+}
+
+void
+progress_set_phase(int phase, Oid indexOid, BlockNumber nblocks)
+{
+}
+
+void
+progress_set_indexes(int nindexes)
+{
+}
+
+void
+progress_add_blocks(uint32 nblocks, uint32 nissues)
+{
+}
+
+void
+progress_index_done(void)
+{
+}
+
+int
+progress_get_slot(void)
+{
+	return -1;
+}
+
+void
+progress_attach(int slot)
+{
+}
+
+void
+progress_detach(void)
+{
+}
+
+#endif
+
+/*
+ * pg_check_progress
+ *
+ * Returns progress of the running checks (used by pg_stat_progress_check).
+ */
+Datum
+pg_check_progress(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext oldcontext;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+
+	if ((rsinfo == NULL) || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tupdesc->natts != PROGRESS_NATTS)
+		elog(ERROR, "incorrect number of output arguments");
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+#if (PG_VERSION_NUM >= 90600)
+	if (progress != NULL)
+	{
+		int			i;
+
+		for (i = 0; i < progress->nslots; i++)
+		{
+			check_progress *slot = &progress->slots[i];
+			Datum		values[PROGRESS_NATTS];
+			bool		nulls[PROGRESS_NATTS];
+			int			pid = slot->pid;
+			int			phase;
+
+			if (pid == 0)
+				continue;
+
+			pg_read_barrier();
+
+			memset(nulls, 0, sizeof(nulls));
+
+			phase = slot->phase;
+			if ((phase < 0) || (phase >= lengthof(phase_names)))
+				phase = PROGRESS_PHASE_INITIALIZING;
+
+			values[0] = Int32GetDatum(pid);
+			values[1] = ObjectIdGetDatum(slot->datid);
+			values[2] = ObjectIdGetDatum(slot->relid);
+			values[3] = CStringGetTextDatum(phase_names[phase]);
+			values[4] = Int64GetDatum((int64) slot->blocks_total);
+			values[5] = Int64GetDatum((int64) pg_atomic_read_u64(&slot->blocks_done));
+			values[6] = ObjectIdGetDatum(slot->index_relid);
+			values[7] = Int32GetDatum(slot->indexes_total);
+			values[8] = Int32GetDatum((int32) pg_atomic_read_u32(&slot->indexes_done));
+			values[9] = Int64GetDatum((int64) pg_atomic_read_u64(&slot->issues_found));
+			values[10] = TimestampTzGetDatum(slot->started_at);
+
+			nulls[6] = !OidIsValid(slot->index_relid);
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+	}
+#endif
+
+	return (Datum) 0;
+}
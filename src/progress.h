@@ -0,0 +1,69 @@
+#ifndef PROGRESS_CHECK_H
+#define PROGRESS_CHECK_H
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "storage/block.h"
+
+/*
+ * Progress of the running checks, published in shared memory (one slot per
+ * backend) and exposed by the pg_stat_progress_check view. This requires
+ * loading the library using shared_preload_libraries (9.6+), otherwise the
+ * functions do nothing and the view is empty.
+ *
+ * The slot is owned by the backend running the check, which is the only
+ * process setting the phase etc. Parallel workers attach the slot of the
+ * leader, and only add the blocks / issues / indexes they've checked.
+ */
+
+/* phases of the check */
+#define PROGRESS_PHASE_INITIALIZING		0
+#define PROGRESS_PHASE_HEAP				1
+#define PROGRESS_PHASE_INDEX			2
+#define PROGRESS_PHASE_COMPARE			3
+
+/* Requests the shared memory (called from _PG_init). */
+void		progress_shmem_request(void);
+
+/* Starts reporting progress of a check of the relation (nested calls are
+ * allowed, only the outermost one does anything).
+ *
+ * - relid : the relation being checked (table or index)
+ */
+void		progress_start(Oid relid);
+
+/* Stops reporting progress (releases the slot). */
+void		progress_end(void);
+
+/* Sets phase of the check (only in the process owning the slot).
+ *
+ * - phase : the new phase (PROGRESS_PHASE_*)
+ * - indexOid : index being checked (InvalidOid in the heap phase)
+ * - nblocks : number of blocks to scan in this phase
+ *
+ * Resets the number of blocks done.
+ */
+void		progress_set_phase(int phase, Oid indexOid, BlockNumber nblocks);
+
+/* Sets number of indexes to check (only in the process owning the slot). */
+void		progress_set_indexes(int nindexes);
+
+/* Adds the checked blocks and the issues found in them. */
+void		progress_add_blocks(uint32 nblocks, uint32 nissues);
+
+/* Counts an index as checked. */
+void		progress_index_done(void);
+
+/* Returns the slot to be attached by parallel workers (-1 if none). */
+int			progress_get_slot(void);
+
+/* Attaches the slot of the leader (in a parallel worker). */
+void		progress_attach(int slot);
+
+/* Detaches the slot of the leader. */
+void		progress_detach(void);
+
+/* Returns rows of the pg_stat_progress_check view. */
+Datum		pg_check_progress(PG_FUNCTION_ARGS);
+
+#endif							/* PROGRESS_CHECK_H */
@@ -0,0 +1,449 @@
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if (PG_VERSION_NUM >= 90400)
+#include "common/relpath.h"
+#else
+#include "catalog/catalog.h"
+#endif
+#include "executor/instrument.h"
+#include "miscadmin.h"
+#include "storage/buf_internals.h"
+#include "storage/fd.h"
+
+#include "common.h"
+#include "pg_check.h"
+#include "reader.h"
+
+/* size of chunks read from the segment files in direct mode (4MB) */
+#define DIRECT_CHUNK_BLOCKS		((4 * 1024 * 1024) / BLCKSZ)
+
+/* accumulated cost of the pages read, since the last delay */
+static int	cost_balance = 0;
+
+static char *reader_read_buffer(page_reader * reader, BlockNumber blkno);
+static void reader_cost_delay(int cost);
+static uint8 reader_vm_status(page_reader * reader, BlockNumber blkno);
+
+#if (PG_VERSION_NUM >= 90300)
+static void reader_read_chunk(page_reader * reader, BlockNumber blkno,
+				  BlockNumber blockTo);
+static void reader_open_segment(page_reader * reader, BlockNumber segno);
+static void reader_close_segment(page_reader * reader);
+static bool reader_read_block(page_reader * reader, BlockNumber blkno);
+static bool block_is_buffered(Relation rel, BlockNumber blkno);
+#endif
+
+page_reader *
+reader_init(Relation rel, BufferAccessStrategy strategy, bool direct)
+{
+	page_reader *reader;
+
+	reader = (page_reader *) palloc0(sizeof(page_reader));
+
+	reader->rel = rel;
+	reader->strategy = strategy;
+	reader->page = (char *) palloc(BLCKSZ);
+	reader->fd = -1;
+	reader->vmbuffer = InvalidBuffer;
+
+	/*
+	 * Temporary relations use local buffers, which we can't look into from
+	 * here, so always read those through the buffer manager.
+	 */
+#if (PG_VERSION_NUM >= 90300)
+	reader->direct = direct && !RelationUsesLocalBuffers(rel);
+#endif
+
+	if (reader->direct)
+		reader->chunk = (char *) palloc(DIRECT_CHUNK_BLOCKS * BLCKSZ);
+
+	return reader;
+}
+
+char *
+reader_read(page_reader * reader, BlockNumber blkno, BlockNumber blockTo)
+{
+#if (PG_VERSION_NUM >= 90300)
+	if (reader->direct)
+	{
+		if ((blkno < reader->chunkFrom) ||
+			(blkno >= reader->chunkFrom + reader->chunkBlocks))
+			reader_read_chunk(reader, blkno, blockTo);
+
+		/*
+		 * Pages in shared buffers may be newer than the file, so read those
+		 * through the buffer manager (that's cheap, as it's a hit). Also the
+		 * pages not in the file yet (short read).
+		 *
+		 * The page might still be loaded, modified and written out again
+		 * while we were reading the chunk, resulting in a torn (or stale)
+		 * copy. So the callers don't trust issues found on pages read from
+		 * the file, and check those again after reader_reread.
+		 */
+		if ((blkno < reader->chunkFrom + reader->chunkBlocks) &&
+			!block_is_buffered(reader->rel, blkno))
+		{
+			reader_cost_delay(pgcheck_cost_page_miss);
+
+			reader->from_file = true;
+
+			/*
+			 * Without the buffer lock the bits may be set concurrently,
+			 * after the chunk was read. That only happens after the page
+			 * gets loaded into shared buffers, so it's just as unlikely as
+			 * the torn read (and handled the same way).
+			 */
+			if (reader->vm)
+				reader->vmstatus = reader_vm_status(reader, blkno);
+
+			return reader->chunk + (Size) (blkno - reader->chunkFrom) * BLCKSZ;
+		}
+
+		reader->nbuffered++;
+
+		return reader_read_buffer(reader, blkno);
+	}
+#endif
+
+	if (reader->sample)
+		block_sample_prefetch(reader->sample, reader->rel,
+							  pgcheck_prefetch_distance);
+	else
+		reader->prefetched = prefetch_blocks(reader->rel, blkno, blockTo,
+											 reader->prefetched,
+											 pgcheck_prefetch_distance);
+
+	return reader_read_buffer(reader, blkno);
+}
+
+/*
+ * The copy is made while holding the buffer lock, so it's consistent (and
+ * so is the visibility map status). Pages already read through the buffer
+ * manager need no re-reading.
+ *
+ * The buffer manager verifies the pages it reads from disk, and a checksum
+ * failure is an error terminating the whole check. So pages not in shared
+ * buffers are read from the file again instead, and the checksum verified
+ * again (just like base backups retry blocks with checksum failures). A
+ * page being written out stays in shared buffers until the write is done,
+ * so if it's not there after the read, the copy is not torn.
+ */
+char *
+reader_reread(page_reader * reader, BlockNumber blkno)
+{
+	if (!reader->from_file)
+		return reader->page;
+
+#if (PG_VERSION_NUM >= 90300)
+	if (!block_is_buffered(reader->rel, blkno) &&
+		reader_read_block(reader, blkno) &&
+		!block_is_buffered(reader->rel, blkno))
+	{
+		reader_cost_delay(pgcheck_cost_page_miss);
+
+		if (reader->vm)
+			reader->vmstatus = reader_vm_status(reader, blkno);
+
+		return reader->page;
+	}
+#endif
+
+	return reader_read_buffer(reader, blkno);
+}
+
+/*
+ * The sampled blocks are (usually) far apart, so reading chunks of the
+ * files would read mostly blocks we don't need.
+ */
+void
+reader_set_sample(page_reader * reader, block_sample * sample)
+{
+	reader->sample = sample;
+
+	if ((sample == NULL) || !reader->direct)
+		return;
+
+	pfree(reader->chunk);
+	reader->chunk = NULL;
+	reader->direct = false;
+}
+
+void
+reader_track_vm(page_reader * reader)
+{
+	reader->vm = true;
+}
+
+void
+reader_free(page_reader * reader)
+{
+#if (PG_VERSION_NUM >= 90300)
+	if (reader->direct)
+	{
+		ereport(DEBUG1,
+				(errmsg("relation \"%s\": " UINT64_FORMAT " pages read through shared buffers",
+						RelationGetRelationName(reader->rel),
+						reader->nbuffered)));
+
+		reader_close_segment(reader);
+		pfree(reader->chunk);
+	}
+#endif
+
+	if (BufferIsValid(reader->vmbuffer))
+		ReleaseBuffer(reader->vmbuffer);
+
+	pfree(reader->page);
+	pfree(reader);
+}
+
+/*
+ * Copy the page from shared buffers, while holding a share lock. The page
+ * is charged as a miss when the buffer manager had to read it (which is
+ * what the buffer usage counters tell us).
+ *
+ * The visibility map status is read twice - first to pin the map page
+ * (which may require I/O, so we don't want to do that while holding the
+ * heap buffer lock), and then again under the lock. Setting the bits
+ * requires an exclusive lock on the heap buffer, so the status can't
+ * change while we copy the page (just like pg_visibility does it).
+ */
+static char *
+reader_read_buffer(page_reader * reader, BlockNumber blkno)
+{
+	Buffer		buf;
+	long		nread;
+
+	nread = pgBufferUsage.shared_blks_read + pgBufferUsage.local_blks_read;
+
+	buf = ReadBufferExtended(reader->rel, MAIN_FORKNUM, blkno, RBM_NORMAL,
+							 reader->strategy);
+
+	if (reader->vm)
+		(void) reader_vm_status(reader, blkno);
+
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+
+	memcpy(reader->page, BufferGetPage(buf), BLCKSZ);
+
+	if (reader->vm)
+		reader->vmstatus = reader_vm_status(reader, blkno);
+
+	LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+	ReleaseBuffer(buf);
+
+	reader->from_file = false;
+
+	if (pgBufferUsage.shared_blks_read + pgBufferUsage.local_blks_read > nread)
+		reader_cost_delay(pgcheck_cost_page_miss);
+	else
+		reader_cost_delay(pgcheck_cost_page_hit);
+
+	return reader->page;
+}
+
+/* status of the block in the visibility map (keeps the map page pinned) */
+static uint8
+reader_vm_status(page_reader * reader, BlockNumber blkno)
+{
+#if (PG_VERSION_NUM >= 90600)
+	return visibilitymap_get_status(reader->rel, blkno, &reader->vmbuffer);
+#else
+	return visibilitymap_test(reader->rel, blkno, &reader->vmbuffer) ?
+		VISIBILITYMAP_ALL_VISIBLE : 0;
+#endif
+}
+
+/*
+ * Cost-based delay, similar to the cost-based vacuum delay. The cost of
+ * each page read is added to a balance, and once it exceeds the limit the
+ * process sleeps for cost_delay (proportionally longer if the balance is
+ * well over the limit, but at most 4x). Called with no buffer locks held.
+ *
+ * The balance is per process, so with parallel workers each of them is
+ * throttled independently.
+ */
+static void
+reader_cost_delay(int cost)
+{
+	double		msec;
+
+	if (pgcheck_cost_delay <= 0)
+		return;
+
+	cost_balance += cost;
+
+	if (cost_balance < pgcheck_cost_limit)
+		return;
+
+	msec = (double) pgcheck_cost_delay * cost_balance / pgcheck_cost_limit;
+	if (msec > pgcheck_cost_delay * 4)
+		msec = pgcheck_cost_delay * 4;
+
+	pg_usleep((long) (msec * 1000));
+
+	cost_balance = 0;
+
+	CHECK_FOR_INTERRUPTS();
+}
+
+#if (PG_VERSION_NUM >= 90300)
+/*
+ * Read a chunk of pages starting at blkno (not crossing the end of the
+ * segment, or blockTo). The next chunk is requested using fadvise, and
+ * the previous one is dropped from page cache (it's unlikely to be needed
+ * again, and we don't want the check to push out other data).
+ */
+static void
+reader_read_chunk(page_reader * reader, BlockNumber blkno, BlockNumber blockTo)
+{
+	BlockNumber segno = blkno / RELSEG_SIZE;
+	BlockNumber nblocks;
+	off_t		offset = (off_t) (blkno % RELSEG_SIZE) * BLCKSZ;
+	Size		nbytes = 0;
+
+	nblocks = Min(DIRECT_CHUNK_BLOCKS, RELSEG_SIZE - (blkno % RELSEG_SIZE));
+	nblocks = Min(nblocks, blockTo - blkno);
+
+	if ((reader->fd == -1) || (reader->segno != segno))
+		reader_open_segment(reader, segno);
+#ifdef USE_POSIX_FADVISE
+	else if (reader->chunkBlocks > 0)
+		(void) posix_fadvise(reader->fd,
+							 (off_t) (reader->chunkFrom % RELSEG_SIZE) * BLCKSZ,
+							 (off_t) reader->chunkBlocks * BLCKSZ,
+							 POSIX_FADV_DONTNEED);
+#endif
+
+	while (nbytes < (Size) nblocks * BLCKSZ)
+	{
+		ssize_t		nread;
+
+		nread = pread(reader->fd, reader->chunk + nbytes,
+					  (Size) nblocks * BLCKSZ - nbytes, offset + nbytes);
+
+		if (nread < 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read segment %u of relation \"%s\": %m",
+							segno, RelationGetRelationName(reader->rel))));
+
+		/* end of file, the remaining pages are read through buffers */
+		if (nread == 0)
+			break;
+
+		nbytes += nread;
+	}
+
+#ifdef USE_POSIX_FADVISE
+	(void) posix_fadvise(reader->fd, offset + (off_t) nblocks * BLCKSZ,
+						 (off_t) DIRECT_CHUNK_BLOCKS * BLCKSZ,
+						 POSIX_FADV_WILLNEED);
+#endif
+
+	reader->chunkFrom = blkno;
+	reader->chunkBlocks = nbytes / BLCKSZ;
+}
+
+/*
+ * Read a single block of the open segment into the private page (the block
+ * was read as part of the current chunk). Returns false if the whole block
+ * could not be read (e.g. when the relation got truncated).
+ */
+static bool
+reader_read_block(page_reader * reader, BlockNumber blkno)
+{
+	off_t		offset = (off_t) (blkno % RELSEG_SIZE) * BLCKSZ;
+	ssize_t		nread;
+
+	Assert(reader->segno == blkno / RELSEG_SIZE);
+
+	nread = pread(reader->fd, reader->page, BLCKSZ, offset);
+
+	if (nread < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read block %u of relation \"%s\": %m",
+						blkno, RelationGetRelationName(reader->rel))));
+
+	return (nread == BLCKSZ);
+}
+
+static void
+reader_open_segment(page_reader * reader, BlockNumber segno)
+{
+	char	   *path;
+	char	   *segpath;
+
+	reader_close_segment(reader);
+
+	path = relpathbackend(reader->rel->rd_node, reader->rel->rd_backend,
+						  MAIN_FORKNUM);
+
+	if (segno > 0)
+		segpath = psprintf("%s.%u", path, segno);
+	else
+		segpath = pstrdup(path);
+
+#if (PG_VERSION_NUM >= 110000)
+	reader->fd = OpenTransientFile(segpath, O_RDONLY | PG_BINARY);
+#else
+	reader->fd = OpenTransientFile(segpath, O_RDONLY | PG_BINARY, 0);
+#endif
+
+	if (reader->fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", segpath)));
+
+#ifdef USE_POSIX_FADVISE
+	(void) posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	reader->segno = segno;
+	reader->chunkBlocks = 0;
+
+	pfree(segpath);
+	pfree(path);
+}
+
+static void
+reader_close_segment(page_reader * reader)
+{
+	if (reader->fd == -1)
+		return;
+
+	CloseTransientFile(reader->fd);
+
+	reader->fd = -1;
+	reader->chunkBlocks = 0;
+}
+
+/* is the block in shared buffers? (it may be dirty) */
+static bool
+block_is_buffered(Relation rel, BlockNumber blkno)
+{
+	BufferTag	tag;
+	uint32		hash;
+	int			buf_id;
+#if (PG_VERSION_NUM >= 90400)
+	LWLock	   *lock;
+#else
+	LWLockId	lock;
+#endif
+
+	INIT_BUFFERTAG(tag, rel->rd_node, MAIN_FORKNUM, blkno);
+
+	hash = BufTableHashCode(&tag);
+	lock = BufMappingPartitionLock(hash);
+
+	LWLockAcquire(lock, LW_SHARED);
+	buf_id = BufTableLookup(&tag, hash);
+	LWLockRelease(lock);
+
+	return (buf_id >= 0);
+}
+#endif
@@ -0,0 +1,120 @@
+#ifndef READER_CHECK_H
+#define READER_CHECK_H
+
+#include "postgres.h"
+#include "access/visibilitymap.h"
+#include "storage/bufmgr.h"
+#include "utils/rel.h"
+
+#include "sample.h"
+
+/* the visibility map had a single bit per page before 9.6 */
+#ifndef VISIBILITYMAP_ALL_VISIBLE
+#define VISIBILITYMAP_ALL_VISIBLE	0x01
+#define VISIBILITYMAP_ALL_FROZEN	0x02
+#endif
+
+/*
+ * Reader of the pages of a relation (main fork), used by the page loops.
+ *
+ * By default the pages are read through shared buffers (using the buffer
+ * access strategy), copied into a private page while holding a share lock
+ * on the buffer. The following blocks are prefetched, to keep multiple
+ * I/O requests in flight.
+ *
+ * In direct mode (9.3+) the segment files are read in large sequential
+ * chunks, bypassing shared buffers. Pages present in shared buffers (which
+ * may be dirty, i.e. newer than the file) are read through the buffer
+ * manager instead.
+ *
+ * When checking a sample of blocks, the pages are read through shared
+ * buffers, prefetching the following sampled blocks.
+ *
+ * With the visibility map tracked (reader_track_vm), the status of each
+ * page in the visibility map is read along with the page, while holding
+ * the lock on the heap buffer.
+ *
+ * With pg_check.cost_delay set, the reader also throttles the check, by
+ * sleeping once the accumulated cost of the pages read reaches the limit.
+ */
+typedef struct page_reader
+{
+	Relation	rel;
+	BufferAccessStrategy strategy;
+	char	   *page;			/* private copy of the last page */
+	bool		from_file;		/* last page read from the file (direct) */
+	BlockNumber prefetched;		/* first block not prefetched yet */
+	block_sample *sample;		/* sampled blocks (or NULL) */
+
+	/* visibility map */
+	bool		vm;				/* read the visibility map status */
+	Buffer		vmbuffer;		/* pinned visibility map page */
+	uint8		vmstatus;		/* bits of the last page read */
+
+	/* direct mode */
+	bool		direct;
+	int			fd;				/* open segment file (-1 if none) */
+	BlockNumber segno;			/* number of the open segment */
+	char	   *chunk;			/* pages read from the segment */
+	BlockNumber chunkFrom;		/* first block in the chunk */
+	BlockNumber chunkBlocks;	/* number of blocks in the chunk */
+	uint64		nbuffered;		/* pages read through shared buffers */
+}			page_reader;
+
+/* Prepares a reader for the relation.
+ *
+ * - rel : relation to read (locked by the caller)
+ * - strategy : buffer access strategy (for pages read through buffers)
+ * - direct : read the segment files directly (if possible)
+ *
+ * Returns the reader.
+ */
+page_reader *reader_init(Relation rel, BufferAccessStrategy strategy,
+			bool direct);
+
+/* Reads a page of the relation.
+ *
+ * - reader : the reader
+ * - blkno : block to read
+ * - blockTo : block after the last one the caller is going to read (used
+ *             to limit prefetching and read-ahead)
+ *
+ * Returns pointer to a private copy of the page, valid until the next
+ * call (the caller may only modify it temporarily, e.g. when computing
+ * the checksum).
+ */
+char	   *reader_read(page_reader * reader, BlockNumber blkno,
+			BlockNumber blockTo);
+
+/* Reads the last page again, through the buffer manager (or from the file,
+ * if the page is not in shared buffers).
+ *
+ * - reader : the reader
+ * - blkno : block read by the last reader_read call
+ *
+ * Pages read directly from the file may be torn or stale, so before
+ * reporting issues found on such page, the caller re-reads it this way
+ * and checks it again (with from_file set if it was read from the file
+ * again, i.e. the checksum should be verified again).
+ *
+ * Returns pointer to a private copy of the page (see reader_read).
+ */
+char	   *reader_reread(page_reader * reader, BlockNumber blkno);
+
+/* Reads only the sampled blocks (disables direct mode).
+ *
+ * - reader : the reader (before reading any pages)
+ * - sample : the sampled blocks (may be NULL)
+ */
+void		reader_set_sample(page_reader * reader, block_sample * sample);
+
+/* Reads the visibility map status of the pages (into vmstatus).
+ *
+ * - reader : the reader (before reading any pages)
+ */
+void		reader_track_vm(page_reader * reader);
+
+/* Releases the reader (closes the files, frees the memory). */
+void		reader_free(page_reader * reader);
+
+#endif							/* READER_CHECK_H */
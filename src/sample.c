@@ -0,0 +1,162 @@
+#include "postgres.h"
+
+#include <math.h>
+
+#if (PG_VERSION_NUM >= 150000)
+#include "common/pg_prng.h"
+#endif
+#include "storage/bufmgr.h"
+
+#include "sample.h"
+
+/* z-score for the upper bound of the estimate (95% confidence) */
+#define SAMPLE_CONFIDENCE_Z		1.96
+
+static double sample_random(void);
+
+/* random number from [0, 1) */
+static double
+sample_random(void)
+{
+#if (PG_VERSION_NUM >= 150000)
+	return pg_prng_double(&pg_global_prng_state);
+#else
+	return (double) random() / ((double) MAX_RANDOM_VALUE + 1);
+#endif
+}
+
+/*
+ * Select the sample using Algorithm S from Knuth 3.4.2 - each block is
+ * selected with probability (blocks still needed) / (blocks remaining),
+ * which produces a uniform sample of exactly the requested size, already
+ * sorted. Either the fraction or number of blocks may be requested.
+ */
+block_sample *
+block_sample_init(BlockNumber blockFrom, BlockNumber blockTo,
+				  sample_options * options)
+{
+	block_sample *sample;
+	BlockNumber nblocks = blockTo - blockFrom;
+	BlockNumber blkno;
+	int64		nsampled;
+
+	if (options == NULL)
+		return NULL;
+
+	if (options->nblocks > 0)
+		nsampled = Min(options->nblocks, (int64) nblocks);
+	else
+		nsampled = (int64) ceil(options->fraction * nblocks);
+
+	/* the sample has to fit into a single allocation */
+	if (nsampled > (int64) (MaxAllocSize / sizeof(BlockNumber)))
+		elog(ERROR, "sample of " INT64_FORMAT " blocks is too large", nsampled);
+
+	sample = (block_sample *) palloc0(sizeof(block_sample));
+
+	sample->nblocks = nblocks;
+	sample->blocks = (BlockNumber *) palloc(Max(1, nsampled) * sizeof(BlockNumber));
+
+	for (blkno = blockFrom; (blkno < blockTo) && (sample->nsampled < nsampled); blkno++)
+	{
+		double		needed = (double) (nsampled - sample->nsampled);
+		double		remaining = (double) (blockTo - blkno);
+
+		if (sample_random() * remaining < needed)
+			sample->blocks[sample->nsampled++] = blkno;
+	}
+
+	return sample;
+}
+
+BlockNumber
+block_sample_next(block_sample * sample, BlockNumber blkno,
+				  BlockNumber blockFrom, BlockNumber blockTo)
+{
+	if (sample == NULL)
+		return (blkno == InvalidBlockNumber) ? blockFrom : (blkno + 1);
+
+	if (sample->next >= sample->nsampled)
+		return blockTo;
+
+	return sample->blocks[sample->next++];
+}
+
+void
+block_sample_checked(block_sample * sample, uint32 nerrs)
+{
+	if (sample == NULL)
+		return;
+
+	sample->nchecked++;
+
+	if (nerrs > 0)
+		sample->ncorrupted++;
+}
+
+void
+block_sample_prefetch(block_sample * sample, Relation rel, int distance)
+{
+#ifdef USE_PREFETCH
+	int			target;
+
+	if (distance <= 0)
+		return;
+
+	/* the next block (to be read right now) is at (next - 1) */
+	target = Min(sample->next - 1 + distance, sample->nsampled);
+
+	if (sample->nprefetched < sample->next - 1)
+		sample->nprefetched = sample->next - 1;
+
+	for (; sample->nprefetched < target; sample->nprefetched++)
+		PrefetchBuffer(rel, MAIN_FORKNUM, sample->blocks[sample->nprefetched]);
+#endif
+}
+
+/*
+ * Report the fraction of sampled pages with issues, and the upper bound
+ * of the Wilson score interval (which behaves well even when no issues
+ * were found, unlike the normal approximation). The bound ignores the
+ * finite population correction, so it's conservative for large samples.
+ */
+void
+block_sample_report(block_sample * sample, Relation rel)
+{
+	double		n = sample->nchecked;
+	double		z = SAMPLE_CONFIDENCE_Z;
+	double		p,
+				upper;
+
+	if (sample->nchecked == 0)
+	{
+		ereport(NOTICE,
+				(errmsg("relation \"%s\": no blocks sampled",
+						RelationGetRelationName(rel))));
+		return;
+	}
+
+	p = sample->ncorrupted / n;
+
+	upper = (p + z * z / (2 * n) +
+			 z * sqrt(p * (1 - p) / n + z * z / (4 * n * n))) / (1 + z * z / n);
+
+	upper = Min(upper, 1.0);
+
+	ereport(NOTICE,
+			(errmsg("relation \"%s\": %d of %d sampled blocks (of %u) have issues",
+					RelationGetRelationName(rel), sample->ncorrupted,
+					sample->nchecked, sample->nblocks),
+			 errdetail("Estimated %.3f%% of pages corrupted (at most %.3f%%, i.e. %.0f pages, with 95%% confidence).",
+					   100 * p, 100 * upper, ceil(upper * sample->nblocks))));
+}
+
+void
+block_sample_free(block_sample * sample)
+{
+	if (sample == NULL)
+		return;
+
+	pfree(sample->blocks);
+	pfree(sample);
+}
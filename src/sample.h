@@ -0,0 +1,76 @@
+#ifndef SAMPLE_CHECK_H
+#define SAMPLE_CHECK_H
+
+#include "postgres.h"
+#include "storage/block.h"
+#include "utils/rel.h"
+
+/*
+ * Sampling of blocks, for quick checks of large relations. A random subset
+ * of the blocks is selected (using Knuth's Algorithm S, just like ANALYZE
+ * does), in the order of block numbers, so the I/O remains mostly
+ * sequential. Only the sampled blocks are checked, and the number of
+ * pages with issues is then used to estimate the fraction of corrupted
+ * pages in the whole relation.
+ */
+
+/* sample requested by the caller (fraction or number of blocks) */
+typedef struct sample_options
+{
+	double		fraction;		/* fraction of blocks (0 : not set) */
+	int64		nblocks;		/* number of blocks (0 : not set) */
+}			sample_options;
+
+typedef struct block_sample
+{
+	BlockNumber nblocks;		/* blocks in the sampled range */
+	int			nsampled;		/* number of sampled blocks */
+	BlockNumber *blocks;		/* sampled blocks (sorted) */
+	int			next;			/* next block to check */
+	int			nprefetched;	/* blocks prefetched so far */
+	int			nchecked;		/* sampled blocks checked */
+	int			ncorrupted;		/* sampled blocks with issues */
+}			block_sample;
+
+/* Selects a sample of blocks from the range [blockFrom, blockTo).
+ *
+ * - blockFrom : first block of the range
+ * - blockTo : block after the last one
+ * - options : requested sample size (NULL means no sampling)
+ *
+ * Returns the sample, or NULL if the options are NULL.
+ */
+block_sample *block_sample_init(BlockNumber blockFrom, BlockNumber blockTo,
+				  sample_options * options);
+
+/* Returns the next block to check - the next sampled block, or the next
+ * block of the range (without a sample).
+ *
+ * - sample : the sample (may be NULL)
+ * - blkno : the block just checked (or InvalidBlockNumber before the first)
+ * - blockFrom, blockTo : the range
+ *
+ * Returns the block, or blockTo when there are no more blocks.
+ */
+BlockNumber block_sample_next(block_sample * sample, BlockNumber blkno,
+				  BlockNumber blockFrom, BlockNumber blockTo);
+
+/* Counts a checked block, and whether there were any issues. */
+void		block_sample_checked(block_sample * sample, uint32 nerrs);
+
+/* Prefetches the next few sampled blocks.
+ *
+ * - sample : the sample
+ * - rel : the sampled relation
+ * - distance : number of blocks to keep in flight
+ */
+void		block_sample_prefetch(block_sample * sample, Relation rel,
+					  int distance);
+
+/* Reports the estimated rate of corrupted pages (as a NOTICE). */
+void		block_sample_report(block_sample * sample, Relation rel);
+
+/* Releases the sample. */
+void		block_sample_free(block_sample * sample);
+
+#endif							/* SAMPLE_CHECK_H */
@@ -0,0 +1,812 @@
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+#if (PG_VERSION_NUM >= 90600)
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#endif
+
+#include "pg_check.h"
+#include "stats.h"
+
+PG_FUNCTION_INFO_V1(pg_check_stats);
+PG_FUNCTION_INFO_V1(pg_check_stats_issues);
+PG_FUNCTION_INFO_V1(pg_check_stats_reset);
+
+/* number of columns of pg_check_stats() and pg_check_stats_issues() */
+#define STATS_NATTS			11
+#define STATS_ISSUES_NATTS	4
+
+/* check codes are short identifiers (longer ones are truncated) */
+#define STATS_CODE_LEN		32
+
+/* entries of the issues hash table, per relation entry */
+#define STATS_CODES_PER_RELATION	8
+
+/* initial size of the local hash tables of the running check */
+#define STATS_PENDING_RELATIONS	16
+
+static void stats_init_srf(FunctionCallInfo fcinfo, int natts,
+			   Tuplestorestate **tupstore, TupleDesc *tupdesc);
+
+#if (PG_VERSION_NUM >= 90600)
+
+#define STATS_TRANCHE_NAME	"pg_check stats"
+
+typedef struct stats_key
+{
+	Oid			dbid;
+	Oid			relid;
+}			stats_key;
+
+/* counters accumulated by the checks (locally, then in the shared entry) */
+typedef struct stats_counters
+{
+	uint64		pages;			/* pages checked */
+	uint64		issues;			/* issues found */
+	double		io_time;		/* time reading the pages (ms) */
+	double		cpu_time;		/* time checking the pages (ms) */
+	uint64		io_histogram[STATS_HISTOGRAM_BUCKETS];
+	uint64		cpu_histogram[STATS_HISTOGRAM_BUCKETS];
+}			stats_counters;
+
+typedef struct stats_entry
+{
+	stats_key	key;
+	stats_counters counters;
+	TimestampTz last_check;		/* last time the counters were updated */
+	TimestampTz last_full_check;	/* last check of the whole relation */
+	uint64		last_full_check_lsn;	/* WAL position at its start */
+}			stats_entry;
+
+typedef struct stats_issue_key
+{
+	Oid			dbid;
+	Oid			relid;
+	char		code[STATS_CODE_LEN];
+}			stats_issue_key;
+
+typedef struct stats_issue_entry
+{
+	stats_issue_key key;
+	uint64		count;
+}			stats_issue_entry;
+
+/* counters of a relation accumulated by the running check */
+typedef struct stats_pending_entry
+{
+	Oid			relid;			/* hash key */
+	stats_counters counters;
+	bool		full_check;		/* was the whole relation checked? */
+	uint64		full_check_lsn; /* WAL position at the start of the check */
+}			stats_pending_entry;
+
+typedef struct stats_shared
+{
+	LWLock	   *lock;			/* protects both hash tables */
+}			stats_shared;
+
+static stats_shared *stats = NULL;
+static HTAB *stats_relations = NULL;
+static HTAB *stats_issues = NULL;
+
+/*
+ * Counters of the running check, not added to the shared entries yet (per
+ * relation, and per relation and code), and the entry of the relation the
+ * pages and issues currently belong to.
+ */
+static HTAB *pending_relations = NULL;
+static HTAB *pending_issues = NULL;
+static Oid	pending_relid = InvalidOid;
+static stats_counters *pending = NULL;
+
+/* nesting of the running checks, and the subtransaction of the outermost */
+static int	check_depth = 0;
+static SubTransactionId check_subid = InvalidSubTransactionId;
+
+static bool callback_registered = false;
+
+#if (PG_VERSION_NUM >= 150000)
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size stats_shmem_size(void);
+#if (PG_VERSION_NUM >= 150000)
+static void stats_request_hook(void);
+#endif
+static void stats_startup_hook(void);
+static void stats_xact_callback(XactEvent event, void *arg);
+static void stats_subxact_callback(SubXactEvent event,
+					   SubTransactionId mySubid,
+					   SubTransactionId parentSubid, void *arg);
+static void stats_register_callbacks(void);
+static stats_pending_entry *stats_get_pending(Oid relid);
+static void stats_discard(void);
+static stats_entry *stats_get_entry(Oid relid);
+static int	stats_bucket(uint64 usec);
+static Datum stats_histogram_datum(uint64 *histogram);
+
+static Size
+stats_shmem_size(void)
+{
+	Size		size = MAXALIGN(sizeof(stats_shared));
+
+	size = add_size(size, hash_estimate_size(pgcheck_stats_max_relations,
+											 sizeof(stats_entry)));
+	size = add_size(size, hash_estimate_size(pgcheck_stats_max_relations *
+											 STATS_CODES_PER_RELATION,
+											 sizeof(stats_issue_entry)));
+
+	return size;
+}
+
+void
+stats_shmem_request(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if (PG_VERSION_NUM >= 150000)
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = stats_request_hook;
+#else
+	RequestAddinShmemSpace(stats_shmem_size());
+	RequestNamedLWLockTranche(STATS_TRANCHE_NAME, 1);
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = stats_startup_hook;
+}
+
+#if (PG_VERSION_NUM >= 150000)
+static void
+stats_request_hook(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(stats_shmem_size());
+	RequestNamedLWLockTranche(STATS_TRANCHE_NAME, 1);
+}
+#endif
+
+static void
+stats_startup_hook(void)
+{
+	bool		found;
+	HASHCTL		info;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	stats = ShmemInitStruct("pg_check stats", sizeof(stats_shared), &found);
+
+	if (!found)
+		stats->lock = &(GetNamedLWLockTranche(STATS_TRANCHE_NAME))->lock;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(stats_key);
+	info.entrysize = sizeof(stats_entry);
+
+	stats_relations = ShmemInitHash("pg_check stats relations",
+									pgcheck_stats_max_relations,
+									pgcheck_stats_max_relations,
+									&info, HASH_ELEM | HASH_BLOBS);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(stats_issue_key);
+	info.entrysize = sizeof(stats_issue_entry);
+
+	stats_issues = ShmemInitHash("pg_check stats issues",
+								 pgcheck_stats_max_relations * STATS_CODES_PER_RELATION,
+								 pgcheck_stats_max_relations * STATS_CODES_PER_RELATION,
+								 &info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Add the remaining counters at commit (parallel workers don't run whole
+ * checks, so those add the counters of the parts they've checked). The
+ * counters of failed checks are discarded - it's not safe to allocate the
+ * shared entries while aborting.
+ */
+static void
+stats_xact_callback(XactEvent event, void *arg)
+{
+	if ((event == XACT_EVENT_PRE_COMMIT) ||
+		(event == XACT_EVENT_PARALLEL_PRE_COMMIT))
+		stats_flush();
+	else if ((event == XACT_EVENT_ABORT) ||
+			 (event == XACT_EVENT_PARALLEL_ABORT))
+	{
+		stats_discard();
+		check_depth = 0;
+	}
+}
+
+/*
+ * Discard counters of a check that failed in a subtransaction (e.g. in a
+ * savepoint or a plpgsql block with an exception handler). The check may
+ * have started in the aborted subtransaction or in one of its children.
+ */
+static void
+stats_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+					   SubTransactionId parentSubid, void *arg)
+{
+	if ((event == SUBXACT_EVENT_ABORT_SUB) && (check_depth > 0) &&
+		(check_subid >= mySubid))
+	{
+		stats_discard();
+		check_depth = 0;
+	}
+}
+
+static void
+stats_register_callbacks(void)
+{
+	if (callback_registered)
+		return;
+
+	RegisterXactCallback(stats_xact_callback, NULL);
+	RegisterSubXactCallback(stats_subxact_callback, NULL);
+	callback_registered = true;
+}
+
+bool
+stats_enabled(void)
+{
+	return (stats != NULL) && pgcheck_track_stats;
+}
+
+void
+stats_start(void)
+{
+	if (stats == NULL)
+		return;
+
+	stats_register_callbacks();
+
+	if (check_depth++ == 0)
+		check_subid = GetCurrentSubTransactionId();
+}
+
+void
+stats_end(void)
+{
+	if ((stats == NULL) || (check_depth == 0))
+		return;
+
+	if (--check_depth == 0)
+		stats_flush();
+}
+
+void
+stats_set_relation(Oid relid)
+{
+	if (stats == NULL)
+		return;
+
+	stats_register_callbacks();
+
+	if ((relid == pending_relid) && (pending != NULL))
+		return;
+
+	pending = &stats_get_pending(relid)->counters;
+	pending_relid = relid;
+}
+
+void
+stats_add_page(instr_time start, instr_time read, instr_time done)
+{
+	instr_time	io = read;
+	instr_time	cpu = done;
+
+	if (pending == NULL)
+		return;
+
+	INSTR_TIME_SUBTRACT(io, start);
+	INSTR_TIME_SUBTRACT(cpu, read);
+
+	pending->pages++;
+
+	pending->io_time += INSTR_TIME_GET_MILLISEC(io);
+	pending->cpu_time += INSTR_TIME_GET_MILLISEC(cpu);
+
+	pending->io_histogram[stats_bucket(INSTR_TIME_GET_MICROSEC(io))]++;
+	pending->cpu_histogram[stats_bucket(INSTR_TIME_GET_MICROSEC(cpu))]++;
+}
+
+void
+stats_count_issue(const char *code)
+{
+	stats_issue_key key;
+	stats_issue_entry *issue;
+	bool		found;
+
+	if (!stats_enabled() || (pending == NULL))
+		return;
+
+	pending->issues++;
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.relid = pending_relid;
+	strlcpy(key.code, code, STATS_CODE_LEN);
+
+	issue = (stats_issue_entry *) hash_search(pending_issues, &key,
+											  HASH_ENTER, &found);
+
+	if (!found)
+		issue->count = 0;
+
+	issue->count++;
+}
+
+void
+stats_full_check(Oid relid, uint64 lsn)
+{
+	stats_pending_entry *entry;
+
+	if (!stats_enabled())
+		return;
+
+	entry = stats_get_pending(relid);
+
+	entry->full_check = true;
+	entry->full_check_lsn = lsn;
+}
+
+void
+stats_flush(void)
+{
+	HASH_SEQ_STATUS status;
+	stats_pending_entry *pentry;
+	stats_issue_entry *pissue;
+	stats_entry *entry;
+	TimestampTz now;
+	int			j;
+
+	if ((stats == NULL) || (pending_relations == NULL))
+		return;
+
+	now = GetCurrentTimestamp();
+
+	LWLockAcquire(stats->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, pending_relations);
+
+	while ((pentry = (stats_pending_entry *) hash_seq_search(&status)) != NULL)
+	{
+		stats_counters *counters = &pentry->counters;
+
+		if ((counters->pages == 0) && (counters->issues == 0) &&
+			!pentry->full_check)
+			continue;
+
+		if ((entry = stats_get_entry(pentry->relid)) == NULL)
+			continue;
+
+		entry->counters.pages += counters->pages;
+		entry->counters.issues += counters->issues;
+		entry->counters.io_time += counters->io_time;
+		entry->counters.cpu_time += counters->cpu_time;
+
+		for (j = 0; j < STATS_HISTOGRAM_BUCKETS; j++)
+		{
+			entry->counters.io_histogram[j] += counters->io_histogram[j];
+			entry->counters.cpu_histogram[j] += counters->cpu_histogram[j];
+		}
+
+		entry->last_check = now;
+
+		if (pentry->full_check)
+		{
+			entry->last_full_check = now;
+			entry->last_full_check_lsn = pentry->full_check_lsn;
+		}
+	}
+
+	hash_seq_init(&status, pending_issues);
+
+	while ((pissue = (stats_issue_entry *) hash_seq_search(&status)) != NULL)
+	{
+		stats_issue_entry *issue;
+		bool		found;
+
+		issue = (stats_issue_entry *) hash_search(stats_issues, &pissue->key,
+												  HASH_FIND, &found);
+
+		/* when full, new codes are not tracked (the total is) */
+		if ((issue == NULL) &&
+			(hash_get_num_entries(stats_issues) <
+			 pgcheck_stats_max_relations * STATS_CODES_PER_RELATION))
+		{
+			issue = (stats_issue_entry *) hash_search(stats_issues,
+													  &pissue->key,
+													  HASH_ENTER_NULL, &found);
+			if (issue != NULL)
+				issue->count = 0;
+		}
+
+		if (issue != NULL)
+			issue->count += pissue->count;
+	}
+
+	LWLockRelease(stats->lock);
+
+	stats_discard();
+}
+
+/*
+ * Local entry of the relation for the running check (a new one, if there's
+ * none yet). The local hash tables are created on the first use, and
+ * destroyed once the counters are added to the shared entries (or
+ * discarded).
+ */
+static stats_pending_entry *
+stats_get_pending(Oid relid)
+{
+	stats_pending_entry *entry;
+	bool		found;
+
+	if (pending_relations == NULL)
+	{
+		HASHCTL		info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(Oid);
+		info.entrysize = sizeof(stats_pending_entry);
+
+		pending_relations = hash_create("pg_check pending stats",
+										STATS_PENDING_RELATIONS, &info,
+										HASH_ELEM | HASH_BLOBS);
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(stats_issue_key);
+		info.entrysize = sizeof(stats_issue_entry);
+
+		pending_issues = hash_create("pg_check pending stats issues",
+									 STATS_PENDING_RELATIONS * STATS_CODES_PER_RELATION,
+									 &info, HASH_ELEM | HASH_BLOBS);
+	}
+
+	entry = (stats_pending_entry *) hash_search(pending_relations, &relid,
+												HASH_ENTER, &found);
+
+	if (!found)
+	{
+		memset(&entry->counters, 0, sizeof(stats_counters));
+		entry->full_check = false;
+		entry->full_check_lsn = 0;
+	}
+
+	return entry;
+}
+
+/* forget the counters of the running check */
+static void
+stats_discard(void)
+{
+	if (pending_relations != NULL)
+	{
+		hash_destroy(pending_relations);
+		hash_destroy(pending_issues);
+	}
+
+	pending_relations = NULL;
+	pending_issues = NULL;
+	pending_relid = InvalidOid;
+	pending = NULL;
+}
+
+/*
+ * Entry of the relation (a new one, if there's none yet). When the table
+ * is full, relations not tracked yet are ignored. Has to be called with
+ * the lock held in exclusive mode.
+ */
+static stats_entry *
+stats_get_entry(Oid relid)
+{
+	stats_key	key;
+	stats_entry *entry;
+	bool		found;
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+
+	entry = (stats_entry *) hash_search(stats_relations, &key, HASH_FIND,
+										&found);
+
+	if ((entry != NULL) ||
+		(hash_get_num_entries(stats_relations) >= pgcheck_stats_max_relations))
+		return entry;
+
+	entry = (stats_entry *) hash_search(stats_relations, &key,
+										HASH_ENTER_NULL, &found);
+
+	if (entry != NULL)
+	{
+		memset(&entry->counters, 0, sizeof(stats_counters));
+		entry->last_check = 0;
+		entry->last_full_check = 0;
+		entry->last_full_check_lsn = 0;
+	}
+
+	return entry;
+}
+
+/*
+ * Bucket of the histograms - the first one is under 1us, bucket i covers
+ * [2^(i-1), 2^i) microseconds, and the last one all the longer times.
+ */
+static int
+stats_bucket(uint64 usec)
+{
+	int			bucket = 0;
+
+	while ((usec > 0) && (bucket < STATS_HISTOGRAM_BUCKETS - 1))
+	{
+		usec >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+static Datum
+stats_histogram_datum(uint64 *histogram)
+{
+	Datum		values[STATS_HISTOGRAM_BUCKETS];
+	int			i;
+
+	for (i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+		values[i] = Int64GetDatum((int64) histogram[i]);
+
+	return PointerGetDatum(construct_array(values, STATS_HISTOGRAM_BUCKETS,
+										   INT8OID, sizeof(int64),
+										   FLOAT8PASSBYVAL, 'd'));
+}
+
+#else							/* PG_VERSION_NUM < 90600 */
+
+/* no shared memory requests by extensions, so no statistics */
+
+void
+stats_shmem_request(void)
+{
+}
+
+void
+stats_start(void)
+{
+}
+
+void
+stats_end(void)
+{
+}
+
+void
+stats_set_relation(Oid relid)
+{
+}
+
+bool
+stats_enabled(void)
+{
+	return false;
+}
+
+void
+stats_add_page(instr_time start, instr_time read, instr_time done)
+{
+}
+
+void
+stats_count_issue(const char *code)
+{
+}
+
+void
+stats_full_check(Oid relid, uint64 lsn)
+{
+}
+
+void
+stats_flush(void)
+{
+}
+
+#endif
+
+/*
+ * pg_check_stats
+ *
+ * Returns the statistics of all the relations (used by pg_check_stats).
+ */
+Datum
+pg_check_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+
+	stats_init_srf(fcinfo, STATS_NATTS, &tupstore, &tupdesc);
+
+#if (PG_VERSION_NUM >= 90600)
+	if (stats != NULL)
+	{
+		HASH_SEQ_STATUS status;
+		stats_entry *entry;
+
+		LWLockAcquire(stats->lock, LW_SHARED);
+
+		hash_seq_init(&status, stats_relations);
+
+		while ((entry = (stats_entry *) hash_seq_search(&status)) != NULL)
+		{
+			Datum		values[STATS_NATTS];
+			bool		nulls[STATS_NATTS];
+
+			memset(nulls, 0, sizeof(nulls));
+
+			values[0] = ObjectIdGetDatum(entry->key.dbid);
+			values[1] = ObjectIdGetDatum(entry->key.relid);
+			values[2] = Int64GetDatum((int64) entry->counters.pages);
+			values[3] = Int64GetDatum((int64) entry->counters.issues);
+			values[4] = Float8GetDatum(entry->counters.io_time);
+			values[5] = Float8GetDatum(entry->counters.cpu_time);
+			values[6] = stats_histogram_datum(entry->counters.io_histogram);
+			values[7] = stats_histogram_datum(entry->counters.cpu_histogram);
+			values[8] = TimestampTzGetDatum(entry->last_check);
+			values[9] = TimestampTzGetDatum(entry->last_full_check);
+			values[10] = CStringGetTextDatum(psprintf("%X/%X",
+													  (uint32) (entry->last_full_check_lsn >> 32),
+													  (uint32) entry->last_full_check_lsn));
+
+			nulls[8] = (entry->last_check == 0);
+			nulls[9] = (entry->last_full_check == 0);
+			nulls[10] = (entry->last_full_check == 0);
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+
+		LWLockRelease(stats->lock);
+	}
+#endif
+
+	return (Datum) 0;
+}
+
+/*
+ * pg_check_stats_issues
+ *
+ * Returns the number of issues found in each relation, per check code
+ * (used by pg_check_stats_issues).
+ */
+Datum
+pg_check_stats_issues(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+
+	stats_init_srf(fcinfo, STATS_ISSUES_NATTS, &tupstore, &tupdesc);
+
+#if (PG_VERSION_NUM >= 90600)
+	if (stats != NULL)
+	{
+		HASH_SEQ_STATUS status;
+		stats_issue_entry *entry;
+
+		LWLockAcquire(stats->lock, LW_SHARED);
+
+		hash_seq_init(&status, stats_issues);
+
+		while ((entry = (stats_issue_entry *) hash_seq_search(&status)) != NULL)
+		{
+			Datum		values[STATS_ISSUES_NATTS];
+			bool		nulls[STATS_ISSUES_NATTS];
+
+			memset(nulls, 0, sizeof(nulls));
+
+			values[0] = ObjectIdGetDatum(entry->key.dbid);
+			values[1] = ObjectIdGetDatum(entry->key.relid);
+			values[2] = CStringGetTextDatum(entry->key.code);
+			values[3] = Int64GetDatum((int64) entry->count);
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+
+		LWLockRelease(stats->lock);
+	}
+#endif
+
+	return (Datum) 0;
+}
+
+/*
+ * pg_check_stats_reset
+ *
+ * Discards the statistics of all the relations.
+ */
+Datum
+pg_check_stats_reset(PG_FUNCTION_ARGS)
+{
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to use pg_check functions"))));
+
+#if (PG_VERSION_NUM >= 90600)
+	if (stats != NULL)
+	{
+		HASH_SEQ_STATUS status;
+		stats_entry *entry;
+		stats_issue_entry *issue;
+
+		LWLockAcquire(stats->lock, LW_EXCLUSIVE);
+
+		hash_seq_init(&status, stats_relations);
+		while ((entry = (stats_entry *) hash_seq_search(&status)) != NULL)
+			hash_search(stats_relations, &entry->key, HASH_REMOVE, NULL);
+
+		hash_seq_init(&status, stats_issues);
+		while ((issue = (stats_issue_entry *) hash_seq_search(&status)) != NULL)
+			hash_search(stats_issues, &issue->key, HASH_REMOVE, NULL);
+
+		LWLockRelease(stats->lock);
+	}
+#endif
+
+	PG_RETURN_VOID();
+}
+
+/* prepares the result of a set-returning function (materialize mode) */
+static void
+stats_init_srf(FunctionCallInfo fcinfo, int natts,
+			   Tuplestorestate **tupstore, TupleDesc *tupdesc)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext oldcontext;
+
+	if ((rsinfo == NULL) || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if ((*tupdesc)->natts != natts)
+		elog(ERROR, "incorrect number of output arguments");
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	*tupdesc = CreateTupleDescCopy(*tupdesc);
+	*tupstore = tuplestore_begin_heap(true, false, work_mem);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = *tupstore;
+	rsinfo->setDesc = *tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+}
@@ -0,0 +1,82 @@
+#ifndef STATS_CHECK_H
+#define STATS_CHECK_H
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "portability/instr_time.h"
+
+/*
+ * Cumulative statistics of the checks, per relation, kept in shared memory
+ * and exposed by the pg_check_stats and pg_check_stats_issues views. Just
+ * like the progress reporting, this requires loading the library using
+ * shared_preload_libraries (9.6+), otherwise nothing is collected.
+ *
+ * The page loops measure time of each page split into the time spent
+ * reading the page (I/O wait, including the cost-based delay) and the
+ * time spent checking it (CPU), and add it to histograms with buckets
+ * doubling in size (the first one is under 1us, the last one everything
+ * over 16ms). The counters are accumulated locally, and added to the
+ * shared entries when the (outermost) check is done, so the checks don't
+ * contend on the lock. Parallel workers add the counters of the parts they
+ * checked at the end of their transaction. Counters of checks failing with
+ * an error are discarded, including checks failing in a subtransaction.
+ *
+ * The stats are not persisted, i.e. are lost on restart.
+ */
+
+/* buckets of the per-page time histograms */
+#define STATS_HISTOGRAM_BUCKETS		16
+
+/* Requests the shared memory (called from _PG_init). */
+void		stats_shmem_request(void);
+
+/* Starts collecting counters of a check (nested calls are allowed, only
+ * the outermost one does anything). */
+void		stats_start(void);
+
+/* Adds the counters collected by the check to the shared entries (in the
+ * outermost check). */
+void		stats_end(void);
+
+/* Sets relation the following pages and issues belong to.
+ *
+ * - relid : relation being checked
+ */
+void		stats_set_relation(Oid relid);
+
+/* Is the timing of pages enabled (pg_check.track_stats, shared memory)? */
+bool		stats_enabled(void);
+
+/* Adds a checked page, with the time spent reading it and checking it.
+ *
+ * - start : before reading the page
+ * - read : after reading the page (before the checks)
+ * - done : after the checks
+ */
+void		stats_add_page(instr_time start, instr_time read, instr_time done);
+
+/* Counts an issue with the check code (of the current relation). */
+void		stats_count_issue(const char *code);
+
+/* Records a check of the whole relation (the last full check, once the
+ * counters of the check are added).
+ *
+ * - relid : the relation checked
+ * - lsn : WAL position at the start of the check
+ */
+void		stats_full_check(Oid relid, uint64 lsn);
+
+/* Adds the counters accumulated by this process to the shared entries
+ * (at the end of the check, or of the transaction in parallel workers). */
+void		stats_flush(void);
+
+/* Returns rows of the pg_check_stats view. */
+Datum		pg_check_stats(PG_FUNCTION_ARGS);
+
+/* Returns rows of the pg_check_stats_issues view. */
+Datum		pg_check_stats_issues(PG_FUNCTION_ARGS);
+
+/* Discards all the statistics. */
+Datum		pg_check_stats_reset(PG_FUNCTION_ARGS);
+
+#endif							/* STATS_CHECK_H */
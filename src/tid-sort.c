@@ -0,0 +1,332 @@
+#include "postgres.h"
+
+#include "access/htup.h"
+#if (PG_VERSION_NUM >= 90300)
+#include "access/htup_details.h"
+#endif
+#include "catalog/pg_operator.h"
+#include "catalog/pg_type.h"
+#include "miscadmin.h"
+#include "utils/guc.h"
+#include "utils/rel.h"
+
+#include "diff.h"
+#include "issues.h"
+#include "item-bitmap.h"
+#include "tid-sort.h"
+
+/* TIDs packed into 48 bits (block, offset), sorting the same as the TIDs */
+#define TID_PACK(block, offset)		(((int64) (block) << 16) | (offset))
+#define TID_BLOCK(tid)				((BlockNumber) ((tid) >> 16))
+#define TID_OFFSET(tid)				((OffsetNumber) ((tid) & 0xFFFF))
+
+static void tid_merge_sort(tid_merge * merge);
+static void tid_sort_fetch(tid_sort * sort);
+static uint32 tid_sort_merge_page(tid_sort * sort, BlockNumber block,
+					int ntuples, bool *add, bool *ignore, bool corrupted);
+
+tid_merge *
+tid_merge_init(int maxindexes, TransactionId horizon, TransactionId frozenxid,
+			   BlockNumber blockFrom, BlockNumber blockTo, bool blockRange)
+{
+	tid_merge  *merge = (tid_merge *) palloc0(sizeof(tid_merge));
+
+	merge->maxindexes = maxindexes;
+	merge->indexes = (tid_sort *) palloc0(Max(1, maxindexes) * sizeof(tid_sort));
+	merge->horizon = horizon;
+	merge->frozenxid = frozenxid;
+	merge->blockFrom = blockFrom;
+	merge->blockTo = blockTo;
+	merge->blockRange = blockRange;
+
+	return merge;
+}
+
+tid_sort *
+tid_merge_add_index(tid_merge * merge, Relation index, Size nbytes)
+{
+	tid_sort   *sort;
+	int			workMem = Max(64, (int) Min(nbytes / 1024, (Size) MAX_KILOBYTES));
+
+	Assert(merge->nindexes < merge->maxindexes);
+	Assert(!merge->sorted);
+
+	sort = &merge->indexes[merge->nindexes++];
+
+	sort->indexid = RelationGetRelid(index);
+	sort->name = pstrdup(RelationGetRelationName(index));
+
+	/* the packed TIDs are sorted as int8 values */
+#if (PG_VERSION_NUM >= 150000)
+	sort->sortstate = tuplesort_begin_datum(INT8OID, Int8LessOperator,
+											InvalidOid, false, workMem,
+											NULL, TUPLESORT_NONE);
+#elif (PG_VERSION_NUM >= 110000)
+	sort->sortstate = tuplesort_begin_datum(INT8OID, Int8LessOperator,
+											InvalidOid, false, workMem,
+											NULL, false);
+#else
+	sort->sortstate = tuplesort_begin_datum(INT8OID, Int8LessOperator,
+											InvalidOid, false, workMem,
+											false);
+#endif
+
+	return sort;
+}
+
+void
+tid_sort_add(tid_sort * sort, ItemPointer tid)
+{
+	/* the TID may be corrupted, so don't use the asserting macros */
+	int64		packed = TID_PACK(BlockIdGetBlockNumber(&tid->ip_blkid),
+								  tid->ip_posid);
+
+	tuplesort_putdatum(sort->sortstate, Int64GetDatum(packed), false);
+
+	sort->ntids++;
+}
+
+uint32
+tid_merge_heap_page(tid_merge * merge, PageHeader header, char *raw_page,
+					BlockNumber block, bool corrupted)
+{
+	uint32		ndiffs = 0;
+	int			ntuples = 0;
+	bool		add[MaxHeapTuplesPerPage];
+	bool		ignore[MaxHeapTuplesPerPage];
+	int			i;
+
+	tid_merge_sort(merge);
+
+	/*
+	 * Line pointers and tuples of corrupted pages can't be trusted, so the
+	 * index entries pointing to those pages are just skipped.
+	 */
+	if (!corrupted)
+	{
+		ntuples = Min(PageGetMaxOffsetNumber(raw_page), MaxHeapTuplesPerPage);
+
+		heap_page_indexed_items(header, raw_page, merge->horizon,
+								merge->frozenxid, add, ignore);
+	}
+
+	for (i = 0; i < merge->nindexes; i++)
+		ndiffs += tid_sort_merge_page(&merge->indexes[i], block, ntuples,
+									  add, ignore, corrupted);
+
+	return ndiffs;
+}
+
+/*
+ * TIDs after the last page either point to pages not checked (when
+ * checking a block range), to pages added after the check started (which
+ * only happens in snapshot mode, and the tuples are not settled), or to
+ * pages that don't exist.
+ */
+uint32
+tid_merge_finish(tid_merge * merge)
+{
+	uint32		nerrs = 0;
+	bool		expected = (merge->blockRange ||
+							TransactionIdIsValid(merge->horizon));
+	int			i;
+
+	tid_merge_sort(merge);
+
+	for (i = 0; i < merge->nindexes; i++)
+	{
+		tid_sort   *sort = &merge->indexes[i];
+
+		for (; sort->has_next && !expected; tid_sort_fetch(sort))
+		{
+			sort->ndiffs++;
+			nerrs++;
+
+			if (pgcheck_diff != NULL)
+			{
+				diff_add(pgcheck_diff, sort->indexid, TID_BLOCK(sort->next),
+						 TID_OFFSET(sort->next), InvalidOffsetNumber,
+						 DIFF_MISSING_IN_HEAP);
+				continue;
+			}
+
+			report_issue("index_mismatch", TID_BLOCK(sort->next),
+						 TID_OFFSET(sort->next),
+						 "index \"%s\" entry [%u,%u] points after the end of the table",
+						 sort->name, TID_BLOCK(sort->next),
+						 TID_OFFSET(sort->next));
+		}
+
+		ereport(DEBUG1,
+				(errmsg("index \"%s\": " UINT64_FORMAT " entries, " UINT64_FORMAT " differences",
+						sort->name, sort->ntids, sort->ndiffs)));
+
+		if (sort->nunconfirmed != 0)
+			ereport(NOTICE,
+					(errmsg("index \"%s\": " UINT64_FORMAT " items not found or duplicate, possibly moved by concurrent page splits (not counted as differences)",
+							sort->name, sort->nunconfirmed)));
+
+		if (sort->ndiffs != 0)
+			report_issue("index_differences", InvalidBlockNumber, 0,
+						 "there are " UINT64_FORMAT " differences between the table and the index \"%s\"",
+						 sort->ndiffs, sort->name);
+
+		tuplesort_end(sort->sortstate);
+		pfree(sort->name);
+	}
+
+	pfree(merge->indexes);
+	pfree(merge);
+
+	return nerrs;
+}
+
+/*
+ * Complete the input of the sorts (before merging the first heap page),
+ * and skip the TIDs pointing before the checked range.
+ */
+static void
+tid_merge_sort(tid_merge * merge)
+{
+	int			i;
+
+	if (merge->sorted)
+		return;
+
+	for (i = 0; i < merge->nindexes; i++)
+	{
+		tid_sort   *sort = &merge->indexes[i];
+
+		tuplesort_performsort(sort->sortstate);
+
+		tid_sort_fetch(sort);
+
+		while (sort->has_next && (TID_BLOCK(sort->next) < merge->blockFrom))
+			tid_sort_fetch(sort);
+	}
+
+	merge->sorted = true;
+}
+
+/* read the next TID from the sorted stream */
+static void
+tid_sort_fetch(tid_sort * sort)
+{
+	Datum		value;
+	bool		isnull;
+
+#if (PG_VERSION_NUM >= 150000)
+	sort->has_next = tuplesort_getdatum(sort->sortstate, true, false,
+										&value, &isnull, NULL);
+#elif (PG_VERSION_NUM >= 100000)
+	sort->has_next = tuplesort_getdatum(sort->sortstate, true,
+										&value, &isnull, NULL);
+#else
+	sort->has_next = tuplesort_getdatum(sort->sortstate, true,
+										&value, &isnull);
+#endif
+
+	if (sort->has_next)
+		sort->next = DatumGetInt64(value);
+}
+
+/*
+ * Merge the TIDs of the index pointing to the heap page with the items
+ * expected on the page. The TIDs are sorted, so the TIDs of the page are
+ * the next ones in the stream. Duplicate TIDs are adjacent.
+ *
+ * In snapshot mode, concurrent page splits may move index entries to pages
+ * the index scan already passed (or had not reached yet). If the index scan
+ * observed such splits, items missing in the index (or duplicate entries)
+ * are only counted as unconfirmed.
+ */
+static uint32
+tid_sort_merge_page(tid_sort * sort, BlockNumber block, int ntuples,
+					bool *add, bool *ignore, bool corrupted)
+{
+	uint32		ndiffs = 0;
+	bool		found[MaxHeapTuplesPerPage];
+	int64		prev = -1;
+	int			item;
+
+	memset(found, 0, sizeof(found));
+
+	for (; sort->has_next && (TID_BLOCK(sort->next) == block); tid_sort_fetch(sort))
+	{
+		OffsetNumber offnum = TID_OFFSET(sort->next);
+
+		if (corrupted)
+			continue;
+
+		/* we should not have two index items pointing to the same tuple */
+		if ((sort->next == prev) && sort->duplicated)
+		{
+			sort->nunconfirmed++;
+			continue;
+		}
+		else if (sort->next == prev)
+		{
+			report_issue("index_duplicate", block, offnum,
+						 "index \"%s\" has multiple entries pointing to [%u,%u]",
+						 sort->name, block, offnum);
+			ndiffs++;
+			continue;
+		}
+
+		prev = sort->next;
+
+		if ((offnum < FirstOffsetNumber) || (offnum > MaxHeapTuplesPerPage))
+		{
+			ndiffs++;
+
+			if (pgcheck_diff != NULL)
+				diff_add(pgcheck_diff, sort->indexid, block, offnum, ntuples,
+						 DIFF_MISSING_IN_HEAP);
+			else
+				report_issue("index_mismatch", block, offnum,
+							 "index \"%s\" entry [%u,%u] has invalid offset",
+							 sort->name, block, offnum);
+			continue;
+		}
+
+		found[offnum - 1] = true;
+	}
+
+	if (corrupted)
+		return ndiffs;
+
+	for (item = 0; item < MaxHeapTuplesPerPage; item++)
+	{
+		bool		expected = (item < ntuples) && add[item];
+
+		if ((expected == found[item]) || ignore[item])
+			continue;
+
+		if (expected && sort->hidden)
+		{
+			ereport(DEBUG1,
+					(errmsg("item [%u,%d] not found in index \"%s\", possibly moved by a concurrent page split",
+							block, (item + 1), sort->name)));
+			sort->nunconfirmed++;
+			continue;
+		}
+
+		ndiffs++;
+
+		if (pgcheck_diff != NULL)
+			diff_add(pgcheck_diff, sort->indexid, block, (item + 1), ntuples,
+					 (expected) ? DIFF_MISSING_IN_INDEX : DIFF_MISSING_IN_HEAP);
+		else if (expected)
+			report_issue("index_mismatch", block, (item + 1),
+						 "item [%u,%d] missing in index \"%s\"",
+						 block, (item + 1), sort->name);
+		else
+			report_issue("index_mismatch", block, (item + 1),
+						 "item [%u,%d] only in index \"%s\"",
+						 block, (item + 1), sort->name);
+	}
+
+	sort->ndiffs += ndiffs;
+
+	return ndiffs;
+}
@@ -0,0 +1,104 @@
+#ifndef TID_SORT_CHECK_H
+#define TID_SORT_CHECK_H
+
+#include "postgres.h"
+#include "storage/bufpage.h"
+#include "storage/itemptr.h"
+#include "utils/tuplesort.h"
+
+/*
+ * Cross-check of the table and indexes using sorted TIDs, requiring only
+ * a limited amount of memory (pg_check.cross_check_memory) for any size
+ * of the table.
+ *
+ * The index check feeds TIDs of the index tuples into a tuplesort (packed
+ * into 48-bit integers, so sorting them is cheap), which spills sorted
+ * runs to temporary files when exceeding the memory. The heap pass then
+ * reads the pages in physical order, i.e. in the order of the TIDs, and
+ * merges the items expected in the indexes with the sorted TIDs of each
+ * index. That also allows cross-checking only a range of heap blocks -
+ * TIDs pointing outside the range are simply skipped.
+ */
+
+/* sorted TIDs of one index */
+typedef struct tid_sort
+{
+	Oid			indexid;		/* the index */
+	char	   *name;			/* name of the index (for messages) */
+	Tuplesortstate *sortstate;	/* TIDs of the index tuples */
+	uint64		ntids;			/* TIDs added */
+	bool		has_next;		/* is next valid? (false at the end) */
+	int64		next;			/* next TID from the sorted stream */
+	uint64		ndiffs;			/* differences found */
+	bool		hidden;			/* concurrent splits may have hidden TIDs */
+	bool		duplicated;		/* ... or added them twice */
+	uint64		nunconfirmed;	/* missing/duplicate, but may be due to the
+								 * splits (not counted) */
+}			tid_sort;
+
+/* state of the heap pass, merging the TIDs of all the indexes */
+typedef struct tid_merge
+{
+	int			nindexes;
+	int			maxindexes;
+	tid_sort   *indexes;
+	TransactionId horizon;		/* snapshot mode (InvalidTransactionId if not) */
+	TransactionId frozenxid;	/* relfrozenxid of the heap relation */
+	BlockNumber blockFrom;		/* range of blocks cross-checked */
+	BlockNumber blockTo;
+	bool		blockRange;		/* only a range of the table is checked */
+	bool		sorted;			/* input of the sorts completed */
+}			tid_merge;
+
+/* Allocates state of the heap pass, for up to maxindexes indexes.
+ *
+ * - maxindexes : number of indexes to cross-check
+ * - horizon : only settled tuples are compared in snapshot mode
+ * - frozenxid : relfrozenxid of the heap relation (bounds the clog lookups)
+ * - blockFrom, blockTo : range of heap blocks cross-checked
+ * - blockRange : the range is not the whole table (TIDs pointing after
+ *                the range are expected)
+ *
+ * Returns the allocated state.
+ */
+tid_merge  *tid_merge_init(int maxindexes, TransactionId horizon,
+			   TransactionId frozenxid, BlockNumber blockFrom,
+			   BlockNumber blockTo, bool blockRange);
+
+/* Registers an index with the merge, and starts a sort for its TIDs.
+ *
+ * - merge : state of the heap pass
+ * - index : the index (already locked by the caller)
+ * - nbytes : memory for the sort (spills to temporary files when more)
+ *
+ * Returns the sort to be populated by the index check (tid_sort_add).
+ */
+tid_sort   *tid_merge_add_index(tid_merge * merge, Relation index, Size nbytes);
+
+/* Adds TID of an index tuple to the sort. */
+void		tid_sort_add(tid_sort * sort, ItemPointer tid);
+
+/* Merges items of a heap page with the TIDs of all the indexes.
+ *
+ * - merge : state of the heap pass
+ * - header : page header
+ * - raw_page : raw page data
+ * - block : number of the page
+ * - corrupted : the page has issues (skip the TIDs without comparing)
+ *
+ * Pages have to be merged in the order of block numbers, without gaps.
+ *
+ * Returns number of differences (items missing in an index, or index
+ * entries not matching any item).
+ */
+uint32		tid_merge_heap_page(tid_merge * merge, PageHeader header,
+					char *raw_page, BlockNumber block, bool corrupted);
+
+/* Checks the TIDs remaining after the last heap page, reports the
+ * differences for each index, and releases the state (incl. the sorts).
+ *
+ * Returns number of differences not returned by tid_merge_heap_page.
+ */
+uint32		tid_merge_finish(tid_merge * merge);
+
+#endif							/* TID_SORT_CHECK_H */
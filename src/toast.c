@@ -0,0 +1,530 @@
+#include "postgres.h"
+
+#include "access/htup.h"
+#if (PG_VERSION_NUM >= 90300)
+#include "access/htup_details.h"
+#endif
+#if (PG_VERSION_NUM >= 130000)
+#include "access/detoast.h"
+#include "access/heaptoast.h"
+#else
+#include "access/tuptoaster.h"
+#endif
+#include "access/transam.h"
+#include "miscadmin.h"
+#include "utils/rel.h"
+#if (PG_VERSION_NUM >= 160000)
+#include "varatt.h"
+#endif
+
+#include "issues.h"
+#include "item-bitmap.h"
+#include "pg_check.h"
+#include "reader.h"
+#include "toast.h"
+
+/* initial size of the buffer (grown up to the limit) */
+#define TOAST_INITIAL_REFS		1024
+
+/* pointers that fit on a heap page (at most) */
+#define TOAST_PAGE_REFS			(BLCKSZ / TOAST_POINTER_SIZE)
+
+#if (PG_VERSION_NUM >= 140000)
+#define TOAST_POINTER_EXTSIZE(ptr)	VARATT_EXTERNAL_GET_EXTSIZE(ptr)
+#else
+#define TOAST_POINTER_EXTSIZE(ptr)	((ptr).va_extsize)
+#endif
+
+static uint32 toast_check_verify(toast_check * toast);
+static bool toast_scan_chunks(toast_check * toast, bool direct);
+static bool toast_ref_complete(toast_ref * ref);
+static void toast_check_chunks(toast_check * toast, PageHeader header,
+				   char *buffer, TupleDesc tupdesc, BlockNumber block);
+static bool toast_chunk_committed(HeapTupleHeader htup,
+					  TransactionId frozenxid);
+static int	toast_ref_cmp(const void *a, const void *b);
+static int	toast_ref_find(const void *key, const void *elem);
+
+toast_check *
+toast_check_init(Relation rel, BufferAccessStrategy strategy,
+				 TransactionId horizon, Size nbytes)
+{
+	toast_check *toast;
+
+	if (!OidIsValid(rel->rd_rel->reltoastrelid))
+		return NULL;
+
+	Assert(TransactionIdIsValid(horizon));
+
+	toast = (toast_check *) palloc0(sizeof(toast_check));
+
+	toast->rel = rel;
+	toast->toastrelid = rel->rd_rel->reltoastrelid;
+	toast->horizon = horizon;
+	toast->frozenxid = rel->rd_rel->relfrozenxid;
+	toast->strategy = strategy;
+
+	nbytes = Min(nbytes, MaxAllocSize);
+	toast->maxrefs = Max(TOAST_INITIAL_REFS, nbytes / sizeof(toast_ref));
+	toast->maxrefs = Max(toast->maxrefs, 2 * TOAST_PAGE_REFS);
+
+	return toast;
+}
+
+uint32
+toast_check_add(toast_check * toast, HeapTupleHeader htup, char *attr,
+				BlockNumber block, OffsetNumber offnum)
+{
+	struct varatt_external pointer;
+	toast_ref  *ref;
+	int32		extsize;
+	uint32		nerrs = 0;
+
+	/* the datum may not be aligned */
+	VARATT_EXTERNAL_GET_POINTER(pointer, attr);
+
+	extsize = TOAST_POINTER_EXTSIZE(pointer);
+
+	if (pointer.va_toastrelid != toast->toastrelid)
+	{
+		report_issue("toast_relid", block, offnum,
+					 "[%u:%u] TOAST pointer references relation %u (expected %u)",
+					 block, offnum, pointer.va_toastrelid, toast->toastrelid);
+		return ++nerrs;
+	}
+
+	/* compressed values are smaller than the raw size */
+	if ((pointer.va_rawsize < VARHDRSZ) || (extsize < 0) ||
+		(extsize > pointer.va_rawsize - VARHDRSZ))
+	{
+		report_issue("toast_pointer_size", block, offnum,
+					 "[%u:%u] TOAST pointer to value %u has invalid sizes (raw %d, external %d)",
+					 block, offnum, pointer.va_valueid, pointer.va_rawsize,
+					 extsize);
+		return ++nerrs;
+	}
+
+	/* the chunks of values not settled may be removed at any moment */
+	if (!heap_tuple_is_settled(htup, toast->horizon, toast->frozenxid))
+		return nerrs;
+
+	if (toast->nrefs == toast->maxrefs)
+		nerrs += toast_check_verify(toast);
+
+	/* grow the buffer up to the limit */
+	if (toast->nrefs == toast->nalloc)
+	{
+		toast->nalloc = (toast->nalloc == 0) ? TOAST_INITIAL_REFS : 2 * toast->nalloc;
+		toast->nalloc = Min(toast->nalloc, toast->maxrefs);
+
+		if (toast->refs == NULL)
+			toast->refs = (toast_ref *) palloc(sizeof(toast_ref) * toast->nalloc);
+		else
+			toast->refs = (toast_ref *) repalloc(toast->refs,
+												 sizeof(toast_ref) * toast->nalloc);
+	}
+
+	ref = &toast->refs[toast->nrefs++];
+
+	ref->valueid = pointer.va_valueid;
+	ref->rawsize = pointer.va_rawsize;
+	ref->extsize = extsize;
+	ref->block = block;
+	ref->offnum = offnum;
+
+	return nerrs;
+}
+
+uint32
+toast_check_mark(toast_check * toast)
+{
+	uint32		nerrs = 0;
+
+	if (toast == NULL)
+		return nerrs;
+
+	if (toast->maxrefs - toast->nrefs < TOAST_PAGE_REFS)
+		nerrs += toast_check_verify(toast);
+
+	toast->mark = toast->nrefs;
+	toast->markpasses = toast->npasses;
+
+	return nerrs;
+}
+
+/*
+ * The buffer only fills up in the middle of a page with more pointers than
+ * a page can fit (i.e. with overlapping tuples), in which case all the
+ * pointers still in the buffer come from the page.
+ */
+void
+toast_check_rollback(toast_check * toast)
+{
+	if (toast == NULL)
+		return;
+
+	if (toast->npasses == toast->markpasses)
+		toast->nrefs = toast->mark;
+	else
+		toast->nrefs = 0;
+}
+
+uint32
+toast_check_finish(toast_check * toast)
+{
+	uint32		nerrs = 0;
+
+	if (toast == NULL)
+		return nerrs;
+
+	if (toast->nrefs > 0)
+		nerrs += toast_check_verify(toast);
+
+	if (toast->refs)
+		pfree(toast->refs);
+
+	pfree(toast);
+
+	return nerrs;
+}
+
+/*
+ * Verifies the collected pointers, in one sequential scan of the TOAST
+ * relation. The chunks are stored in the order of inserts, not by value
+ * ID, so instead of merging two sorted streams the pointers are sorted
+ * (and deduplicated - updates not modifying the value keep the pointer)
+ * and each chunk looks up its pointer using a binary search.
+ */
+static uint32
+toast_check_verify(toast_check * toast)
+{
+	uint32		nerrs = 0;
+	uint64		nchunks = 0;
+	int			nvalues;
+	int			i,
+				n;
+	bool		quiet = pgcheck_issues_quiet;
+
+	/*
+	 * The buffer may fill up while checking a page quietly, but the issues
+	 * with pointers collected from the previous pages are still reported.
+	 */
+	pgcheck_issues_quiet = false;
+
+	qsort(toast->refs, toast->nrefs, sizeof(toast_ref), toast_ref_cmp);
+
+	/* keep the first pointer to each value, the others have to match it */
+	for (i = 0, n = 0; i < toast->nrefs; i++)
+	{
+		toast_ref  *ref = &toast->refs[i];
+
+		if ((n > 0) && (toast->refs[n - 1].valueid == ref->valueid))
+		{
+			toast_ref  *prev = &toast->refs[n - 1];
+
+			if ((prev->rawsize != ref->rawsize) ||
+				(prev->extsize != ref->extsize))
+			{
+				report_issue("toast_pointer_mismatch", ref->block, ref->offnum,
+							 "[%u:%u] TOAST pointer to value %u does not match the pointer in [%u:%u]",
+							 ref->block, ref->offnum, ref->valueid,
+							 prev->block, prev->offnum);
+				++nerrs;
+			}
+
+			continue;
+		}
+
+		toast->refs[n++] = *ref;
+	}
+
+	toast->nrefs = n;
+	nvalues = n;
+
+	/*
+	 * Pages read from the file may be torn or stale (see reader_read), in
+	 * which case some chunks may be missing. So if any values look broken,
+	 * scan the TOAST relation again (just for those values) through the
+	 * buffer manager, and report only what's broken in the second scan.
+	 */
+	if (toast_scan_chunks(toast, pgcheck_direct_read))
+	{
+		for (i = 0, n = 0; i < toast->nrefs; i++)
+		{
+			if (toast_ref_complete(&toast->refs[i]))
+			{
+				nchunks += toast->refs[i].nchunks;
+				continue;
+			}
+
+			toast->refs[n++] = toast->refs[i];
+		}
+
+		toast->nrefs = n;
+
+		if (n > 0)
+			(void) toast_scan_chunks(toast, false);
+	}
+
+	/* now compare the chunks found to the pointers */
+	for (i = 0; i < toast->nrefs; i++)
+	{
+		toast_ref  *ref = &toast->refs[i];
+		uint64		expected = ((uint64) ref->extsize + TOAST_MAX_CHUNK_SIZE - 1) /
+		TOAST_MAX_CHUNK_SIZE;
+
+		nchunks += ref->nchunks;
+
+		if (ref->nchunks == 0)
+		{
+			report_issue("toast_value_missing", ref->block, ref->offnum,
+						 "[%u:%u] TOAST value %u not found in the TOAST relation",
+						 ref->block, ref->offnum, ref->valueid);
+			++nerrs;
+		}
+		else if ((ref->nchunks != expected) ||
+				 (ref->seqsum != expected * (expected - 1) / 2))
+		{
+			report_issue("toast_chunk_count", ref->block, ref->offnum,
+						 "[%u:%u] TOAST value %u has %u chunks (expected " UINT64_FORMAT ")",
+						 ref->block, ref->offnum, ref->valueid, ref->nchunks,
+						 expected);
+			++nerrs;
+		}
+		else if (ref->badsize || (ref->nbytes != (uint64) ref->extsize))
+		{
+			report_issue("toast_chunk_size", ref->block, ref->offnum,
+						 "[%u:%u] TOAST value %u has " UINT64_FORMAT " bytes in chunks (expected %d)",
+						 ref->block, ref->offnum, ref->valueid, ref->nbytes,
+						 ref->extsize);
+			++nerrs;
+		}
+	}
+
+	toast->npasses++;
+
+	ereport(DEBUG1,
+			(errmsg("verified %d TOAST values in " UINT64_FORMAT " chunks (scan %u of the TOAST relation)",
+					nvalues, nchunks, toast->npasses)));
+
+	toast->nrefs = 0;
+
+	pgcheck_issues_quiet = quiet;
+
+	return nerrs;
+}
+
+/*
+ * Scans the TOAST relation, matching the chunks to the (sorted) pointers.
+ *
+ * Returns true if any pages were read directly from the file.
+ */
+static bool
+toast_scan_chunks(toast_check * toast, bool direct)
+{
+	Relation	toastrel;
+	page_reader *reader;
+	BlockNumber nblocks;
+	BlockNumber blkno;
+	bool		from_file = false;
+	int			i;
+
+	for (i = 0; i < toast->nrefs; i++)
+	{
+		toast_ref  *ref = &toast->refs[i];
+
+		ref->badsize = false;
+		ref->nchunks = 0;
+		ref->nbytes = 0;
+		ref->seqsum = 0;
+	}
+
+	toastrel = relation_open(toast->toastrelid, AccessShareLock);
+
+	toast->toastfrozenxid = toastrel->rd_rel->relfrozenxid;
+
+	reader = reader_init(toastrel, toast->strategy, direct);
+
+	nblocks = RelationGetNumberOfBlocks(toastrel);
+
+	for (blkno = 0; blkno < nblocks; blkno++)
+	{
+		char	   *raw_page = reader_read(reader, blkno, nblocks);
+
+		from_file |= reader->from_file;
+
+		toast_check_chunks(toast, (PageHeader) raw_page, raw_page,
+						   RelationGetDescr(toastrel), blkno);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	reader_free(reader);
+
+	relation_close(toastrel, AccessShareLock);
+
+	return from_file;
+}
+
+/* were all the chunks of the value found (with the expected sizes)? */
+static bool
+toast_ref_complete(toast_ref * ref)
+{
+	uint64		expected = ((uint64) ref->extsize + TOAST_MAX_CHUNK_SIZE - 1) /
+	TOAST_MAX_CHUNK_SIZE;
+
+	return (ref->nchunks == expected) &&
+		(ref->seqsum == expected * (expected - 1) / 2) &&
+		!ref->badsize && (ref->nbytes == (uint64) ref->extsize);
+}
+
+/*
+ * Matches chunks on a page of the TOAST relation to the pointers. Pages
+ * and tuples that look broken are skipped - those are issues of the TOAST
+ * relation itself (reported when checking it), here they only result in
+ * missing chunks.
+ */
+static void
+toast_check_chunks(toast_check * toast, PageHeader header, char *buffer,
+				   TupleDesc tupdesc, BlockNumber block)
+{
+	int			ntuples,
+				i;
+
+	if (PageIsNew(buffer) ||
+		(header->pd_lower < SizeOfPageHeaderData) ||
+		(header->pd_lower > header->pd_upper) ||
+		(header->pd_upper > header->pd_special) ||
+		(header->pd_special > BLCKSZ))
+		return;
+
+	ntuples = PageGetMaxOffsetNumber(buffer);
+
+	for (i = 0; i < ntuples; i++)
+	{
+		ItemId		lp = &header->pd_linp[i];
+		HeapTupleHeader htup;
+		HeapTupleData tuple;
+		Datum		values[3];
+		bool		isnull[3];
+		toast_ref  *ref;
+		Oid			valueid;
+		int32		seq;
+		char	   *chunk;
+		int32		size;
+		uint64		expected;
+
+		if (!ItemIdIsNormal(lp) ||
+			(lp->lp_off + lp->lp_len > BLCKSZ) ||
+			(lp->lp_len < SizeofHeapTupleHeader))
+			continue;
+
+		htup = (HeapTupleHeader) (buffer + lp->lp_off);
+
+		/* there has to be at least the chunk_id, chunk_seq and a varlena */
+		if ((HeapTupleHeaderGetNatts(htup) != tupdesc->natts) ||
+			(htup->t_hoff + 2 * sizeof(int32) + 1 > lp->lp_len) ||
+			(htup->t_infomask & HEAP_HASNULL))
+			continue;
+
+		/* quick check of the value ID, before deforming the tuple */
+		memcpy(&valueid, buffer + lp->lp_off + htup->t_hoff, sizeof(Oid));
+
+		ref = (toast_ref *) bsearch(&valueid, toast->refs, toast->nrefs,
+									sizeof(toast_ref), toast_ref_find);
+
+		if ((ref == NULL) || !toast_chunk_committed(htup, toast->toastfrozenxid))
+			continue;
+
+		tuple.t_data = htup;
+		tuple.t_len = lp->lp_len;
+		tuple.t_tableOid = toast->toastrelid;
+		ItemPointerSet(&tuple.t_self, block, (i + 1));
+
+		heap_deform_tuple(&tuple, tupdesc, values, isnull);
+
+		seq = DatumGetInt32(values[1]);
+		chunk = DatumGetPointer(values[2]);
+
+		/* the chunk has to fit into the tuple */
+		if ((chunk + VARSIZE_ANY(chunk) > buffer + lp->lp_off + lp->lp_len) ||
+			VARATT_IS_EXTERNAL(chunk) || VARATT_IS_COMPRESSED(chunk))
+			continue;
+
+		size = VARSIZE_ANY_EXHDR(chunk);
+
+		ref->nchunks++;
+		ref->nbytes += size;
+		ref->seqsum += (uint32) seq;
+
+		/* all chunks but the last one are full */
+		expected = ((uint64) ref->extsize + TOAST_MAX_CHUNK_SIZE - 1) /
+			TOAST_MAX_CHUNK_SIZE;
+
+		if ((seq < 0) || ((uint64) seq >= expected))
+			continue;
+		else if (((uint64) seq < expected - 1) && (size != TOAST_MAX_CHUNK_SIZE))
+			ref->badsize = true;
+		else if (((uint64) seq == expected - 1) &&
+				 (size != ref->extsize - seq * TOAST_MAX_CHUNK_SIZE))
+			ref->badsize = true;
+	}
+}
+
+/*
+ * Was the chunk inserted by a committed transaction? Chunks inserted by
+ * aborted transactions (e.g. a failed insert retried later) are ignored.
+ * Chunks of the settled values can't be deleted by a transaction older
+ * than the horizon, so we don't need to look at xmax. Chunks with xmin
+ * outside the clog are corrupted, so we don't look those up.
+ */
+static bool
+toast_chunk_committed(HeapTupleHeader htup, TransactionId frozenxid)
+{
+	TransactionId xmin = HeapTupleHeaderGetXmin(htup);
+
+	if (HeapTupleHeaderXminFrozen(htup) || !TransactionIdIsNormal(xmin))
+		return true;
+
+	if (htup->t_infomask & HEAP_XMIN_COMMITTED)
+		return true;
+
+	if (htup->t_infomask & HEAP_XMIN_INVALID)
+		return false;
+
+	if (!xid_in_clog_range(xmin, frozenxid))
+		return false;
+
+	return TransactionIdDidCommit(xmin);
+}
+
+/* sort by value ID, and then by the location of the heap tuple */
+static int
+toast_ref_cmp(const void *a, const void *b)
+{
+	const toast_ref *ra = (const toast_ref *) a;
+	const toast_ref *rb = (const toast_ref *) b;
+
+	if (ra->valueid != rb->valueid)
+		return (ra->valueid < rb->valueid) ? -1 : 1;
+
+	if (ra->block != rb->block)
+		return (ra->block < rb->block) ? -1 : 1;
+
+	if (ra->offnum != rb->offnum)
+		return (ra->offnum < rb->offnum) ? -1 : 1;
+
+	return 0;
+}
+
+static int
+toast_ref_find(const void *key, const void *elem)
+{
+	Oid			valueid = *(const Oid *) key;
+	const toast_ref *ref = (const toast_ref *) elem;
+
+	if (valueid != ref->valueid)
+		return (valueid < ref->valueid) ? -1 : 1;
+
+	return 0;
+}
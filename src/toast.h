@@ -0,0 +1,116 @@
+#ifndef TOAST_CHECK_H
+#define TOAST_CHECK_H
+
+#include "postgres.h"
+#include "access/htup.h"
+#include "storage/bufmgr.h"
+#include "utils/rel.h"
+
+#ifndef VARATT_IS_EXTERNAL_ONDISK
+#define VARATT_IS_EXTERNAL_ONDISK(PTR)	VARATT_IS_EXTERNAL(PTR)
+#endif
+
+/*
+ * Verification of TOAST pointers against the TOAST relation.
+ *
+ * The heap pass only collects the pointers (value ID, sizes, and the heap
+ * tuple referencing the value) into a buffer, and the TOAST relation is
+ * then read sequentially, matching each chunk to the (sorted) pointers.
+ * That checks the values are complete - the number of chunks, the chunk
+ * sequence numbers and sizes match the pointer - without fetching the
+ * values through the TOAST index (i.e. random I/O for each value).
+ *
+ * The buffer is limited by pg_check.toast_memory. When it fills up, the
+ * collected pointers are verified and the buffer is reset, so each
+ * batch means one scan of the TOAST relation.
+ *
+ * Only pointers from tuples settled with respect to the horizon (xmin of
+ * the active snapshot) are verified, as the chunks of other values may
+ * be removed by vacuum at any moment.
+ */
+typedef struct toast_ref
+{
+	Oid			valueid;		/* chunk_id of the value */
+	int32		rawsize;		/* original size of the value (incl. header) */
+	int32		extsize;		/* stored size of the value (chunks) */
+	BlockNumber block;			/* heap tuple referencing the value */
+	OffsetNumber offnum;
+	bool		badsize;		/* some chunk had unexpected size */
+	uint32		nchunks;		/* chunks found in the TOAST relation */
+	uint64		nbytes;			/* bytes in the chunks found */
+	uint64		seqsum;			/* sum of the chunk_seq values found */
+}			toast_ref;
+
+typedef struct toast_check
+{
+	Relation	rel;			/* the heap relation */
+	Oid			toastrelid;		/* its TOAST relation */
+	TransactionId horizon;		/* only verify settled tuples */
+	TransactionId frozenxid;	/* relfrozenxid of the heap relation */
+	TransactionId toastfrozenxid;	/* relfrozenxid of the TOAST relation */
+	BufferAccessStrategy strategy;	/* used to read the TOAST relation */
+
+	int			nrefs;			/* pointers collected so far */
+	int			nalloc;			/* pointers allocated */
+	int			maxrefs;		/* limit of the buffer */
+	toast_ref  *refs;
+
+	uint32		npasses;		/* scans of the TOAST relation done */
+
+	int			mark;			/* pointers collected before the page */
+	uint32		markpasses;		/* scans done before the page */
+}			toast_check;
+
+/* Prepares verification of the TOAST pointers of a relation.
+ *
+ * - rel : the heap relation (locked by the caller)
+ * - strategy : buffer access strategy used to read the TOAST relation
+ * - horizon : xmin of the active snapshot
+ * - nbytes : memory for the pointers collected between the scans
+ *
+ * Returns the state, or NULL if the relation has no TOAST relation.
+ */
+toast_check *toast_check_init(Relation rel, BufferAccessStrategy strategy,
+				 TransactionId horizon, Size nbytes);
+
+/* Adds a TOAST pointer found in the heap pass (called by the tuple checks).
+ *
+ * - toast : verification state
+ * - htup : the heap tuple with the pointer
+ * - attr : the TOAST pointer (external on-disk datum, possibly unaligned)
+ * - block, offnum : location of the heap tuple
+ *
+ * Verifies the pointer itself right away, and the collected pointers when
+ * the buffer is full.
+ *
+ * Returns number of issues found.
+ */
+uint32		toast_check_add(toast_check * toast, HeapTupleHeader htup,
+				char *attr, BlockNumber block, OffsetNumber offnum);
+
+/* Marks the start of a heap page, so that pointers collected from the page
+ * may be discarded (when the page is checked again, see check_heap_range).
+ *
+ * - toast : verification state (may be NULL)
+ *
+ * Verifies the collected pointers first, unless there's enough space for
+ * all pointers a page may contain (so the page is not split between two
+ * scans of the TOAST relation).
+ *
+ * Returns number of issues found.
+ */
+uint32		toast_check_mark(toast_check * toast);
+
+/* Discards pointers collected since the last toast_check_mark.
+ *
+ * - toast : verification state (may be NULL)
+ */
+void		toast_check_rollback(toast_check * toast);
+
+/* Verifies the remaining pointers, and releases the state.
+ *
+ * Returns number of issues found.
+ */
+uint32		toast_check_finish(toast_check * toast);
+
+#endif							/* TOAST_CHECK_H */
@@ -0,0 +1,176 @@
+#include "postgres.h"
+
+#include "access/htup.h"
+#if (PG_VERSION_NUM >= 90300)
+#include "access/htup_details.h"
+#endif
+#include "access/transam.h"
+#include "storage/freespace.h"
+
+#include "common.h"
+#include "issues.h"
+#include "item-bitmap.h"
+#include "reader.h"
+#include "visibility.h"
+
+/*
+ * Difference between the free space recorded in the free space map and
+ * the actual free space, considered "way off". Smaller differences are
+ * possible after a crash (the free space map is not WAL-logged).
+ */
+#define FREE_SPACE_TOLERANCE	(BLCKSZ / 4)
+
+static bool xmin_committed(Relation rel, HeapTupleHeader htup);
+static bool xmax_committed(Relation rel, HeapTupleHeader htup);
+
+uint32
+check_heap_visibility(Relation rel, PageHeader header, char *buffer,
+					  BlockNumber block, uint8 vmstatus)
+{
+	uint32		nerrs = 0;
+	int			ntuples,
+				i;
+	bool		all_visible = (vmstatus & VISIBILITYMAP_ALL_VISIBLE);
+	bool		all_frozen = (vmstatus & VISIBILITYMAP_ALL_FROZEN);
+
+	if (PageIsNew(buffer))
+		return nerrs;
+
+	if (all_frozen && !all_visible)
+	{
+		report_issue("vm_frozen_not_visible", block, 0,
+					 "[%u] visibility map marks the page as all-frozen, but not all-visible",
+					 block);
+		++nerrs;
+	}
+
+	if (all_visible && !PageIsAllVisible(buffer))
+	{
+		report_issue("vm_page_not_all_visible", block, 0,
+					 "[%u] visibility map marks the page as all-visible, but the page is not",
+					 block);
+		++nerrs;
+	}
+
+	/* nothing to check about the tuples (or not checking them) */
+	if ((!all_visible && !all_frozen && !PageIsAllVisible(buffer)) ||
+		(check_level < CHECK_LEVEL_LINE_POINTERS))
+		return nerrs;
+
+	ntuples = PageGetMaxOffsetNumber(buffer);
+
+	for (i = 0; i < ntuples; i++)
+	{
+		ItemId		lp = &header->pd_linp[i];
+		HeapTupleHeader htup;
+
+		if (ItemIdIsDead(lp))
+		{
+			report_issue("vm_dead_item", block, (i + 1),
+						 "[%u:%u] page is all-visible, but the line pointer is dead",
+						 block, (i + 1));
+			++nerrs;
+			continue;
+		}
+
+		if (!ItemIdIsNormal(lp) || (check_level < CHECK_LEVEL_TUPLES))
+			continue;
+
+		htup = (HeapTupleHeader) (buffer + lp->lp_off);
+
+		if (!xmin_committed(rel, htup) || xmax_committed(rel, htup))
+		{
+			report_issue("vm_tuple_not_visible", block, (i + 1),
+						 "[%u:%u] page is all-visible, but the tuple is not visible to all transactions",
+						 block, (i + 1));
+			++nerrs;
+		}
+		else if (all_frozen &&
+				 ((TransactionIdIsNormal(HeapTupleHeaderGetRawXmin(htup)) &&
+				   !HeapTupleHeaderXminFrozen(htup)) ||
+				  !(htup->t_infomask & HEAP_XMAX_INVALID)))
+		{
+			report_issue("vm_tuple_not_frozen", block, (i + 1),
+						 "[%u:%u] page is all-frozen, but the tuple is not frozen (xmin %u, xmax %u)",
+						 block, (i + 1), HeapTupleHeaderGetRawXmin(htup),
+						 HeapTupleHeaderGetRawXmax(htup));
+			++nerrs;
+		}
+	}
+
+	return nerrs;
+}
+
+uint32
+check_heap_free_space(Relation rel, char *buffer, BlockNumber block,
+					  uint8 vmstatus)
+{
+	Size		recorded;
+	Size		actual;
+
+	if (!(vmstatus & VISIBILITYMAP_ALL_VISIBLE) || PageIsNew(buffer))
+		return 0;
+
+	recorded = GetRecordedFreeSpace(rel, block);
+	actual = PageGetHeapFreeSpace((Page) buffer);
+
+	if (recorded <= actual + FREE_SPACE_TOLERANCE)
+		return 0;
+
+	report_issue("fsm_free_space", block, 0,
+				 "[%u] free space map records %u bytes free, but the page has only %u bytes free",
+				 block, (uint32) recorded, (uint32) actual);
+
+	return 1;
+}
+
+/*
+ * Was the tuple inserted by a committed transaction? We're looking at a
+ * copy of the page, so the hint bits are not set, and we have to look at
+ * the clog. Transactions older than relfrozenxid may be truncated from the
+ * clog already, but tuples inserted by those have to be frozen anyway (and
+ * XIDs after the next XID can only come from corrupted tuples).
+ */
+static bool
+xmin_committed(Relation rel, HeapTupleHeader htup)
+{
+	TransactionId xmin = HeapTupleHeaderGetRawXmin(htup);
+
+	if (HeapTupleHeaderXminFrozen(htup) || !TransactionIdIsNormal(xmin))
+		return true;
+
+	if (htup->t_infomask & HEAP_XMIN_COMMITTED)
+		return true;
+
+	if (htup->t_infomask & HEAP_XMIN_INVALID)
+		return false;
+
+	if (!xid_in_clog_range(xmin, rel->rd_rel->relfrozenxid))
+		return false;
+
+	return TransactionIdDidCommit(xmin);
+}
+
+/*
+ * Was the tuple deleted (or updated) by a committed transaction? Locks
+ * don't make the tuple invisible, and we don't look into multixacts.
+ */
+static bool
+xmax_committed(Relation rel, HeapTupleHeader htup)
+{
+	TransactionId xmax = HeapTupleHeaderGetRawXmax(htup);
+
+	if ((htup->t_infomask & HEAP_XMAX_INVALID) ||
+		HEAP_XMAX_IS_LOCKED_ONLY(htup->t_infomask) ||
+		(htup->t_infomask & HEAP_XMAX_IS_MULTI) ||
+		!TransactionIdIsNormal(xmax))
+		return false;
+
+	if (htup->t_infomask & HEAP_XMAX_COMMITTED)
+		return true;
+
+	if (!xid_in_clog_range(xmax, rel->rd_rel->relfrozenxid))
+		return false;
+
+	return TransactionIdDidCommit(xmax);
+}
@@ -0,0 +1,51 @@
+#ifndef VISIBILITY_CHECK_H
+#define VISIBILITY_CHECK_H
+
+#include "postgres.h"
+#include "storage/bufpage.h"
+#include "utils/rel.h"
+
+/*
+ * Verification of the visibility map and free space map against the heap
+ * pages, while the page is in memory for the other checks. The status of
+ * the page in the visibility map is read by the page reader, while holding
+ * the lock on the heap buffer (the bits can't change without an exclusive
+ * lock on the heap page), see reader_track_vm.
+ */
+
+/* Checks the heap page matches the visibility map bits.
+ *
+ * - rel : the heap relation
+ * - header, buffer : the page
+ * - block : block number of the page
+ * - vmstatus : the visibility map bits of the page
+ *
+ * A page marked as all-visible (in the visibility map or the page header)
+ * must not contain tuples that may be invisible to some transactions, or
+ * dead line pointers. On all-frozen pages, all tuples have to be frozen.
+ * The line pointers and tuples are only checked at the corresponding
+ * check_level, so the cheap levels only compare the page bits.
+ *
+ * Returns number of issues found.
+ */
+uint32		check_heap_visibility(Relation rel, PageHeader header, char *buffer,
+					  BlockNumber block, uint8 vmstatus);
+
+/* Checks the free space map does not overstate the free space on the page.
+ *
+ * - rel : the heap relation
+ * - buffer : the page
+ * - block : block number of the page
+ * - vmstatus : the visibility map bits of the page
+ *
+ * The free space map is updated lazily (after inserts it may record more
+ * free space than there is), but pages marked as all-visible were not
+ * modified since vacuum recorded the free space. So this only checks the
+ * all-visible pages, and reports values way off.
+ *
+ * Returns number of issues found.
+ */
+uint32		check_heap_free_space(Relation rel, char *buffer, BlockNumber block,
+					  uint8 vmstatus);
+
+#endif							/* VISIBILITY_CHECK_H */
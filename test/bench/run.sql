@@ -0,0 +1,28 @@
+--
+-- Benchmarks the checks on the tables created by setup.sql, e.g.
+--
+--     psql -v label=before -v runs=5 -f test/bench/run.sql
+--
+-- and prints throughput of each phase (heap-only, index-only, cross-check
+-- with dense and compressed bitmaps). The results are kept, so runs with
+-- different labels may be compared using pg_check_bench.compare().
+--
+
+\set ON_ERROR_STOP on
+\if :{?label}
+\else
+\set label `date +%Y%m%d%H%M%S`
+\endif
+\if :{?runs}
+\else
+\set runs 3
+\endif
+
+SET client_min_messages = warning;
+
+SELECT pg_check_bench.run(:'label', :runs);
+
+SELECT relation, phase, bitmap_type, pages, mb, seconds, pages_per_sec, mb_per_sec, bitmap_kb
+  FROM pg_check_bench.report
+ WHERE label = :'label'
+ ORDER BY relation, phase, bitmap_type;
@@ -0,0 +1,226 @@
+--
+-- Tables of controlled shapes for the benchmarks (see run.sql). The
+-- number of rows is multiplied by the "scale" variable, e.g.
+--
+--     psql -v scale=10 -f test/bench/setup.sql
+--
+-- With scale=1 the tables take about 250MB in total (including indexes).
+--
+
+\set ON_ERROR_STOP on
+\if :{?scale}
+\else
+\set scale 1
+\endif
+
+SET client_min_messages = warning;
+
+CREATE EXTENSION IF NOT EXISTS pg_check;
+
+DROP SCHEMA IF EXISTS pg_check_bench CASCADE;
+CREATE SCHEMA pg_check_bench;
+
+-- narrow rows (many tuples per page)
+CREATE TABLE pg_check_bench.narrow (id int, val int);
+
+INSERT INTO pg_check_bench.narrow
+SELECT i, i % 1000 FROM generate_series(1, 2000000 * :scale) s(i);
+
+CREATE INDEX ON pg_check_bench.narrow (id);
+
+-- wide rows (many fixed-width attributes, a few varlenas and NULLs)
+CREATE TABLE pg_check_bench.wide (
+    id int, c1 bigint, c2 bigint, c3 bigint, c4 bigint, c5 int, c6 int,
+    c7 int, c8 int, c9 float8, c10 float8, c11 timestamp, c12 timestamp,
+    c13 date, c14 date, c15 bool, c16 bool, c17 text, c18 text, c19 text,
+    c20 numeric);
+
+INSERT INTO pg_check_bench.wide
+SELECT i, i, i * 2, i * 3, i * 4, i % 10, i % 100, i % 1000, i % 10000,
+       i / 3.0, i / 7.0, now() - i * interval '1 second', now(),
+       current_date - (i % 1000), current_date, i % 2 = 0, true,
+       md5(i::text), 'x', CASE WHEN i % 10 = 0 THEN NULL ELSE repeat('y', i % 50) END,
+       i * 1.5
+  FROM generate_series(1, 400000 * :scale) s(i);
+
+CREATE INDEX ON pg_check_bench.wide (id);
+
+-- heavy HOT chains (updates of a non-indexed column, with free space)
+CREATE TABLE pg_check_bench.hot (id int PRIMARY KEY, counter int, pad text)
+  WITH (fillfactor = 50, autovacuum_enabled = false);
+
+INSERT INTO pg_check_bench.hot
+SELECT i, 0, repeat('z', 20) FROM generate_series(1, 400000 * :scale) s(i);
+
+UPDATE pg_check_bench.hot SET counter = counter + 1;
+UPDATE pg_check_bench.hot SET counter = counter + 1;
+UPDATE pg_check_bench.hot SET counter = counter + 1;
+UPDATE pg_check_bench.hot SET counter = counter + 1;
+
+-- many indexes
+CREATE TABLE pg_check_bench.indexes (a int, b int, c int, d int, e int, f int, g int, h int);
+
+INSERT INTO pg_check_bench.indexes
+SELECT i, i % 7, i % 101, i % 1009, -i, i * 2, (i * 7919) % 100003, i / 10
+  FROM generate_series(1, 500000 * :scale) s(i);
+
+CREATE INDEX ON pg_check_bench.indexes (a);
+CREATE INDEX ON pg_check_bench.indexes (b);
+CREATE INDEX ON pg_check_bench.indexes (c);
+CREATE INDEX ON pg_check_bench.indexes (d);
+CREATE INDEX ON pg_check_bench.indexes (e);
+CREATE INDEX ON pg_check_bench.indexes (f);
+CREATE INDEX ON pg_check_bench.indexes (g);
+CREATE INDEX ON pg_check_bench.indexes (h, a);
+
+-- TOAST-heavy (uncompressed values, stored out of line)
+CREATE TABLE pg_check_bench.toast (id int, doc text);
+ALTER TABLE pg_check_bench.toast ALTER COLUMN doc SET STORAGE EXTERNAL;
+
+INSERT INTO pg_check_bench.toast
+SELECT i, repeat(md5(i::text), 128) FROM generate_series(1, 50000 * :scale) s(i);
+
+CREATE INDEX ON pg_check_bench.toast (id);
+
+-- the relations to benchmark (including the TOAST table, heap only)
+CREATE TABLE pg_check_bench.targets (relation regclass, with_indexes bool);
+
+INSERT INTO pg_check_bench.targets VALUES
+    ('pg_check_bench.narrow', true),
+    ('pg_check_bench.wide', true),
+    ('pg_check_bench.hot', true),
+    ('pg_check_bench.indexes', true),
+    ('pg_check_bench.toast', true);
+
+INSERT INTO pg_check_bench.targets
+SELECT reltoastrelid::regclass, false FROM pg_class
+ WHERE oid = 'pg_check_bench.toast'::regclass;
+
+-- results of the runs (one row per relation / phase / bitmap type)
+CREATE TABLE pg_check_bench.results (
+    label           text,
+    relation        text,
+    phase           text,
+    bitmap_type     text,
+    pages           bigint,
+    bytes           bigint,
+    seconds         float8,
+    bitmap_memory   bigint,
+    created_at      timestamptz DEFAULT now()
+);
+
+--
+-- Runs a phase of the check on the relation, and returns the duration of
+-- the fastest of the runs (after one run warming up the cache).
+--
+CREATE FUNCTION pg_check_bench.time_phase(p_relation regclass, p_phase text, p_runs int)
+RETURNS float8 AS $$
+DECLARE
+    v_best  float8;
+    v_start timestamptz;
+    v_index regclass;
+    i       int;
+BEGIN
+    FOR i IN 0 .. p_runs LOOP
+        v_start := clock_timestamp();
+
+        IF p_phase = 'heap' THEN
+            PERFORM pg_check_table(p_relation, false, false);
+        ELSIF p_phase = 'index' THEN
+            FOR v_index IN SELECT indexrelid FROM pg_index WHERE indrelid = p_relation LOOP
+                PERFORM pg_check_index(v_index);
+            END LOOP;
+        ELSIF p_phase = 'cross' THEN
+            PERFORM pg_check_table(p_relation, true, true);
+        ELSE
+            RAISE EXCEPTION 'unknown phase "%"', p_phase;
+        END IF;
+
+        IF i > 0 THEN
+            v_best := least(v_best, extract(epoch FROM clock_timestamp() - v_start));
+        END IF;
+    END LOOP;
+
+    RETURN v_best;
+END;
+$$ LANGUAGE plpgsql;
+
+--
+-- Benchmarks all the phases on all the targets, and stores the results
+-- under the label. The cross-check is done with both bitmap types.
+--
+CREATE FUNCTION pg_check_bench.run(p_label text, p_runs int DEFAULT 3)
+RETURNS void AS $$
+DECLARE
+    v_target        record;
+    v_heap_bytes    bigint;
+    v_index_bytes   bigint;
+    v_seconds       float8;
+    v_type          text;
+BEGIN
+    FOR v_target IN SELECT * FROM pg_check_bench.targets LOOP
+        v_heap_bytes := pg_relation_size(v_target.relation);
+        v_index_bytes := coalesce((SELECT sum(pg_relation_size(indexrelid)) FROM pg_index
+                                    WHERE indrelid = v_target.relation), 0);
+
+        v_seconds := pg_check_bench.time_phase(v_target.relation, 'heap', p_runs);
+
+        INSERT INTO pg_check_bench.results (label, relation, phase, pages, bytes, seconds)
+        VALUES (p_label, v_target.relation::text, 'heap',
+                v_heap_bytes / current_setting('block_size')::int, v_heap_bytes, v_seconds);
+
+        CONTINUE WHEN NOT v_target.with_indexes;
+
+        v_seconds := pg_check_bench.time_phase(v_target.relation, 'index', p_runs);
+
+        INSERT INTO pg_check_bench.results (label, relation, phase, pages, bytes, seconds)
+        VALUES (p_label, v_target.relation::text, 'index',
+                v_index_bytes / current_setting('block_size')::int, v_index_bytes, v_seconds);
+
+        FOREACH v_type IN ARRAY ARRAY['dense', 'compressed'] LOOP
+            PERFORM set_config('pg_check.bitmap_type', v_type, true);
+
+            v_seconds := pg_check_bench.time_phase(v_target.relation, 'cross', p_runs);
+
+            INSERT INTO pg_check_bench.results (label, relation, phase, bitmap_type, pages, bytes, seconds, bitmap_memory)
+            VALUES (p_label, v_target.relation::text, 'cross', v_type,
+                    (v_heap_bytes + v_index_bytes) / current_setting('block_size')::int,
+                    v_heap_bytes + v_index_bytes, v_seconds, pg_check_bitmap_memory());
+        END LOOP;
+
+        PERFORM set_config('pg_check.bitmap_type', 'dense', true);
+    END LOOP;
+END;
+$$ LANGUAGE plpgsql;
+
+-- throughput of the runs
+CREATE VIEW pg_check_bench.report AS
+SELECT label, relation, phase, bitmap_type, pages,
+       round(bytes / 1048576.0, 1) AS mb,
+       round(seconds::numeric, 3) AS seconds,
+       round((pages / nullif(seconds, 0))::numeric) AS pages_per_sec,
+       round((bytes / 1048576.0 / nullif(seconds, 0))::numeric, 1) AS mb_per_sec,
+       round(bitmap_memory / 1024.0) AS bitmap_kb
+  FROM pg_check_bench.results;
+
+--
+-- Compares throughput of two labels (e.g. before and after a change), the
+-- ratio is above 1.0 when the current run is faster.
+--
+CREATE FUNCTION pg_check_bench.compare(p_baseline text, p_current text)
+RETURNS TABLE (relation text, phase text, bitmap_type text,
+               baseline_mb_per_sec numeric, current_mb_per_sec numeric,
+               ratio numeric, baseline_bitmap_kb numeric, current_bitmap_kb numeric) AS $$
+    SELECT b.relation, b.phase, b.bitmap_type, b.mb_per_sec, c.mb_per_sec,
+           round(c.mb_per_sec / nullif(b.mb_per_sec, 0), 2), b.bitmap_kb, c.bitmap_kb
+      FROM pg_check_bench.report b
+      JOIN pg_check_bench.report c
+        ON (b.relation = c.relation AND b.phase = c.phase AND
+            b.bitmap_type IS NOT DISTINCT FROM c.bitmap_type)
+     WHERE b.label = p_baseline AND c.label = p_current
+     ORDER BY 1, 2, 3;
+$$ LANGUAGE sql;
+
+VACUUM ANALYZE pg_check_bench.narrow, pg_check_bench.wide, pg_check_bench.indexes, pg_check_bench.toast;
+ANALYZE pg_check_bench.hot;
+CHECKPOINT;
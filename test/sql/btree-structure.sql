@@ -0,0 +1,68 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+\ir include/corrupt.sql
+
+-- verify the structure of the b-tree indexes
+SET pg_check.verify_btree_structure = on;
+
+CREATE TABLE test_table (
+    id      BIGINT PRIMARY KEY,
+    val_a   VARCHAR(10),
+    val_b   CHAR(10)
+);
+
+INSERT INTO test_table SELECT i, substr(md5(i::text), 0, floor(random()*10)::int), NULL FROM generate_series(1,100000) s(i);
+
+CREATE INDEX test_table_a_index ON test_table (val_a);
+CREATE INDEX test_table_b_index ON test_table (val_b);
+CREATE INDEX test_table_ab_index ON test_table (val_a, val_b);
+
+SELECT pg_check_index('test_table_pkey');
+SELECT pg_check_index('test_table_a_index');
+SELECT pg_check_table('test_table', true, false);
+SELECT pg_check_table('test_table', true, true);
+
+-- page splits of an index built by inserts
+CREATE TABLE test_table_2 (
+    id      INT
+);
+
+CREATE INDEX test_table_2_index ON test_table_2 (id);
+
+INSERT INTO test_table_2 SELECT MOD(i * 7919, 100000) FROM generate_series(1,100000) s(i);
+
+SELECT pg_check_index('test_table_2_index');
+
+-- deleted items
+DELETE FROM test_table WHERE MOD(id, 2) = 0;
+
+SELECT pg_check_table('test_table', true, true);
+
+-- a copy of an index with a damaged left sibling link of the second leaf
+-- page (block 2, the root is allocated after it), written into the file of
+-- a new index (not in shared buffers yet)
+CREATE TABLE test_table_3 (
+    id      INT
+);
+
+INSERT INTO test_table_3 SELECT i FROM generate_series(1,10000) s(i);
+
+CREATE INDEX test_table_3_index ON test_table_3 (id);
+
+CREATE TABLE test_table_4 (LIKE test_table_3);
+
+CREATE INDEX test_table_4_index ON test_table_4 (id);
+
+SELECT pg_temp.corrupt_copy('test_table_3_index', 'test_table_4_index', ARRAY[[2 * 8192 + 8176, 0, 232], [2 * 8192 + 8177, 0, 3]]);
+
+SELECT pg_check_index('test_table_4_index');
+
+DROP TABLE test_table_3;
+DROP TABLE test_table_4;
+
+DROP TABLE test_table;
+DROP TABLE test_table_2;
+
+ROLLBACK;
@@ -0,0 +1,77 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+\ir include/corrupt.sql
+
+CREATE TABLE test_table (
+    id      BIGINT PRIMARY KEY,
+    val_a   VARCHAR(10),
+    val_b   CHAR(10)
+);
+
+INSERT INTO test_table SELECT i, substr(md5(i::text), 0, floor(random()*10)::int), NULL FROM generate_series(1,100000) s(i);
+
+CREATE INDEX test_table_a_index ON test_table (val_a);
+
+DELETE FROM test_table WHERE MOD(id, 2) = 0;
+
+-- each level includes the lower ones
+SET pg_check.check_level = header;
+
+SELECT pg_check_table('test_table', true, true);
+
+SET pg_check.check_level = line_pointers;
+
+SELECT pg_check_table('test_table', true, true);
+
+SET pg_check.check_level = tuples;
+
+SELECT pg_check_table('test_table', true, true);
+SELECT pg_check_index('test_table_a_index');
+
+-- fingerprints require checking the attributes (falls back to sorted TIDs)
+SET pg_check.cross_check_method = fingerprint;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.cross_check_method;
+
+SET pg_check.check_level = attributes;
+
+SELECT pg_check_table('test_table', true, true);
+
+SAVEPOINT s;
+SET pg_check.check_level = everything;
+ROLLBACK TO s;
+
+-- a copy of a table with a damaged line pointer (LP_UNUSED with a length),
+-- written into the file of a new table (not in shared buffers yet)
+CREATE TABLE test_table_2 (
+    id      INT,
+    val     INT
+);
+
+INSERT INTO test_table_2 SELECT i, i FROM generate_series(1,1000) s(i);
+
+CREATE TABLE test_table_3 (LIKE test_table_2);
+
+SELECT pg_temp.corrupt_copy('test_table_2', 'test_table_3', ARRAY[[25, 127, 0]]);
+
+-- the line pointers are not checked with just the page headers
+SET pg_check.check_level = header;
+
+SELECT pg_check_table('test_table_3', false, false);
+
+SET pg_check.check_level = line_pointers;
+
+SELECT pg_check_table('test_table_3', false, false);
+
+RESET pg_check.check_level;
+
+DROP TABLE test_table_2;
+DROP TABLE test_table_3;
+
+DROP TABLE test_table;
+
+ROLLBACK;
@@ -0,0 +1,70 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      BIGINT PRIMARY KEY,
+    val_a   VARCHAR(10),
+    val_b   CHAR(10)
+);
+
+INSERT INTO test_table SELECT i, substr(md5(i::text), 0, floor(random()*10)::int), NULL FROM generate_series(1,100000) s(i);
+
+CREATE INDEX test_table_a_index ON test_table (val_a);
+
+DELETE FROM test_table WHERE MOD(id, 2) = 0;
+
+-- the differences are returned as ranges of items
+SELECT * FROM pg_check_table_diff('test_table');
+
+SET pg_check.bitmap_type = compressed;
+
+SELECT * FROM pg_check_table_diff('test_table');
+
+RESET pg_check.bitmap_type;
+
+-- fingerprints fall back to the sorted TIDs
+SET pg_check.cross_check_method = fingerprint;
+
+SELECT * FROM pg_check_table_diff('test_table');
+
+SET pg_check.cross_check_method = sorted;
+
+SELECT * FROM pg_check_table_diff('test_table');
+
+RESET pg_check.cross_check_method;
+
+-- items missing in the index (inserted while the index was not ready)
+CREATE TABLE test_table_2 (
+    id      INT PRIMARY KEY
+);
+
+UPDATE pg_index SET indisready = false WHERE indexrelid = 'test_table_2_pkey'::regclass;
+INSERT INTO test_table_2 SELECT i FROM generate_series(1,3) s(i);
+UPDATE pg_index SET indisready = true WHERE indexrelid = 'test_table_2_pkey'::regclass;
+
+INSERT INTO test_table_2 SELECT i FROM generate_series(4,1000) s(i);
+
+SELECT * FROM pg_check_table_diff('test_table_2');
+
+SET pg_check.bitmap_type = compressed;
+
+SELECT * FROM pg_check_table_diff('test_table_2');
+
+RESET pg_check.bitmap_type;
+
+SET pg_check.cross_check_method = sorted;
+
+SELECT * FROM pg_check_table_diff('test_table_2');
+
+RESET pg_check.cross_check_method;
+
+DROP TABLE test_table_2;
+
+-- or written into a file (with just the header)
+SELECT pg_check_table_diff_file('test_table', 'pg_check_diff.bin');
+SELECT size FROM pg_stat_file('pg_check_diff.bin');
+
+DROP TABLE test_table;
+
+ROLLBACK;
@@ -0,0 +1,64 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+\ir include/corrupt.sql
+
+-- read the pages not in shared buffers directly from the files
+SET pg_check.direct_read = on;
+
+CREATE TABLE test_table (
+    id      BIGINT PRIMARY KEY,
+    val_a   VARCHAR(10),
+    val_b   CHAR(10)
+);
+
+INSERT INTO test_table SELECT i, substr(md5(i::text), 0, floor(random()*10)::int), NULL FROM generate_series(1,100000) s(i);
+
+CREATE INDEX test_table_a_index ON test_table (val_a);
+
+SELECT pg_check_table('test_table', false, false);
+SELECT pg_check_table('test_table', true, true);
+SELECT pg_check_index('test_table_a_index');
+
+-- pages written out (possibly evicted from shared buffers)
+CHECKPOINT;
+
+SELECT pg_check_table('test_table', true, true);
+SELECT pg_check_index('test_table_a_index');
+
+-- without verifying the checksums
+SET pg_check.verify_checksums = off;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.verify_checksums;
+
+-- without prefetching
+SET pg_check.prefetch_distance = 0;
+
+SELECT pg_check_table('test_table', false, false);
+
+RESET pg_check.prefetch_distance;
+
+-- a copy of a table with a damaged line pointer (LP_UNUSED with a length),
+-- the copy is not in shared buffers so it's read from the file
+CREATE TABLE test_table_2 (
+    id      INT,
+    val     INT
+);
+
+INSERT INTO test_table_2 SELECT i, i FROM generate_series(1,1000) s(i);
+
+CREATE TABLE test_table_3 (LIKE test_table_2);
+
+SELECT pg_temp.corrupt_copy('test_table_2', 'test_table_3', ARRAY[[25, 127, 0]]);
+
+SELECT pg_check_table('test_table_3', false, false);
+
+DROP TABLE test_table_2;
+DROP TABLE test_table_3;
+
+DROP TABLE test_table;
+
+ROLLBACK;
@@ -0,0 +1,78 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+-- cross-check the keys using fingerprints
+SET pg_check.cross_check_method = fingerprint;
+
+CREATE TABLE test_table (
+    id      INT PRIMARY KEY,
+    val_a   TEXT,
+    val_b   INT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text), (CASE WHEN MOD(i, 2) = 0 THEN NULL ELSE i END) FROM generate_series(1,100000) s(i);
+
+CREATE INDEX test_table_a_index ON test_table (val_a);
+CREATE INDEX test_table_ab_index ON test_table (val_a, val_b);
+
+SELECT pg_check_table('test_table', true, true);
+
+-- deleted and updated tuples
+DELETE FROM test_table WHERE MOD(id, 3) = 0;
+UPDATE test_table SET val_b = val_b + 1 WHERE MOD(id, 5) = 0;
+
+SELECT pg_check_table('test_table', true, true);
+
+-- expression index (only TIDs cross-checked), partial index (not cross-checked)
+CREATE INDEX test_table_expr_index ON test_table (lower(val_a));
+CREATE INDEX test_table_partial_index ON test_table (val_b) WHERE val_b > 1000;
+
+SELECT pg_check_table('test_table', true, true);
+
+-- little memory for the filters (more false positives, no false differences)
+SET pg_check.cross_check_memory = 64;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.cross_check_memory;
+
+-- compressed and external values are not detoasted (only TIDs are
+-- cross-checked for those rows), without reporting differences
+CREATE TABLE test_table_2 (
+    id      INT PRIMARY KEY,
+    val     TEXT
+);
+
+ALTER TABLE test_table_2 ALTER COLUMN val SET STORAGE EXTERNAL;
+
+CREATE INDEX test_table_2_val_index ON test_table_2 (val);
+
+-- external in the table, compressed in the index
+INSERT INTO test_table_2 SELECT i, repeat(md5(i::text), 100) FROM generate_series(1,100) s(i);
+
+SELECT pg_check_table('test_table_2', true, true);
+
+DROP TABLE test_table_2;
+
+-- items missing in an index (inserted while the index was not ready)
+CREATE TABLE test_table_2 (
+    id      INT PRIMARY KEY,
+    val     TEXT
+);
+
+CREATE INDEX test_table_2_val_index ON test_table_2 (val);
+
+UPDATE pg_index SET indisready = false WHERE indexrelid = 'test_table_2_pkey'::regclass;
+INSERT INTO test_table_2 VALUES (0, md5('0'));
+UPDATE pg_index SET indisready = true WHERE indexrelid = 'test_table_2_pkey'::regclass;
+
+INSERT INTO test_table_2 SELECT i, md5(i::text) FROM generate_series(1,1000) s(i);
+
+SELECT pg_check_table('test_table_2', true, true);
+
+DROP TABLE test_table_2;
+
+DROP TABLE test_table;
+
+ROLLBACK;
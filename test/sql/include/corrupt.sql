@@ -0,0 +1,66 @@
+\set ECHO none
+--
+-- Simulates on-disk corruption, for the tests of the checks detecting it.
+--
+-- pg_temp.corrupt_copy(source, target, changes, fork) writes a copy of a
+-- fork of the source relation, with some bytes modified, into the file of
+-- the target relation. Each change is an {offset, mask, bits} triple, and
+-- sets the byte at the offset (from the start of the file) to
+-- (byte & mask) | bits.
+--
+-- The file is written underneath the buffer manager, which is why:
+--
+--  * The target has to be a new relation with the same layout as the source
+--    (e.g. created by CREATE TABLE ... (LIKE ...) in the same transaction),
+--    and none of its pages may have been read, so that those are not in
+--    shared buffers. A new index has a metapage, but that is written to
+--    the file directly. The dirty pages of the source are written out by a
+--    checkpoint before reading its file.
+--
+--  * It requires a superuser, to read and write files of the relations
+--    (and to run the checkpoint).
+--
+--  * It requires data checksums to be disabled. The checksums of the
+--    modified pages are not updated, so with checksums the pages would be
+--    rejected when reading them (and the expected output would differ).
+--
+CREATE FUNCTION pg_temp.corrupt_copy(source regclass, target regclass,
+                                     changes int[] DEFAULT '{}',
+                                     fork text DEFAULT 'main')
+RETURNS void
+AS $$
+DECLARE
+    v_suffix    text := CASE WHEN fork = 'main' THEN '' ELSE '_' || fork END;
+    v_data      bytea;
+    v_oid       oid;
+    v_offset    int;
+BEGIN
+    IF NOT (SELECT rolsuper FROM pg_roles WHERE rolname = current_user) THEN
+        RAISE EXCEPTION 'corrupting relation "%" requires superuser', target;
+    END IF;
+
+    IF current_setting('data_checksums')::bool THEN
+        RAISE EXCEPTION 'corrupting relation "%" requires data checksums to be disabled', target;
+    END IF;
+
+    IF pg_stat_get_xact_blocks_fetched(target) > 0 THEN
+        RAISE EXCEPTION 'pages of relation "%" were read (and may be in shared buffers)', target;
+    END IF;
+
+    CHECKPOINT;
+
+    v_data := pg_read_binary_file(pg_relation_filepath(source) || v_suffix);
+
+    FOR i IN 1 .. COALESCE(array_length(changes, 1), 0) LOOP
+        v_offset := changes[i][1];
+        v_data := set_byte(v_data, v_offset,
+                           (get_byte(v_data, v_offset) & changes[i][2]) | changes[i][3]);
+    END LOOP;
+
+    v_oid := lo_from_bytea(0, v_data);
+
+    PERFORM lo_export(v_oid, pg_relation_filepath(target) || v_suffix);
+    PERFORM lo_unlink(v_oid);
+END;
+$$ LANGUAGE plpgsql;
+\set ECHO all
@@ -0,0 +1,51 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT PRIMARY KEY,
+    val     INT
+);
+
+INSERT INTO test_table SELECT i, i FROM generate_series(1,100000) s(i);
+
+-- all pages, and pages modified since an LSN (the LSN is not stable), the
+-- pages checked are counted in pg_check_stats (skipped ones are not)
+SELECT pg_check_stats_reset();
+SELECT issues FROM pg_check_table_since('test_table', '0/0');
+SELECT sum(pages_checked) = pg_relation_size('test_table') / current_setting('block_size')::int AS all_pages FROM pg_check_stats WHERE relid = 'test_table'::regclass;
+
+SELECT pg_check_stats_reset();
+SELECT issues FROM pg_check_table_since('test_table', 'FFFFFFFF/FFFFFFFF');
+SELECT COALESCE(sum(pages_checked), 0) AS pages_checked FROM pg_check_stats WHERE relid = 'test_table'::regclass;
+
+SELECT (start_lsn::pg_lsn <= pg_current_wal_insert_lsn()) AS valid_lsn FROM pg_check_table_since('test_table', '0/0');
+
+-- incremental checks, using the watermarks
+SELECT pg_check_table_incremental('test_table');
+SELECT count(*) FROM pg_check_watermarks WHERE relid = 'test_table'::regclass;
+
+UPDATE test_table SET val = val + 1 WHERE MOD(id, 10) = 0;
+
+SELECT pg_check_table_incremental('test_table');
+SELECT count(*) FROM pg_check_watermarks WHERE relid = 'test_table'::regclass;
+
+-- no pages modified since the last check, so all of them are skipped
+SELECT pg_check_stats_reset();
+SELECT pg_check_table_incremental('test_table');
+SELECT COALESCE(sum(pages_checked), 0) AS pages_checked FROM pg_check_stats WHERE relid = 'test_table'::regclass;
+
+-- only the modified pages are checked
+UPDATE test_table SET val = val + 1 WHERE id <= 1000;
+
+SELECT pg_check_stats_reset();
+SELECT pg_check_table_incremental('test_table');
+SELECT sum(pages_checked) BETWEEN 1 AND pg_relation_size('test_table') / current_setting('block_size')::int - 1 AS some_pages FROM pg_check_stats WHERE relid = 'test_table'::regclass;
+
+SAVEPOINT s;
+SELECT * FROM pg_check_table_since('test_table', 'invalid');
+ROLLBACK TO s;
+
+DROP TABLE test_table;
+
+ROLLBACK;
@@ -0,0 +1,54 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+\ir include/corrupt.sql
+
+CREATE TABLE test_table (
+    id      BIGINT PRIMARY KEY,
+    val_a   VARCHAR(10),
+    val_b   CHAR(10)
+);
+
+INSERT INTO test_table SELECT i, substr(md5(i::text), 0, floor(random()*10)::int), NULL FROM generate_series(1,100000) s(i);
+
+CREATE INDEX test_table_a_index ON test_table (val_a);
+
+DELETE FROM test_table WHERE MOD(id, 2) = 0;
+
+-- the issues are returned as rows
+SELECT * FROM pg_check_table_issues('test_table');
+SELECT * FROM pg_check_table_issues('test_table', false, false);
+SELECT * FROM pg_check_table_issues('test_table', true, true, NULL, true);
+SELECT * FROM pg_check_index_issues('test_table_a_index');
+SELECT * FROM pg_check_index_issues('test_table_a_index', 10, true);
+
+-- a copy of a table with a damaged line pointer (LP_UNUSED with a length),
+-- written into the file of a new table (not in shared buffers yet)
+CREATE TABLE test_table_2 (
+    id      INT,
+    val     INT
+);
+
+INSERT INTO test_table_2 SELECT i, i FROM generate_series(1,1000) s(i);
+
+CREATE TABLE test_table_3 (LIKE test_table_2);
+
+SELECT pg_temp.corrupt_copy('test_table_2', 'test_table_3', ARRAY[[25, 127, 0]]);
+
+SELECT * FROM pg_check_table_issues('test_table_3', false, false);
+
+DROP TABLE test_table_2;
+DROP TABLE test_table_3;
+
+SAVEPOINT s;
+SELECT * FROM pg_check_table_issues('test_table', false, true);
+ROLLBACK TO s;
+
+SAVEPOINT s;
+SELECT * FROM pg_check_index_issues('test_table_a_index', -2);
+ROLLBACK TO s;
+
+DROP TABLE test_table;
+
+ROLLBACK;
@@ -0,0 +1,66 @@
+CREATE EXTENSION pg_check;
+
+\ir include/corrupt.sql
+
+-- verify the visibility map and free space map (requires a vacuum)
+SET pg_check.verify_maps = on;
+
+CREATE TABLE test_table (
+    id      INT PRIMARY KEY,
+    val     INT
+);
+
+INSERT INTO test_table SELECT i, i FROM generate_series(1,100000) s(i);
+
+SELECT pg_check_table('test_table', false, false);
+
+VACUUM test_table;
+
+SELECT pg_check_table('test_table', false, false);
+
+VACUUM (FREEZE) test_table;
+
+SELECT pg_check_table('test_table', true, true);
+
+-- modified pages (clears the bits in the visibility map)
+DELETE FROM test_table WHERE MOD(id, 10) = 0;
+UPDATE test_table SET val = val + 1 WHERE MOD(id, 7) = 0;
+
+SELECT pg_check_table('test_table', false, false);
+
+VACUUM test_table;
+
+SELECT pg_check_table('test_table', true, true);
+
+-- the checks of the tuples are limited too
+SET pg_check.check_level = line_pointers;
+
+SELECT pg_check_table('test_table', false, false);
+
+RESET pg_check.check_level;
+
+-- a copy of a frozen table (with the visibility map), with PD_ALL_VISIBLE
+-- cleared on the first page, written into the files of a new table
+CREATE TABLE test_table_2 (
+    id      INT,
+    val     INT
+);
+
+INSERT INTO test_table_2 SELECT i, i FROM generate_series(1,1000) s(i);
+
+VACUUM (FREEZE) test_table_2;
+
+CREATE TABLE test_table_3 (LIKE test_table_2);
+
+SELECT pg_temp.corrupt_copy('test_table_2', 'test_table_3', ARRAY[[10, 251, 0]]);
+
+SELECT pg_temp.corrupt_copy('test_table_2', 'test_table_3', fork => 'vm');
+
+SELECT pg_check_table('test_table_3', false, false);
+
+DROP TABLE test_table_2;
+DROP TABLE test_table_3;
+
+DROP TABLE test_table;
+
+DROP EXTENSION pg_check;
@@ -0,0 +1,43 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT PRIMARY KEY
+);
+
+INSERT INTO test_table SELECT i FROM generate_series(1,100000) s(i);
+
+-- no limit
+SELECT pg_check_table('test_table', true, true);
+
+-- the dense bitmaps don't fit, compressed do
+SET pg_check.max_memory = '24kB';
+
+SELECT pg_check_table('test_table', true, true);
+
+-- not even compressed bitmaps fit (and not the summaries of the index pages)
+SET pg_check.max_memory = '2kB';
+
+SELECT pg_check_table('test_table', true, true);
+SELECT pg_check_table('test_table', true, false);
+
+SET pg_check.verify_btree_structure = on;
+
+SELECT pg_check_index('test_table_pkey');
+
+RESET pg_check.verify_btree_structure;
+
+-- compressed bitmaps requested explicitly
+SET pg_check.bitmap_type = compressed;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.bitmap_type;
+RESET pg_check.max_memory;
+
+SELECT pg_check_memory() > 0 AS memory_used;
+
+DROP TABLE test_table;
+
+ROLLBACK;
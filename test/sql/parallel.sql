@@ -0,0 +1,67 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+-- the NOTICEs of parallel workers are not in a stable order
+SET client_min_messages = warning;
+
+SET pg_check.max_parallel_workers = 2;
+
+-- table with multiple indexes (checked concurrently)
+CREATE TABLE test_table (
+    id      BIGINT PRIMARY KEY,
+    val_a   VARCHAR(10),
+    val_b   CHAR(10)
+);
+
+INSERT INTO test_table SELECT i, substr(md5(i::text), 0, floor(random()*10)::int), NULL FROM generate_series(1,100000) s(i);
+
+CREATE INDEX test_table_a_index ON test_table (val_a);
+CREATE INDEX test_table_b_index ON test_table (val_b);
+
+SELECT pg_check_table('test_table', false, false);
+SELECT pg_check_table('test_table', true, false);
+SELECT pg_check_table('test_table', true, true);
+
+DELETE FROM test_table WHERE MOD(id, 3) = 0;
+
+SELECT pg_check_table('test_table', true, true);
+
+-- compressed bitmaps are checked by a single process
+SET pg_check.bitmap_type = compressed;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.bitmap_type;
+
+-- items missing in the index (inserted while the index was not ready) are
+-- found in the heap bitmap built by the workers
+CREATE TABLE test_table_2 (
+    id      BIGINT PRIMARY KEY
+);
+
+UPDATE pg_index SET indisready = false WHERE indexrelid = 'test_table_2_pkey'::regclass;
+INSERT INTO test_table_2 VALUES (0);
+UPDATE pg_index SET indisready = true WHERE indexrelid = 'test_table_2_pkey'::regclass;
+
+INSERT INTO test_table_2 SELECT i FROM generate_series(1,100000) s(i);
+
+SELECT pg_check_table('test_table_2', true, true);
+
+DROP TABLE test_table_2;
+
+-- a single index
+SELECT pg_check_index('test_table_pkey');
+
+-- the whole database
+SELECT pg_check_database();
+SELECT pg_check_database(0);
+SELECT pg_check_database(4);
+
+SAVEPOINT s;
+SELECT pg_check_database(-1);
+ROLLBACK TO s;
+
+DROP TABLE test_table;
+
+ROLLBACK;
@@ -0,0 +1,88 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+-- partitioned table (the partitions are checked from the largest one)
+CREATE TABLE test_table (
+    id      INT PRIMARY KEY,
+    val     INT
+) PARTITION BY RANGE (id);
+
+CREATE TABLE test_table_1 PARTITION OF test_table FOR VALUES FROM (1) TO (1001);
+CREATE TABLE test_table_2 PARTITION OF test_table FOR VALUES FROM (1001) TO (200001);
+
+CREATE INDEX test_table_val_index ON test_table (val);
+
+INSERT INTO test_table SELECT i, MOD(i, 1000) FROM generate_series(1,100000) s(i);
+
+SELECT pg_check_table('test_table', false, false);
+SELECT pg_check_table('test_table', true, false);
+SELECT pg_check_table('test_table', true, true);
+
+-- a single partition
+SELECT pg_check_table('test_table_1', true, true);
+
+-- incremental checks keep the watermarks of the partitions
+SELECT pg_check_table_incremental('test_table');
+SELECT count(*) FROM pg_check_watermarks;
+
+UPDATE test_table SET val = val + 1 WHERE MOD(id, 10) = 0;
+
+SELECT pg_check_table_incremental('test_table');
+
+-- each partition is checked since its own watermark, so a new partition
+-- (without a watermark) is checked whole, while the pages of a partition
+-- not modified since the last check are skipped (see pg_check_stats)
+CREATE TABLE test_table_0 PARTITION OF test_table FOR VALUES FROM (-1000) TO (1);
+
+INSERT INTO test_table SELECT i, MOD(i, 1000) FROM generate_series(-999,0) s(i);
+
+UPDATE test_table SET val = val + 1 WHERE id > 1000 AND MOD(id, 10) = 0;
+
+SELECT pg_check_stats_reset();
+
+SELECT pg_check_table_incremental('test_table');
+
+SELECT c.relname, COALESCE(s.pages_checked, 0) > 0 AS pages_checked
+  FROM pg_class c LEFT JOIN pg_check_stats s ON (s.relid = c.oid)
+ WHERE c.relname IN ('test_table_0', 'test_table_1', 'test_table_2')
+ ORDER BY c.relname;
+
+SELECT count(*) FROM pg_check_watermarks;
+
+SAVEPOINT s;
+SELECT pg_check_table('test_table', false, false, 0, 10);
+ROLLBACK TO s;
+
+SAVEPOINT s;
+SELECT pg_check_table('test_table', false, false, sample_blocks => 10);
+ROLLBACK TO s;
+
+-- items missing in the index of a partition (inserted while the index was
+-- not ready) are found when checking the partitioned table
+CREATE TABLE test_table_3 (
+    id      INT PRIMARY KEY
+) PARTITION BY RANGE (id);
+
+CREATE TABLE test_table_3_1 PARTITION OF test_table_3 FOR VALUES FROM (0) TO (100001);
+CREATE TABLE test_table_3_2 PARTITION OF test_table_3 FOR VALUES FROM (100001) TO (200001);
+
+UPDATE pg_index SET indisready = false WHERE indexrelid = 'test_table_3_1_pkey'::regclass;
+INSERT INTO test_table_3 VALUES (0);
+UPDATE pg_index SET indisready = true WHERE indexrelid = 'test_table_3_1_pkey'::regclass;
+
+INSERT INTO test_table_3 SELECT i FROM generate_series(1,100010) s(i);
+
+SELECT pg_check_table('test_table_3', true, true);
+
+DROP TABLE test_table_3;
+
+-- using parallel workers (the NOTICEs are not in a stable order)
+SET client_min_messages = warning;
+SET pg_check.max_parallel_workers = 2;
+
+SELECT pg_check_table('test_table', true, true);
+
+DROP TABLE test_table;
+
+ROLLBACK;
@@ -0,0 +1,64 @@
+CREATE EXTENSION pg_check;
+
+\ir include/corrupt.sql
+
+-- the progress is reported only when the library is loaded using
+-- shared_preload_libraries (see test/pg_check.conf)
+CREATE TABLE test_table (
+    id      INT,
+    val     INT
+);
+
+-- 226 tuples per page, i.e. 5 pages
+INSERT INTO test_table SELECT i, i FROM generate_series(1,1000) s(i);
+
+-- a copy with invalid flags in the header of the second page, so the check
+-- fails with an error when reading it
+CREATE TABLE test_table_2 (LIKE test_table);
+
+SELECT pg_temp.corrupt_copy('test_table', 'test_table_2', ARRAY[[8192 + 11, 255, 128]]);
+
+-- the slot of a check failing in a subtransaction is released
+DO $$
+BEGIN
+    PERFORM pg_check_table('test_table_2', false, false);
+EXCEPTION WHEN data_corrupted THEN
+    RAISE NOTICE 'check of test_table_2 failed';
+END;
+$$;
+
+SELECT relid::regclass FROM pg_stat_progress_check WHERE pid = pg_backend_pid();
+
+-- and a following check is not treated as nested in the failed one, i.e. it
+-- reports progress in its own slot and releases it when done
+SELECT pg_check_table('test_table', false, false);
+
+SELECT relid::regclass FROM pg_stat_progress_check WHERE pid = pg_backend_pid();
+
+-- the same for a check failing in a nested subtransaction
+BEGIN;
+
+SAVEPOINT s;
+
+DO $$
+BEGIN
+    PERFORM pg_check_table('test_table_2', false, false);
+EXCEPTION WHEN data_corrupted THEN
+    RAISE NOTICE 'check of test_table_2 failed';
+END;
+$$;
+
+RELEASE SAVEPOINT s;
+
+SELECT relid::regclass FROM pg_stat_progress_check WHERE pid = pg_backend_pid();
+
+SELECT pg_check_table('test_table', false, false);
+
+SELECT relid::regclass FROM pg_stat_progress_check WHERE pid = pg_backend_pid();
+
+COMMIT;
+
+DROP TABLE test_table;
+DROP TABLE test_table_2;
+
+DROP EXTENSION pg_check;
@@ -0,0 +1,38 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT PRIMARY KEY,
+    val     TEXT
+);
+
+-- five tuples per page, i.e. 10 pages
+INSERT INTO test_table SELECT i, repeat('x', 1500) FROM generate_series(1,50) s(i);
+
+SELECT pg_relation_size('test_table') / current_setting('block_size')::int AS blocks;
+
+-- check the table in chunks of pages
+SELECT * FROM pg_check_table_resume('test_table', 4);
+SELECT * FROM pg_check_table_resume('test_table', 4);
+SELECT relid::regclass, next_block, issues FROM pg_check_cursors;
+SELECT * FROM pg_check_table_resume('test_table', 4);
+SELECT count(*) FROM pg_check_cursors;
+
+-- starts from the beginning again
+SELECT * FROM pg_check_table_resume('test_table');
+SELECT count(*) FROM pg_check_cursors;
+
+SAVEPOINT s;
+SELECT * FROM pg_check_table_resume('test_table', 0);
+ROLLBACK TO s;
+
+-- cost-based throttling
+SET pg_check.cost_delay = 1;
+SET pg_check.cost_limit = 10;
+
+SELECT pg_check_table('test_table', true, true);
+
+DROP TABLE test_table;
+
+ROLLBACK;
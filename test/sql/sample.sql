@@ -0,0 +1,64 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+\ir include/corrupt.sql
+
+CREATE TABLE test_table (
+    id      INT PRIMARY KEY,
+    val     TEXT
+);
+
+-- five tuples per page, i.e. 10 pages (and 2 pages of the index)
+INSERT INTO test_table SELECT i, repeat('x', 1500) FROM generate_series(1,50) s(i);
+
+SELECT pg_relation_size('test_table') / current_setting('block_size')::int AS blocks;
+
+-- check a sample of the blocks
+SELECT pg_check_table('test_table', false, false, sample_blocks => 4);
+SELECT pg_check_table('test_table', false, false, sample_fraction => 0.5);
+SELECT pg_check_table('test_table', false, false, sample_blocks => 100);
+SELECT pg_check_table('test_table', false, false, 0, 4, sample_fraction => 0.5);
+
+-- the indexes are sampled too
+SELECT pg_check_table('test_table', true, false, sample_blocks => 4);
+SELECT pg_check_index('test_table_pkey', sample_blocks => 1);
+
+SAVEPOINT s;
+SELECT pg_check_table('test_table', true, true, sample_blocks => 4);
+ROLLBACK TO s;
+
+SAVEPOINT s;
+SELECT pg_check_table('test_table', false, false, sample_fraction => 0.5, sample_blocks => 4);
+ROLLBACK TO s;
+
+SAVEPOINT s;
+SELECT pg_check_table('test_table', false, false, sample_fraction => 0);
+ROLLBACK TO s;
+
+SAVEPOINT s;
+SELECT pg_check_index('test_table_pkey', sample_blocks => 0);
+ROLLBACK TO s;
+
+-- a copy of a table with a damaged line pointer (LP_UNUSED with a length),
+-- written into the file of a new table (not in shared buffers yet)
+CREATE TABLE test_table_2 (
+    id      INT,
+    val     INT
+);
+
+-- 226 tuples per page, i.e. 5 pages
+INSERT INTO test_table_2 SELECT i, i FROM generate_series(1,1000) s(i);
+
+CREATE TABLE test_table_3 (LIKE test_table_2);
+
+SELECT pg_temp.corrupt_copy('test_table_2', 'test_table_3', ARRAY[[25, 127, 0]]);
+
+SELECT pg_check_table('test_table_3', false, false, sample_blocks => 100);
+
+DROP TABLE test_table_2;
+DROP TABLE test_table_3;
+
+DROP TABLE test_table;
+
+ROLLBACK;
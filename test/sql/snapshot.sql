@@ -0,0 +1,76 @@
+CREATE EXTENSION pg_check;
+
+-- cross-check without blocking writes
+SET pg_check.snapshot_cross_check = on;
+
+CREATE TABLE test_table (
+    id      BIGINT PRIMARY KEY,
+    val_a   VARCHAR(10),
+    val_b   CHAR(10)
+);
+
+INSERT INTO test_table SELECT i, substr(md5(i::text), 0, floor(random()*10)::int), NULL FROM generate_series(1,100000) s(i);
+
+CREATE INDEX test_table_a_index ON test_table (val_a);
+
+SELECT pg_check_table('test_table', true, true);
+
+-- deleted and updated tuples
+DELETE FROM test_table WHERE MOD(id, 3) = 0;
+UPDATE test_table SET val_a = 'updated' WHERE MOD(id, 5) = 0;
+
+SELECT pg_check_table('test_table', true, true);
+
+-- compressed bitmaps
+SET pg_check.bitmap_type = compressed;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.bitmap_type;
+
+-- the other cross-check methods
+SET pg_check.cross_check_method = fingerprint;
+
+SELECT pg_check_table('test_table', true, true);
+
+SET pg_check.cross_check_method = sorted;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.cross_check_method;
+
+DROP TABLE test_table;
+
+-- items missing in the index (inserted while the index was not ready) are
+-- settled, so those are differences with all the methods
+CREATE TABLE test_table (
+    id      INT PRIMARY KEY
+);
+
+UPDATE pg_index SET indisready = false WHERE indexrelid = 'test_table_pkey'::regclass;
+INSERT INTO test_table VALUES (0);
+UPDATE pg_index SET indisready = true WHERE indexrelid = 'test_table_pkey'::regclass;
+
+INSERT INTO test_table SELECT i FROM generate_series(1,1000) s(i);
+
+SELECT pg_check_table('test_table', true, true);
+
+SET pg_check.bitmap_type = compressed;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.bitmap_type;
+
+SET pg_check.cross_check_method = fingerprint;
+
+SELECT pg_check_table('test_table', true, true);
+
+SET pg_check.cross_check_method = sorted;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.cross_check_method;
+
+DROP TABLE test_table;
+
+DROP EXTENSION pg_check;
@@ -0,0 +1,68 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+-- cross-check by merging sorted TIDs
+SET pg_check.cross_check_method = sorted;
+
+CREATE TABLE test_table (
+    id      BIGINT PRIMARY KEY,
+    val_a   VARCHAR(10),
+    val_b   CHAR(10)
+);
+
+INSERT INTO test_table SELECT i, substr(md5(i::text), 0, floor(random()*10)::int), NULL FROM generate_series(1,100000) s(i);
+
+CREATE INDEX test_table_a_index ON test_table (val_a);
+CREATE INDEX test_table_b_index ON test_table (val_b);
+
+SELECT pg_check_table('test_table', true, true);
+
+-- deleted and updated tuples, partial index (not cross-checked)
+DELETE FROM test_table WHERE MOD(id, 3) = 0;
+UPDATE test_table SET val_a = 'updated' WHERE MOD(id, 5) = 0;
+
+CREATE INDEX test_table_partial_index ON test_table (val_a) WHERE id > 1000;
+
+SELECT pg_check_table('test_table', true, true);
+
+-- little memory for the sorts (spills to temporary files)
+SET pg_check.cross_check_memory = 64;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.cross_check_memory;
+
+-- only a range of the table (the indexes are still checked whole)
+SELECT pg_check_table('test_table', true, true, 0, 10);
+SELECT pg_check_table('test_table', true, true, 100, 200);
+
+-- other methods don't support block ranges with indexes
+SET pg_check.cross_check_method = bitmap;
+
+SELECT pg_check_table('test_table', false, false, 0, 10);
+
+SAVEPOINT s;
+SELECT pg_check_table('test_table', true, true, 0, 10);
+ROLLBACK TO s;
+
+SET pg_check.cross_check_method = sorted;
+
+-- items missing in the index (inserted while the index was not ready)
+CREATE TABLE test_table_2 (
+    id      INT PRIMARY KEY
+);
+
+UPDATE pg_index SET indisready = false WHERE indexrelid = 'test_table_2_pkey'::regclass;
+INSERT INTO test_table_2 VALUES (0);
+UPDATE pg_index SET indisready = true WHERE indexrelid = 'test_table_2_pkey'::regclass;
+
+INSERT INTO test_table_2 SELECT i FROM generate_series(1,1000) s(i);
+
+SELECT pg_check_table('test_table_2', true, true);
+
+DROP TABLE test_table_2;
+
+DROP TABLE test_table;
+
+ROLLBACK;
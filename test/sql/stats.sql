@@ -0,0 +1,91 @@
+CREATE EXTENSION pg_check;
+
+\ir include/corrupt.sql
+
+-- the statistics are collected only when the library is loaded using
+-- shared_preload_libraries (see test/pg_check.conf)
+SELECT pg_check_stats_reset();
+
+CREATE TABLE test_table (
+    id      INT PRIMARY KEY
+);
+
+INSERT INTO test_table SELECT i FROM generate_series(1,100000) s(i);
+
+SELECT pg_check_table('test_table', true, true);
+
+-- all pages of the table and of the index were checked
+SELECT relid::regclass AS relation,
+       pages_checked = pg_relation_size(relid) / current_setting('block_size')::int AS all_pages,
+       issues, last_full_check IS NOT NULL AS full_check
+  FROM pg_check_stats
+ WHERE datid = (SELECT oid FROM pg_database WHERE datname = current_database())
+ ORDER BY relid;
+
+SELECT count(*) FROM pg_check_stats_issues;
+
+-- issues found in a copy of a table with a damaged line pointer (LP_UNUSED
+-- with a length), counted per check code
+CREATE TABLE test_table_2 (
+    id      INT,
+    val     INT
+);
+
+-- 226 tuples per page, i.e. 5 pages
+INSERT INTO test_table_2 SELECT i, i FROM generate_series(1,1000) s(i);
+
+CREATE TABLE test_table_3 (LIKE test_table_2);
+
+SELECT pg_temp.corrupt_copy('test_table_2', 'test_table_3', ARRAY[[25, 127, 0]]);
+
+SELECT pg_check_table('test_table_3', false, false);
+
+SELECT pages_checked, issues FROM pg_check_stats WHERE relid = 'test_table_3'::regclass;
+
+SELECT check_code, count FROM pg_check_stats_issues
+ WHERE relid = 'test_table_3'::regclass ORDER BY check_code;
+
+-- a copy with invalid flags in the header of the second page, so the check
+-- fails with an error when reading it (after checking the first page), and
+-- the counters of the failed check are discarded even though the error is
+-- caught (and the transaction commits)
+CREATE TABLE test_table_4 (LIKE test_table_2);
+
+SELECT pg_temp.corrupt_copy('test_table_2', 'test_table_4', ARRAY[[8192 + 11, 255, 128]]);
+
+DO $$
+BEGIN
+    PERFORM pg_check_table('test_table_4', false, false);
+EXCEPTION WHEN data_corrupted THEN
+    RAISE NOTICE 'check of test_table_4 failed';
+END;
+$$;
+
+SELECT count(*) FROM pg_check_stats WHERE relid = 'test_table_4'::regclass;
+
+-- later checks are counted again
+SELECT pg_check_table('test_table_2', false, false);
+
+SELECT pages_checked, issues FROM pg_check_stats WHERE relid = 'test_table_2'::regclass;
+
+-- nothing is collected without tracking the statistics
+SELECT pg_check_stats_reset();
+
+SET pg_check.track_stats = off;
+
+SELECT pg_check_table('test_table', true, true);
+
+RESET pg_check.track_stats;
+
+SELECT count(*) FROM pg_check_stats;
+SELECT count(*) FROM pg_check_stats_issues;
+
+-- no checks running right now
+SELECT count(*) FROM pg_stat_progress_check;
+
+DROP TABLE test_table;
+DROP TABLE test_table_2;
+DROP TABLE test_table_3;
+DROP TABLE test_table_4;
+
+DROP EXTENSION pg_check;